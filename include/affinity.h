@@ -0,0 +1,67 @@
+#ifndef _AFFINITY_H_
+#define _AFFINITY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef AFFINITY_SYSFS_ROOT
+#define AFFINITY_SYSFS_ROOT "/sys/devices/system"
+#endif
+
+/* Same as CPU_SETSIZE */
+#define AFFINITY_MAX_CPUS 1024
+#define AFFINITY_MAX_NODES 64
+
+/* CPUs that can be listed in the configuration, the event loop's and one per worker */
+#define AFFINITY_MAX_SLOTS 16
+
+typedef enum {
+    AFFINITY_NOT_OK = -1,
+    AFFINITY_OK,
+} E_AFFINITY_STATUS;
+
+typedef enum {
+    E_AFFINITY_NONE = 0,
+    E_AFFINITY_AUTO,
+    E_AFFINITY_LIST,
+} E_AFFINITY_MODE;
+
+/* Placement configuration, cpus is only used by E_AFFINITY_LIST, in slot order */
+typedef struct {
+    E_AFFINITY_MODE mode;
+    int num_cpus;
+    int cpus[AFFINITY_MAX_SLOTS];
+} affinity_config_t;
+
+/* Placement of a process, cpu and node are -1 when it isn't pinned */
+typedef struct {
+    int cpu;
+    int node;
+} affinity_slot_t;
+
+/* Plan Placement
+ *
+ * Fills count slots, slot 0 for the process that runs the event loop and the rest for workers.
+ *
+ * E_AFFINITY_LIST takes the configured CPUs in order, and wraps around if there are fewer than
+ * slots. E_AFFINITY_AUTO reads the topology from sysfs: the event loop gets the first CPU it's
+ * allowed on, workers get the next physical cores on the same NUMA node, then cores of the other
+ * nodes, and only then hyperthread siblings. E_AFFINITY_NONE leaves every slot unpinned.
+ */
+extern int affinity_plan( const affinity_config_t *cfg, affinity_slot_t *slots, int count );
+
+/* Pin
+ *
+ * Moves the calling process to the slot's CPU and prefers its NUMA node for new memory, so buffers
+ * allocated and first touched from now on are local. A slot of -1 restores the CPUs the process
+ * started with and the default memory policy.
+ */
+extern int affinity_pin( const affinity_slot_t *slot );
+
+/* NUMA node of cpu, 0 on machines without NUMA */
+extern int affinity_node_of_cpu( int cpu );
+
+#endif // _AFFINITY_H_
@@ -0,0 +1,90 @@
+#ifndef _AGGREGATE_H_
+#define _AGGREGATE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "support.h"
+
+/* Series are a source and a metric, names longer than AGGREGATE_NAME_SIZE - 1 are cut */
+#define AGGREGATE_MAX_SERIES 256
+#define AGGREGATE_NAME_SIZE 32
+
+/* A sliding window is at most this many slides long */
+#define AGGREGATE_MAX_BUCKETS 16
+
+/* Quantile sketch, 4 bins per power of two up to 2^31 of either sign, so estimates are within 12.5% */
+#define AGGREGATE_SKETCH_MAGNITUDES 128
+#define AGGREGATE_SKETCH_BINS (2 * AGGREGATE_SKETCH_MAGNITUDES)
+
+#define AGGREGATE_DEFAULT_WINDOW_MS 10000
+
+typedef enum {
+    AGGREGATE_NOT_OK = -1,
+    AGGREGATE_OK,
+} E_AGGREGATE_STATUS;
+
+typedef enum {
+    E_WINDOW_TUMBLING = 0,
+    E_WINDOW_SLIDING,
+} E_WINDOW_TYPE;
+
+/* Windows, a tumbling window's slide_ms is its window_ms, a sliding window is a multiple of its slide */
+typedef struct {
+    E_WINDOW_TYPE type;
+    msec_t window_ms;
+    msec_t slide_ms;
+} aggregate_config_t;
+
+/* Rollup of a series over the window [start_ms, end_ms) of the monotonic clock */
+typedef struct {
+    const char *source;
+    const char *metric;
+    msec_t start_ms;
+    msec_t end_ms;
+    uint64_t count;
+    int64_t sum;
+    int64_t min;
+    int64_t max;
+    int64_t p50;
+    int64_t p90;
+    int64_t p99;
+} rollup_t;
+
+typedef void (*rollup_handler_t)( const rollup_t *rollup, void *ctx );
+
+/* Stats, dropped counts samples of new series while AGGREGATE_MAX_SERIES are active */
+typedef struct {
+    uint64_t samples;
+    uint64_t dropped;
+    uint64_t rollups;
+    uint32_t series;
+} aggregate_stats_t;
+
+/* Streaming Aggregation
+ *
+ * Keeps windows of samples per series instead of the samples. Time is cut into slides, each slide
+ * of every series is a bucket with the count, sum, min, max, and a quantile sketch of its samples.
+ * Buckets are stored by column, each statistic in its own array indexed by slide then series, so
+ * closing a window reads every series of a slide from contiguous memory. A window is its last
+ * window_ms / slide_ms slides, one for a tumbling window.
+ *
+ * aggregate_init() starts over with cfg. aggregate_add() adds a sample to the open slide, by
+ * arrival. aggregate_tick() closes the slides that ended by now_ms and calls handler with a rollup
+ * of every series with samples in each closed window, call it at least once a slide. A series
+ * without samples for a whole window is forgotten.
+ */
+extern int aggregate_init( const aggregate_config_t *cfg );
+extern int aggregate_add( const void *source, size_t source_len, const void *metric, size_t metric_len, int64_t value );
+extern int aggregate_tick( msec_t now_ms, rollup_handler_t handler, void *ctx );
+extern int get_aggregate_stats( aggregate_stats_t *stats );
+
+/* True if a and b give the same windows, compared by field since the struct has padding. A tumbling
+ * window's slide_ms isn't used, so it doesn't count.
+ */
+extern bool aggregate_same_config( const aggregate_config_t *a, const aggregate_config_t *b );
+
+#endif // _AGGREGATE_H_
@@ -0,0 +1,156 @@
+#ifndef _BROKER_H_
+#define _BROKER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "sock_config.h"
+#include "event_loop.h"
+
+/* Shared ring holding every published message once, power of 2 */
+#define BROKER_RING_SIZE (1024 * 1024)
+
+#define BROKER_MAX_PAYLOAD 4096
+#define BROKER_TOPIC_SIZE 32
+/* Topics with subscribers at a time, a topic is reused once it has none. At most 64, topics are bits. */
+#define BROKER_MAX_TOPICS 64
+#define BROKER_MAX_CLIENTS 64
+
+/* Notifications queued per subscriber while its socket is full. Larger than BROKER_MAX_TOPICS, so a
+ * conflating subscriber always has room for the latest message of every topic. */
+#define BROKER_MAX_PENDING 128
+
+typedef enum {
+    BROKER_POLICY_DROP = 0,
+    BROKER_POLICY_CONFLATE,
+    BROKER_POLICY_DISCONNECT,
+} E_BROKER_POLICY;
+
+typedef enum {
+    BROKER_SUBSCRIBE = 1,
+    BROKER_UNSUBSCRIBE,
+    BROKER_PUBLISH,
+    BROKER_RING,
+    BROKER_NOTIFY,
+} E_BROKER_FRAME;
+
+/* Frame
+ *
+ * Every message on a broker connection is a header, followed by topic_len bytes of topic and len bytes
+ * of payload. Host byte order, both ends are on the same machine.
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t policy;
+    uint16_t topic_len;
+    uint32_t len;
+} broker_hdr_t;
+
+#define BROKER_MAX_FRAME (sizeof(broker_hdr_t) + BROKER_TOPIC_SIZE + BROKER_MAX_PAYLOAD)
+
+/* Notify payload, a message was written to the ring at offset. dropped counts the messages this
+ * subscriber missed since the previous notification. */
+typedef struct {
+    uint64_t seq;
+    uint32_t offset;
+    uint32_t dropped;
+} broker_notify_t;
+
+/* Shared ring header, at the start of the mapping. Messages below oldest_seq may be overwritten. */
+typedef struct {
+    uint32_t size;
+    uint32_t data_offset;
+    uint64_t oldest_seq;
+    uint64_t next_seq;
+} broker_ring_hdr_t;
+
+/* Ring record, followed by topic and payload, padded to BROKER_RECORD_ALIGN */
+typedef struct {
+    uint64_t seq;
+    uint32_t len;
+    uint16_t topic_len;
+    uint16_t flags;
+} broker_record_t;
+
+#define BROKER_RECORD_ALIGN 16
+#define BROKER_RECORD_PAD 0x1
+
+typedef struct {
+    uint32_t published;
+    uint32_t notified;
+    uint32_t dropped;
+    uint32_t conflated;
+    uint32_t disconnected;
+    uint32_t subscribers;
+} broker_stats_t;
+
+/* Received message, data points into the read-only shared ring */
+typedef struct {
+    uint64_t seq;
+    uint32_t dropped;
+    char topic[BROKER_TOPIC_SIZE + 1];
+    const void *data;
+    size_t len;
+} broker_msg_t;
+
+/* Publish/Subscribe Broker
+ *
+ * Runs on a LOCAL listener of the server. Publishers send a message once, the broker copies it into a
+ * shared memory ring and sends every subscriber of the topic a small notification with its offset.
+ * Subscribers map the ring read-only, so a message is copied once however many subscribers there are.
+ *
+ * A subscriber that can't keep up fills its socket, notifications are then queued per subscriber and
+ * handled by the policy it subscribed with:
+ *
+ *  DROP       - new notifications are dropped once BROKER_MAX_PENDING are queued
+ *  CONFLATE   - only the latest message per topic is kept, older pending ones are replaced
+ *  DISCONNECT - the subscriber is disconnected once BROKER_MAX_PENDING are queued
+ *
+ * The ring is overwritten once it wraps, a subscriber that is behind by more than BROKER_RING_SIZE
+ * loses messages whatever the policy, reported in dropped.
+ */
+
+/* Broker (server side)
+ *
+ * broker_open() creates the ring for the LOCAL listener id, broker_message_handler() and
+ * broker_conn_closed() are its event loop handlers. broker_tick_all() retries queued notifications
+ * and must be called from the scheduler.
+ */
+extern int broker_open( sock_id_t id );
+extern void broker_close( sock_id_t id );
+extern void broker_message_handler( ev_conn_t *conn, const void *buffer, size_t len, void *ctx );
+extern void broker_conn_closed( ev_conn_t *conn, void *ctx );
+extern void broker_tick_all( void );
+extern int get_broker_stats( sock_id_t id, broker_stats_t *stats );
+
+/* Broker client
+ *
+ * For a LOCAL client socket connected to a broker listener. Topics are at most BROKER_TOPIC_SIZE
+ * bytes, payloads at most BROKER_MAX_PAYLOAD. Return SOCK_OK or SOCK_NOT_OK, a failed connect
+ * re-initializes the socket and updates id, as with await_local_send().
+ */
+extern int broker_subscribe( sock_id_t *id, const char *topic, E_BROKER_POLICY policy );
+extern int broker_unsubscribe( sock_id_t *id, const char *topic );
+extern int broker_publish( sock_id_t *id, const char *topic, const void *buffer, size_t len );
+
+/* Broker Receive
+ *
+ * Blocks until the next message for a subscribed topic. msg->data is only valid until the broker
+ * wraps the ring, check broker_msg_valid() after using it, a false return means the data may have
+ * been overwritten while it was read and must be discarded.
+ */
+extern int broker_receive( sock_id_t id, broker_msg_t *msg );
+extern bool broker_msg_valid( sock_id_t id, const broker_msg_t *msg );
+
+/* Frees the ring mapping of a client, before close_sock() */
+extern void broker_release( sock_id_t id );
+
+#endif // _BROKER_H_
@@ -0,0 +1,128 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sock_config.h"
+#include "event_loop.h"
+
+#define CAPTURE_MAGIC 0x3150414350414e50ULL /* "PNAPCAP1" */
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_PATH_SIZE 108
+#define CAPTURE_MIN_SEGMENT_SIZE (1024 * 1024)
+#define CAPTURE_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+
+/* Records start on 8 byte boundaries */
+#define CAPTURE_ALIGN(len) (((len) + 7) & ~(size_t)7)
+
+typedef enum {
+    CAPTURE_NOT_OK = -1,
+    CAPTURE_OK,
+    CAPTURE_END,
+} E_CAPTURE_STATUS;
+
+typedef enum {
+    CAPTURE_RECORD_LISTENER = 1,
+    CAPTURE_RECORD_MESSAGE,
+    CAPTURE_RECORD_CLOSE,
+} E_CAPTURE_RECORD;
+
+/* Segment header
+ *
+ * used is the end of the last complete record, it's updated after every record, so a segment of a
+ * server that crashed is readable up to there.
+ */
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t segment;
+    uint64_t size;
+    uint64_t used;
+} capture_hdr_t;
+
+/* Record
+ *
+ * time_us is wall clock time, so captures of an old and a new server process line up after an
+ * upgrade. listener is the socket id on the capturing server, described by a
+ * CAPTURE_RECORD_LISTENER record earlier in the same segment. conn is the fd of a stream
+ * connection, -1 for datagrams. The peer address is 4 bytes for AF_INET, 16 for AF_INET6, and
+ * empty for AF_UNIX. len bytes of payload follow the record.
+ */
+typedef struct {
+    uint64_t time_us;
+    uint32_t len;
+    uint16_t kind;
+    uint16_t listener;
+    int32_t conn;
+    uint16_t family;
+    uint16_t port;
+    uint8_t addr[16];
+} capture_record_t;
+
+/* Payload of a CAPTURE_RECORD_LISTENER record */
+typedef struct {
+    uint16_t type;
+    uint16_t port;
+    char addr[CAPTURE_PATH_SIZE];
+} capture_listener_t;
+
+typedef struct {
+    uint64_t records;
+    uint64_t bytes;
+    uint32_t dropped;
+    uint32_t segments;
+} capture_stats_t;
+
+typedef struct {
+    char path[CAPTURE_PATH_SIZE];
+    uint32_t segment;
+    int fd;
+    uint8_t *base;
+    size_t size;
+    size_t offset;
+} capture_reader_t;
+
+/* Capture
+ *
+ * Appends every message received by the event loop, with the time, listener, connection, and peer,
+ * to memory-mapped segment files "<path>.<n>". Writing a record is a copy into the mapping, the
+ * kernel writes it back to the file. A full segment is closed, truncated to its used size, and the
+ * next one is opened. Segments that already exist are skipped, never overwritten.
+ *
+ * capture_start() starts capturing with segments of segment_size bytes. The space is reserved on
+ * disk up front, so a full disk fails the start rather than the server. capture_stop() closes the
+ * current segment. Messages longer than a segment are dropped and counted.
+ *
+ * capture_message() and capture_conn_closed() are called by the event loop,
+ * capture_forget_listener() whenever a listener is added, since its socket id may have been reused.
+ */
+extern int capture_start( const char *path, size_t segment_size );
+extern void capture_stop( void );
+extern bool capture_active( void );
+extern void capture_message( const ev_conn_t *conn, const void *buffer, size_t len );
+extern void capture_conn_closed( const ev_conn_t *conn );
+extern void capture_forget_listener( sock_id_t id );
+extern int get_capture_stats( capture_stats_t *stats );
+
+/* Capture Reader
+ *
+ * Reads the segments of a capture in order, starting at "<path>.0". capture_read() returns
+ * CAPTURE_OK with the next record and its payload, which is valid until the next call, CAPTURE_END
+ * after the last record, or CAPTURE_NOT_OK if a segment is invalid.
+ */
+extern int capture_reader_open( capture_reader_t *reader, const char *path );
+extern int capture_read( capture_reader_t *reader, capture_record_t *record, const void **payload );
+extern void capture_reader_close( capture_reader_t *reader );
+
+#endif // _CAPTURE_H_
@@ -1,6 +1,14 @@
 #ifndef _CLIENT_H_
 #define _CLIENT_H_
 
-extern void __attribute__((weak)) appClientTask10Ms( void );
+#include <stdbool.h>
 
-#endif // _CLIENT_H_
\ No newline at end of file
+/* Application task
+ *
+ * Called every 10 ms by the client's scheduler. A long hook checks scheduler_should_yield() and
+ * returns true when it stopped early with work left, it's then called again, within the same
+ * period, once the more urgent tasks have run. Returns false once the period's work is done.
+ */
+extern bool __attribute__((weak)) appClientTask10Ms( void );
+
+#endif // _CLIENT_H_
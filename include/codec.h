@@ -0,0 +1,86 @@
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "messages.h"
+
+/* Longest LEB128 encoding of a 64 bit value */
+#define CODEC_VARINT_MAX 10
+
+typedef enum {
+    CODEC_NOT_OK = -1,
+    CODEC_OK,
+} E_CODEC_STATUS;
+
+/* Bytes field, points into the buffer a message was decoded from, or the data to encode */
+typedef struct {
+    const uint8_t *data;
+    uint32_t len;
+} codec_bytes_t;
+
+/* Generated from CODEC_MESSAGES, see messages.h */
+
+#define _CODEC_FIELD_INT(type, field) type field;
+#define _CODEC_FIELD_BYTES(field, max) codec_bytes_t field;
+
+#define _CODEC_SIZE_INT(type, field) + sizeof(type)
+#define _CODEC_SIZE_VARINT(type, field) + CODEC_VARINT_MAX
+#define _CODEC_SIZE_BYTES(field, max) + CODEC_VARINT_MAX + (max)
+
+#define _CODEC_ID(NAME, name, id, fields) CODEC_MSG_##NAME = id,
+#define _CODEC_STRUCT(NAME, name, id, fields) \
+    typedef struct { fields(_CODEC_FIELD_INT, _CODEC_FIELD_INT, _CODEC_FIELD_INT, _CODEC_FIELD_BYTES) } codec_##name##_t;
+#define _CODEC_MAX_SIZE(NAME, name, id, fields) \
+    CODEC_##NAME##_MAX_SIZE = 1 fields(_CODEC_SIZE_INT, _CODEC_SIZE_VARINT, _CODEC_SIZE_VARINT, _CODEC_SIZE_BYTES),
+#define _CODEC_UNION(NAME, name, id, fields) codec_##name##_t name;
+#define _CODEC_PROTOTYPES(NAME, name, id, fields) \
+    extern int codec_encode_##name( const codec_##name##_t *msg, void *buffer, size_t len ); \
+    extern int codec_decode_##name( const void *buffer, size_t len, codec_##name##_t *msg );
+
+typedef enum {
+    CODEC_MSG_NONE = 0,
+    CODEC_MESSAGES(_CODEC_ID)
+} E_CODEC_MSG;
+
+CODEC_MESSAGES(_CODEC_STRUCT)
+
+enum {
+    CODEC_MESSAGES(_CODEC_MAX_SIZE)
+};
+
+/* Any decoded message, type selects the member of body */
+typedef struct {
+    E_CODEC_MSG type;
+    union {
+        CODEC_MESSAGES(_CODEC_UNION)
+    } body;
+} codec_msg_t;
+
+/* Binary Codec
+ *
+ * A message is its one byte id followed by its fields, see messages.h. Every message has its own
+ * encoder and decoder, generated at compile time, so there is no schema lookup while encoding or
+ * decoding.
+ *
+ * codec_encode_<name>() writes msg to buffer and returns the number of bytes written, or
+ * CODEC_NOT_OK if it doesn't fit or a BYTES field is longer than its max. A buffer of
+ * CODEC_<NAME>_MAX_SIZE bytes always fits.
+ *
+ * codec_decode_<name>() reads a message of that type from buffer and returns the number of bytes
+ * read, or CODEC_NOT_OK if the message is of another type, truncated, or invalid. Nothing is copied,
+ * BYTES fields point into buffer, so they're only valid as long as buffer is.
+ *
+ * codec_decode() decodes any message into msg, codec_peek() returns the id of the message in buffer
+ * without decoding it.
+ */
+CODEC_MESSAGES(_CODEC_PROTOTYPES)
+
+extern int codec_decode( const void *buffer, size_t len, codec_msg_t *msg );
+extern int codec_peek( const void *buffer, size_t len );
+
+#endif // _CODEC_H_
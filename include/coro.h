@@ -0,0 +1,131 @@
+#ifndef _CORO_H_
+#define _CORO_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "event_loop.h"
+#include "support.h"
+
+typedef enum {
+    CORO_TIMEOUT = -2,
+    CORO_NOT_OK,
+    CORO_OK,
+} E_CORO_STATUS;
+
+/* Returned by a coroutine's function, through the CORO_* macros */
+typedef enum {
+    CORO_DONE = 0,
+    CORO_WAITING,
+} E_CORO_STATE;
+
+typedef struct coro_s coro_t;
+typedef E_CORO_STATE (*coro_fn_t)( coro_t *co );
+
+/* Coroutine
+ *
+ * Owned by the caller, usually part of the state of the connection it handles, the runtime keeps
+ * no memory per coroutine. line is where the function resumes. result holds the outcome of the last
+ * CORO_RECV()/CORO_SEND(): bytes, 0 when the peer closed, CORO_TIMEOUT, or CORO_NOT_OK with errno.
+ * The other fields are the runtime's, length is the len the last CORO_RECV()/CORO_SEND() was given.
+ */
+struct coro_s {
+    int line;
+    coro_fn_t fn;
+    void *arg;
+    ssize_t result;
+    size_t length;
+    size_t done;
+
+    int fd;
+    msec_t deadline_ms;
+    uint32_t timer_round;
+    int timer_idx;
+    bool timed_out;
+};
+
+/* Coroutines
+ *
+ * Stackless, a coroutine is a function that returns whenever it waits and is called again by the
+ * event loop when the wait is over, continuing after the CORO_* macro it returned from. Locals don't
+ * survive a wait, state that does lives in co->arg. Thousands can wait at once, each costs one
+ * coro_t, plus an fd watch of the event loop while it waits on an fd.
+ *
+ *     static E_CORO_STATE echo( coro_t *co ) {
+ *         conn_t *c = co->arg;
+ *
+ *         CORO_BEGIN(co);
+ *         for (;;) {
+ *             CORO_RECV(co, c->fd, c->buf, sizeof(c->buf), 5000);
+ *             if (co->result <= 0) { break; }
+ *             CORO_SEND(co, c->fd, c->buf, (size_t)co->result, 5000);
+ *             if (co->result < 0) { break; }
+ *         }
+ *         close(c->fd);
+ *         CORO_END(co);
+ *     }
+ *
+ * coro_start() runs fn until its first wait, it needs the event loop. The timeouts, in ms, are per
+ * wait, -1 waits for ever. An fd has at most one coroutine waiting on it. coro_cancel() drops the
+ * waits of a coroutine, it's never resumed, e.g. before freeing it.
+ */
+extern int coro_start( coro_t *co, coro_fn_t fn, void *arg );
+extern int coro_cancel( coro_t *co );
+extern int coro_wait( coro_t *co, int fd, uint32_t events, int timeout_ms );
+
+#define CORO_BEGIN(co) switch ((co)->line) { case 0:
+
+#define CORO_END(co) } (co)->line = -1; return CORO_DONE
+
+/* Resume point, only used by the macros below. Numbered by __COUNTER__, so any number fit on a line */
+#define CORO_SUSPEND(co) CORO_SUSPEND_AT(co, __COUNTER__ + 1)
+#define CORO_SUSPEND_AT(co, n) do { (co)->line = (n); return CORO_WAITING; case (n):; } while (0)
+
+/* Waits for events on fd, co->timed_out is set if timeout_ms passed first */
+#define CORO_WAIT_FD(co, fd, events, timeout_ms) do { \
+        if (coro_wait((co), (fd), (events), (timeout_ms)) == CORO_OK) { CORO_SUSPEND(co); } \
+    } while (0)
+
+#define CORO_SLEEP(co, ms) do { \
+        if (coro_wait((co), -1, 0, (ms)) == CORO_OK) { CORO_SUSPEND(co); } \
+    } while (0)
+
+/* Lets every other ready coroutine and fd run first */
+#define CORO_YIELD(co) CORO_SLEEP(co, 0)
+
+/* Receives what's there, up to len bytes, waiting until something is. len is evaluated once, before
+ * the first wait, so it can be co->result of the previous call.
+ */
+#define CORO_RECV(co, fd, buffer, len, timeout_ms) do { \
+        (co)->length = (len); \
+        for (;;) { \
+            (co)->result = recv((fd), (buffer), (co)->length, MSG_DONTWAIT); \
+            if (((co)->result >= 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) { break; } \
+            if (coro_wait((co), (fd), EPOLLIN, (timeout_ms)) != CORO_OK) { (co)->result = CORO_NOT_OK; break; } \
+            CORO_SUSPEND(co); \
+            if ((co)->timed_out) { (co)->result = CORO_TIMEOUT; break; } \
+        } \
+    } while (0)
+
+/* Sends all len bytes, result is len once they're sent. len is evaluated once, as for CORO_RECV() */
+#define CORO_SEND(co, fd, buffer, len, timeout_ms) do { \
+        (co)->length = (len); \
+        for ((co)->done = 0; (co)->done < (co)->length; ) { \
+            (co)->result = send((fd), (const char *)(buffer) + (co)->done, (co)->length - (co)->done, MSG_DONTWAIT | MSG_NOSIGNAL); \
+            if ((co)->result >= 0) { (co)->done += (size_t)(co)->result; continue; } \
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) { break; } \
+            if (coro_wait((co), (fd), EPOLLOUT, (timeout_ms)) != CORO_OK) { (co)->result = CORO_NOT_OK; break; } \
+            CORO_SUSPEND(co); \
+            if ((co)->timed_out) { (co)->result = CORO_TIMEOUT; break; } \
+        } \
+        if ((co)->done == (co)->length) { (co)->result = (ssize_t)(co)->done; } \
+    } while (0)
+
+#endif // _CORO_H_
@@ -0,0 +1,24 @@
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli)
+ *
+ * Returns the CRC of len bytes of buffer, continuing from crc, which is 0 for the first buffer. The
+ * implementation is chosen on the first call, the SSE4.2 crc32 instruction if the CPU has it,
+ * otherwise a slicing-by-8 table.
+ */
+extern uint32_t crc32c( uint32_t crc, const void *buffer, size_t len );
+
+/* True if crc32c() uses the CPU instruction */
+extern bool crc32c_hw( void );
+
+/* The same CRC from the slicing-by-8 table whatever the CPU has, so both paths can be checked */
+extern uint32_t crc32c_sw( uint32_t crc, const void *buffer, size_t len );
+
+#endif // _CRC32C_H_
@@ -0,0 +1,148 @@
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "sock_config.h"
+
+#define MAX_NUM_OF_EVENTS 64
+#define MAX_NUM_OF_CONNS 1024
+#define MAX_NUM_OF_WATCHES (MAX_NUM_OF_SOCKS + MAX_NUM_OF_CONNS + 32)
+
+typedef enum {
+    EVENT_NOT_OK = -1,
+    EVENT_OK,
+} E_EVENT_STATUS;
+
+/* Connection
+ *
+ * The origin of a received message. Stream listeners (TCP, LOCAL) have one connection per accepted
+ * client, fd is the accepted socket. Datagram listeners (UDP, RUDP) share the listener fd, and peer
+ * holds the address of the sender of the current datagram. RUDP handlers only see complete, in-order
+ * messages. A connection is only valid during the handler call, unless it's a stream connection which
+ * lives until closed. data is free for the handler to attach per-connection state.
+ */
+typedef struct {
+    int fd;
+    sock_id_t listener;
+    E_APP_SOCK_TYPE type;
+    sockaddr_storage_t peer;
+    socklen_t peer_len;
+    void *data;
+} ev_conn_t;
+
+/* Message handler
+ *
+ * Common interface for every listener type. Called from event_loop_run_once() with the bytes of a
+ * single receive, buffer is NUL terminated one byte past len. The bytes are captured first while
+ * capture_start() is active.
+ */
+typedef void (*msg_handler_t)( ev_conn_t *conn, const void *buffer, size_t len, void *ctx );
+
+/* Close handler
+ *
+ * Called when a stream connection is closed, by the peer or by the server, before the connection is
+ * released. Used to free state attached to conn->data.
+ */
+typedef void (*close_handler_t)( ev_conn_t *conn, void *ctx );
+
+/* fd handler
+ *
+ * Called from event_loop_run_once() with the epoll events that are ready on a watched fd.
+ */
+typedef void (*fd_handler_t)( int fd, uint32_t events, void *ctx );
+
+/* Writable handler
+ *
+ * Called when a stream connection that waits for room with event_loop_want_write() is writable.
+ */
+typedef void (*writable_handler_t)( ev_conn_t *conn, void *ctx );
+
+/* Initialize Event Loop
+ *
+ * Creates the epoll instance and a receive buffer of buffer_size bytes. Returns EVENT_OK on success.
+ */
+extern int event_loop_init( size_t buffer_size );
+extern int event_loop_set_buffer_size( size_t buffer_size );
+
+/* Listeners
+ *
+ * Registers a socket created with initialize_sock() as a server. The socket is made non-blocking,
+ * stream listeners accept connections automatically. Every message received on the listener or its
+ * connections is passed to handler. Removing a listener closes its connections, but not the socket.
+ */
+extern int event_loop_add_listener( sock_id_t id, msg_handler_t handler, void *ctx );
+extern int event_loop_remove_listener( sock_id_t id );
+extern int event_loop_set_close_handler( sock_id_t id, close_handler_t handler );
+
+/* Backpressure
+ *
+ * For handlers that buffer what a stream connection's socket didn't take. While write is set, conn
+ * is watched for room and the listener's writable handler is called, block also stops reading it
+ * until then, so a peer that doesn't read its replies isn't read either. The handler clears write
+ * once its buffer is sent. The writable handler is set like the close handler, not for compact
+ * connections.
+ */
+extern int event_loop_set_writable_handler( sock_id_t id, writable_handler_t handler );
+extern int event_loop_want_write( ev_conn_t *conn, bool write, bool block );
+
+/* Compact Connections
+ *
+ * For listeners with many mostly idle connections. A connection of a compact stream listener is a
+ * 40 byte record indexed by its fd, instead of a watch, and isn't limited by MAX_NUM_OF_CONNS, only
+ * by the listener's max_conns and the fd limit. No buffer is held per connection, messages are read
+ * into the shared receive buffer and replies are sent directly.
+ *
+ * The handler gets the connection unpacked into an ev_conn_t that's only valid during the call, as
+ * for datagram listeners, data is kept across calls. Handlers that keep the pointer to a connection,
+ * like the broker's and RPC's, can't be used with it. Applies to connections accepted afterwards.
+ */
+extern int event_loop_set_compact( sock_id_t id, bool enable );
+
+/* Draining
+ *
+ * Stopping a listener keeps its connections, so in-flight work can complete. The number of open
+ * stream connections can be polled until it reaches zero, or a deadline forces them closed.
+ */
+extern int event_loop_stop_listener( sock_id_t id );
+extern int event_loop_num_conns( void );
+extern void event_loop_close_all_conns( void );
+
+/* fd Watches
+ *
+ * Registers any fd (timers, pipes, signalfd, client sockets, ...) to be dispatched from the loop.
+ * events are EPOLLIN/EPOLLOUT, modify replaces the events of a watched fd.
+ */
+extern int event_loop_watch_fd( int fd, uint32_t events, fd_handler_t handler, void *ctx );
+extern int event_loop_modify_fd( int fd, uint32_t events );
+extern int event_loop_unwatch_fd( int fd );
+
+/* Run Event Loop
+ *
+ * Waits up to timeout_ms (-1 blocks, 0 polls) for events and dispatches them. Returns the number of
+ * events dispatched, or EVENT_NOT_OK.
+ */
+extern int event_loop_run_once( int timeout_ms );
+
+/* Reply
+ *
+ * Sends buffer back to the origin of conn, sendto() the peer for datagram connections. RUDP replies
+ * are queued for reliable delivery, EVENT_NOT_OK if the peer's window is full. Returns the number of
+ * bytes sent, or EVENT_NOT_OK.
+ */
+extern int event_loop_reply( ev_conn_t *conn, const void *buffer, size_t len );
+
+/* Close Connection
+ *
+ * Closes a stream connection. Has no effect on datagram connections.
+ */
+extern int event_loop_close_conn( ev_conn_t *conn );
+
+#endif // _EVENT_LOOP_H_
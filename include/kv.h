@@ -0,0 +1,76 @@
+#ifndef _KV_H_
+#define _KV_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "codec.h"
+#include "support.h"
+#include "rpc.h"
+
+/* Same as the KV messages, see messages.h */
+#define KV_MAX_KEY_SIZE 250
+#define KV_MAX_VALUE_SIZE 4096
+
+/* Memory is handed to the size classes a page at a time */
+#define KV_PAGE_SIZE (1024 * 1024)
+
+/* Chunk sizes are KV_MIN_CHUNK_SIZE doubled for every class, the largest fits any item */
+#define KV_MIN_CHUNK_SIZE 64
+#define KV_NUM_CLASSES 8
+
+typedef enum {
+    KV_NOT_OK = -1,
+    KV_OK,
+    KV_NOT_FOUND,
+    KV_TOO_LARGE,
+    KV_NO_SPACE,
+} E_KV_STATUS;
+
+/* Stats
+ *
+ * items and bytes are current, bytes counts the chunks items occupy, memory the pages handed out
+ * so far. The rest count since kv_init().
+ */
+typedef struct {
+    uint64_t gets;
+    uint64_t hits;
+    uint64_t sets;
+    uint64_t deletes;
+    uint64_t evictions;
+    uint64_t expired;
+    uint32_t items;
+    size_t bytes;
+    size_t memory;
+} kv_stats_t;
+
+/* Key-Value Cache
+ *
+ * In-memory cache of up to memory_bytes of items, at least a page for every class. An item, its
+ * header, key, and value, is stored in a chunk of the smallest size class it fits. Each class takes
+ * pages from the budget as it grows.
+ * Once the budget is used, a full class evicts with CLOCK, a read marks an item and the hand skips
+ * marked items once, so items read since the hand last passed stay. A class without pages takes one
+ * from the class with the most. Keys are found through an open addressing table with linear probing,
+ * sized for items of 128 bytes on average, smaller ones are evicted before their memory runs out.
+ *
+ * kv_set() replaces an existing key, a ttl_ms of 0 never expires. Expired items are removed when
+ * they're read or reached by the hand. kv_get() points value into the cache, it's valid until the
+ * next kv_set() or kv_del().
+ *
+ * kv_request_handler() serves the cache as an RPC listener. A request is any number of KV_GET,
+ * KV_SET, and KV_DEL messages back to back, the response has a KV_VALUE for each, in order, so a
+ * client can batch a multi-get in one round trip. A value that doesn't fit in what's left of the
+ * response is answered with KV_TOO_LARGE, the client asks for it again on its own.
+ */
+extern int kv_init( size_t memory_bytes );
+extern int kv_get( const void *key, size_t key_len, const void **value, size_t *value_len );
+extern int kv_set( const void *key, size_t key_len, const void *value, size_t value_len, msec_t ttl_ms );
+extern int kv_del( const void *key, size_t key_len );
+extern int kv_request_handler( const void *request, size_t len, void *response, size_t *response_len, void *ctx );
+extern int get_kv_stats( kv_stats_t *stats );
+
+#endif // _KV_H_
@@ -0,0 +1,100 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+/* Threads that can log at once while the writer runs, each gets its own ring until it exits */
+#define LOGGER_MAX_THREADS 16
+
+/* Records per ring, a power of 2 */
+#define LOGGER_RING_SIZE 512
+
+#define LOGGER_RECORD_SIZE 256
+#define LOGGER_MSG_SIZE (LOGGER_RECORD_SIZE - 16)
+
+/* Records kept per call site per second, the rest are counted and dropped */
+#define LOGGER_DEFAULT_RATE 10
+
+/* How long the writer sleeps while the rings are empty */
+#define LOGGER_INTERVAL_MS 10
+
+typedef enum {
+    LOGGER_NOT_OK = -1,
+    LOGGER_OK,
+} E_LOGGER_STATUS;
+
+typedef enum {
+    LOGGER_DEBUG = 0,
+    LOGGER_INFO,
+    LOGGER_WARN,
+    LOGGER_ERROR,
+} E_LOGGER_LEVEL;
+
+/* Record
+ *
+ * time_us is wall clock time. suppressed is the number of records the call site dropped to its rate
+ * limit during the previous second, reported with the first record after it.
+ */
+typedef struct {
+    uint64_t time_us;
+    uint32_t suppressed;
+    uint16_t level;
+    uint16_t len;
+    char msg[LOGGER_MSG_SIZE];
+} logger_record_t;
+
+/* Rate limit state of a call site, one is declared by every log_*() */
+typedef struct {
+    uint64_t second;
+    uint32_t count;
+    uint32_t suppressed;
+} logger_site_t;
+
+typedef struct {
+    uint64_t records;
+    uint64_t dropped;
+    uint64_t suppressed;
+} logger_stats_t;
+
+/* Logger
+ *
+ * log_error(), log_warn(), log_info(), and log_debug() take printf arguments. The message is
+ * formatted into a fixed size record in the calling thread's ring, no lock is taken and no system
+ * call is made, a full ring drops the record. A writer thread drains the rings to stdout, in batches,
+ * and flushes stdout, so printf output of the same process still comes out in time. The writer
+ * blocks every signal, they're left to the process's own threads.
+ *
+ * Until logger_start() is called, and in the child of a fork() until it's called again, records
+ * are written to stdout directly. logger_flush() writes every pending record before returning.
+ * logger_stop() flushes and stops the writer, it's also called at exit.
+ *
+ * Records below the level set by logger_set_level() are discarded, LOGGER_INFO by default. Each call
+ * site keeps at most logger_set_rate() records per second, 0 disables the limit.
+ */
+#define log_debug(...) LOGGER_WRITE(LOGGER_DEBUG, __VA_ARGS__)
+#define log_info(...) LOGGER_WRITE(LOGGER_INFO, __VA_ARGS__)
+#define log_warn(...) LOGGER_WRITE(LOGGER_WARN, __VA_ARGS__)
+#define log_error(...) LOGGER_WRITE(LOGGER_ERROR, __VA_ARGS__)
+
+#define LOGGER_WRITE(level, ...) do { \
+        static logger_site_t _site; \
+        logger_write(&_site, (level), __VA_ARGS__); \
+    } while (0)
+
+extern int logger_start( void );
+extern void logger_stop( void );
+extern void logger_flush( void );
+extern void logger_set_level( E_LOGGER_LEVEL level );
+extern void logger_set_rate( uint32_t records_per_sec );
+extern void logger_write( logger_site_t *site, E_LOGGER_LEVEL level, const char *fmt, ... ) __attribute__((format(printf, 3, 4)));
+extern int get_logger_stats( logger_stats_t *stats );
+
+#endif // _LOGGER_H_
@@ -0,0 +1,41 @@
+#ifndef _LZ_H_
+#define _LZ_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Shortest match worth a back reference */
+#define LZ_MIN_MATCH 4
+
+/* Farthest back reference, offsets are 16 bits */
+#define LZ_MAX_OFFSET 65535
+
+/* Largest output of lz_compress() for len bytes of input, when nothing matches */
+#define LZ_MAX_SIZE(len) ((len) + ((len) / 255) + 16)
+
+typedef enum {
+    LZ_NOT_OK = -1,
+    LZ_OK,
+} E_LZ_STATUS;
+
+/* LZ Compression
+ *
+ * A byte-oriented LZ77 in the style of LZ4, fast enough to run on every large message. The output is
+ * a series of sequences, each a token, literals copied as they are, and a back reference to bytes
+ * already written. The last sequence has literals only.
+ *
+ *   token: literal length in the high nibble, match length - LZ_MIN_MATCH in the low nibble, 15
+ *          meaning more length bytes follow, each added up until one is below 255
+ *   match: 16 bit little endian offset back from the current position, then the extra length bytes
+ *
+ * lz_compress() returns the number of bytes written to dst, or LZ_NOT_OK if they don't fit in cap.
+ * Passing a cap smaller than len only keeps output that saves space. lz_decompress() returns the
+ * number of bytes written to dst, or LZ_NOT_OK if src is malformed or doesn't fit in cap.
+ */
+extern int lz_compress( const void *src, size_t len, void *dst, size_t cap );
+extern int lz_decompress( const void *src, size_t len, void *dst, size_t cap );
+
+#endif // _LZ_H_
@@ -0,0 +1,72 @@
+#ifndef _MESSAGES_H_
+#define _MESSAGES_H_
+
+/* Message Schemas
+ *
+ * Every message is MSG(NAME, name, id, FIELDS), FIELDS lists its fields in wire order:
+ *
+ *  FIXED(type, field)    unsigned or signed integer, little-endian, sizeof(type) bytes
+ *  VARINT(type, field)   unsigned integer, LEB128, 1 byte below 128
+ *  SVARINT(type, field)  signed integer, zigzag LEB128, 1 byte between -64 and 63
+ *  BYTES(field, max)     varint length followed by up to max bytes, decoded in place
+ *
+ * codec.h generates a codec_<name>_t struct, CODEC_<NAME>_MAX_SIZE, and the encoder and decoder of
+ * every message from this list. Ids are one byte on the wire. A message that changes gets a new id,
+ * peers reject ids they don't know.
+ */
+
+/* Client greeting, sent as an RPC request */
+#define CODEC_HELLO_FIELDS(FIXED, VARINT, SVARINT, BYTES) \
+    FIXED(uint32_t, seq) \
+    VARINT(uint64_t, sent_ms) \
+    BYTES(name, 32)
+
+/* Server response to HELLO, sent_ms is echoed so the client can measure the round trip */
+#define CODEC_HELLO_ACK_FIELDS(FIXED, VARINT, SVARINT, BYTES) \
+    FIXED(uint32_t, seq) \
+    VARINT(uint64_t, sent_ms) \
+    SVARINT(int32_t, status)
+
+/* Key-value cache requests, see kv.h. Sizes are KV_MAX_KEY_SIZE and KV_MAX_VALUE_SIZE */
+#define CODEC_KV_GET_FIELDS(FIXED, VARINT, SVARINT, BYTES) \
+    BYTES(key, 250)
+
+/* ttl_ms of 0 never expires */
+#define CODEC_KV_SET_FIELDS(FIXED, VARINT, SVARINT, BYTES) \
+    VARINT(uint32_t, ttl_ms) \
+    BYTES(key, 250) \
+    BYTES(value, 4096)
+
+#define CODEC_KV_DEL_FIELDS(FIXED, VARINT, SVARINT, BYTES) \
+    BYTES(key, 250)
+
+/* Answer to every key-value request, value is only set for a GET that found its key */
+#define CODEC_KV_VALUE_FIELDS(FIXED, VARINT, SVARINT, BYTES) \
+    SVARINT(int32_t, status) \
+    BYTES(value, 4096)
+
+/* Telemetry sample of a client, aggregated by source and metric, see aggregate.h */
+#define CODEC_SAMPLE_FIELDS(FIXED, VARINT, SVARINT, BYTES) \
+    BYTES(source, 31) \
+    BYTES(metric, 31) \
+    SVARINT(int64_t, value)
+
+/* Optional trace context, sent in front of the message it traces, see trace.h. Times are
+ * get_monotonic_us() of the client, when the message was queued and when it was sent.
+ */
+#define CODEC_TRACE_FIELDS(FIXED, VARINT, SVARINT, BYTES) \
+    VARINT(uint64_t, id) \
+    VARINT(uint64_t, queued_us) \
+    VARINT(uint64_t, sent_us)
+
+#define CODEC_MESSAGES(MSG) \
+    MSG(HELLO, hello, 1, CODEC_HELLO_FIELDS) \
+    MSG(HELLO_ACK, hello_ack, 2, CODEC_HELLO_ACK_FIELDS) \
+    MSG(KV_GET, kv_get, 3, CODEC_KV_GET_FIELDS) \
+    MSG(KV_SET, kv_set, 4, CODEC_KV_SET_FIELDS) \
+    MSG(KV_DEL, kv_del, 5, CODEC_KV_DEL_FIELDS) \
+    MSG(KV_VALUE, kv_value, 6, CODEC_KV_VALUE_FIELDS) \
+    MSG(SAMPLE, sample, 7, CODEC_SAMPLE_FIELDS) \
+    MSG(TRACE, trace, 8, CODEC_TRACE_FIELDS)
+
+#endif // _MESSAGES_H_
@@ -0,0 +1,74 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "sock_config.h"
+#include "rpc.h"
+
+#define MAX_NUM_OF_POOLS 4
+#define POOL_MAX_ENDPOINTS 8
+
+/* Connections per pool, across all of its endpoints */
+#define POOL_MAX_CONNS 32
+
+/* Consecutive timeouts or connection failures before an endpoint is ejected */
+#define POOL_EJECT_FAILURES 3
+
+/* Ejection time, doubled every time the endpoint is ejected again without a success in between */
+#define POOL_EJECT_MS 100
+#define POOL_EJECT_MAX_MS 5000
+
+typedef int pool_id_t;
+
+typedef enum {
+    POOL_BALANCE_LEAST_OUTSTANDING = 0,
+    POOL_BALANCE_P2C,
+} E_POOL_BALANCE;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t completed;
+    uint32_t failures;
+    uint32_t ejections;
+    uint32_t reconnects;
+    uint32_t healthy_endpoints;
+    uint32_t connected;
+    uint32_t in_flight;
+} pool_stats_t;
+
+/* Connection Pool
+ *
+ * Spreads RPC requests over several connections to each of several server endpoints. Every request
+ * goes to the connection with the fewest requests in flight, either searched across the whole pool
+ * (POOL_BALANCE_LEAST_OUTSTANDING) or picked from two random connections (POOL_BALANCE_P2C), which
+ * is cheaper with many connections and avoids piling onto the same one.
+ *
+ * An endpoint that fails POOL_EJECT_FAILURES times in a row, by timeouts, lost connections or failed
+ * connects, is ejected and gets no new requests until its ejection time passes. If every endpoint is
+ * ejected, requests go to any connection that is still up. Lost connections are reconnected from
+ * pool_tick_all(), which must be called from the scheduler along with rpc_tick_all().
+ *
+ * pool_add_endpoint() opens num_conns connections to a TCP or LOCAL endpoint, those that fail to
+ * connect are retried from the tick. pool_call() returns as rpc_call(), the callback gets the
+ * completion of the connection the request was sent on. pool_destroy() completes every request
+ * in flight with RPC_STATUS_DISCONNECTED and must not be called from a callback.
+ *
+ * pool_set_checksum() and pool_set_compression() turn rpc_set_checksum() and rpc_set_compression()
+ * on or off for every connection of the pool, including those added later.
+ */
+extern pool_id_t pool_create( E_POOL_BALANCE balance );
+extern int pool_add_endpoint( pool_id_t pool, E_APP_SOCK_TYPE type, const char *addr_str, int port, int num_conns );
+extern void pool_destroy( pool_id_t pool );
+extern int pool_set_checksum( pool_id_t pool, bool enable );
+extern int pool_set_compression( pool_id_t pool, bool enable );
+extern int pool_call( pool_id_t pool, const void *buffer, size_t len, msec_t timeout_ms, rpc_callback_t callback, void *ctx );
+extern void pool_tick_all( void );
+extern int get_pool_stats( pool_id_t pool, pool_stats_t *stats );
+
+#endif // _POOL_H_
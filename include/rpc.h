@@ -0,0 +1,129 @@
+#ifndef _RPC_H_
+#define _RPC_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "sock_config.h"
+#include "event_loop.h"
+#include "support.h"
+#include "crc32c.h"
+#include "lz.h"
+
+#define RPC_MAX_PAYLOAD (8 * 1024)
+
+/* Requests in flight per connection, power of 2 */
+#define RPC_MAX_IN_FLIGHT 256
+
+/* Bytes buffered per connection in each direction, at least one frame */
+#define RPC_BUFFER_SIZE (32 * 1024)
+
+/* Call rpc_tick_all() at least this often for timely deadlines */
+#define RPC_TICK_MS SCHEDULER_INTERVAL_10_MS
+
+typedef enum {
+    RPC_STATUS_OK = 0,
+    RPC_STATUS_ERROR,
+    RPC_STATUS_TIMEOUT,
+    RPC_STATUS_DISCONNECTED,
+} E_RPC_STATUS;
+
+/* Frame flags, RPC_FLAG_ACCEPT_LZ tells the peer it may send compressed payloads */
+#define RPC_FLAG_CRC 0x0001
+#define RPC_FLAG_LZ 0x0002
+#define RPC_FLAG_ACCEPT_LZ 0x0004
+
+/* Smaller payloads are sent as they are, they rarely shrink enough to pay for it */
+#define RPC_LZ_MIN_SIZE 512
+
+/* Frame
+ *
+ * Requests and responses are a header followed by len bytes of payload, in network byte order. A
+ * response carries the id of its request, responses may arrive in any order. With RPC_FLAG_CRC set,
+ * crc is the CRC32C of the header, with crc zeroed, and the payload, otherwise it's 0 and unchecked.
+ * With RPC_FLAG_LZ set, the payload is compressed with lz_compress() and len is its compressed
+ * length, the CRC covers the compressed bytes.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+    uint16_t status;
+    uint16_t flags;
+    uint32_t crc;
+} rpc_hdr_t;
+
+typedef struct {
+    uint32_t sent;
+    uint32_t completed;
+    uint32_t errors;
+    uint32_t timeouts;
+    uint32_t disconnects;
+    uint32_t late;
+    uint32_t corrupt;
+    uint32_t compressed;
+    uint64_t bytes_saved;
+    uint32_t in_flight;
+} rpc_stats_t;
+
+/* Completion callback
+ *
+ * Called once per request from the event loop, or from rpc_tick_all() when the deadline expires.
+ * buffer is only valid during the call, it's empty unless status is RPC_STATUS_OK.
+ */
+typedef void (*rpc_callback_t)( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx );
+
+/* Request handler
+ *
+ * Handles a request on the server, writes up to RPC_MAX_PAYLOAD bytes of response. Returns the
+ * E_RPC_STATUS sent with the response.
+ */
+typedef int (*rpc_request_handler_t)( const void *request, size_t len, void *response, size_t *response_len, void *ctx );
+
+/* RPC Client
+ *
+ * Pipelines requests over a LOCAL or TCP client socket. Any number of requests, up to
+ * RPC_MAX_IN_FLIGHT, can be outstanding on one connection, each is tagged with a correlation id and
+ * completes through its callback when the response arrives. The socket is non-blocking and watched by
+ * the event loop, so event_loop_run_once() must be called to receive responses.
+ *
+ * rpc_attach() connects id and registers it, id is updated if the socket had to be re-initialized.
+ * rpc_call() queues a request and sets req_id, which may be NULL. Returns SOCK_OK, SOCK_FAILED_TO_SEND
+ * if too many requests are in flight or the send buffer is full, or SOCK_NOT_OK if the connection is
+ * lost. A lost connection completes every request with RPC_STATUS_DISCONNECTED, attach again to
+ * reconnect.
+ *
+ * rpc_set_checksum() makes id send its requests with RPC_FLAG_CRC, the server answers them the same
+ * way. It may be called before or after attaching and holds across reconnects. A response that fails
+ * its check is counted as corrupt and disconnects the client, a request that fails closes the
+ * connection on the server.
+ *
+ * rpc_set_compression() offers compression to the server with every request. Once a response shows
+ * the server accepts it too, requests of at least RPC_LZ_MIN_SIZE bytes are compressed when that
+ * makes them smaller, and so are the server's responses. The setting holds like the checksum, the
+ * negotiation starts over on every connection.
+ */
+extern int rpc_attach( sock_id_t *id );
+extern void rpc_detach( sock_id_t id );
+extern int rpc_set_checksum( sock_id_t id, bool enable );
+extern int rpc_set_compression( sock_id_t id, bool enable );
+extern int rpc_call( sock_id_t id, const void *buffer, size_t len, msec_t timeout_ms, rpc_callback_t callback, void *ctx, uint32_t *req_id );
+extern int rpc_num_in_flight( sock_id_t id );
+extern bool rpc_connected( sock_id_t id );
+extern void rpc_tick_all( void );
+extern int get_rpc_stats( sock_id_t id, rpc_stats_t *stats );
+
+/* RPC Server
+ *
+ * Serves requests on a LOCAL or TCP listener. Every complete request on a connection is passed to
+ * handler, responses are buffered and sent once per receive, so pipelined requests are answered
+ * with as few sends as possible. A client that stops reading its responses isn't read either until
+ * they're sent.
+ */
+extern int rpc_serve( sock_id_t id, rpc_request_handler_t handler, void *ctx );
+
+#endif // _RPC_H_
@@ -0,0 +1,112 @@
+#ifndef _RUDP_H_
+#define _RUDP_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "sock_config.h"
+#include "support.h"
+
+/* Largest payload of a single message, keeps datagrams below the common 1280 byte IPv6 minimum MTU */
+#define RUDP_MAX_PAYLOAD 1200
+
+/* Messages in flight per peer, and out-of-order messages buffered per peer. Power of 2. */
+#define RUDP_WINDOW_SIZE 64
+
+#define RUDP_MAX_PEERS 32
+#define RUDP_SACK_BITS 32
+
+#define RUDP_MIN_RTO_MS 20
+#define RUDP_MAX_RTO_MS 2000
+#define RUDP_INITIAL_RTO_MS 200
+#define RUDP_MAX_RETRIES 10
+#define RUDP_DUP_THRESH 3
+
+/* Call rudp_tick_all() at least this often for timely retransmits */
+#define RUDP_TICK_MS SCHEDULER_INTERVAL_10_MS
+
+typedef struct {
+    uint32_t sent;
+    uint32_t retransmits;
+    uint32_t fast_retransmits;
+    uint32_t timeouts;
+    uint32_t received;
+    uint32_t duplicates;
+    uint32_t delivered;
+    uint32_t dropped;
+    uint32_t peers_failed;
+    uint32_t peers_evicted;
+    uint32_t resyncs;
+    msec_t srtt_ms;
+    uint32_t cwnd;
+} rudp_stats_t;
+
+/* Peer whose state was dropped, unacked messages to it may be lost, undelivered ones from it are */
+typedef struct {
+    sockaddr_storage_t addr;
+    socklen_t addr_len;
+    uint32_t unacked;
+    uint32_t undelivered;
+} rudp_drop_t;
+
+/* Reliable UDP
+ *
+ * Ordered, reliable delivery over a socket initialized as E_RUDP_SOCK. Every peer has its own sequence
+ * space, messages are acknowledged cumulatively with a selective acknowledgement (SACK) bitmap of the
+ * next RUDP_SACK_BITS messages, so a single loss only retransmits the missing message. The send window
+ * is the smaller of RUDP_WINDOW_SIZE and a congestion window, which grows on acks (slow start, then
+ * additive increase) and is cut on loss. Messages are never split, len is at most RUDP_MAX_PAYLOAD.
+ *
+ * Every peer's sequence space is a session, named by an epoch that's sent with every message along
+ * with the oldest unacknowledged one. Epochs are the wall clock time the session started, in ms, and
+ * compared as serial numbers. A receiver that sees a newer epoch, e.g. of a peer that was restarted
+ * or dropped its state, starts over at that message instead of waiting for ones that are never sent
+ * again, and one that lost its own state picks up where the sender is. Late messages of an older
+ * epoch are dropped.
+ *
+ * Nothing blocks. rudp_process() reads every pending datagram, rudp_tick() retransmits on timeout and
+ * must be called from the scheduler, every RUDP_TICK_MS. The await_network_*() APIs call these for a
+ * client socket.
+ */
+
+/* Send
+ *
+ * Queues and sends buffer to peer, or to the address the socket was initialized with if peer is NULL.
+ * Returns SOCK_OK, SOCK_FAILED_TO_SEND if the window is full (retry after acks arrive), or SOCK_NOT_OK.
+ */
+extern int rudp_send( sock_id_t id, const sockaddr_t *peer, socklen_t peer_len, const void *buffer, size_t len );
+
+/* Receive
+ *
+ * Copies the next in-order message of any peer to buffer, and the peer's address to peer if not NULL.
+ * Returns the length of the message, or SOCK_NOT_OK if no message is ready. As for recv() with
+ * MSG_TRUNC, a message longer than len is cut and its full length returned.
+ */
+extern int rudp_receive( sock_id_t id, void *buffer, size_t len, sockaddr_storage_t *peer, socklen_t *peer_len );
+
+extern int rudp_process( sock_id_t id );
+extern void rudp_tick( sock_id_t id );
+extern void rudp_tick_all( void );
+
+/* Dropped Peers
+ *
+ * A peer's state is dropped when it exhausts RUDP_MAX_RETRIES, or when the peer table is full and
+ * it's the least recently active one with nothing in flight or undelivered. Copies the oldest peer
+ * dropped since the last call to drop, the last RUDP_MAX_PEERS are kept. Returns SOCK_OK, or
+ * SOCK_NOT_OK if there's none.
+ */
+extern int rudp_dropped( sock_id_t id, rudp_drop_t *drop );
+
+/* Close
+ *
+ * Frees the state of id, called by close_sock(). Unacknowledged messages are lost.
+ */
+extern void rudp_close( sock_id_t id );
+
+extern int get_rudp_stats( sock_id_t id, rudp_stats_t *stats );
+
+#endif // _RUDP_H_
@@ -0,0 +1,80 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "support.h"
+
+#define SCHEDULER_MAX_TASKS 32
+#define SCHEDULER_NAME_SIZE 32
+
+/* Longest a task runs before scheduler_should_yield() asks it to give the CPU back */
+#define SCHEDULER_SLICE_US 2000
+
+/* Window the CPU budgets of the classes are measured over */
+#define SCHEDULER_WINDOW_MS 100
+
+typedef enum {
+    SCHEDULER_NOT_OK = -1,
+    SCHEDULER_OK,
+} E_SCHEDULER_STATUS;
+
+/* Classes, in priority order */
+typedef enum {
+    SCHEDULER_CLASS_CRITICAL = 0,
+    SCHEDULER_CLASS_NORMAL,
+    SCHEDULER_CLASS_BACKGROUND,
+    SCHEDULER_NUM_CLASSES
+} E_SCHEDULER_CLASS;
+
+/* Returned by a task, yield means it has more work for this period and wants to be called again */
+typedef enum {
+    SCHEDULER_TASK_DONE = 0,
+    SCHEDULER_TASK_YIELD,
+} E_SCHEDULER_TASK;
+
+typedef E_SCHEDULER_TASK (*scheduler_task_t)( void *arg );
+
+/* Stats of a task
+ *
+ * missed counts runs that finished after their deadline, and periods skipped because the task
+ * was still running. max_latency_us is the longest a released task waited for its first slice.
+ */
+typedef struct {
+    uint64_t runs;
+    uint64_t yields;
+    uint64_t missed;
+    uint64_t cpu_us;
+    uint64_t max_latency_us;
+} scheduler_stats_t;
+
+/* Scheduler
+ *
+ * Cooperative scheduler for the tasks of one thread. A task is released every period_ms and has
+ * to finish within deadline_ms of its release, 0 for the period. Of the released tasks, the one of
+ * the highest class runs first, and within a class the one with the earliest deadline.
+ *
+ * A long task checks scheduler_should_yield() and returns SCHEDULER_TASK_YIELD when it's true, it
+ * is then called again, with the same deadline, once every task more urgent than it has run. It's
+ * true once the task has used its slice, or a task of a higher class has been released.
+ *
+ * scheduler_set_budget() caps the share of each SCHEDULER_WINDOW_MS window a class gets, 100 by
+ * default. A class over its budget only runs when no other class has work, so background work
+ * can't starve the rest, and is never starved while the CPU is idle.
+ *
+ * scheduler_run_once() runs one task, or returns how long nothing is due, in ms, so the caller can
+ * wait in event_loop_run_once() and handle I/O in the meantime.
+ */
+extern int scheduler_add_task( const char *name, E_SCHEDULER_CLASS cls, msec_t period_ms, msec_t deadline_ms,
+                               scheduler_task_t task, void *arg );
+extern int scheduler_remove_task( int id );
+extern int scheduler_set_budget( E_SCHEDULER_CLASS cls, int percent );
+extern bool scheduler_should_yield( void );
+extern int scheduler_run_once( void );
+extern int get_scheduler_stats( int id, scheduler_stats_t *stats );
+
+#endif // _SCHEDULER_H_
@@ -0,0 +1,127 @@
+#ifndef _SERVER_CONFIG_H_
+#define _SERVER_CONFIG_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "affinity.h"
+#include "aggregate.h"
+#include "sock_config.h"
+#include "support.h"
+#include "trace.h"
+
+#define MAX_NUM_OF_LISTENERS 16
+#define MAX_NUM_OF_WORKERS 4
+
+#define LISTENER_ADDR_SIZE 108
+#define CONFIG_LINE_SIZE 256
+
+#define DEFAULT_SERVER_CONFIG_PATH "server.conf"
+#define DEFAULT_NUM_OF_WORKERS 1
+#define DEFAULT_BUFFER_SIZE 128
+#define DEFAULT_SCHEDULER_MS SCHEDULER_INTERVAL_1000_MS
+#define DEFAULT_DRAIN_MS 5000
+#define DEFAULT_CAPTURE_SEGMENT_MB 64
+#define MAX_CAPTURE_SEGMENT_MB 4096
+#define DEFAULT_KV_MEMORY_MB 64
+#define MIN_KV_MEMORY_MB 8
+#define MAX_KV_MEMORY_MB (64 * 1024)
+
+typedef enum {
+    CONFIG_NOT_OK = -1,
+    CONFIG_OK,
+} E_CONFIG_STATUS;
+
+/* What a listener serves, messages to the message handler, the broker, request/response RPC, or
+ * the key-value cache over RPC
+ */
+typedef enum {
+    E_LISTENER_MESSAGE = 0,
+    E_LISTENER_BROKER,
+    E_LISTENER_RPC,
+    E_LISTENER_KV,
+} E_LISTENER_ROLE;
+
+typedef struct {
+    E_APP_SOCK_TYPE type;
+    char addr[LISTENER_ADDR_SIZE];
+    int port;
+    sock_opts_t opts;
+    E_LISTENER_ROLE role;
+    bool compact;
+} listener_config_t;
+
+typedef struct {
+    int num_workers;
+    size_t buffer_size;
+    msec_t scheduler_ms;
+    msec_t drain_ms;
+
+    /* Empty unless traffic is captured */
+    char capture_path[LISTENER_ADDR_SIZE];
+    size_t capture_segment_mb;
+
+    /* Budget of the key-value cache, see kv.h */
+    size_t kv_memory_mb;
+
+    /* Windows telemetry samples are rolled up over */
+    aggregate_config_t aggregate;
+
+    /* Empty unless traced messages are, one in trace_sample of them is dumped */
+    char trace_path[LISTENER_ADDR_SIZE];
+    int trace_sample;
+
+    /* CPUs of the event loop and the workers */
+    affinity_config_t affinity;
+
+    int num_listeners;
+    listener_config_t listeners[MAX_NUM_OF_LISTENERS];
+} server_config_t;
+
+/* Default Server Configuration
+ *
+ * The configuration used when no file is provided, a single UDP listener on 127.0.0.1:9003.
+ */
+extern void get_default_server_config( server_config_t *cfg );
+
+/* Load Server Configuration
+ *
+ * Parses the file at path into cfg. Lines are "key = value", blank lines and lines starting with '#'
+ * are ignored. Recognised keys:
+ *
+ *  workers      = <1..MAX_NUM_OF_WORKERS>
+ *  buffer_size  = <bytes>
+ *  scheduler_ms = <ms>
+ *  drain_ms     = <ms>, how long connections may finish on shutdown or upgrade
+ *  kv_memory_mb = <MB>, memory of the key-value cache served by kv listeners, read at startup
+ *  aggregate    = <tumbling|sliding> <window_ms> [slide_ms], windows of the rollups of telemetry
+ *                 samples, a sliding window is up to AGGREGATE_MAX_BUCKETS slides, see aggregate.h
+ *  trace        = <path> [sample], traces messages that carry a trace context, and dumps one in
+ *                 sample of them to <path>.<worker> as Chrome trace JSON, see trace.h
+ *  capture      = <path> [segment_mb], records received messages to <path>.<n>, see capture.h
+ *  cpus         = <none|auto|list>, pins the event loop to the first CPU and workers to the rest,
+ *                 e.g. "0,2-4", auto places them by topology, see affinity.h
+ *  listener     = <local|tcp|udp|rudp|broker> <addr|path> <port> [option=value ...]
+ *
+ * Listener options are profile=<default|latency|throughput>, rcvbuf, sndbuf, busy_poll, incoming_cpu,
+ * and the booleans nodelay, cork, quickack, zerocopy. The profile is applied first, other options
+ * override it. rate, burst, max_conns, and max_conns_per_peer limit clients, see sock_opts_t.
+ *
+ * role=<message|rpc|kv> selects what a stream listener serves, a broker listener is a LOCAL listener
+ * with the broker role. compact=1 keeps the connections of a stream listener with the message role
+ * as small records, for large numbers of idle clients, see event_loop_set_compact().
+ *
+ * cfg is only modified if the whole file is valid. Returns CONFIG_OK or CONFIG_NOT_OK.
+ */
+extern int load_server_config( const char *path, server_config_t *cfg );
+
+/* Compare Listeners
+ *
+ * Listeners are the same endpoint if type, address, port, and role match. Options are not compared,
+ * so a reload can re-tune a listener without closing it.
+ */
+extern bool is_same_listener( const listener_config_t *a, const listener_config_t *b );
+
+#endif // _SERVER_CONFIG_H_
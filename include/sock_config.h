@@ -12,7 +12,14 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/un.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+
+#include "support.h"
 
 #define CLIENT_SIDE 0
 #define SERVER_SIDE 1
@@ -20,9 +27,25 @@
 #define MESSAGE_BUF_SIZE 1000
 #define MAX_SERVER_MESSAGE_SIZE 256 
 
-#define MAX_NUM_OF_SOCKS 3
+#define MAX_NUM_OF_SOCKS 64
 #define MAX_NUM_OF_CLIENTS 10
 
+/* Sends smaller than this are copied, pinning pages and reading the completion costs more than a copy */
+#define ZEROCOPY_MIN_SEND_SIZE (16 * 1024)
+/* Number of zero-copy sends that may be in flight per socket before falling back to copying */
+#define ZEROCOPY_MAX_IN_FLIGHT 64
+/* Peers tracked per rate limited server socket, power of 2. A new peer replaces the least recently
+ * seen idle peer within SOCK_LIMIT_MAX_PROBE slots of its hash, or is refused if there is none. */
+#define SOCK_LIMIT_TABLE_SIZE 1024
+#define SOCK_LIMIT_MAX_PROBE 16
+/* Stream receives aren't framed, a stream peer is charged one message per this many bytes */
+#define SOCK_LIMIT_MESSAGE_SIZE MAX_SERVER_MESSAGE_SIZE
+
+/* Sequence returned for sends that were copied, the buffer can be reused immediately */
+#define ZEROCOPY_SEQ_COPIED UINT32_MAX
+/* Longest await_network_send() waits for the kernel to release a zero-copy buffer */
+#define ZEROCOPY_WAIT_MS 1000
+
 #define INET4_ADDRSIZE INET_ADDRSTRLEN * 4
 #define INET6_ADDRSIZE INET6_ADDRSTRLEN * 4
 
@@ -35,6 +58,7 @@ typedef struct sockaddr_un sockaddr_un_t;
 typedef struct sockaddr_in sockaddr_in_t;
 typedef struct sockaddr_in6 sockaddr_in6_t;
 typedef struct sockaddr sockaddr_t;
+typedef struct sockaddr_storage sockaddr_storage_t;
 typedef int sock_id_t;
 
 typedef enum {
@@ -48,6 +72,7 @@ typedef enum {
     E_LOCAL_SOCK = 0,
     E_TCP_SOCK,
     E_UDP_SOCK,
+    E_RUDP_SOCK,
 } E_APP_SOCK_TYPE;
 
 typedef enum {
@@ -55,6 +80,49 @@ typedef enum {
     E_IPV6_SOCK,
 } E_DOMAIN_TYPE;
 
+typedef enum {
+    E_SOCK_PROFILE_DEFAULT = 0,
+    E_SOCK_PROFILE_LATENCY,
+    E_SOCK_PROFILE_THROUGHPUT,
+} E_SOCK_PROFILE;
+
+/* Socket Options
+ *
+ * Tuning applied to a socket when it is initialized, and to every connection accepted on it. A buffer
+ * size of 0 keeps the kernel default, a busy_poll_us of 0 disables busy polling, and an incoming_cpu of
+ * -1 lets the kernel steer incoming packets. TCP only options are ignored on UDP and LOCAL sockets.
+ *
+ * The limits only apply to server sockets, 0 disables each of them. rate is in messages per second
+ * per peer, with bursts of up to burst messages (rate if 0), a datagram is a message and a stream
+ * is charged one per SOCK_LIMIT_MESSAGE_SIZE bytes. max_conns caps the connections open on the
+ * socket, max_conns_per_peer those from one address.
+ */
+typedef struct {
+    int rcvbuf;
+    int sndbuf;
+    bool nodelay;
+    bool cork;
+    bool quickack;
+    int busy_poll_us;
+    int incoming_cpu;
+    bool zerocopy;
+
+    uint32_t rate;
+    uint32_t burst;
+    int max_conns;
+    int max_conns_per_peer;
+} sock_opts_t;
+
+typedef struct {
+    uint32_t admitted;
+    uint32_t rate_limited;
+    uint32_t conns_refused;
+    uint32_t peers_evicted;
+    uint32_t peers_refused;
+    uint32_t conns;
+    uint32_t peers;
+} sock_limit_stats_t;
+
 typedef struct {
     bool is_server;
     bool is_connected;
@@ -78,8 +146,17 @@ typedef struct {
     sockaddr_t *conn_addr;
     int conn_num_bytes;
     void *conn_buff;
+    size_t conn_buff_len;
 
     int listen_opt;
+
+    sock_opts_t opts;
+
+    uint32_t zc_base;
+    uint32_t zc_next_seq;
+    uint32_t zc_done_seq;
+    uint64_t zc_done_mask;
+    int zc_copied;
     
 } sock_config_t;
 
@@ -94,12 +171,96 @@ typedef struct {
  */
 extern sock_id_t initialize_sock( E_APP_SOCK_TYPE type, const char *addr, int port, bool is_server );
 
+/* Initialize Socket with Options
+ *
+ * Same as initialize_sock(), but applies opts to the socket. initialize_sock() uses the default profile.
+ * The options are stored with the socket, so they survive a reconnect. opts may be NULL.
+ */
+extern sock_id_t initialize_sock_opts( E_APP_SOCK_TYPE type, const char *addr, int port, bool is_server,
+    const sock_opts_t *opts );
+
+/* Set Socket Options
+ *
+ * Re-tunes an open socket. Established connections keep their buffers, new connections use opts.
+ */
+extern int set_sock_opts( sock_id_t id, const sock_opts_t *opts );
+
+/* Get Socket Poll FD
+ *
+ * fd to poll()/epoll() for readability before calling a receive API on id, so it won't block.
+ */
+extern int get_sock_poll_fd( sock_id_t id );
+
+/* Socket Accessors
+ *
+ * The socket fd, the E_APP_SOCK_TYPE of id, the address it was initialized with, and tuning of
+ * connections accepted by the caller. Used by the event loop, which accepts and receives on the fd
+ * directly.
+ */
+extern int get_sock_fd( sock_id_t id );
+extern int get_sock_app_type( sock_id_t id );
+extern int get_sock_addr( sock_id_t id, sockaddr_storage_t *addr, socklen_t *len );
+extern int apply_sock_conn_opts( sock_id_t id, int fd );
+
+/* Connection options after I/O
+ *
+ * For connections that are received and sent on outside of the await_* APIs. rearm_sock_quickack()
+ * is called after every receive, uncork_sock_conn() after every complete reply, both do nothing
+ * unless the listener id has the option set.
+ */
+extern int rearm_sock_quickack( sock_id_t id, int fd );
+extern int uncork_sock_conn( sock_id_t id, int fd );
+
+/* Socket Profiles
+ *
+ * Fills opts with a named profile. LATENCY disables Nagle, enables quick acks and busy polling. THROUGHPUT 
+ * uses large kernel buffers and enables zero-copy. The result can be modified before use.
+ */
+extern void get_sock_profile( E_SOCK_PROFILE profile, sock_opts_t *opts );
+
+/* Admission Control
+ *
+ * Enforces the limits of a server socket for receive paths that accept and receive on the fd
+ * directly, such as the event loop. Peers are keyed by address, TCP and UDP clients behind one
+ * address share a bucket, LOCAL clients have no address and get one per connection, keyed by fd.
+ * Lookups are a hash of the key with a short linear probe.
+ *
+ * admit_sock_conn() is called for every accepted connection, false means it must be closed, and
+ * release_sock_conn() once an admitted connection is closed. admit_sock_message() takes a token from
+ * the peer's bucket, it returns 0 if the message is admitted, otherwise the time in ms until the peer
+ * has a token again. Sockets without limits admit everything without a lookup.
+ *
+ * A stream connection is read while admit_sock_stream() finds a token, without taking it, and
+ * charge_sock_stream() then takes what the len bytes read cost. A receive may cost more than is
+ * left, the peer then waits until the bucket has refilled past the debt.
+ */
+extern bool admit_sock_conn( sock_id_t id, const sockaddr_storage_t *peer, int fd );
+extern void release_sock_conn( sock_id_t id, const sockaddr_storage_t *peer, int fd );
+extern msec_t admit_sock_message( sock_id_t id, const sockaddr_storage_t *peer, int fd );
+extern msec_t admit_sock_stream( sock_id_t id, const sockaddr_storage_t *peer, int fd );
+extern void charge_sock_stream( sock_id_t id, const sockaddr_storage_t *peer, int fd, size_t len );
+extern int get_sock_limit_stats( sock_id_t id, sock_limit_stats_t *stats );
+
 /* Close Socket
  * 
  * Closes open connection and frees resources referenced by id.
  */
 extern int close_sock( sock_id_t id );
 
+/* Release Socket
+ *
+ * Closes id without unlinking the path of a LOCAL server, for sockets that are shared with another
+ * process.
+ */
+extern int release_sock( sock_id_t id );
+
+/* Adopt Socket
+ *
+ * Wraps an already bound server socket fd, e.g. inherited across exec(), so the APIs can be used with
+ * it. addr and port are only recorded, the socket is not re-bound.
+ */
+extern sock_id_t adopt_sock( E_APP_SOCK_TYPE type, int fd, const char *addr, int port, const sock_opts_t *opts );
+
 /* Local APIs
  *
  * There are no network features enabled on a LOCAL socket.
@@ -107,6 +268,22 @@ extern int close_sock( sock_id_t id );
 extern int await_local_receive( sock_id_t id, void *buffer, size_t len );
 extern int await_local_send( sock_id_t *id, const void *buffer, size_t len );
 
+/* Connect Socket
+ *
+ * Connects a LOCAL or TCP client socket, if it isn't already, for callers that use the fd directly.
+ * Like the send APIs a failed connect re-initializes the socket and updates id. Returns SOCK_OK if
+ * the socket is connected.
+ */
+extern int connect_sock( sock_id_t *id );
+
+/* Reset Socket
+ *
+ * Closes id and initializes a new socket with the same type, address, port, and options, e.g. after
+ * the peer closed a connection. id is updated. Returns SOCK_OK, or SOCK_NOT_OK if the new socket
+ * couldn't be created.
+ */
+extern int reset_sock( sock_id_t *id );
+
 /* TCP and UDP APIs
  * 
  * Supports both IP4 and IP6, whether IP4 or IP6 is used dependens on the type passed during 
@@ -117,5 +294,23 @@ extern int await_local_send( sock_id_t *id, const void *buffer, size_t len );
 extern int await_network_receive( sock_id_t id, void *buffer, size_t len );
 extern int await_network_send( sock_id_t *id, const void *buffer, size_t len );
 
+/* Zero-copy send APIs
+ *
+ * Sends with MSG_ZEROCOPY when the socket was initialized with opts.zerocopy and len is at least 
+ * ZEROCOPY_MIN_SEND_SIZE, otherwise the buffer is copied as with await_network_send(). On success seq
+ * identifies the send, the buffer must not be modified or freed until is_zerocopy_complete() returns
+ * true for seq. Copied sends return ZEROCOPY_SEQ_COPIED, which is always complete. Completions are 
+ * read from the socket error queue by poll_zerocopy_completions(), which returns the number of sends 
+ * completed or SOCK_NOT_OK. Only TCP sockets support zero-copy. await_network_send() uses the same
+ * path and waits for the completion, at most ZEROCOPY_WAIT_MS, so its buffer is free on return.
+ *
+ * A socket that's reconnected loses the completions of sends still in flight. They are read one last
+ * time before the socket is closed, the rest are logged and reported complete on the new socket: the
+ * buffers can be reused, but the data may not have been delivered.
+ */
+extern int await_network_send_zc( sock_id_t *id, const void *buffer, size_t len, uint32_t *seq );
+extern int poll_zerocopy_completions( sock_id_t id );
+extern bool is_zerocopy_complete( sock_id_t id, uint32_t seq );
+
 
 #endif // __SOCK_CONFIG_H_
\ No newline at end of file
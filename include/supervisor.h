@@ -0,0 +1,87 @@
+#ifndef _SUPERVISOR_H_
+#define _SUPERVISOR_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "event_loop.h"
+#include "support.h"
+
+#define SUPERVISOR_MAX_CHILDREN 32
+#define SUPERVISOR_NAME_SIZE 32
+
+/* Restart delay after the first quick exit, doubled on every quick exit after it */
+#define SUPERVISOR_DEFAULT_MIN_BACKOFF_MS 100
+#define SUPERVISOR_DEFAULT_MAX_BACKOFF_MS 10000
+
+/* A child that ran this long is restarted without delay, and its backoff starts over */
+#define SUPERVISOR_STABLE_MS 10000
+
+typedef enum {
+    SUPERVISOR_NOT_OK = -1,
+    SUPERVISOR_OK,
+} E_SUPERVISOR_STATUS;
+
+typedef enum {
+    SUPERVISOR_RESTART_NEVER = 0,
+    SUPERVISOR_RESTART_ON_FAILURE,
+    SUPERVISOR_RESTART_ALWAYS,
+} E_SUPERVISOR_RESTART;
+
+/* Restart policy
+ *
+ * On failure restarts children that exit with a non-zero status or are killed by a signal.
+ * death_signal is sent to the child when the supervising process dies, 0 for SIGTERM.
+ */
+typedef struct {
+    E_SUPERVISOR_RESTART restart;
+    msec_t min_backoff_ms;
+    msec_t max_backoff_ms;
+    int death_signal;
+} supervisor_policy_t;
+
+/* Stats of a child
+ *
+ * pid is 0 while the child isn't running. status is the wait status of the last exit. CPU time
+ * and max_rss_kb cover every exit so far, a running child's usage is added once it exits.
+ */
+typedef struct {
+    pid_t pid;
+    uint32_t restarts;
+    int status;
+    msec_t started_ms;
+    uint64_t user_us;
+    uint64_t system_us;
+    long max_rss_kb;
+} supervisor_stats_t;
+
+typedef void (*child_main_t)( void *arg );
+
+/* Supervisor
+ *
+ * Forks children and restarts them by policy. Each child's exit is seen the moment it happens,
+ * through a pidfd watched by the event loop, or on kernels without pidfd through SIGCHLD read from
+ * a signalfd. Restarts that are delayed by backoff are done by supervisor_tick(). Children get
+ * PR_SET_PDEATHSIG, so they're terminated when the supervising process dies.
+ *
+ * supervisor_init() needs the event loop. It blocks SIGCHLD, threads started before it must block
+ * it too. supervisor_spawn() forks a child running entry(arg), which exits when entry returns, and
+ * returns its id, policy NULL uses the defaults. supervisor_stop() terminates the child and waits
+ * for it, it's never restarted.
+ */
+extern int supervisor_init( void );
+extern int supervisor_spawn( const char *name, const supervisor_policy_t *policy, child_main_t entry, void *arg );
+extern int supervisor_stop( int id );
+extern void supervisor_tick( void );
+extern int get_supervisor_stats( int id, supervisor_stats_t *stats );
+
+#endif // _SUPERVISOR_H_
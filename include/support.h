@@ -37,6 +37,25 @@ extern msec_t get_elasped_time( void );
 extern bool start_timer( void );
 extern msec_t stop_timer( void );
 
+/***************************************************************************//**
+ * Monotonic time in milliseconds
+ *
+ * Unlike the scheduler, which measures process CPU time with clock(), this keeps
+ * advancing while the process is blocked, e.g. waiting in the event loop.
+ *
+ * @return Milliseconds since an arbitrary fixed point.
+ ******************************************************************************/
+extern msec_t get_monotonic_ms( void );
+
+/***************************************************************************//**
+ * Monotonic time in microseconds
+ *
+ * Same clock as get_monotonic_ms(), for measuring work shorter than a millisecond.
+ *
+ * @return Microseconds since an arbitrary fixed point.
+ ******************************************************************************/
+extern usec_t get_monotonic_us( void );
+
 /***************************************************************************//**
  * Delay in milliseconds 
  *
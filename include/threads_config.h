@@ -8,16 +8,27 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "crc32c.h"
 
 #define READ_END_OF_PIPE 0
 #define WRITE_END_OF_PIPE 1
 
-#define MAX_NUM_OF_PIPES 5
+#define MAX_NUM_OF_PIPES 10
+#define MAX_NUM_OF_QUEUES 10
+
+/* Largest message a queue can be created for */
+#define MAX_QUEUE_MSG_SIZE 65536
 
 typedef int pipe_id_t;
+typedef int queue_id_t;
 
 typedef enum {
-    THREAD_NOT_OK = -1,
+    THREAD_CORRUPT_RECORD = -2,
+    THREAD_NOT_OK,
     THREAD_OK,
     THRED_BROKEN_LINKED_LIST
 } E_THREAD_STATUS;
@@ -26,13 +37,74 @@ typedef struct  {
     int pipfd[2];
     void *nxt;
     pipe_id_t id;
+    bool checksum;
 } node_t;
 
+/* Record flags */
+#define PIPE_RECORD_CRC 0x0001
+
+/* Record
+ *
+ * Header of a record written by write_pipe_record(), in host byte order since both ends are on the
+ * same machine. With PIPE_RECORD_CRC set, crc is the CRC32C of the header, with crc zeroed, and the
+ * payload.
+ */
+typedef struct {
+    uint16_t len;
+    uint16_t flags;
+    uint32_t crc;
+} pipe_record_hdr_t;
+
+/* A whole record fits one atomic write */
+#define MAX_PIPE_RECORD_SIZE (PIPE_BUF - sizeof(pipe_record_hdr_t))
+
 extern pipe_id_t create_pipe( void );
 extern int free_pipe ( pipe_id_t id );
 extern int write_pipe( pipe_id_t id, void *buffer, size_t len );
 extern int read_pipe ( pipe_id_t id, void *buffer, size_t len );
+
+/* Pipe records
+ *
+ * Messages with their length, written whole in a single write of at most PIPE_BUF bytes, so records
+ * of several writers never interleave and a reader never sees half of one.
+ *
+ * set_pipe_checksum() makes write_pipe_record() add a CRC32C to every record of the pipe. Call it
+ * before fork() so every process writes the same way. read_pipe_record() checks any record that
+ * carries a CRC, whatever the setting of the reader.
+ *
+ * write_pipe_record() returns len, 0 if the pipe is full, or THREAD_NOT_OK. read_pipe_record()
+ * returns the number of bytes copied to buffer, truncated to len, 0 if no record is waiting,
+ * THREAD_CORRUPT_RECORD if the record failed its check, or THREAD_NOT_OK.
+ *
+ * get_pipe_read_fd() returns the read end, for a reader that waits in poll() until a record comes
+ * in. Records are still read with read_pipe_record().
+ */
+extern int set_pipe_checksum ( pipe_id_t id, bool enable );
+extern int get_pipe_read_fd ( pipe_id_t id );
+extern int write_pipe_record ( pipe_id_t id, const void *buffer, size_t len );
+extern int read_pipe_record ( pipe_id_t id, void *buffer, size_t len );
 extern int lock_pipes ( void );
 extern int unlock_pipes ( void );
 
-#endif // _FORK_CFG_H_
\ No newline at end of file
+/* Queues
+ *
+ * Bounded multi-producer/multi-consumer queue for handing messages between threads of the same
+ * process, without a system call. Every slot holds up to msg_size bytes and a sequence number that
+ * tells producers and consumers whose turn it is, so a send or receive is one compare-and-swap on
+ * the tail or head and a copy. Slots and the two ends sit on their own cache lines.
+ *
+ * create_queue() rounds capacity up to a power of 2. Create and free a queue while no other thread
+ * uses it. The queue isn't shared with a fork()ed child, use a pipe for that.
+ *
+ * Messages are never empty, so 0 always means there was none. send_queue() returns len, 0 if the
+ * queue is full, or THREAD_NOT_OK. recv_queue() returns the number of bytes copied to buffer,
+ * truncated to len, or 0 if no message came in timeout_ms, -1 waits for ever and 0 doesn't wait.
+ * A receiver only sleeps, on a futex, while the queue is empty, and senders only wake it when a
+ * receiver sleeps.
+ */
+extern queue_id_t create_queue ( size_t capacity, size_t msg_size );
+extern int free_queue ( queue_id_t id );
+extern int send_queue ( queue_id_t id, const void *buffer, size_t len );
+extern int recv_queue ( queue_id_t id, void *buffer, size_t len, int timeout_ms );
+
+#endif // _FORK_CFG_H_
@@ -0,0 +1,88 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "codec.h"
+#include "support.h"
+
+/* Sampled traces kept for the Chrome trace, the oldest are overwritten */
+#define TRACE_MAX_SAMPLES 1024
+
+/* Latency histograms, bin n counts latencies below 2^n us, the last one the rest */
+#define TRACE_HISTOGRAM_BINS 32
+
+#define TRACE_DEFAULT_SAMPLE 100
+
+/* Record flags */
+#define TRACE_FLAG_ACTIVE 0x0001
+#define TRACE_FLAG_SAMPLED 0x0002
+
+typedef enum {
+    TRACE_NOT_OK = -1,
+    TRACE_OK,
+} E_TRACE_STATUS;
+
+/* Where a message was, in order, each stamped with get_monotonic_us() */
+typedef enum {
+    E_TRACE_QUEUED = 0,
+    E_TRACE_SENT,
+    E_TRACE_RECEIVED,
+    E_TRACE_HANDLED,
+    E_TRACE_IPC_READ,
+    E_TRACE_NUM_POINTS,
+} E_TRACE_POINT;
+
+/* Stage n is the time from point n to point n + 1, e.g. the client's scheduler is queued to sent */
+typedef enum {
+    E_TRACE_STAGE_CLIENT = 0,
+    E_TRACE_STAGE_NETWORK,
+    E_TRACE_STAGE_HANDLER,
+    E_TRACE_STAGE_PIPE,
+    E_TRACE_NUM_STAGES,
+} E_TRACE_STAGE;
+
+/* Trace of a message, written whole to a pipe record */
+typedef struct {
+    uint64_t id;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t stamps[E_TRACE_NUM_POINTS];
+} trace_record_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t max_us;
+    uint64_t bins[TRACE_HISTOGRAM_BINS];
+} trace_histogram_t;
+
+/* Message Tracing
+ *
+ * A client traces a message by sending a TRACE in front of it, in the same payload, with an id and
+ * the times it queued and sent it. The server stamps when it received the message and when its
+ * handler completed, then writes the trace to a worker's pipe, the worker stamps when it read it.
+ * The pipe stage includes the write, it can't be stamped in a record that's already written. Every
+ * process reads the same CLOCK_MONOTONIC, so stamps only compare on the same machine.
+ *
+ * trace_init() enables tracing in the receiving process, one of every sample traces is sampled.
+ * trace_begin() returns the length of the trace context at the start of buffer, 0 if there's none,
+ * which is skipped either way, and starts record, active only while tracing is enabled.
+ *
+ * trace_add() adds a complete record to the histograms of every stage and keeps it if it's sampled.
+ * trace_report() prints every stage's histogram since the previous report, quiet while nothing was
+ * traced. trace_dump() writes the sampled traces to path as Chrome trace JSON, one row per trace and
+ * one slice per stage, for chrome://tracing or Perfetto, and leaves it alone until there are new ones.
+ */
+extern int trace_init( bool enable, int sample );
+extern int trace_begin( const void *buffer, size_t len, trace_record_t *record );
+extern void trace_stamp( trace_record_t *record, E_TRACE_POINT point );
+extern int trace_add( const trace_record_t *record );
+extern void trace_report( void );
+extern int trace_dump( const char *path );
+extern int get_trace_histogram( E_TRACE_STAGE stage, trace_histogram_t *histogram );
+
+#endif // _TRACE_H_
@@ -0,0 +1,270 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "affinity.h"
+
+#define AFFINITY_PATH_SIZE 256
+#define AFFINITY_LIST_SIZE 4096
+
+/* CPUs the process started with, restored by unpinning */
+static cpu_set_t initial_cpus;
+static bool have_initial_cpus;
+
+/* Static Functions */
+static int _parse_cpulist( const char *str, cpu_set_t *set );
+static int _read_cpulist( const char *path, cpu_set_t *set );
+static int _core_of_cpu( int cpu );
+static int _num_nodes( void );
+static void _set_preferred_node( int node );
+
+int affinity_plan( const affinity_config_t *cfg, affinity_slot_t *slots, int count ) {
+    cpu_set_t allowed;
+    cpu_set_t online;
+    cpu_set_t used_cores;
+    int order[AFFINITY_MAX_CPUS];
+    int num_order = 0;
+    int first = -1;
+    int home;
+
+    if ((cfg == NULL) || (slots == NULL) || (count <= 0)) { return AFFINITY_NOT_OK; }
+
+    for (int i=0; i<count; i++) {
+        slots[i].cpu = -1;
+        slots[i].node = -1;
+    }
+
+    if (cfg->mode == E_AFFINITY_NONE) { return AFFINITY_OK; }
+
+    if (cfg->mode == E_AFFINITY_LIST) {
+        if (cfg->num_cpus <= 0) { return AFFINITY_NOT_OK; }
+
+        for (int i=0; i<count; i++) {
+            slots[i].cpu = cfg->cpus[i % cfg->num_cpus];
+            slots[i].node = affinity_node_of_cpu(slots[i].cpu);
+        }
+
+        return AFFINITY_OK;
+    }
+
+    /* Auto, CPUs that are online and in the process's mask, e.g. of taskset or a cgroup */
+    if (have_initial_cpus) {
+        allowed = initial_cpus;
+    } else if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        return AFFINITY_NOT_OK;
+    }
+
+    if (_read_cpulist(AFFINITY_SYSFS_ROOT "/cpu/online", &online) == AFFINITY_OK) {
+        CPU_AND(&allowed, &allowed, &online);
+    }
+
+    for (int cpu=0; cpu<AFFINITY_MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) { first = cpu; break; }
+    }
+
+    if (first < 0) { return AFFINITY_NOT_OK; }
+
+    home = affinity_node_of_cpu(first);
+    CPU_ZERO(&used_cores);
+
+    /* One CPU per physical core, the home node first, then the rest of the nodes in order */
+    for (int pass=0; pass<2; pass++) {
+        for (int n=-1; n<AFFINITY_MAX_NODES; n++) {
+            int node = (n < 0) ? home : n;
+
+            if ((n >= 0) && (n == home)) { continue; }
+
+            for (int cpu=0; cpu<AFFINITY_MAX_CPUS; cpu++) {
+                int core;
+
+                if (!CPU_ISSET(cpu, &allowed) || (affinity_node_of_cpu(cpu) != node)) { continue; }
+
+                core = _core_of_cpu(cpu);
+
+                if (pass == 0) {
+                    if (CPU_ISSET(core, &used_cores)) { continue; }
+                    CPU_SET(core, &used_cores);
+                    order[num_order++] = cpu;
+                } else if (core != cpu) {
+                    /* Siblings, every core's first CPU was taken by the first pass */
+                    bool taken = false;
+
+                    for (int i=0; i<num_order; i++) {
+                        if (order[i] == cpu) { taken = true; break; }
+                    }
+
+                    if (!taken) { order[num_order++] = cpu; }
+                }
+            }
+
+            if (_num_nodes() <= 1) { break; }
+        }
+    }
+
+    for (int i=0; i<count; i++) {
+        slots[i].cpu = order[i % num_order];
+        slots[i].node = affinity_node_of_cpu(slots[i].cpu);
+    }
+
+    return AFFINITY_OK;
+}
+
+int affinity_pin( const affinity_slot_t *slot ) {
+    cpu_set_t set;
+
+    if (slot == NULL) { return AFFINITY_NOT_OK; }
+
+    if (!have_initial_cpus) {
+        if (sched_getaffinity(0, sizeof(initial_cpus), &initial_cpus) < 0) { return AFFINITY_NOT_OK; }
+        have_initial_cpus = true;
+    }
+
+    if (slot->cpu < 0) {
+        _set_preferred_node(-1);
+        return (sched_setaffinity(0, sizeof(initial_cpus), &initial_cpus) < 0) ? AFFINITY_NOT_OK : AFFINITY_OK;
+    }
+
+    if (slot->cpu >= AFFINITY_MAX_CPUS) { return AFFINITY_NOT_OK; }
+
+    CPU_ZERO(&set);
+    CPU_SET(slot->cpu, &set);
+
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        printf("Failed to pin to CPU %d: %s\n", slot->cpu, strerror(errno));
+        return AFFINITY_NOT_OK;
+    }
+
+    _set_preferred_node(slot->node);
+
+    return AFFINITY_OK;
+}
+
+/* Each node lists its CPUs, cached since the topology doesn't change while running */
+int affinity_node_of_cpu( int cpu ) {
+    static int8_t nodes[AFFINITY_MAX_CPUS];
+    static bool loaded;
+    char path[AFFINITY_PATH_SIZE];
+    cpu_set_t set;
+
+    if ((cpu < 0) || (cpu >= AFFINITY_MAX_CPUS)) { return 0; }
+
+    if (!loaded) {
+        memset(nodes, 0, sizeof(nodes));
+
+        for (int node=0; node<AFFINITY_MAX_NODES; node++) {
+            snprintf(path, sizeof(path), AFFINITY_SYSFS_ROOT "/node/node%d/cpulist", node);
+
+            if (_read_cpulist(path, &set) < 0) { continue; }
+
+            for (int i=0; i<AFFINITY_MAX_CPUS; i++) {
+                if (CPU_ISSET(i, &set)) { nodes[i] = (int8_t)node; }
+            }
+        }
+
+        loaded = true;
+    }
+
+    return nodes[cpu];
+}
+
+/* Parses a sysfs style list, "0-3,8,10-11" */
+static int _parse_cpulist( const char *str, cpu_set_t *set ) {
+    const char *p = str;
+    char *end;
+    long first;
+    long last;
+
+    if ((str == NULL) || (set == NULL)) { return AFFINITY_NOT_OK; }
+
+    CPU_ZERO(set);
+
+    while ((*p != '\0') && (*p != '\n')) {
+        first = strtol(p, &end, 10);
+        if (end == p) { return AFFINITY_NOT_OK; }
+        last = first;
+        p = end;
+
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p) { return AFFINITY_NOT_OK; }
+            p = end;
+        }
+
+        if ((first < 0) || (last < first) || (last >= AFFINITY_MAX_CPUS)) { return AFFINITY_NOT_OK; }
+
+        for (long cpu=first; cpu<=last; cpu++) {
+            CPU_SET((int)cpu, set);
+        }
+
+        if (*p == ',') { p++; }
+    }
+
+    return AFFINITY_OK;
+}
+
+static int _read_cpulist( const char *path, cpu_set_t *set ) {
+    char list[AFFINITY_LIST_SIZE];
+    FILE *fp;
+    int rc;
+
+    if ((fp = fopen(path, "r")) == NULL) { return AFFINITY_NOT_OK; }
+
+    rc = (fgets(list, sizeof(list), fp) != NULL) ? _parse_cpulist(list, set) : AFFINITY_NOT_OK;
+
+    fclose(fp);
+
+    return rc;
+}
+
+/* A core is named by its first hyperthread */
+static int _core_of_cpu( int cpu ) {
+    char path[AFFINITY_PATH_SIZE];
+    cpu_set_t siblings;
+
+    snprintf(path, sizeof(path), AFFINITY_SYSFS_ROOT "/cpu/cpu%d/topology/thread_siblings_list", cpu);
+
+    if (_read_cpulist(path, &siblings) < 0) { return cpu; }
+
+    for (int i=0; i<AFFINITY_MAX_CPUS; i++) {
+        if (CPU_ISSET(i, &siblings)) { return i; }
+    }
+
+    return cpu;
+}
+
+static int _num_nodes( void ) {
+    static int num_nodes;
+    cpu_set_t online;
+
+    if (num_nodes == 0) {
+        num_nodes = 1;
+
+        if (_read_cpulist(AFFINITY_SYSFS_ROOT "/node/online", &online) == AFFINITY_OK) {
+            num_nodes = CPU_COUNT(&online);
+        }
+    }
+
+    return num_nodes;
+}
+
+/* Preferred rather than bound, a full node falls back to the others instead of failing allocations */
+static void _set_preferred_node( int node ) {
+    unsigned long mask = 0;
+
+    if (_num_nodes() <= 1) { return; }
+
+    if ((node < 0) || (node >= (int)(sizeof(mask) * 8))) {
+        (void)syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+        return;
+    }
+
+    mask = 1UL << node;
+
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) < 0) {
+        printf("Failed to prefer NUMA node %d: %s\n", node, strerror(errno));
+    }
+}
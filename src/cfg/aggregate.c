@@ -0,0 +1,373 @@
+#include "aggregate.h"
+#include "crc32c.h"
+
+/* Twice the series, probes stay short */
+#define AGGREGATE_TABLE_SIZE (2 * AGGREGATE_MAX_SERIES)
+
+typedef struct {
+    bool used;
+    uint32_t hash;
+    char source[AGGREGATE_NAME_SIZE];
+    char metric[AGGREGATE_NAME_SIZE];
+} series_key_t;
+
+static aggregate_config_t config;
+static int num_buckets;
+
+/* Slide that's open, in slides since the monotonic clock started */
+static msec_t open_slide;
+static int open_bucket;
+
+/* Columns, cell (bucket * AGGREGATE_MAX_SERIES) + series, sketch bins follow each other per cell */
+static uint32_t *counts;
+static int64_t *sums;
+static int64_t *mins;
+static int64_t *maxs;
+static uint32_t *sketches;
+
+/* Series by hash of their key, -1 is empty */
+static series_key_t keys[AGGREGATE_MAX_SERIES];
+static int16_t table[AGGREGATE_TABLE_SIZE];
+
+/* Window of every series, filled while a window closes */
+static uint64_t window_counts[AGGREGATE_MAX_SERIES];
+static int64_t window_sums[AGGREGATE_MAX_SERIES];
+static int64_t window_mins[AGGREGATE_MAX_SERIES];
+static int64_t window_maxs[AGGREGATE_MAX_SERIES];
+
+static aggregate_stats_t stats;
+
+/* Static Functions */
+static int _find_series( const void *source, size_t source_len, const void *metric, size_t metric_len );
+static void _index_series( int series );
+static void _close_window( msec_t end_ms, rollup_handler_t handler, void *ctx );
+static void _clear_bucket( int bucket );
+static int _bin( int64_t value );
+static int64_t _bin_value( int bin );
+static int _magnitude_bin( uint64_t magnitude );
+static int64_t _magnitude_value( int bin );
+static int64_t _quantile( const uint32_t *sketch, uint64_t count, int permille, int64_t min, int64_t max );
+
+int aggregate_init( const aggregate_config_t *cfg ) {
+    size_t cells;
+    msec_t slide_ms;
+
+    if ((cfg == NULL) || (cfg->window_ms <= 0)) { return AGGREGATE_NOT_OK; }
+
+    slide_ms = (cfg->type == E_WINDOW_TUMBLING) ? cfg->window_ms : cfg->slide_ms;
+
+    if ((slide_ms <= 0) || ((cfg->window_ms % slide_ms) != 0) ||
+            ((cfg->window_ms / slide_ms) > AGGREGATE_MAX_BUCKETS)) {
+        return AGGREGATE_NOT_OK;
+    }
+
+    free(counts);
+    free(sums);
+    free(mins);
+    free(maxs);
+    free(sketches);
+
+    config = *cfg;
+    config.slide_ms = slide_ms;
+    num_buckets = (int)(cfg->window_ms / slide_ms);
+    cells = (size_t)num_buckets * AGGREGATE_MAX_SERIES;
+
+    counts = calloc(cells, sizeof(uint32_t));
+    sums = calloc(cells, sizeof(int64_t));
+    mins = calloc(cells, sizeof(int64_t));
+    maxs = calloc(cells, sizeof(int64_t));
+    sketches = calloc(cells * AGGREGATE_SKETCH_BINS, sizeof(uint32_t));
+
+    if ((counts == NULL) || (sums == NULL) || (mins == NULL) || (maxs == NULL) || (sketches == NULL)) {
+        free(counts);
+        free(sums);
+        free(mins);
+        free(maxs);
+        free(sketches);
+        counts = NULL;
+        sums = NULL;
+        mins = NULL;
+        maxs = NULL;
+        sketches = NULL;
+        return AGGREGATE_NOT_OK;
+    }
+
+    memset(keys, 0, sizeof(keys));
+    memset(table, 0xff, sizeof(table));
+    memset(&stats, 0, sizeof(stats));
+
+    open_slide = get_monotonic_ms() / slide_ms;
+    open_bucket = (int)(open_slide % num_buckets);
+
+    return AGGREGATE_OK;
+}
+
+int aggregate_add( const void *source, size_t source_len, const void *metric, size_t metric_len, int64_t value ) {
+    size_t cell;
+    int series;
+
+    if ((counts == NULL) || (source == NULL) || (metric == NULL)) { return AGGREGATE_NOT_OK; }
+
+    if ((series = _find_series(source, source_len, metric, metric_len)) < 0) {
+        stats.dropped++;
+        return AGGREGATE_NOT_OK;
+    }
+
+    cell = ((size_t)open_bucket * AGGREGATE_MAX_SERIES) + (size_t)series;
+
+    /* A cleared bucket only has its count and sketch zeroed */
+    if (counts[cell] == 0) {
+        sums[cell] = 0;
+        mins[cell] = value;
+        maxs[cell] = value;
+    } else {
+        if (value < mins[cell]) { mins[cell] = value; }
+        if (value > maxs[cell]) { maxs[cell] = value; }
+    }
+
+    counts[cell]++;
+    sums[cell] += value;
+    sketches[(cell * AGGREGATE_SKETCH_BINS) + (size_t)_bin(value)]++;
+
+    stats.samples++;
+
+    return AGGREGATE_OK;
+}
+
+/* Closes one window per slide that ended, windows after every bucket was cleared are empty */
+int aggregate_tick( msec_t now_ms, rollup_handler_t handler, void *ctx ) {
+    msec_t slide = now_ms / config.slide_ms;
+    int closed = 0;
+
+    if (counts == NULL) { return AGGREGATE_NOT_OK; }
+
+    while (open_slide < slide) {
+        _close_window((open_slide + 1) * config.slide_ms, handler, ctx);
+
+        open_slide++;
+        open_bucket = (int)(open_slide % num_buckets);
+        _clear_bucket(open_bucket);
+
+        if (++closed == num_buckets) {
+            open_slide = slide;
+            open_bucket = (int)(open_slide % num_buckets);
+        }
+    }
+
+    return AGGREGATE_OK;
+}
+
+int get_aggregate_stats( aggregate_stats_t *aggregate_stats ) {
+    if (aggregate_stats == NULL) { return AGGREGATE_NOT_OK; }
+
+    *aggregate_stats = stats;
+
+    return AGGREGATE_OK;
+}
+
+bool aggregate_same_config( const aggregate_config_t *a, const aggregate_config_t *b ) {
+    if ((a == NULL) || (b == NULL)) { return false; }
+    if ((a->type != b->type) || (a->window_ms != b->window_ms)) { return false; }
+
+    return (a->type == E_WINDOW_TUMBLING) || (a->slide_ms == b->slide_ms);
+}
+
+/* Finds the series of the key, adding it if there's room */
+static int _find_series( const void *source, size_t source_len, const void *metric, size_t metric_len ) {
+    uint32_t hash;
+    uint32_t idx;
+    int series;
+
+    if (source_len >= AGGREGATE_NAME_SIZE) { source_len = AGGREGATE_NAME_SIZE - 1; }
+    if (metric_len >= AGGREGATE_NAME_SIZE) { metric_len = AGGREGATE_NAME_SIZE - 1; }
+
+    hash = crc32c(crc32c(0, source, source_len), metric, metric_len);
+    idx = hash % AGGREGATE_TABLE_SIZE;
+
+    while ((series = table[idx]) >= 0) {
+        if ((keys[series].hash == hash) && (keys[series].source[source_len] == '\0') &&
+                (keys[series].metric[metric_len] == '\0') && (memcmp(keys[series].source, source, source_len) == 0) &&
+                (memcmp(keys[series].metric, metric, metric_len) == 0)) {
+            return series;
+        }
+
+        idx = (idx + 1) % AGGREGATE_TABLE_SIZE;
+    }
+
+    if (stats.series == AGGREGATE_MAX_SERIES) { return AGGREGATE_NOT_OK; }
+
+    for (series=0; keys[series].used; series++) {}
+
+    keys[series].used = true;
+    keys[series].hash = hash;
+    memcpy(keys[series].source, source, source_len);
+    keys[series].source[source_len] = '\0';
+    memcpy(keys[series].metric, metric, metric_len);
+    keys[series].metric[metric_len] = '\0';
+
+    table[idx] = (int16_t)series;
+    stats.series++;
+
+    return series;
+}
+
+static void _index_series( int series ) {
+    uint32_t idx = keys[series].hash % AGGREGATE_TABLE_SIZE;
+
+    while (table[idx] >= 0) { idx = (idx + 1) % AGGREGATE_TABLE_SIZE; }
+
+    table[idx] = (int16_t)series;
+}
+
+/* Merges the buckets of the window a column at a time, then the sketches of the series that had
+ * samples. Series that had none are forgotten and the table is rebuilt without them.
+ */
+static void _close_window( msec_t end_ms, rollup_handler_t handler, void *ctx ) {
+    uint32_t sketch[AGGREGATE_SKETCH_BINS];
+    bool forgotten = false;
+    rollup_t rollup;
+    size_t cell;
+
+    memset(window_counts, 0, sizeof(window_counts));
+    memset(window_sums, 0, sizeof(window_sums));
+
+    for (int b=0; b<num_buckets; b++) {
+        cell = (size_t)b * AGGREGATE_MAX_SERIES;
+
+        for (int s=0; s<AGGREGATE_MAX_SERIES; s++, cell++) {
+            if (counts[cell] == 0) { continue; }
+
+            if (window_counts[s] == 0) {
+                window_mins[s] = mins[cell];
+                window_maxs[s] = maxs[cell];
+            } else {
+                if (mins[cell] < window_mins[s]) { window_mins[s] = mins[cell]; }
+                if (maxs[cell] > window_maxs[s]) { window_maxs[s] = maxs[cell]; }
+            }
+
+            window_counts[s] += counts[cell];
+            window_sums[s] += sums[cell];
+        }
+    }
+
+    for (int s=0; s<AGGREGATE_MAX_SERIES; s++) {
+        if (!keys[s].used) { continue; }
+
+        if (window_counts[s] == 0) {
+            keys[s].used = false;
+            stats.series--;
+            forgotten = true;
+            continue;
+        }
+
+        memset(sketch, 0, sizeof(sketch));
+
+        for (int b=0; b<num_buckets; b++) {
+            cell = ((size_t)b * AGGREGATE_MAX_SERIES) + (size_t)s;
+
+            if (counts[cell] == 0) { continue; }
+
+            for (int i=0; i<AGGREGATE_SKETCH_BINS; i++) {
+                sketch[i] += sketches[(cell * AGGREGATE_SKETCH_BINS) + (size_t)i];
+            }
+        }
+
+        rollup.source = keys[s].source;
+        rollup.metric = keys[s].metric;
+        rollup.start_ms = end_ms - config.window_ms;
+        rollup.end_ms = end_ms;
+        rollup.count = window_counts[s];
+        rollup.sum = window_sums[s];
+        rollup.min = window_mins[s];
+        rollup.max = window_maxs[s];
+        rollup.p50 = _quantile(sketch, rollup.count, 500, rollup.min, rollup.max);
+        rollup.p90 = _quantile(sketch, rollup.count, 900, rollup.min, rollup.max);
+        rollup.p99 = _quantile(sketch, rollup.count, 990, rollup.min, rollup.max);
+
+        stats.rollups++;
+
+        if (handler != NULL) { handler(&rollup, ctx); }
+    }
+
+    if (forgotten) {
+        memset(table, 0xff, sizeof(table));
+
+        for (int s=0; s<AGGREGATE_MAX_SERIES; s++) {
+            if (keys[s].used) { _index_series(s); }
+        }
+    }
+}
+
+static void _clear_bucket( int bucket ) {
+    size_t cell = (size_t)bucket * AGGREGATE_MAX_SERIES;
+
+    memset(counts + cell, 0, AGGREGATE_MAX_SERIES * sizeof(uint32_t));
+    memset(sketches + (cell * AGGREGATE_SKETCH_BINS), 0, AGGREGATE_MAX_SERIES * AGGREGATE_SKETCH_BINS * sizeof(uint32_t));
+}
+
+/* Bins are in order of value, negative magnitudes mirrored below the non-negative ones */
+static int _bin( int64_t value ) {
+    if (value < 0) {
+        return AGGREGATE_SKETCH_MAGNITUDES - 1 - _magnitude_bin((uint64_t)0 - (uint64_t)value);
+    }
+
+    return AGGREGATE_SKETCH_MAGNITUDES + _magnitude_bin((uint64_t)value);
+}
+
+static int64_t _bin_value( int bin ) {
+    if (bin < AGGREGATE_SKETCH_MAGNITUDES) {
+        return -_magnitude_value(AGGREGATE_SKETCH_MAGNITUDES - 1 - bin);
+    }
+
+    return _magnitude_value(bin - AGGREGATE_SKETCH_MAGNITUDES);
+}
+
+/* Bin 0 holds 0, then 4 bins per power of two, by the 2 bits after the leading one */
+static int _magnitude_bin( uint64_t magnitude ) {
+    int exp;
+    int sub;
+    int bin;
+
+    if (magnitude == 0) { return 0; }
+
+    exp = 63 - __builtin_clzll(magnitude);
+    sub = (int)(((exp >= 2) ? (magnitude >> (exp - 2)) : (magnitude << (2 - exp))) & 3);
+    bin = 1 + (exp * 4) + sub;
+
+    return (bin < AGGREGATE_SKETCH_MAGNITUDES) ? bin : (AGGREGATE_SKETCH_MAGNITUDES - 1);
+}
+
+/* Middle of the magnitudes of the bin */
+static int64_t _magnitude_value( int bin ) {
+    int exp = (bin - 1) / 4;
+    int64_t low;
+    int64_t high;
+
+    if (bin == 0) { return 0; }
+
+    low = ((int64_t)(4 + ((bin - 1) % 4)) << exp) >> 2;
+    high = ((int64_t)(5 + ((bin - 1) % 4)) << exp) >> 2;
+
+    return low + ((high - low) / 2);
+}
+
+/* Value at the rank of permille, within the window's min and max, which are exact */
+static int64_t _quantile( const uint32_t *sketch, uint64_t count, int permille, int64_t min, int64_t max ) {
+    uint64_t rank = ((count * (uint64_t)permille) + 999) / 1000;
+    uint64_t seen = 0;
+    int64_t value = max;
+
+    for (int i=0; i<AGGREGATE_SKETCH_BINS; i++) {
+        seen += sketch[i];
+
+        if (seen >= rank) {
+            value = _bin_value(i);
+            break;
+        }
+    }
+
+    if (value < min) { value = min; }
+    if (value > max) { value = max; }
+
+    return value;
+}
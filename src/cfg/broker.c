@@ -0,0 +1,616 @@
+#define _GNU_SOURCE
+#include "broker.h"
+#include "logger.h"
+
+#define BROKER_ALIGN(x) (((x) + BROKER_RECORD_ALIGN - 1) & ~(size_t)(BROKER_RECORD_ALIGN - 1))
+
+/* Ring data starts on its own cache line */
+#define BROKER_DATA_OFFSET 64
+
+#define BROKER_NOTIFY_FRAME (sizeof(broker_hdr_t) + sizeof(broker_notify_t))
+
+typedef struct {
+    broker_notify_t notify;
+    int topic;
+} broker_pending_t;
+
+typedef struct {
+    ev_conn_t *conn;
+    uint64_t topics;
+    E_BROKER_POLICY policy;
+    bool ring_sent;
+
+    /* Messages missed since the last queued notification */
+    uint32_t dropped;
+
+    /* Frames split across receives */
+    uint32_t in_len;
+    char in_buf[BROKER_MAX_FRAME];
+
+    /* Notifications not yet sent, out_off bytes of the first one were sent */
+    uint32_t out_head;
+    uint32_t out_tail;
+    uint32_t out_off;
+    broker_pending_t out[BROKER_MAX_PENDING];
+} broker_client_t;
+
+typedef struct {
+    int mem_fd;
+    int ro_fd;
+    char *map;
+    size_t map_len;
+    broker_ring_hdr_t *hdr;
+    char *data;
+
+    /* Write position, and position of the oldest record still in the ring */
+    uint64_t head;
+    uint64_t tail;
+
+    /* Topics with subscribers, or pending notifications, a free one is empty */
+    char topics[BROKER_MAX_TOPICS][BROKER_TOPIC_SIZE + 1];
+
+    broker_client_t *clients[BROKER_MAX_CLIENTS];
+    broker_stats_t stats;
+} broker_t;
+
+static broker_t *brokers[MAX_NUM_OF_SOCKS];
+
+/* Static Functions */
+static broker_t *_get_broker( sock_id_t id );
+static broker_client_t *_get_client( broker_t *broker, ev_conn_t *conn );
+static int _find_topic( broker_t *broker, const char *topic, size_t topic_len, bool create );
+static int _reclaim_topics( broker_t *broker );
+static int _handle_frame( broker_t *broker, broker_client_t *client, const broker_hdr_t *hdr, const char *body );
+static int _send_ring( broker_t *broker, broker_client_t *client );
+static uint32_t _ring_write( broker_t *broker, const char *topic, size_t topic_len, const char *buffer, size_t len, uint64_t *seq );
+static void _ring_reclaim( broker_t *broker, size_t needed );
+static int _enqueue( broker_t *broker, broker_client_t *client, int topic, uint64_t seq, uint32_t offset );
+static int _flush( broker_t *broker, broker_client_t *client );
+
+/* Open broker
+ *
+ * The ring is a sealed memfd, so its size can't change under the subscribers' mappings. Subscribers
+ * are sent a read-only reopen of it, they can map it but not write to it.
+ */
+int broker_open( sock_id_t id ) {
+    char path[64];
+    broker_t *broker;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (brokers[id] != NULL) { return SOCK_OK; }
+    if (get_sock_app_type(id) != E_LOCAL_SOCK) { return SOCK_NOT_OK; }
+
+    if ((broker = calloc(1, sizeof(broker_t))) == NULL) { return SOCK_NOT_OK; }
+
+    broker->map_len = BROKER_DATA_OFFSET + BROKER_RING_SIZE;
+    broker->ro_fd = -1;
+
+    if ((broker->mem_fd = memfd_create("broker_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+        printf("Failed to create broker ring\n");
+        free(broker);
+        return SOCK_NOT_OK;
+    }
+
+    if ((ftruncate(broker->mem_fd, broker->map_len) < 0) ||
+        ((broker->map = mmap(NULL, broker->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, broker->mem_fd, 0)) == MAP_FAILED)) {
+        printf("Failed to map broker ring\n");
+        (void)close(broker->mem_fd);
+        free(broker);
+        return SOCK_NOT_OK;
+    }
+
+    (void)fcntl(broker->mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    /* Without /proc the writable fd is shared instead */
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", broker->mem_fd);
+    broker->ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    broker->hdr = (broker_ring_hdr_t *)broker->map;
+    broker->data = broker->map + BROKER_DATA_OFFSET;
+    broker->hdr->size = BROKER_RING_SIZE;
+    broker->hdr->data_offset = BROKER_DATA_OFFSET;
+
+    brokers[id] = broker;
+
+    return SOCK_OK;
+}
+
+/* Close broker
+ *
+ * Connections are left to the event loop, their state is freed here. Subscribers keep their mapping
+ * of the ring until they release it.
+ */
+void broker_close( sock_id_t id ) {
+    broker_t *broker;
+
+    if ((broker = _get_broker(id)) == NULL) { return; }
+
+    for (int i=0; i<BROKER_MAX_CLIENTS; i++) {
+        if (broker->clients[i] != NULL) {
+            broker->clients[i]->conn->data = NULL;
+            free(broker->clients[i]);
+        }
+    }
+
+    (void)munmap(broker->map, broker->map_len);
+    (void)close(broker->mem_fd);
+    if (broker->ro_fd >= 0) { (void)close(broker->ro_fd); }
+
+    free(broker);
+    brokers[id] = NULL;
+}
+
+/* Broker message handler
+ *
+ * Receives are appended to the connection's frame buffer, every complete frame is handled. A frame
+ * that can't be valid closes the connection, its stream can't be resynchronized. Closing a connection
+ * frees its client state through broker_conn_closed().
+ */
+void broker_message_handler( ev_conn_t *conn, const void *buffer, size_t len, void __attribute__((unused)) *ctx ) {
+    const char *bytes = buffer;
+    broker_client_t *client;
+    broker_t *broker;
+    broker_hdr_t hdr;
+    size_t num_bytes;
+    size_t frame_len;
+    size_t consumed;
+
+    if (((broker = _get_broker(conn->listener)) == NULL) || ((client = _get_client(broker, conn)) == NULL)) {
+        (void)event_loop_close_conn(conn);
+        return;
+    }
+
+    while (len > 0) {
+        num_bytes = sizeof(client->in_buf) - client->in_len;
+        if (num_bytes > len) { num_bytes = len; }
+
+        memcpy(client->in_buf + client->in_len, bytes, num_bytes);
+        client->in_len += num_bytes;
+        bytes += num_bytes;
+        len -= num_bytes;
+
+        consumed = 0;
+
+        while ((client->in_len - consumed) >= sizeof(hdr)) {
+            memcpy(&hdr, client->in_buf + consumed, sizeof(hdr));
+
+            if ((hdr.topic_len > BROKER_TOPIC_SIZE) || (hdr.len > BROKER_MAX_PAYLOAD)) {
+                log_warn("Broker: invalid frame, closing connection");
+                (void)event_loop_close_conn(client->conn);
+                return;
+            }
+
+            frame_len = sizeof(hdr) + hdr.topic_len + hdr.len;
+
+            if ((client->in_len - consumed) < frame_len) { break; }
+
+            if (_handle_frame(broker, client, &hdr, client->in_buf + consumed + sizeof(hdr)) < 0) {
+                (void)event_loop_close_conn(client->conn);
+                return;
+            }
+
+            /* A publish may disconnect slow subscribers, this one included */
+            if (conn->data != client) { return; }
+
+            consumed += frame_len;
+        }
+
+        memmove(client->in_buf, client->in_buf + consumed, client->in_len - consumed);
+        client->in_len -= consumed;
+    }
+}
+
+void broker_conn_closed( ev_conn_t *conn, void __attribute__((unused)) *ctx ) {
+    broker_client_t *client = conn->data;
+    broker_t *broker;
+
+    if (client == NULL) { return; }
+
+    if ((broker = _get_broker(conn->listener)) != NULL) {
+        for (int i=0; i<BROKER_MAX_CLIENTS; i++) {
+            if (broker->clients[i] == client) {
+                broker->clients[i] = NULL;
+            }
+        }
+    }
+
+    conn->data = NULL;
+    free(client);
+}
+
+/* Flushes notifications that were queued while a subscriber's socket was full */
+void broker_tick_all( void ) {
+    broker_client_t *client;
+
+    for (int i=0; i<MAX_NUM_OF_SOCKS; i++) {
+        if (brokers[i] == NULL) { continue; }
+
+        for (int j=0; j<BROKER_MAX_CLIENTS; j++) {
+            client = brokers[i]->clients[j];
+
+            if ((client != NULL) && (client->out_head != client->out_tail)) {
+                (void)_flush(brokers[i], client);
+            }
+        }
+    }
+}
+
+int get_broker_stats( sock_id_t id, broker_stats_t *stats ) {
+    broker_t *broker;
+
+    if (stats == NULL) { return SOCK_NOT_OK; }
+    if ((broker = _get_broker(id)) == NULL) { return SOCK_NOT_OK; }
+
+    *stats = broker->stats;
+    stats->subscribers = 0;
+
+    for (int i=0; i<BROKER_MAX_CLIENTS; i++) {
+        if ((broker->clients[i] != NULL) && (broker->clients[i]->topics != 0)) {
+            stats->subscribers++;
+        }
+    }
+
+    return SOCK_OK;
+}
+
+static broker_t *_get_broker( sock_id_t id ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return NULL; }
+
+    return brokers[id];
+}
+
+/* Client state is attached to the connection on its first message */
+static broker_client_t *_get_client( broker_t *broker, ev_conn_t *conn ) {
+    broker_client_t *client;
+
+    if (conn->data != NULL) { return conn->data; }
+
+    for (int i=0; i<BROKER_MAX_CLIENTS; i++) {
+        if (broker->clients[i] != NULL) { continue; }
+
+        if ((client = calloc(1, sizeof(broker_client_t))) == NULL) { return NULL; }
+
+        client->conn = conn;
+        conn->data = client;
+        broker->clients[i] = client;
+
+        return client;
+    }
+
+    log_warn("Broker: too many clients");
+
+    return NULL;
+}
+
+/* Find topic
+ *
+ * Only subscribing creates a topic, one that is full first reclaims the topics nobody uses anymore.
+ */
+static int _find_topic( broker_t *broker, const char *topic, size_t topic_len, bool create ) {
+    int free_topic = SOCK_NOT_OK;
+
+    if (topic_len == 0) { return SOCK_NOT_OK; }
+
+    for (int i=0; i<BROKER_MAX_TOPICS; i++) {
+        if (broker->topics[i][0] == '\0') {
+            if (free_topic < 0) { free_topic = i; }
+            continue;
+        }
+
+        if ((strlen(broker->topics[i]) == topic_len) && (memcmp(broker->topics[i], topic, topic_len) == 0)) {
+            return i;
+        }
+    }
+
+    if (!create) { return SOCK_NOT_OK; }
+    if ((free_topic < 0) && ((free_topic = _reclaim_topics(broker)) < 0)) { return SOCK_NOT_OK; }
+
+    memcpy(broker->topics[free_topic], topic, topic_len);
+    broker->topics[free_topic][topic_len] = '\0';
+
+    return free_topic;
+}
+
+/* Reclaim topics
+ *
+ * Frees the topics no client subscribes to and no queued notification refers to, their index may be
+ * reused right away. Returns the first free one, or SOCK_NOT_OK if every topic is in use.
+ */
+static int _reclaim_topics( broker_t *broker ) {
+    broker_client_t *client;
+    uint64_t used = 0;
+    int free_topic = SOCK_NOT_OK;
+
+    for (int i=0; i<BROKER_MAX_CLIENTS; i++) {
+        if ((client = broker->clients[i]) == NULL) { continue; }
+
+        used |= client->topics;
+
+        for (uint32_t j = client->out_head; j != client->out_tail; j++) {
+            used |= 1ULL << client->out[j % BROKER_MAX_PENDING].topic;
+        }
+    }
+
+    for (int i=0; i<BROKER_MAX_TOPICS; i++) {
+        if (used & (1ULL << i)) { continue; }
+
+        broker->topics[i][0] = '\0';
+        if (free_topic < 0) { free_topic = i; }
+    }
+
+    return free_topic;
+}
+
+static int _handle_frame( broker_t *broker, broker_client_t *client, const broker_hdr_t *hdr, const char *body ) {
+    broker_client_t *sub;
+    uint64_t seq;
+    uint32_t offset;
+    int topic;
+
+    switch (hdr->type) {
+        case BROKER_SUBSCRIBE:
+            if (hdr->policy > BROKER_POLICY_DISCONNECT) { return SOCK_NOT_OK; }
+
+            if ((topic = _find_topic(broker, body, hdr->topic_len, true)) < 0) {
+                log_warn("Broker: too many topics");
+                return SOCK_OK;
+            }
+
+            if (!client->ring_sent && (_send_ring(broker, client) < 0)) { return SOCK_NOT_OK; }
+
+            client->topics |= (1ULL << topic);
+            client->policy = (E_BROKER_POLICY)hdr->policy;
+            break;
+
+        case BROKER_UNSUBSCRIBE:
+            if ((topic = _find_topic(broker, body, hdr->topic_len, false)) >= 0) {
+                client->topics &= ~(1ULL << topic);
+            }
+            break;
+
+        case BROKER_PUBLISH:
+            /* Written either way, a topic nobody subscribes to only has no one to notify */
+            offset = _ring_write(broker, body, hdr->topic_len, body + hdr->topic_len, hdr->len, &seq);
+            broker->stats.published++;
+
+            if ((topic = _find_topic(broker, body, hdr->topic_len, false)) < 0) { break; }
+
+            for (int i=0; i<BROKER_MAX_CLIENTS; i++) {
+                sub = broker->clients[i];
+
+                if ((sub == NULL) || !(sub->topics & (1ULL << topic))) { continue; }
+
+                if (_enqueue(broker, sub, topic, seq, offset) == SOCK_OK) {
+                    (void)_flush(broker, sub);
+                }
+            }
+            break;
+
+        default:
+            return SOCK_NOT_OK;
+    }
+
+    return SOCK_OK;
+}
+
+/* Send ring
+ *
+ * The ring fd is passed with SCM_RIGHTS on an empty RING frame, ahead of any notification.
+ */
+static int _send_ring( broker_t *broker, broker_client_t *client ) {
+    char control[CMSG_SPACE(sizeof(int))];
+    broker_hdr_t hdr = { .type = BROKER_RING };
+    struct iovec iov = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int fd = (broker->ro_fd >= 0) ? broker->ro_fd : broker->mem_fd;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    /* A new connection always has room for it, anything else is a failed connection */
+    if (sendmsg(client->conn->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)sizeof(hdr)) {
+        return SOCK_NOT_OK;
+    }
+
+    client->ring_sent = true;
+
+    return SOCK_OK;
+}
+
+/* Write to ring
+ *
+ * Records are appended at head, a record that doesn't fit before the end of the ring is preceded by
+ * a pad record and starts over at offset 0. Returns the offset of the record.
+ */
+static uint32_t _ring_write( broker_t *broker, const char *topic, size_t topic_len, const char *buffer, size_t len, uint64_t *seq ) {
+    size_t needed = BROKER_ALIGN(sizeof(broker_record_t) + topic_len + len);
+    uint32_t offset = (uint32_t)(broker->head % BROKER_RING_SIZE);
+    broker_record_t *record;
+
+    if ((offset + needed) > BROKER_RING_SIZE) {
+        size_t pad = BROKER_RING_SIZE - offset;
+
+        _ring_reclaim(broker, pad);
+
+        record = (broker_record_t *)(broker->data + offset);
+        record->seq = 0;
+        record->len = (uint32_t)(pad - sizeof(broker_record_t));
+        record->topic_len = 0;
+        record->flags = BROKER_RECORD_PAD;
+
+        broker->head += pad;
+        offset = 0;
+    }
+
+    _ring_reclaim(broker, needed);
+
+    *seq = broker->hdr->next_seq;
+
+    record = (broker_record_t *)(broker->data + offset);
+    record->seq = *seq;
+    record->len = (uint32_t)len;
+    record->topic_len = (uint16_t)topic_len;
+    record->flags = 0;
+    memcpy((char *)(record + 1), topic, topic_len);
+    memcpy((char *)(record + 1) + topic_len, buffer, len);
+
+    broker->head += needed;
+
+    __atomic_store_n(&broker->hdr->next_seq, *seq + 1, __ATOMIC_RELEASE);
+
+    return offset;
+}
+
+/* Reclaim ring space
+ *
+ * Frees the oldest records until needed bytes are free at head. oldest_seq is published before any
+ * of their bytes are overwritten, a reader that checks it after reading knows if it raced the writer.
+ */
+static void _ring_reclaim( broker_t *broker, size_t needed ) {
+    broker_record_t *record;
+    bool reclaimed = false;
+
+    while ((broker->head + needed - broker->tail) > BROKER_RING_SIZE) {
+        record = (broker_record_t *)(broker->data + (broker->tail % BROKER_RING_SIZE));
+
+        if (!(record->flags & BROKER_RECORD_PAD)) {
+            __atomic_store_n(&broker->hdr->oldest_seq, record->seq + 1, __ATOMIC_RELAXED);
+            reclaimed = true;
+        }
+
+        broker->tail += BROKER_ALIGN(sizeof(broker_record_t) + record->topic_len + record->len);
+    }
+
+    if (reclaimed) {
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+/* Enqueue notification
+ *
+ * Applies the subscriber's policy when it's behind. Returns SOCK_NOT_OK if the notification wasn't
+ * queued, the subscriber may have been disconnected.
+ */
+static int _enqueue( broker_t *broker, broker_client_t *client, int topic, uint64_t seq, uint32_t offset ) {
+    broker_pending_t *pending;
+    uint32_t first = client->out_head + ((client->out_off > 0) ? 1 : 0);
+
+    if (client->policy == BROKER_POLICY_CONFLATE) {
+        for (uint32_t i = first; i != client->out_tail; i++) {
+            pending = &client->out[i % BROKER_MAX_PENDING];
+
+            if (pending->topic != topic) { continue; }
+
+            pending->notify.seq = seq;
+            pending->notify.offset = offset;
+            pending->notify.dropped += 1 + client->dropped;
+            client->dropped = 0;
+
+            broker->stats.conflated++;
+            return SOCK_OK;
+        }
+    }
+
+    if ((client->out_tail - client->out_head) >= BROKER_MAX_PENDING) {
+        if (client->policy == BROKER_POLICY_DISCONNECT) {
+            log_warn("Broker: disconnecting slow subscriber");
+            broker->stats.disconnected++;
+            (void)event_loop_close_conn(client->conn);
+        } else {
+            client->dropped++;
+            broker->stats.dropped++;
+        }
+        return SOCK_NOT_OK;
+    }
+
+    pending = &client->out[client->out_tail % BROKER_MAX_PENDING];
+    pending->topic = topic;
+    pending->notify.seq = seq;
+    pending->notify.offset = offset;
+    pending->notify.dropped = client->dropped;
+    client->dropped = 0;
+    client->out_tail++;
+
+    return SOCK_OK;
+}
+
+/* Flush notifications
+ *
+ * Every queued notification is sent with a single non-blocking send(). Notifications at the front
+ * of the queue that point to overwritten records are skipped, and counted as dropped in the next
+ * one. A partial send leaves the rest of the frame for the next flush.
+ */
+static int _flush( broker_t *broker, broker_client_t *client ) {
+    char buffer[BROKER_MAX_PENDING * BROKER_NOTIFY_FRAME];
+    broker_hdr_t hdr = { .type = BROKER_NOTIFY, .len = sizeof(broker_notify_t) };
+    broker_pending_t *pending;
+    uint64_t oldest = broker->hdr->oldest_seq;
+    uint32_t skipped = 0;
+    size_t len = 0;
+    size_t total;
+    ssize_t num_bytes;
+
+    while ((client->out_head != client->out_tail) && (client->out_off == 0)) {
+        pending = &client->out[client->out_head % BROKER_MAX_PENDING];
+
+        if (pending->notify.seq >= oldest) { break; }
+
+        skipped += pending->notify.dropped + 1;
+        broker->stats.dropped++;
+        client->out_head++;
+    }
+
+    if (skipped > 0) {
+        if (client->policy == BROKER_POLICY_DISCONNECT) {
+            log_warn("Broker: disconnecting slow subscriber");
+            broker->stats.disconnected++;
+            (void)event_loop_close_conn(client->conn);
+            return SOCK_NOT_OK;
+        }
+
+        if (client->out_head != client->out_tail) {
+            client->out[client->out_head % BROKER_MAX_PENDING].notify.dropped += skipped;
+        } else {
+            client->dropped += skipped;
+        }
+    }
+
+    if (client->out_head == client->out_tail) { return SOCK_OK; }
+
+    for (uint32_t i = client->out_head; i != client->out_tail; i++) {
+        pending = &client->out[i % BROKER_MAX_PENDING];
+
+        memcpy(buffer + len, &hdr, sizeof(hdr));
+        memcpy(buffer + len + sizeof(hdr), &pending->notify, sizeof(pending->notify));
+        len += BROKER_NOTIFY_FRAME;
+    }
+
+    num_bytes = send(client->conn->fd, buffer + client->out_off, len - client->out_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (num_bytes < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) { return SOCK_OK; }
+
+        (void)event_loop_close_conn(client->conn);
+        return SOCK_NOT_OK;
+    }
+
+    total = client->out_off + (size_t)num_bytes;
+    client->out_head += (uint32_t)(total / BROKER_NOTIFY_FRAME);
+    client->out_off = (uint32_t)(total % BROKER_NOTIFY_FRAME);
+
+    broker->stats.notified += (uint32_t)(total / BROKER_NOTIFY_FRAME);
+
+    return SOCK_OK;
+}
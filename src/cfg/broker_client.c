@@ -0,0 +1,275 @@
+#include "broker.h"
+#include "logger.h"
+
+typedef struct {
+    const char *map;
+    size_t map_len;
+    const broker_ring_hdr_t *hdr;
+    const char *data;
+
+    /* Frames split across receives */
+    uint32_t in_len;
+    char in_buf[BROKER_MAX_FRAME];
+} broker_sub_t;
+
+static broker_sub_t *broker_subs[MAX_NUM_OF_SOCKS];
+
+/* Static Functions */
+static int _send_frame( sock_id_t *id, uint8_t type, uint8_t policy, const char *topic, const void *buffer, size_t len );
+static broker_sub_t *_get_sub( sock_id_t id );
+static int _map_ring( broker_sub_t *sub, int fd );
+static int _read_notify( broker_sub_t *sub, const broker_notify_t *notify, broker_msg_t *msg );
+
+int broker_subscribe( sock_id_t *id, const char *topic, E_BROKER_POLICY policy ) {
+    return _send_frame(id, BROKER_SUBSCRIBE, (uint8_t)policy, topic, NULL, 0);
+}
+
+int broker_unsubscribe( sock_id_t *id, const char *topic ) {
+    return _send_frame(id, BROKER_UNSUBSCRIBE, 0, topic, NULL, 0);
+}
+
+int broker_publish( sock_id_t *id, const char *topic, const void *buffer, size_t len ) {
+    if ((buffer == NULL) && (len > 0)) { return SOCK_NOT_OK; }
+
+    return _send_frame(id, BROKER_PUBLISH, 0, topic, buffer, len);
+}
+
+/* Broker receive
+ *
+ * Frames are read into the subscriber's buffer until a notification for a message that is still in
+ * the ring arrives. The ring fd arrives with the RING frame, it's mapped as soon as it's received.
+ * Notifications for overwritten messages are skipped and counted in msg->dropped.
+ */
+int broker_receive( sock_id_t id, broker_msg_t *msg ) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    broker_sub_t *sub;
+    broker_hdr_t hdr;
+    broker_notify_t notify;
+    uint32_t lost = 0;
+    size_t frame_len;
+    ssize_t num_bytes;
+    int fd;
+
+    if (msg == NULL) { return SOCK_NOT_OK; }
+    if (get_sock_app_type(id) != E_LOCAL_SOCK) { return SOCK_NOT_OK; }
+    if (((fd = get_sock_fd(id)) < 0) || ((sub = _get_sub(id)) == NULL)) { return SOCK_NOT_OK; }
+
+    for (;;) {
+        while (sub->in_len >= sizeof(hdr)) {
+            memcpy(&hdr, sub->in_buf, sizeof(hdr));
+
+            if ((hdr.topic_len > BROKER_TOPIC_SIZE) || (hdr.len > BROKER_MAX_PAYLOAD)) {
+                sub->in_len = 0;
+                return SOCK_NOT_OK;
+            }
+
+            frame_len = sizeof(hdr) + hdr.topic_len + hdr.len;
+
+            if (sub->in_len < frame_len) { break; }
+
+            if ((hdr.type == BROKER_NOTIFY) && (hdr.len == sizeof(notify))) {
+                memcpy(&notify, sub->in_buf + sizeof(hdr), sizeof(notify));
+            } else {
+                hdr.type = 0;
+            }
+
+            memmove(sub->in_buf, sub->in_buf + frame_len, sub->in_len - frame_len);
+            sub->in_len -= frame_len;
+
+            if (hdr.type != BROKER_NOTIFY) { continue; }
+
+            if (_read_notify(sub, &notify, msg) == SOCK_OK) {
+                msg->dropped += lost;
+                return SOCK_OK;
+            }
+
+            lost += notify.dropped + 1;
+        }
+
+        memset(&mh, 0, sizeof(mh));
+        iov.iov_base = sub->in_buf + sub->in_len;
+        iov.iov_len = sizeof(sub->in_buf) - sub->in_len;
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+
+        if ((num_bytes = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC)) <= 0) {
+            if ((num_bytes < 0) && (errno == EINTR)) { continue; }
+
+            /* Broker closed the connection */
+            sub->in_len = 0;
+            return SOCK_NOT_OK;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+                int ring_fd;
+
+                memcpy(&ring_fd, CMSG_DATA(cmsg), sizeof(int));
+
+                if (_map_ring(sub, ring_fd) < 0) {
+                    printf("Failed to map broker ring\n");
+                }
+            }
+        }
+
+        sub->in_len += (uint32_t)num_bytes;
+    }
+}
+
+/* Message valid
+ *
+ * The broker publishes oldest_seq before it overwrites a record, so if it's still at or below seq
+ * after the data was read, the data wasn't overwritten.
+ */
+bool broker_msg_valid( sock_id_t id, const broker_msg_t *msg ) {
+    broker_sub_t *sub;
+
+    if ((msg == NULL) || (id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return false; }
+    if (((sub = broker_subs[id]) == NULL) || (sub->hdr == NULL)) { return false; }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&sub->hdr->oldest_seq, __ATOMIC_RELAXED) <= msg->seq;
+}
+
+void broker_release( sock_id_t id ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return; }
+    if (broker_subs[id] == NULL) { return; }
+
+    if (broker_subs[id]->map != NULL) {
+        (void)munmap((void *)broker_subs[id]->map, broker_subs[id]->map_len);
+    }
+
+    free(broker_subs[id]);
+    broker_subs[id] = NULL;
+}
+
+/* Send frame
+ *
+ * The frame is built in one buffer and written with a single send(), so frames of concurrent
+ * publishers on other connections never interleave with it.
+ */
+static int _send_frame( sock_id_t *id, uint8_t type, uint8_t policy, const char *topic, const void *buffer, size_t len ) {
+    char frame[BROKER_MAX_FRAME];
+    broker_hdr_t hdr;
+    size_t topic_len;
+    size_t frame_len;
+    size_t sent = 0;
+    ssize_t num_bytes;
+    sock_id_t prev_id;
+    int fd;
+
+    if ((id == NULL) || (topic == NULL)) { return SOCK_NOT_OK; }
+    if (((topic_len = strlen(topic)) == 0) || (topic_len > BROKER_TOPIC_SIZE)) { return SOCK_NOT_OK; }
+    if (len > BROKER_MAX_PAYLOAD) { return SOCK_NOT_OK; }
+    if (get_sock_app_type(*id) != E_LOCAL_SOCK) { return SOCK_NOT_OK; }
+
+    prev_id = *id;
+
+    if (connect_sock(id) != SOCK_OK) {
+        /* The connection is gone, so is everything that was received on it */
+        broker_release(prev_id);
+        return SOCK_NOT_OK;
+    }
+
+    if ((fd = get_sock_fd(*id)) < 0) { return SOCK_NOT_OK; }
+
+    hdr.type = type;
+    hdr.policy = policy;
+    hdr.topic_len = (uint16_t)topic_len;
+    hdr.len = (uint32_t)len;
+
+    memcpy(frame, &hdr, sizeof(hdr));
+    memcpy(frame + sizeof(hdr), topic, topic_len);
+    if (len > 0) { memcpy(frame + sizeof(hdr) + topic_len, buffer, len); }
+    frame_len = sizeof(hdr) + topic_len + len;
+
+    while (sent < frame_len) {
+        if ((num_bytes = send(fd, frame + sent, frame_len - sent, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) { continue; }
+            log_error("Failed to send");
+            return SOCK_NOT_OK;
+        }
+        sent += (size_t)num_bytes;
+    }
+
+    return SOCK_OK;
+}
+
+static broker_sub_t *_get_sub( sock_id_t id ) {
+    if (broker_subs[id] == NULL) {
+        broker_subs[id] = calloc(1, sizeof(broker_sub_t));
+    }
+
+    return broker_subs[id];
+}
+
+/* Map ring, read-only. A new ring replaces the previous one, e.g. after the broker restarted. */
+static int _map_ring( broker_sub_t *sub, int fd ) {
+    const broker_ring_hdr_t *hdr;
+    struct stat st;
+    void *map;
+
+    if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(broker_ring_hdr_t))) {
+        (void)close(fd);
+        return SOCK_NOT_OK;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    (void)close(fd);
+
+    if (map == MAP_FAILED) { return SOCK_NOT_OK; }
+
+    hdr = map;
+
+    if (((size_t)hdr->data_offset + hdr->size) > (size_t)st.st_size) {
+        (void)munmap(map, (size_t)st.st_size);
+        return SOCK_NOT_OK;
+    }
+
+    if (sub->map != NULL) {
+        (void)munmap((void *)sub->map, sub->map_len);
+    }
+
+    sub->map = map;
+    sub->map_len = (size_t)st.st_size;
+    sub->hdr = hdr;
+    sub->data = sub->map + hdr->data_offset;
+
+    return SOCK_OK;
+}
+
+/* Read notification
+ *
+ * Fills msg from the record the notification points to. SOCK_NOT_OK if the record was already
+ * overwritten, or the notification is invalid.
+ */
+static int _read_notify( broker_sub_t *sub, const broker_notify_t *notify, broker_msg_t *msg ) {
+    const broker_record_t *record;
+
+    if (sub->hdr == NULL) { return SOCK_NOT_OK; }
+    if (((size_t)notify->offset + sizeof(broker_record_t)) > sub->hdr->size) { return SOCK_NOT_OK; }
+
+    record = (const broker_record_t *)(sub->data + notify->offset);
+
+    if (__atomic_load_n(&sub->hdr->oldest_seq, __ATOMIC_ACQUIRE) > notify->seq) { return SOCK_NOT_OK; }
+    if (record->seq != notify->seq) { return SOCK_NOT_OK; }
+    if (record->topic_len > BROKER_TOPIC_SIZE) { return SOCK_NOT_OK; }
+    if (((size_t)notify->offset + sizeof(broker_record_t) + record->topic_len + record->len) > sub->hdr->size) {
+        return SOCK_NOT_OK;
+    }
+
+    memcpy(msg->topic, (const char *)(record + 1), record->topic_len);
+    msg->topic[record->topic_len] = '\0';
+    msg->seq = notify->seq;
+    msg->dropped = notify->dropped;
+    msg->data = (const char *)(record + 1) + record->topic_len;
+    msg->len = record->len;
+
+    return SOCK_OK;
+}
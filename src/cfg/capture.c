@@ -0,0 +1,364 @@
+#include "capture.h"
+
+typedef struct {
+    char path[CAPTURE_PATH_SIZE];
+    size_t segment_size;
+    uint32_t next_segment;
+
+    int fd;
+    uint8_t *base;
+    size_t used;
+
+    /* Listeners described in the current segment */
+    bool described[MAX_NUM_OF_SOCKS];
+
+    capture_stats_t stats;
+} capture_t;
+
+static capture_t *capture;
+
+/* Static Functions */
+static int _open_segment( capture_t *cap );
+static void _close_segment( capture_t *cap );
+static void _append( capture_t *cap, E_CAPTURE_RECORD kind, const ev_conn_t *conn, const void *payload, size_t len );
+static void _describe_listener( sock_id_t id, capture_listener_t *listener );
+static void _segment_path( const char *path, uint32_t segment, char *buffer, size_t len );
+static uint64_t _now_us( void );
+
+int capture_start( const char *path, size_t segment_size ) {
+    capture_t *cap;
+
+    if ((path == NULL) || (strlen(path) >= (CAPTURE_PATH_SIZE - 8))) { return CAPTURE_NOT_OK; }
+    if (segment_size < CAPTURE_MIN_SEGMENT_SIZE) { return CAPTURE_NOT_OK; }
+
+    capture_stop();
+
+    if ((cap = calloc(1, sizeof(capture_t))) == NULL) { return CAPTURE_NOT_OK; }
+
+    strncpy(cap->path, path, CAPTURE_PATH_SIZE - 1);
+    cap->segment_size = segment_size;
+    cap->fd = -1;
+
+    if (_open_segment(cap) < 0) {
+        free(cap);
+        return CAPTURE_NOT_OK;
+    }
+
+    capture = cap;
+
+    return CAPTURE_OK;
+}
+
+void capture_stop( void ) {
+    if (capture == NULL) { return; }
+
+    _close_segment(capture);
+
+    free(capture);
+    capture = NULL;
+}
+
+bool capture_active( void ) {
+    return capture != NULL;
+}
+
+void capture_message( const ev_conn_t *conn, const void *buffer, size_t len ) {
+    capture_listener_t listener;
+
+    if ((capture == NULL) || (conn == NULL)) { return; }
+    if ((conn->listener < 0) || (conn->listener >= MAX_NUM_OF_SOCKS)) { return; }
+
+    if (!capture->described[conn->listener]) {
+        _describe_listener(conn->listener, &listener);
+        _append(capture, CAPTURE_RECORD_LISTENER, conn, &listener, sizeof(listener));
+
+        /* Stopped if the next segment couldn't be opened */
+        if (capture == NULL) { return; }
+
+        capture->described[conn->listener] = true;
+    }
+
+    _append(capture, CAPTURE_RECORD_MESSAGE, conn, buffer, len);
+}
+
+void capture_conn_closed( const ev_conn_t *conn ) {
+    if ((capture == NULL) || (conn == NULL)) { return; }
+    if ((conn->listener < 0) || (conn->listener >= MAX_NUM_OF_SOCKS)) { return; }
+
+    /* Connections that never sent anything aren't in the capture */
+    if (!capture->described[conn->listener]) { return; }
+
+    _append(capture, CAPTURE_RECORD_CLOSE, conn, NULL, 0);
+}
+
+void capture_forget_listener( sock_id_t id ) {
+    if ((capture == NULL) || (id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return; }
+
+    capture->described[id] = false;
+}
+
+int get_capture_stats( capture_stats_t *stats ) {
+    if ((stats == NULL) || (capture == NULL)) { return CAPTURE_NOT_OK; }
+
+    *stats = capture->stats;
+
+    return CAPTURE_OK;
+}
+
+int capture_reader_open( capture_reader_t *reader, const char *path ) {
+    if ((reader == NULL) || (path == NULL) || (strlen(path) >= (CAPTURE_PATH_SIZE - 8))) { return CAPTURE_NOT_OK; }
+
+    memset(reader, 0, sizeof(*reader));
+    strncpy(reader->path, path, CAPTURE_PATH_SIZE - 1);
+    reader->fd = -1;
+
+    return CAPTURE_OK;
+}
+
+/* Read
+ *
+ * Segments are mapped one at a time, the next one is opened once the current one is exhausted. The
+ * capture ends at the first segment that doesn't exist.
+ */
+int capture_read( capture_reader_t *reader, capture_record_t *record, const void **payload ) {
+    char segment_path[CAPTURE_PATH_SIZE];
+    capture_hdr_t *hdr;
+    struct stat st;
+    size_t used;
+
+    if ((reader == NULL) || (record == NULL) || (payload == NULL)) { return CAPTURE_NOT_OK; }
+
+    for (;;) {
+        if (reader->base == NULL) {
+            _segment_path(reader->path, reader->segment, segment_path, sizeof(segment_path));
+
+            if ((reader->fd = open(segment_path, O_RDONLY | O_CLOEXEC)) < 0) {
+                return (errno == ENOENT) ? CAPTURE_END : CAPTURE_NOT_OK;
+            }
+
+            if ((fstat(reader->fd, &st) < 0) || ((size_t)st.st_size < sizeof(capture_hdr_t))) {
+                capture_reader_close(reader);
+                return CAPTURE_NOT_OK;
+            }
+
+            reader->size = (size_t)st.st_size;
+            reader->base = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+
+            if (reader->base == MAP_FAILED) {
+                reader->base = NULL;
+                capture_reader_close(reader);
+                return CAPTURE_NOT_OK;
+            }
+
+            hdr = (capture_hdr_t *)reader->base;
+
+            if ((hdr->magic != CAPTURE_MAGIC) || (hdr->version != CAPTURE_VERSION)) {
+                printf("%s is not a capture segment\n", segment_path);
+                capture_reader_close(reader);
+                return CAPTURE_NOT_OK;
+            }
+
+            reader->offset = CAPTURE_ALIGN(sizeof(capture_hdr_t));
+        }
+
+        hdr = (capture_hdr_t *)reader->base;
+        used = __atomic_load_n(&hdr->used, __ATOMIC_ACQUIRE);
+        if (used > reader->size) { used = reader->size; }
+
+        if ((reader->offset + sizeof(capture_record_t)) <= used) {
+            memcpy(record, reader->base + reader->offset, sizeof(*record));
+
+            if ((used - reader->offset - sizeof(capture_record_t)) < record->len) { return CAPTURE_NOT_OK; }
+
+            *payload = reader->base + reader->offset + sizeof(capture_record_t);
+            reader->offset += CAPTURE_ALIGN(sizeof(capture_record_t) + record->len);
+
+            return CAPTURE_OK;
+        }
+
+        /* Segment done, on to the next */
+        munmap(reader->base, reader->size);
+        close(reader->fd);
+        reader->base = NULL;
+        reader->fd = -1;
+        reader->segment++;
+    }
+}
+
+void capture_reader_close( capture_reader_t *reader ) {
+    if (reader == NULL) { return; }
+
+    if (reader->base != NULL) { munmap(reader->base, reader->size); }
+    if (reader->fd >= 0) { close(reader->fd); }
+
+    reader->base = NULL;
+    reader->fd = -1;
+}
+
+/* Open segment
+ *
+ * Created exclusively, a segment left by an earlier capture, or by the previous server process
+ * during an upgrade, is skipped.
+ */
+static int _open_segment( capture_t *cap ) {
+    char segment_path[CAPTURE_PATH_SIZE];
+    capture_hdr_t *hdr;
+    int rc;
+
+    for (;;) {
+        _segment_path(cap->path, cap->next_segment, segment_path, sizeof(segment_path));
+
+        cap->fd = open(segment_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+        if (cap->fd >= 0) { break; }
+        if (errno != EEXIST) {
+            printf("Failed to create capture segment %s\n", segment_path);
+            return CAPTURE_NOT_OK;
+        }
+
+        cap->next_segment++;
+    }
+
+    /* Blocks are allocated now, a sparse file would SIGBUS on a full disk */
+    if ((rc = posix_fallocate(cap->fd, 0, (off_t)cap->segment_size)) != 0) {
+        printf("Failed to reserve capture segment %s: %s\n", segment_path, strerror(rc));
+        close(cap->fd);
+        unlink(segment_path);
+        cap->fd = -1;
+        return CAPTURE_NOT_OK;
+    }
+
+    cap->base = mmap(NULL, cap->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, 0);
+
+    if (cap->base == MAP_FAILED) {
+        cap->base = NULL;
+        close(cap->fd);
+        unlink(segment_path);
+        cap->fd = -1;
+        return CAPTURE_NOT_OK;
+    }
+
+    cap->used = CAPTURE_ALIGN(sizeof(capture_hdr_t));
+
+    hdr = (capture_hdr_t *)cap->base;
+    hdr->magic = CAPTURE_MAGIC;
+    hdr->version = CAPTURE_VERSION;
+    hdr->segment = cap->next_segment;
+    hdr->size = cap->segment_size;
+    __atomic_store_n(&hdr->used, cap->used, __ATOMIC_RELEASE);
+
+    memset(cap->described, 0, sizeof(cap->described));
+
+    cap->next_segment++;
+    cap->stats.segments++;
+
+    return CAPTURE_OK;
+}
+
+/* The unused tail is given back, the segment is left as long as its records */
+static void _close_segment( capture_t *cap ) {
+    if (cap->base == NULL) { return; }
+
+    (void)msync(cap->base, cap->used, MS_ASYNC);
+    (void)munmap(cap->base, cap->segment_size);
+    (void)ftruncate(cap->fd, (off_t)cap->used);
+    (void)close(cap->fd);
+
+    cap->base = NULL;
+    cap->fd = -1;
+}
+
+/* Append
+ *
+ * The record is written before used is advanced past it, so a reader never sees half of one. A
+ * listener description is repeated at the start of every segment, segments are read on their own.
+ */
+static void _append( capture_t *cap, E_CAPTURE_RECORD kind, const ev_conn_t *conn, const void *payload, size_t len ) {
+    capture_listener_t listener;
+    capture_record_t record;
+    size_t size = CAPTURE_ALIGN(sizeof(record) + len);
+
+    if (size > (cap->segment_size - CAPTURE_ALIGN(sizeof(capture_hdr_t)) - CAPTURE_ALIGN(sizeof(record) + sizeof(listener)))) {
+        cap->stats.dropped++;
+        return;
+    }
+
+    if ((cap->used + size) > cap->segment_size) {
+        _close_segment(cap);
+
+        if (_open_segment(cap) < 0) {
+            /* Nothing more can be written */
+            printf("Capture stopped\n");
+            capture = NULL;
+            free(cap);
+            return;
+        }
+
+        if (kind != CAPTURE_RECORD_LISTENER) {
+            _describe_listener(conn->listener, &listener);
+            _append(cap, CAPTURE_RECORD_LISTENER, conn, &listener, sizeof(listener));
+            cap->described[conn->listener] = true;
+        }
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.time_us = _now_us();
+    record.len = (uint32_t)len;
+    record.kind = (uint16_t)kind;
+    record.listener = (uint16_t)conn->listener;
+    record.conn = ((conn->type == E_TCP_SOCK) || (conn->type == E_LOCAL_SOCK)) ? conn->fd : -1;
+    record.family = (uint16_t)conn->peer.ss_family;
+
+    if (conn->peer.ss_family == AF_INET) {
+        const sockaddr_in_t *in = (const sockaddr_in_t *)&conn->peer;
+        record.port = ntohs(in->sin_port);
+        memcpy(record.addr, &in->sin_addr, sizeof(in->sin_addr));
+    } else if (conn->peer.ss_family == AF_INET6) {
+        const sockaddr_in6_t *in6 = (const sockaddr_in6_t *)&conn->peer;
+        record.port = ntohs(in6->sin6_port);
+        memcpy(record.addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+
+    memcpy(cap->base + cap->used, &record, sizeof(record));
+    if (len > 0) { memcpy(cap->base + cap->used + sizeof(record), payload, len); }
+
+    cap->used += size;
+    __atomic_store_n(&((capture_hdr_t *)cap->base)->used, cap->used, __ATOMIC_RELEASE);
+
+    if (kind == CAPTURE_RECORD_MESSAGE) {
+        cap->stats.records++;
+        cap->stats.bytes += len;
+    }
+}
+
+static void _describe_listener( sock_id_t id, capture_listener_t *listener ) {
+    sockaddr_storage_t addr;
+    socklen_t addr_len = sizeof(addr);
+
+    memset(listener, 0, sizeof(*listener));
+    listener->type = (uint16_t)get_sock_app_type(id);
+
+    if (get_sock_addr(id, &addr, &addr_len) != SOCK_OK) { return; }
+
+    if (addr.ss_family == AF_UNIX) {
+        strncpy(listener->addr, ((sockaddr_un_t *)&addr)->sun_path, CAPTURE_PATH_SIZE - 1);
+    } else if (addr.ss_family == AF_INET) {
+        listener->port = ntohs(((sockaddr_in_t *)&addr)->sin_port);
+        (void)inet_ntop(AF_INET, &((sockaddr_in_t *)&addr)->sin_addr, listener->addr, CAPTURE_PATH_SIZE);
+    } else if (addr.ss_family == AF_INET6) {
+        listener->port = ntohs(((sockaddr_in6_t *)&addr)->sin6_port);
+        (void)inet_ntop(AF_INET6, &((sockaddr_in6_t *)&addr)->sin6_addr, listener->addr, CAPTURE_PATH_SIZE);
+    }
+}
+
+static void _segment_path( const char *path, uint32_t segment, char *buffer, size_t len ) {
+    (void)snprintf(buffer, len, "%s.%u", path, segment);
+}
+
+static uint64_t _now_us( void ) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
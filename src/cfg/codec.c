@@ -0,0 +1,198 @@
+#include "codec.h"
+
+/* Cursor over the buffer being encoded or decoded */
+typedef struct {
+    uint8_t *p;
+    uint8_t *end;
+} codec_writer_t;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} codec_reader_t;
+
+/* Static Functions */
+static inline int _put_fixed( codec_writer_t *w, uint64_t value, size_t size );
+static inline int _put_varint( codec_writer_t *w, uint64_t value );
+static inline int _put_bytes( codec_writer_t *w, const codec_bytes_t *bytes, uint32_t max );
+static inline int _get_fixed( codec_reader_t *r, size_t size, uint64_t *value );
+static inline int _get_varint( codec_reader_t *r, uint64_t *value );
+static inline int _get_bytes( codec_reader_t *r, codec_bytes_t *bytes, uint32_t max );
+
+/* Encoders
+ *
+ * One function per message, every field is a call with constant sizes that the compiler inlines and
+ * unrolls. Signed fixed fields are written as their two's complement bits.
+ */
+#define _ENCODE_FIXED(type, field) \
+    if (_put_fixed(&w, (uint64_t)msg->field, sizeof(type)) < 0) { return CODEC_NOT_OK; }
+#define _ENCODE_VARINT(type, field) \
+    if (_put_varint(&w, (uint64_t)msg->field) < 0) { return CODEC_NOT_OK; }
+#define _ENCODE_SVARINT(type, field) \
+    if (_put_varint(&w, ((uint64_t)(int64_t)msg->field << 1) ^ (uint64_t)((int64_t)msg->field >> 63)) < 0) { \
+        return CODEC_NOT_OK; \
+    }
+#define _ENCODE_BYTES(field, max) \
+    if (_put_bytes(&w, &msg->field, (max)) < 0) { return CODEC_NOT_OK; }
+
+#define _ENCODER(NAME, name, id, fields) \
+    int codec_encode_##name( const codec_##name##_t *msg, void *buffer, size_t len ) { \
+        codec_writer_t w; \
+        \
+        if ((msg == NULL) || (buffer == NULL) || (len < 1)) { return CODEC_NOT_OK; } \
+        \
+        w.p = buffer; \
+        w.end = w.p + len; \
+        *w.p++ = CODEC_MSG_##NAME; \
+        \
+        fields(_ENCODE_FIXED, _ENCODE_VARINT, _ENCODE_SVARINT, _ENCODE_BYTES) \
+        \
+        return (int)(w.p - (uint8_t *)buffer); \
+    }
+
+/* Decoders
+ *
+ * Values that don't fit the field type are rejected rather than truncated.
+ */
+#define _DECODE_FIXED(type, field) \
+    if (_get_fixed(&r, sizeof(type), &value) < 0) { return CODEC_NOT_OK; } \
+    msg->field = (type)value;
+#define _DECODE_VARINT(type, field) \
+    if (_get_varint(&r, &value) < 0) { return CODEC_NOT_OK; } \
+    if ((uint64_t)(type)value != value) { return CODEC_NOT_OK; } \
+    msg->field = (type)value;
+#define _DECODE_SVARINT(type, field) \
+    if (_get_varint(&r, &value) < 0) { return CODEC_NOT_OK; } \
+    svalue = (int64_t)(value >> 1) ^ -(int64_t)(value & 1); \
+    if ((int64_t)(type)svalue != svalue) { return CODEC_NOT_OK; } \
+    msg->field = (type)svalue;
+#define _DECODE_BYTES(field, max) \
+    if (_get_bytes(&r, &msg->field, (max)) < 0) { return CODEC_NOT_OK; }
+
+#define _DECODER(NAME, name, id, fields) \
+    int codec_decode_##name( const void *buffer, size_t len, codec_##name##_t *msg ) { \
+        codec_reader_t r; \
+        uint64_t __attribute__((unused)) value; \
+        int64_t __attribute__((unused)) svalue; \
+        \
+        if ((msg == NULL) || (buffer == NULL) || (len < 1)) { return CODEC_NOT_OK; } \
+        \
+        r.p = buffer; \
+        r.end = r.p + len; \
+        \
+        if (*r.p++ != CODEC_MSG_##NAME) { return CODEC_NOT_OK; } \
+        \
+        fields(_DECODE_FIXED, _DECODE_VARINT, _DECODE_SVARINT, _DECODE_BYTES) \
+        \
+        return (int)(r.p - (const uint8_t *)buffer); \
+    }
+
+#define _DECODE_CASE(NAME, name, id, fields) \
+    case CODEC_MSG_##NAME: \
+        return codec_decode_##name(buffer, len, &msg->body.name);
+
+CODEC_MESSAGES(_ENCODER)
+CODEC_MESSAGES(_DECODER)
+
+int codec_decode( const void *buffer, size_t len, codec_msg_t *msg ) {
+    if (msg == NULL) { return CODEC_NOT_OK; }
+
+    if ((msg->type = (E_CODEC_MSG)codec_peek(buffer, len)) == (E_CODEC_MSG)CODEC_NOT_OK) {
+        msg->type = CODEC_MSG_NONE;
+        return CODEC_NOT_OK;
+    }
+
+    switch (msg->type) {
+        CODEC_MESSAGES(_DECODE_CASE)
+        default:
+            msg->type = CODEC_MSG_NONE;
+            return CODEC_NOT_OK;
+    }
+}
+
+int codec_peek( const void *buffer, size_t len ) {
+    if ((buffer == NULL) || (len < 1)) { return CODEC_NOT_OK; }
+
+    return *(const uint8_t *)buffer;
+}
+
+static inline int _put_fixed( codec_writer_t *w, uint64_t value, size_t size ) {
+    if ((size_t)(w->end - w->p) < size) { return CODEC_NOT_OK; }
+
+    for (size_t i=0; i<size; i++) {
+        w->p[i] = (uint8_t)(value >> (8 * i));
+    }
+    w->p += size;
+
+    return CODEC_OK;
+}
+
+static inline int _put_varint( codec_writer_t *w, uint64_t value ) {
+    while (value >= 0x80) {
+        if (w->p == w->end) { return CODEC_NOT_OK; }
+        *w->p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    if (w->p == w->end) { return CODEC_NOT_OK; }
+    *w->p++ = (uint8_t)value;
+
+    return CODEC_OK;
+}
+
+static inline int _put_bytes( codec_writer_t *w, const codec_bytes_t *bytes, uint32_t max ) {
+    if ((bytes->len > max) || ((bytes->data == NULL) && (bytes->len > 0))) { return CODEC_NOT_OK; }
+    if (_put_varint(w, bytes->len) < 0) { return CODEC_NOT_OK; }
+    if ((size_t)(w->end - w->p) < bytes->len) { return CODEC_NOT_OK; }
+
+    if (bytes->len > 0) { memcpy(w->p, bytes->data, bytes->len); }
+    w->p += bytes->len;
+
+    return CODEC_OK;
+}
+
+static inline int _get_fixed( codec_reader_t *r, size_t size, uint64_t *value ) {
+    if ((size_t)(r->end - r->p) < size) { return CODEC_NOT_OK; }
+
+    *value = 0;
+    for (size_t i=0; i<size; i++) {
+        *value |= (uint64_t)r->p[i] << (8 * i);
+    }
+    r->p += size;
+
+    return CODEC_OK;
+}
+
+/* Overlong encodings past CODEC_VARINT_MAX bytes, or bits past 64, are invalid */
+static inline int _get_varint( codec_reader_t *r, uint64_t *value ) {
+    uint64_t byte;
+
+    *value = 0;
+
+    for (int shift=0; shift<(7 * CODEC_VARINT_MAX); shift+=7) {
+        if (r->p == r->end) { return CODEC_NOT_OK; }
+
+        byte = *r->p++;
+
+        if ((shift == 63) && (byte > 1)) { return CODEC_NOT_OK; }
+
+        *value |= (byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) { return CODEC_OK; }
+    }
+
+    return CODEC_NOT_OK;
+}
+
+static inline int _get_bytes( codec_reader_t *r, codec_bytes_t *bytes, uint32_t max ) {
+    uint64_t len;
+
+    if (_get_varint(r, &len) < 0) { return CODEC_NOT_OK; }
+    if ((len > max) || ((uint64_t)(r->end - r->p) < len)) { return CODEC_NOT_OK; }
+
+    bytes->data = r->p;
+    bytes->len = (uint32_t)len;
+    r->p += len;
+
+    return CODEC_OK;
+}
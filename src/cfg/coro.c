@@ -0,0 +1,224 @@
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "coro.h"
+
+/* Capacity the timer heap starts with, doubled when full */
+#define CORO_TIMERS_INITIAL 64
+
+/* Coroutines waiting with a timeout, a min-heap on deadline_ms */
+static coro_t **timers;
+static int num_timers;
+static int max_timers;
+
+/* Bumped by every expiry, timers added while it's handled wait for the next one */
+static uint32_t timer_round;
+
+/* One timerfd, armed for the earliest deadline, wakes the event loop for every timeout */
+static int timer_fd = -1;
+static msec_t armed_ms = -1;
+
+/* Static Functions */
+static void _resume( coro_t *co );
+static void _clear_wait( coro_t *co );
+static int _add_timer( coro_t *co );
+static void _remove_timer( coro_t *co );
+static void _sift( int idx );
+static void _swap_timers( int a, int b );
+static void _arm_timer( void );
+static void _fd_handler( int fd, uint32_t events, void *ctx );
+static void _timer_handler( int fd, uint32_t events, void *ctx );
+
+int coro_start( coro_t *co, coro_fn_t fn, void *arg ) {
+    if ((co == NULL) || (fn == NULL)) { return CORO_NOT_OK; }
+
+    if (timer_fd < 0) {
+        if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+            printf("Failed to create coroutine timer\n");
+            return CORO_NOT_OK;
+        }
+
+        if (event_loop_watch_fd(timer_fd, EPOLLIN, _timer_handler, NULL) < 0) {
+            (void)close(timer_fd);
+            timer_fd = -1;
+            return CORO_NOT_OK;
+        }
+    }
+
+    memset(co, 0, sizeof(*co));
+    co->fn = fn;
+    co->arg = arg;
+    co->fd = -1;
+    co->timer_idx = -1;
+
+    _resume(co);
+
+    return CORO_OK;
+}
+
+int coro_cancel( coro_t *co ) {
+    if (co == NULL) { return CORO_NOT_OK; }
+
+    _clear_wait(co);
+    co->line = -1;
+
+    return CORO_OK;
+}
+
+/* Wait
+ *
+ * Registers the waits of the coroutine, the caller then returns CORO_WAITING. Either one resumes
+ * it and cancels the other.
+ */
+int coro_wait( coro_t *co, int fd, uint32_t events, int timeout_ms ) {
+    if (co == NULL) { return CORO_NOT_OK; }
+
+    co->timed_out = false;
+
+    if ((fd >= 0) && (event_loop_watch_fd(fd, events, _fd_handler, co) < 0)) {
+        co->result = CORO_NOT_OK;
+        return CORO_NOT_OK;
+    }
+
+    co->fd = fd;
+
+    if (timeout_ms >= 0) {
+        co->deadline_ms = get_monotonic_ms() + timeout_ms;
+
+        if (_add_timer(co) < 0) {
+            _clear_wait(co);
+            co->result = CORO_NOT_OK;
+            return CORO_NOT_OK;
+        }
+    }
+
+    return CORO_OK;
+}
+
+static void _resume( coro_t *co ) {
+    (void)co->fn(co);
+}
+
+static void _clear_wait( coro_t *co ) {
+    if (co->fd >= 0) {
+        (void)event_loop_unwatch_fd(co->fd);
+        co->fd = -1;
+    }
+
+    if (co->timer_idx >= 0) { _remove_timer(co); }
+}
+
+static int _add_timer( coro_t *co ) {
+    coro_t **grown;
+    int size;
+
+    if (num_timers == max_timers) {
+        size = (max_timers > 0) ? (max_timers * 2) : CORO_TIMERS_INITIAL;
+
+        if ((grown = realloc(timers, (size_t)size * sizeof(coro_t *))) == NULL) { return CORO_NOT_OK; }
+
+        timers = grown;
+        max_timers = size;
+    }
+
+    co->timer_round = timer_round;
+    co->timer_idx = num_timers;
+    timers[num_timers++] = co;
+    _sift(co->timer_idx);
+
+    /* Only an earlier deadline needs the timerfd armed again */
+    if ((armed_ms < 0) || (co->deadline_ms < armed_ms)) { _arm_timer(); }
+
+    return CORO_OK;
+}
+
+/* An earlier deadline that's removed leaves the timerfd armed, it fires for nothing once */
+static void _remove_timer( coro_t *co ) {
+    int idx = co->timer_idx;
+
+    co->timer_idx = -1;
+    num_timers--;
+
+    if (idx == num_timers) { return; }
+
+    timers[idx] = timers[num_timers];
+    timers[idx]->timer_idx = idx;
+    _sift(idx);
+}
+
+/* Moves the timer at idx up or down to its place */
+static void _sift( int idx ) {
+    int child;
+
+    while ((idx > 0) && (timers[idx]->deadline_ms < timers[(idx - 1) / 2]->deadline_ms)) {
+        _swap_timers(idx, (idx - 1) / 2);
+        idx = (idx - 1) / 2;
+    }
+
+    for (;;) {
+        child = (2 * idx) + 1;
+
+        if (child >= num_timers) { break; }
+        if (((child + 1) < num_timers) && (timers[child + 1]->deadline_ms < timers[child]->deadline_ms)) { child++; }
+        if (timers[idx]->deadline_ms <= timers[child]->deadline_ms) { break; }
+
+        _swap_timers(idx, child);
+        idx = child;
+    }
+}
+
+static void _swap_timers( int a, int b ) {
+    coro_t *tmp = timers[a];
+
+    timers[a] = timers[b];
+    timers[b] = tmp;
+    timers[a]->timer_idx = a;
+    timers[b]->timer_idx = b;
+}
+
+static void _arm_timer( void ) {
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+    armed_ms = -1;
+
+    if (num_timers > 0) {
+        armed_ms = timers[0]->deadline_ms;
+
+        /* A deadline of 0 would disarm it, it's in the past either way */
+        spec.it_value.tv_sec = armed_ms / 1000;
+        spec.it_value.tv_nsec = ((armed_ms % 1000) * 1000000) + 1;
+    }
+
+    (void)timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void _fd_handler( int __attribute__((unused)) fd, uint32_t __attribute__((unused)) events, void *ctx ) {
+    coro_t *co = (coro_t *)ctx;
+
+    _clear_wait(co);
+    _resume(co);
+}
+
+/* Resumes every coroutine whose deadline passed. Those that wait again meanwhile, e.g. CORO_YIELD(),
+ * are left for the next expiry, the timerfd fires again right away, after the other fds are handled.
+ */
+static void _timer_handler( int fd, uint32_t __attribute__((unused)) events, void __attribute__((unused)) *ctx ) {
+    msec_t now = get_monotonic_ms();
+    uint64_t expirations;
+    coro_t *co;
+
+    (void)read(fd, &expirations, sizeof(expirations));
+
+    timer_round++;
+
+    while ((num_timers > 0) && (timers[0]->deadline_ms <= now) && (timers[0]->timer_round != timer_round)) {
+        co = timers[0];
+        _clear_wait(co);
+        co->timed_out = true;
+        _resume(co);
+    }
+
+    _arm_timer();
+}
@@ -0,0 +1,149 @@
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_X86
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78U
+
+typedef uint32_t (*crc32c_fn_t)( uint32_t crc, const uint8_t *p, size_t len );
+
+static uint32_t crc32c_table[8][256];
+
+/* Set once on the first call, the table is built before it's published */
+static crc32c_fn_t crc32c_impl;
+static bool crc32c_table_built;
+
+/* Static Functions */
+static crc32c_fn_t _select_impl( void );
+static void _build_table( void );
+static uint32_t _crc32c_table( uint32_t crc, const uint8_t *p, size_t len );
+#ifdef CRC32C_X86
+static uint32_t _crc32c_sse42( uint32_t crc, const uint8_t *p, size_t len );
+#endif
+
+uint32_t crc32c( uint32_t crc, const void *buffer, size_t len ) {
+    crc32c_fn_t impl = __atomic_load_n(&crc32c_impl, __ATOMIC_ACQUIRE);
+
+    if (impl == NULL) {
+        impl = _select_impl();
+        __atomic_store_n(&crc32c_impl, impl, __ATOMIC_RELEASE);
+    }
+
+    if ((buffer == NULL) || (len == 0)) { return crc; }
+
+    return ~impl(~crc, buffer, len);
+}
+
+uint32_t crc32c_sw( uint32_t crc, const void *buffer, size_t len ) {
+    if (!__atomic_load_n(&crc32c_table_built, __ATOMIC_ACQUIRE)) { _build_table(); }
+
+    if ((buffer == NULL) || (len == 0)) { return crc; }
+
+    return ~_crc32c_table(~crc, buffer, len);
+}
+
+bool crc32c_hw( void ) {
+#ifdef CRC32C_X86
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+/* Select implementation
+ *
+ * Every thread that races here builds the same table and picks the same function, so the result
+ * doesn't depend on who publishes it.
+ */
+static crc32c_fn_t _select_impl( void ) {
+#ifdef CRC32C_X86
+    if (crc32c_hw()) { return _crc32c_sse42; }
+#endif
+
+    _build_table();
+
+    return _crc32c_table;
+}
+
+/* Same for the table, every racing thread writes the same values before setting the flag */
+static void _build_table( void ) {
+    uint32_t crc;
+
+    for (int i=0; i<256; i++) {
+        crc = (uint32_t)i;
+        for (int j=0; j<8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crc32c_table[0][i] = crc;
+    }
+
+    for (int i=0; i<256; i++) {
+        for (int k=1; k<8; k++) {
+            crc32c_table[k][i] = (crc32c_table[k - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[k - 1][i] & 0xff];
+        }
+    }
+
+    __atomic_store_n(&crc32c_table_built, true, __ATOMIC_RELEASE);
+}
+
+/* Slicing-by-8, eight table lookups per 8 bytes instead of one per byte */
+static uint32_t _crc32c_table( uint32_t crc, const uint8_t *p, size_t len ) {
+    uint32_t lo, hi;
+
+    while (len >= 8) {
+        lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+
+        crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+              crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+              crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+
+        p += 8;
+        len -= 8;
+    }
+
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    }
+
+    return crc;
+}
+
+#ifdef CRC32C_X86
+/* SSE4.2
+ *
+ * 8 bytes per instruction after aligning the pointer. Interleaving three streams would hide the
+ * instruction's latency, one stream already checks several GB/s, far more than a socket carries.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t _crc32c_sse42( uint32_t crc, const uint8_t *p, size_t len ) {
+    uint64_t crc64;
+    uint64_t word;
+
+    while ((len > 0) && (((uintptr_t)p & 7) != 0)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+
+    crc64 = crc;
+
+    while (len >= 8) {
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t)crc64;
+
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+
+    return crc;
+}
+#endif
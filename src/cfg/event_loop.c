@@ -0,0 +1,931 @@
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <sys/resource.h>
+
+#include "event_loop.h"
+#include "capture.h"
+#include "logger.h"
+#include "rudp.h"
+
+typedef enum {
+    E_WATCH_FREE = 0,
+    E_WATCH_LISTENER,
+    E_WATCH_CONN,
+    E_WATCH_FD,
+    E_WATCH_CLOSED,
+} E_WATCH_TYPE;
+
+typedef struct {
+    E_WATCH_TYPE kind;
+    int fd;
+    ev_conn_t conn;
+    msg_handler_t msg_handler;
+    close_handler_t close_handler;
+    fd_handler_t fd_handler;
+    writable_handler_t writable_handler;
+    void *ctx;
+    bool paused;
+    bool want_write;
+    bool blocked;
+    msec_t resume_at;
+} ev_watch_t;
+
+/* Compact connections are registered with their fd and this bit, no watch pointer has it set */
+#define EVENT_COMPACT_TAG (1ULL << 63)
+
+#define COMPACT_USED 0x01
+#define COMPACT_PAUSED 0x02
+
+/* Compact connection
+ *
+ * A stream connection of a compact listener, indexed by its fd. The peer is packed, an AF_UNIX peer
+ * keeps only its family, accepted local sockets are unnamed. The handlers are the listener's.
+ */
+typedef struct {
+    uint8_t flags;
+    uint8_t listener;
+    uint16_t family;
+    uint16_t port;
+    uint32_t resume_at;
+    uint8_t addr[16];
+    void *data;
+} ev_compact_t;
+
+/* Handlers of a compact listener, kept apart from its watch so they outlive event_loop_stop_listener() */
+typedef struct {
+    bool enabled;
+    E_APP_SOCK_TYPE type;
+    msg_handler_t msg_handler;
+    close_handler_t close_handler;
+    void *ctx;
+} ev_compact_listener_t;
+
+static int epoll_fd = -1;
+
+static ev_watch_t watches[MAX_NUM_OF_WATCHES];
+
+static char *recv_buffer;
+static size_t recv_buffer_size;
+
+/* Set while events are dispatched, closed watches aren't reused until the batch is complete */
+static bool dispatching;
+
+/* Connections that are out of tokens aren't read until they have one again */
+static int num_paused;
+
+static ev_compact_listener_t compact_listeners[MAX_NUM_OF_SOCKS];
+
+/* Compact connections by fd, grown to the highest fd accepted */
+static ev_compact_t *compact_conns;
+static int compact_size;
+static int num_compact;
+
+/* fds of the compact connections that are paused */
+static int *paused_compact;
+static int num_paused_compact;
+static int max_paused_compact;
+
+/* Static Functions */
+static ev_watch_t *_alloc_watch( E_WATCH_TYPE kind, int fd, uint32_t events );
+static void _free_watch( ev_watch_t *watch );
+static ev_watch_t *_find_watch( E_WATCH_TYPE kind, int fd );
+static ev_watch_t *_conn_watch( ev_conn_t *conn );
+static uint32_t _conn_events( const ev_watch_t *watch );
+static void _close_fd( int fd );
+static void _accept_conns( ev_watch_t *listener );
+static void _receive_conn( ev_watch_t *watch );
+static void _receive_datagram( ev_watch_t *listener );
+static void _receive_rudp( ev_watch_t *listener );
+static void _pause_conn( ev_watch_t *watch, msec_t wait_ms );
+static int _resume_conns( int timeout_ms );
+static int _add_compact( sock_id_t listener, int fd, const sockaddr_storage_t *peer );
+static void _load_compact( int fd, ev_conn_t *conn );
+static void _receive_compact( int fd );
+static int _close_compact( ev_conn_t *conn );
+static void _pause_compact( int fd, msec_t wait_ms );
+static void _unpause_compact( int fd );
+
+int event_loop_init( size_t buffer_size ) {
+    if (epoll_fd >= 0) { return event_loop_set_buffer_size(buffer_size); }
+
+    /* Create an epoll instance
+     *
+     * The interest list is kept by the kernel, epoll_wait() only returns the fds that are ready. Cost
+     * is proportional to the number of ready fds, not the number of watched fds, unlike poll().
+     */
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        log_error("Failed to create event loop");
+        return EVENT_NOT_OK;
+    }
+
+    return event_loop_set_buffer_size(buffer_size);
+}
+
+/* Set receive buffer size
+ *
+ * One buffer is shared by every listener, messages are handed to the handler before the next
+ * receive. One extra byte is allocated so the buffer can always be NUL terminated.
+ */
+int event_loop_set_buffer_size( size_t buffer_size ) {
+    char *buffer;
+
+    if (buffer_size == 0) { return EVENT_NOT_OK; }
+    if (buffer_size == recv_buffer_size) { return EVENT_OK; }
+
+    if ((buffer = realloc(recv_buffer, buffer_size + 1)) == NULL) {
+        return EVENT_NOT_OK;
+    }
+
+    recv_buffer = buffer;
+    recv_buffer_size = buffer_size;
+
+    return EVENT_OK;
+}
+
+int event_loop_add_listener( sock_id_t id, msg_handler_t handler, void *ctx ) {
+    ev_watch_t *watch;
+    int fd;
+    int type;
+
+    if (handler == NULL) { return EVENT_NOT_OK; }
+    if ((fd = get_sock_fd(id)) < 0) { return EVENT_NOT_OK; }
+    if ((type = get_sock_app_type(id)) < 0) { return EVENT_NOT_OK; }
+
+    /* A readable listener may still have nothing to accept, it must never block the loop */
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) { return EVENT_NOT_OK; }
+
+    if ((watch = _alloc_watch(E_WATCH_LISTENER, fd, EPOLLIN)) == NULL) { return EVENT_NOT_OK; }
+
+    watch->conn.fd = fd;
+    watch->conn.listener = id;
+    watch->conn.type = (E_APP_SOCK_TYPE)type;
+    watch->msg_handler = handler;
+    watch->ctx = ctx;
+
+    /* The id may have belonged to another listener */
+    capture_forget_listener(id);
+    compact_listeners[id].enabled = false;
+
+    return EVENT_OK;
+}
+
+int event_loop_remove_listener( sock_id_t id ) {
+    ev_conn_t conn;
+
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if ((watches[i].kind == E_WATCH_CONN) && (watches[i].conn.listener == id)) {
+            (void)event_loop_close_conn(&watches[i].conn);
+        }
+    }
+
+    for (int fd=0; (fd<compact_size) && (num_compact > 0); fd++) {
+        if ((compact_conns[fd].flags & COMPACT_USED) && (compact_conns[fd].listener == id)) {
+            _load_compact(fd, &conn);
+            (void)_close_compact(&conn);
+        }
+    }
+
+    return event_loop_stop_listener(id);
+}
+
+/* Set close handler
+ *
+ * Applies to connections accepted on the listener afterwards, so it's set right after adding it.
+ */
+int event_loop_set_close_handler( sock_id_t id, close_handler_t handler ) {
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if ((watches[i].kind == E_WATCH_LISTENER) && (watches[i].conn.listener == id)) {
+            watches[i].close_handler = handler;
+            compact_listeners[id].close_handler = handler;
+            return EVENT_OK;
+        }
+    }
+
+    return EVENT_NOT_OK;
+}
+
+int event_loop_set_writable_handler( sock_id_t id, writable_handler_t handler ) {
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if ((watches[i].kind == E_WATCH_LISTENER) && (watches[i].conn.listener == id)) {
+            watches[i].writable_handler = handler;
+            return EVENT_OK;
+        }
+    }
+
+    return EVENT_NOT_OK;
+}
+
+/* Want write
+ *
+ * A connection is only blocked while it waits for room, otherwise nothing would resume it. The
+ * rate limiter's pause is kept apart, either one stops reading.
+ */
+int event_loop_want_write( ev_conn_t *conn, bool write, bool block ) {
+    struct epoll_event ev;
+    ev_watch_t *watch;
+
+    if ((watch = _conn_watch(conn)) == NULL) { return EVENT_NOT_OK; }
+
+    block = block && write;
+
+    if ((watch->want_write == write) && (watch->blocked == block)) { return EVENT_OK; }
+
+    watch->want_write = write;
+    watch->blocked = block;
+
+    ev.events = _conn_events(watch);
+    ev.data.ptr = watch;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, watch->fd, &ev) < 0) { return EVENT_NOT_OK; }
+
+    return EVENT_OK;
+}
+
+/* Set compact
+ *
+ * Like the close handler, applies to connections accepted afterwards. The process may need more fds
+ * than its soft limit, it's raised to the hard limit.
+ */
+int event_loop_set_compact( sock_id_t id, bool enable ) {
+    struct rlimit limit;
+
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if ((watches[i].kind != E_WATCH_LISTENER) || (watches[i].conn.listener != id)) { continue; }
+
+        if ((watches[i].conn.type != E_TCP_SOCK) && (watches[i].conn.type != E_LOCAL_SOCK)) { return EVENT_NOT_OK; }
+
+        compact_listeners[id].enabled = enable;
+        compact_listeners[id].type = watches[i].conn.type;
+        compact_listeners[id].msg_handler = watches[i].msg_handler;
+        compact_listeners[id].close_handler = watches[i].close_handler;
+        compact_listeners[id].ctx = watches[i].ctx;
+
+        if (enable && (getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < limit.rlim_max)) {
+            limit.rlim_cur = limit.rlim_max;
+            (void)setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        return EVENT_OK;
+    }
+
+    return EVENT_NOT_OK;
+}
+
+/* Stop a listener
+ *
+ * No more connections are accepted, or datagrams received, on the listener. Connections that are
+ * already accepted are still dispatched, so they can be drained before shutting down.
+ */
+int event_loop_stop_listener( sock_id_t id ) {
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if ((watches[i].kind == E_WATCH_LISTENER) && (watches[i].conn.listener == id)) {
+            (void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, watches[i].fd, NULL);
+            _free_watch(&watches[i]);
+            return EVENT_OK;
+        }
+    }
+
+    return EVENT_NOT_OK;
+}
+
+int event_loop_num_conns( void ) {
+    int num_conns = num_compact;
+
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if (watches[i].kind == E_WATCH_CONN) { num_conns++; }
+    }
+
+    return num_conns;
+}
+
+void event_loop_close_all_conns( void ) {
+    ev_conn_t conn;
+
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if (watches[i].kind == E_WATCH_CONN) {
+            (void)event_loop_close_conn(&watches[i].conn);
+        }
+    }
+
+    for (int fd=0; (fd<compact_size) && (num_compact > 0); fd++) {
+        if (compact_conns[fd].flags & COMPACT_USED) {
+            _load_compact(fd, &conn);
+            (void)_close_compact(&conn);
+        }
+    }
+}
+
+int event_loop_watch_fd( int fd, uint32_t events, fd_handler_t handler, void *ctx ) {
+    ev_watch_t *watch;
+
+    if (handler == NULL) { return EVENT_NOT_OK; }
+
+    if ((watch = _alloc_watch(E_WATCH_FD, fd, events)) == NULL) { return EVENT_NOT_OK; }
+
+    watch->fd_handler = handler;
+    watch->ctx = ctx;
+
+    return EVENT_OK;
+}
+
+int event_loop_modify_fd( int fd, uint32_t events ) {
+    struct epoll_event ev;
+    ev_watch_t *watch;
+
+    if ((watch = _find_watch(E_WATCH_FD, fd)) == NULL) { return EVENT_NOT_OK; }
+
+    ev.events = events;
+    ev.data.ptr = watch;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) { return EVENT_NOT_OK; }
+
+    return EVENT_OK;
+}
+
+int event_loop_unwatch_fd( int fd ) {
+    ev_watch_t *watch;
+
+    if ((watch = _find_watch(E_WATCH_FD, fd)) == NULL) { return EVENT_NOT_OK; }
+
+    (void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    _free_watch(watch);
+
+    return EVENT_OK;
+}
+
+/* Run event loop once
+ *
+ * Level triggered, a listener with more pending connections or data than is handled in one dispatch
+ * is reported again on the next call, so one busy connection can't starve the others.
+ */
+int event_loop_run_once( int timeout_ms ) {
+    struct epoll_event events[MAX_NUM_OF_EVENTS];
+    ev_watch_t *watch;
+    int num_events;
+
+    if (epoll_fd < 0) { return EVENT_NOT_OK; }
+
+    if (num_paused > 0) {
+        timeout_ms = _resume_conns(timeout_ms);
+    }
+
+    if ((num_events = epoll_wait(epoll_fd, events, MAX_NUM_OF_EVENTS, timeout_ms)) < 0) {
+        /* Interrupted by a signal, e.g. SIGHUP, not an error */
+        return (errno == EINTR) ? 0 : EVENT_NOT_OK;
+    }
+
+    dispatching = true;
+
+    for (int i=0; i<num_events; i++) {
+        if (events[i].data.u64 & EVENT_COMPACT_TAG) {
+            _receive_compact((int)(events[i].data.u64 & ~EVENT_COMPACT_TAG));
+            continue;
+        }
+
+        watch = (ev_watch_t *)events[i].data.ptr;
+
+        switch (watch->kind) {
+            case E_WATCH_LISTENER:
+                if (watch->conn.type == E_UDP_SOCK) {
+                    _receive_datagram(watch);
+                } else if (watch->conn.type == E_RUDP_SOCK) {
+                    _receive_rudp(watch);
+                } else {
+                    _accept_conns(watch);
+                }
+                break;
+            case E_WATCH_CONN:
+                if ((events[i].events & EPOLLOUT) && (watch->writable_handler != NULL)) {
+                    watch->writable_handler(&watch->conn, watch->ctx);
+                }
+
+                /* The writable handler may have closed it */
+                if ((watch->kind != E_WATCH_CONN) || !(events[i].events & ~(uint32_t)EPOLLOUT)) { break; }
+
+                if (watch->paused || watch->blocked) {
+                    /* Only a hang up or error is reported while not reading */
+                    (void)event_loop_close_conn(&watch->conn);
+                } else {
+                    _receive_conn(watch);
+                }
+                break;
+            case E_WATCH_FD:
+                watch->fd_handler(watch->fd, events[i].events, watch->ctx);
+                break;
+            default:
+                /* Closed earlier in this batch */
+                break;
+        }
+    }
+
+    dispatching = false;
+
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if (watches[i].kind == E_WATCH_CLOSED) {
+            watches[i].kind = E_WATCH_FREE;
+        }
+    }
+
+    return num_events;
+}
+
+int event_loop_reply( ev_conn_t *conn, const void *buffer, size_t len ) {
+    ssize_t num_bytes;
+
+    if ((conn == NULL) || (buffer == NULL)) { return EVENT_NOT_OK; }
+
+    if (conn->type == E_RUDP_SOCK) {
+        if (rudp_send(conn->listener, (const sockaddr_t *)&conn->peer, conn->peer_len, buffer, len) != SOCK_OK) {
+            return EVENT_NOT_OK;
+        }
+        num_bytes = (ssize_t)len;
+    } else if (conn->type == E_UDP_SOCK) {
+        num_bytes = sendto(conn->fd, buffer, len, 0, (const sockaddr_t *)&conn->peer, conn->peer_len);
+    } else {
+        /* A peer that closed its end must not kill the server with SIGPIPE */
+        num_bytes = send(conn->fd, buffer, len, MSG_NOSIGNAL);
+        (void)uncork_sock_conn(conn->listener, conn->fd);
+    }
+
+    return (num_bytes < 0) ? EVENT_NOT_OK : (int)num_bytes;
+}
+
+int event_loop_close_conn( ev_conn_t *conn ) {
+    ev_watch_t *watch;
+
+    if (conn == NULL) { return EVENT_NOT_OK; }
+    if ((conn->type == E_UDP_SOCK) || (conn->type == E_RUDP_SOCK)) { return EVENT_OK; }
+
+    /* Not a watch's, it's a compact connection loaded for a handler */
+    if (((char *)conn < (char *)watches) || ((char *)conn >= (char *)&watches[MAX_NUM_OF_WATCHES])) {
+        return _close_compact(conn);
+    }
+
+    if ((watch = _conn_watch(conn)) == NULL) { return EVENT_NOT_OK; }
+
+    if (watch->close_handler != NULL) {
+        watch->close_handler(&watch->conn, watch->ctx);
+    }
+
+    capture_conn_closed(&watch->conn);
+
+    if (watch->paused) {
+        num_paused--;
+    }
+
+    release_sock_conn(watch->conn.listener, &watch->conn.peer, watch->fd);
+
+    _close_fd(watch->fd);
+    _free_watch(watch);
+
+    return EVENT_OK;
+}
+
+/* Accept connections
+ *
+ * Accepts every pending connection on a stream listener. Accepted sockets are non-blocking and are
+ * tuned with the options of the listener. If the watch table is full, or the listener's connection
+ * limits are reached, the connection is refused.
+ */
+static void _accept_conns( ev_watch_t *listener ) {
+    sockaddr_storage_t peer;
+    socklen_t peer_len;
+    ev_watch_t *watch;
+    int fd;
+
+    for (;;) {
+        peer_len = sizeof(peer);
+
+        if ((fd = accept4(listener->fd, (sockaddr_t *)&peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                log_error("Failed to accept connection.");
+            }
+            return;
+        }
+
+        if (!admit_sock_conn(listener->conn.listener, &peer, fd)) {
+            (void)close(fd);
+            continue;
+        }
+
+        if (compact_listeners[listener->conn.listener].enabled) {
+            if (_add_compact(listener->conn.listener, fd, &peer) < 0) {
+                log_warn("Failed to add compact connection, refusing");
+                release_sock_conn(listener->conn.listener, &peer, fd);
+                (void)close(fd);
+            } else {
+                (void)apply_sock_conn_opts(listener->conn.listener, fd);
+            }
+            continue;
+        }
+
+        if ((watch = _alloc_watch(E_WATCH_CONN, fd, EPOLLIN)) == NULL) {
+            log_warn("Too many connections, refusing");
+            release_sock_conn(listener->conn.listener, &peer, fd);
+            (void)close(fd);
+            continue;
+        }
+
+        (void)apply_sock_conn_opts(listener->conn.listener, fd);
+
+        watch->conn.fd = fd;
+        watch->conn.listener = listener->conn.listener;
+        watch->conn.type = listener->conn.type;
+        watch->conn.peer = peer;
+        watch->conn.peer_len = peer_len;
+        watch->msg_handler = listener->msg_handler;
+        watch->close_handler = listener->close_handler;
+        watch->writable_handler = listener->writable_handler;
+        watch->ctx = listener->ctx;
+    }
+}
+
+/* Receive on a connection
+ *
+ * A peer that is out of tokens isn't read, its data stays in the socket so the sender is slowed down
+ * by flow control instead of losing messages. What's read is charged by the byte, a receive may hold
+ * any number of messages.
+ */
+static void _receive_conn( ev_watch_t *watch ) {
+    ssize_t num_bytes;
+    msec_t wait_ms;
+
+    if ((wait_ms = admit_sock_stream(watch->conn.listener, &watch->conn.peer, watch->fd)) > 0) {
+        _pause_conn(watch, wait_ms);
+        return;
+    }
+
+    num_bytes = recv(watch->fd, recv_buffer, recv_buffer_size, 0);
+
+    if (num_bytes > 0) {
+        charge_sock_stream(watch->conn.listener, &watch->conn.peer, watch->fd, (size_t)num_bytes);
+        (void)rearm_sock_quickack(watch->conn.listener, watch->fd);
+        recv_buffer[num_bytes] = '\0';
+        capture_message(&watch->conn, recv_buffer, num_bytes);
+        watch->msg_handler(&watch->conn, recv_buffer, num_bytes, watch->ctx);
+    } else if ((num_bytes == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) {
+        /* Peer closed the connection, or it failed */
+        (void)event_loop_close_conn(&watch->conn);
+    }
+}
+
+static void _receive_datagram( ev_watch_t *listener ) {
+    ssize_t num_bytes;
+
+    listener->conn.peer_len = sizeof(listener->conn.peer);
+
+    num_bytes = recvfrom(listener->fd, recv_buffer, recv_buffer_size, 0,
+        (sockaddr_t *)&listener->conn.peer, &listener->conn.peer_len);
+
+    /* Datagrams over the peer's rate are dropped */
+    if ((num_bytes >= 0) && (admit_sock_message(listener->conn.listener, &listener->conn.peer, listener->fd) == 0)) {
+        recv_buffer[num_bytes] = '\0';
+        capture_message(&listener->conn, recv_buffer, num_bytes);
+        listener->msg_handler(&listener->conn, recv_buffer, num_bytes, listener->ctx);
+    }
+}
+
+/* Receive reliable UDP
+ *
+ * Datagrams are consumed by the reliable UDP layer, which sends the acks. Only complete in-order
+ * messages reach the handler, the handler may remove the listener. A message larger than the receive
+ * buffer is dropped rather than handled cut, and peers whose state was dropped are logged.
+ */
+static void _receive_rudp( ev_watch_t *listener ) {
+    rudp_drop_t drop;
+    int num_bytes;
+
+    (void)rudp_process(listener->conn.listener);
+
+    while (rudp_dropped(listener->conn.listener, &drop) == SOCK_OK) {
+        log_warn("Dropped reliable UDP peer, %u messages unacknowledged, %u undelivered", drop.unacked,
+            drop.undelivered);
+    }
+
+    while (listener->kind == E_WATCH_LISTENER) {
+        listener->conn.peer_len = sizeof(listener->conn.peer);
+
+        num_bytes = rudp_receive(listener->conn.listener, recv_buffer, recv_buffer_size,
+            &listener->conn.peer, &listener->conn.peer_len);
+
+        if (num_bytes < 0) { break; }
+
+        if ((size_t)num_bytes > recv_buffer_size) {
+            log_warn("Reliable UDP message of %d bytes is larger than the receive buffer, dropped", num_bytes);
+            continue;
+        }
+
+        recv_buffer[num_bytes] = '\0';
+        capture_message(&listener->conn, recv_buffer, num_bytes);
+        listener->msg_handler(&listener->conn, recv_buffer, num_bytes, listener->ctx);
+    }
+}
+
+static void _pause_conn( ev_watch_t *watch, msec_t wait_ms ) {
+    struct epoll_event ev;
+
+    watch->paused = true;
+
+    ev.events = _conn_events(watch);
+    ev.data.ptr = watch;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, watch->fd, &ev) < 0) {
+        watch->paused = false;
+        return;
+    }
+
+    watch->resume_at = get_monotonic_ms() + wait_ms;
+    num_paused++;
+}
+
+/* Resume connections
+ *
+ * Re-enables paused connections that are due, returns timeout_ms shortened to the next one that
+ * isn't, so the wait doesn't outlast it.
+ */
+static int _resume_conns( int timeout_ms ) {
+    struct epoll_event ev;
+    msec_t now = get_monotonic_ms();
+    int32_t wait_ms;
+    int fd;
+
+    for (int i=0; i<num_paused_compact; ) {
+        fd = paused_compact[i];
+        wait_ms = (int32_t)(compact_conns[fd].resume_at - (uint32_t)now);
+
+        if (wait_ms > 0) {
+            if ((timeout_ms < 0) || (wait_ms < timeout_ms)) { timeout_ms = wait_ms; }
+            i++;
+            continue;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = EVENT_COMPACT_TAG | (uint64_t)fd;
+
+        (void)epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+
+        /* The last one takes its place */
+        paused_compact[i] = paused_compact[--num_paused_compact];
+        compact_conns[fd].flags &= (uint8_t)~COMPACT_PAUSED;
+        num_paused--;
+    }
+
+    for (int i=0; (i<MAX_NUM_OF_WATCHES) && (num_paused > 0); i++) {
+        if ((watches[i].kind != E_WATCH_CONN) || !watches[i].paused) { continue; }
+
+        if (watches[i].resume_at > now) {
+            if ((timeout_ms < 0) || ((watches[i].resume_at - now) < timeout_ms)) {
+                timeout_ms = (int)(watches[i].resume_at - now);
+            }
+            continue;
+        }
+
+        watches[i].paused = false;
+        num_paused--;
+
+        ev.events = _conn_events(&watches[i]);
+        ev.data.ptr = &watches[i];
+
+        (void)epoll_ctl(epoll_fd, EPOLL_CTL_MOD, watches[i].fd, &ev);
+    }
+
+    return timeout_ms;
+}
+
+static ev_watch_t *_alloc_watch( E_WATCH_TYPE kind, int fd, uint32_t events ) {
+    struct epoll_event ev;
+
+    if (epoll_fd < 0) { return NULL; }
+
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if (watches[i].kind != E_WATCH_FREE) { continue; }
+
+        memset(&watches[i], 0, sizeof(watches[i]));
+
+        ev.events = events;
+        ev.data.ptr = &watches[i];
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) { return NULL; }
+
+        watches[i].kind = kind;
+        watches[i].fd = fd;
+
+        return &watches[i];
+    }
+
+    return NULL;
+}
+
+static void _free_watch( ev_watch_t *watch ) {
+    watch->kind = dispatching ? E_WATCH_CLOSED : E_WATCH_FREE;
+    watch->fd = -1;
+}
+
+static ev_watch_t *_find_watch( E_WATCH_TYPE kind, int fd ) {
+    for (int i=0; i<MAX_NUM_OF_WATCHES; i++) {
+        if ((watches[i].kind == kind) && (watches[i].fd == fd)) {
+            return &watches[i];
+        }
+    }
+    return NULL;
+}
+
+/* The watch of a stream connection, NULL for compact and datagram connections */
+static ev_watch_t *_conn_watch( ev_conn_t *conn ) {
+    ev_watch_t *watch;
+
+    if ((conn == NULL) || ((char *)conn < (char *)watches) || ((char *)conn >= (char *)&watches[MAX_NUM_OF_WATCHES])) {
+        return NULL;
+    }
+
+    watch = (ev_watch_t *)((char *)conn - offsetof(ev_watch_t, conn));
+
+    return (watch->kind == E_WATCH_CONN) ? watch : NULL;
+}
+
+static uint32_t _conn_events( const ev_watch_t *watch ) {
+    uint32_t events = (watch->paused || watch->blocked) ? 0 : EPOLLIN;
+
+    return watch->want_write ? (events | EPOLLOUT) : events;
+}
+
+/* Close a connection's fd
+ *
+ * Removed from the interest list first. epoll tracks the open file, not the fd, so a dup() of it
+ * that's still open elsewhere would otherwise keep reporting events for a closed fd.
+ */
+static void _close_fd( int fd ) {
+    (void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    (void)close(fd);
+}
+
+static int _add_compact( sock_id_t listener, int fd, const sockaddr_storage_t *peer ) {
+    struct epoll_event ev;
+    ev_compact_t *grown;
+    ev_compact_t *rec;
+    int size;
+
+    if (fd >= compact_size) {
+        size = (compact_size > 0) ? compact_size : 1024;
+        while (size <= fd) { size *= 2; }
+
+        if ((grown = realloc(compact_conns, (size_t)size * sizeof(ev_compact_t))) == NULL) { return EVENT_NOT_OK; }
+
+        memset(&grown[compact_size], 0, (size_t)(size - compact_size) * sizeof(ev_compact_t));
+        compact_conns = grown;
+        compact_size = size;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_COMPACT_TAG | (uint64_t)fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) { return EVENT_NOT_OK; }
+
+    rec = &compact_conns[fd];
+    memset(rec, 0, sizeof(*rec));
+    rec->flags = COMPACT_USED;
+    rec->listener = (uint8_t)listener;
+    rec->family = peer->ss_family;
+
+    if (peer->ss_family == AF_INET) {
+        rec->port = ((const sockaddr_in_t *)peer)->sin_port;
+        memcpy(rec->addr, &((const sockaddr_in_t *)peer)->sin_addr, 4);
+    } else if (peer->ss_family == AF_INET6) {
+        rec->port = ((const sockaddr_in6_t *)peer)->sin6_port;
+        memcpy(rec->addr, &((const sockaddr_in6_t *)peer)->sin6_addr, 16);
+    }
+
+    num_compact++;
+
+    return EVENT_OK;
+}
+
+/* Unpacks a compact connection into conn, which is only valid until the connection is closed */
+static void _load_compact( int fd, ev_conn_t *conn ) {
+    ev_compact_t *rec = &compact_conns[fd];
+
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = fd;
+    conn->listener = rec->listener;
+    conn->type = compact_listeners[rec->listener].type;
+    conn->peer.ss_family = rec->family;
+    conn->data = rec->data;
+
+    if (rec->family == AF_INET) {
+        ((sockaddr_in_t *)&conn->peer)->sin_port = rec->port;
+        memcpy(&((sockaddr_in_t *)&conn->peer)->sin_addr, rec->addr, 4);
+        conn->peer_len = sizeof(sockaddr_in_t);
+    } else if (rec->family == AF_INET6) {
+        ((sockaddr_in6_t *)&conn->peer)->sin6_port = rec->port;
+        memcpy(&((sockaddr_in6_t *)&conn->peer)->sin6_addr, rec->addr, 16);
+        conn->peer_len = sizeof(sockaddr_in6_t);
+    } else {
+        conn->peer_len = sizeof(sa_family_t);
+    }
+}
+
+/* Receive on a compact connection
+ *
+ * Same as _receive_conn(), with the connection unpacked for the handler and data packed back after.
+ * A handler that closed the connection leaves it unused, no connection is accepted in the meantime.
+ */
+static void _receive_compact( int fd ) {
+    ev_compact_listener_t *listener;
+    ev_conn_t conn;
+    ssize_t num_bytes;
+    msec_t wait_ms;
+
+    /* Closed earlier in this batch */
+    if ((fd >= compact_size) || !(compact_conns[fd].flags & COMPACT_USED)) { return; }
+
+    _load_compact(fd, &conn);
+    listener = &compact_listeners[compact_conns[fd].listener];
+
+    if (compact_conns[fd].flags & COMPACT_PAUSED) {
+        /* Only a hang up or error is reported while paused */
+        (void)_close_compact(&conn);
+        return;
+    }
+
+    if ((wait_ms = admit_sock_stream(conn.listener, &conn.peer, fd)) > 0) {
+        _pause_compact(fd, wait_ms);
+        return;
+    }
+
+    num_bytes = recv(fd, recv_buffer, recv_buffer_size, 0);
+
+    if (num_bytes > 0) {
+        charge_sock_stream(conn.listener, &conn.peer, fd, (size_t)num_bytes);
+        (void)rearm_sock_quickack(conn.listener, fd);
+        recv_buffer[num_bytes] = '\0';
+        capture_message(&conn, recv_buffer, num_bytes);
+        listener->msg_handler(&conn, recv_buffer, num_bytes, listener->ctx);
+
+        if (compact_conns[fd].flags & COMPACT_USED) { compact_conns[fd].data = conn.data; }
+    } else if ((num_bytes == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) {
+        (void)_close_compact(&conn);
+    }
+}
+
+static int _close_compact( ev_conn_t *conn ) {
+    ev_compact_listener_t *listener;
+    int fd = conn->fd;
+
+    if ((fd < 0) || (fd >= compact_size) || !(compact_conns[fd].flags & COMPACT_USED)) { return EVENT_NOT_OK; }
+
+    listener = &compact_listeners[compact_conns[fd].listener];
+
+    if (listener->close_handler != NULL) {
+        listener->close_handler(conn, listener->ctx);
+    }
+
+    capture_conn_closed(conn);
+
+    if (compact_conns[fd].flags & COMPACT_PAUSED) { _unpause_compact(fd); }
+
+    release_sock_conn(conn->listener, &conn->peer, fd);
+
+    _close_fd(fd);
+
+    compact_conns[fd].flags = 0;
+    compact_conns[fd].data = NULL;
+    num_compact--;
+
+    return EVENT_OK;
+}
+
+static void _pause_compact( int fd, msec_t wait_ms ) {
+    struct epoll_event ev;
+    int *grown;
+    int size;
+
+    if (num_paused_compact == max_paused_compact) {
+        size = (max_paused_compact > 0) ? (max_paused_compact * 2) : 64;
+
+        if ((grown = realloc(paused_compact, (size_t)size * sizeof(int))) == NULL) { return; }
+
+        paused_compact = grown;
+        max_paused_compact = size;
+    }
+
+    ev.events = 0;
+    ev.data.u64 = EVENT_COMPACT_TAG | (uint64_t)fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) { return; }
+
+    compact_conns[fd].flags |= COMPACT_PAUSED;
+    compact_conns[fd].resume_at = (uint32_t)(get_monotonic_ms() + wait_ms);
+    paused_compact[num_paused_compact++] = fd;
+    num_paused++;
+}
+
+static void _unpause_compact( int fd ) {
+    for (int i=0; i<num_paused_compact; i++) {
+        if (paused_compact[i] != fd) { continue; }
+
+        paused_compact[i] = paused_compact[--num_paused_compact];
+        compact_conns[fd].flags &= (uint8_t)~COMPACT_PAUSED;
+        num_paused--;
+        return;
+    }
+}
@@ -0,0 +1,462 @@
+#include "kv.h"
+#include "crc32c.h"
+
+/* The table holds one item per KV_AVG_ITEM_SIZE bytes of the budget, smaller items are evicted
+ * earlier than their memory needs, to keep the table at a quarter of the budget
+ */
+#define KV_AVG_ITEM_SIZE 128
+
+#define KV_ITEM_USED 0x01
+#define KV_ITEM_REF 0x02
+
+/* Item, stored in a chunk of its class, the key followed by the value. A free chunk keeps the
+ * next free chunk of its class in data.
+ */
+typedef struct {
+    uint32_t hash;
+    uint8_t flags;
+    uint8_t cls;
+    uint16_t key_len;
+    uint32_t value_len;
+    msec_t expires_ms;
+    uint8_t data[];
+} kv_item_t;
+
+typedef struct {
+    uint32_t hash;
+    kv_item_t *item;
+} kv_entry_t;
+
+/* Size class, hand is the CLOCK position over every chunk of its pages in order */
+typedef struct {
+    size_t chunk_size;
+    uint32_t per_page;
+    uint8_t **pages;
+    int num_pages;
+    kv_item_t *free_list;
+    uint32_t hand;
+} kv_class_t;
+
+static kv_class_t classes[KV_NUM_CLASSES];
+static int max_pages;
+static int used_pages;
+
+/* Open addressing, an entry is empty when item is NULL */
+static kv_entry_t *table;
+static uint32_t table_mask;
+static uint32_t max_items;
+
+static kv_stats_t stats;
+static size_t kv_memory;
+
+/* Static Functions */
+static uint32_t _hash( const void *key, size_t key_len );
+static int _find( const void *key, size_t key_len, uint32_t hash );
+static void _insert( kv_item_t *item );
+static void _remove_at( uint32_t idx );
+static void _unlink( kv_item_t *item );
+static bool _expired( const kv_item_t *item, msec_t now );
+static int _class_of( size_t size );
+static kv_item_t *_alloc( int cls );
+static kv_item_t *_chunk( const kv_class_t *c, uint32_t idx );
+static void _add_page( int cls, uint8_t *page );
+static int _evict( int cls );
+static int _steal_page( int cls );
+
+int kv_init( size_t memory_bytes ) {
+    uint32_t size = 1;
+
+    if (table != NULL) {
+        if (memory_bytes == kv_memory) { return KV_OK; }
+        printf("KV memory can't change while running, keeping %zu MB\n", kv_memory / (1024 * 1024));
+        return KV_NOT_OK;
+    }
+
+    /* A page for every class, so there's always a class with pages to spare */
+    if (memory_bytes < (KV_NUM_CLASSES * KV_PAGE_SIZE)) { return KV_NOT_OK; }
+
+    max_pages = (int)(memory_bytes / KV_PAGE_SIZE);
+    max_items = (uint32_t)(memory_bytes / KV_AVG_ITEM_SIZE);
+
+    /* At most 3/4 full, probes stay short */
+    while (size < (max_items / 3) * 4) { size <<= 1; }
+
+    if ((table = calloc(size, sizeof(kv_entry_t))) == NULL) { return KV_NOT_OK; }
+
+    table_mask = size - 1;
+
+    for (int i=0; i<KV_NUM_CLASSES; i++) {
+        classes[i].chunk_size = (size_t)KV_MIN_CHUNK_SIZE << i;
+        classes[i].per_page = (uint32_t)(KV_PAGE_SIZE / classes[i].chunk_size);
+
+        if ((classes[i].pages = calloc((size_t)max_pages, sizeof(uint8_t *))) == NULL) { return KV_NOT_OK; }
+    }
+
+    kv_memory = memory_bytes;
+    memset(&stats, 0, sizeof(stats));
+
+    return KV_OK;
+}
+
+int kv_get( const void *key, size_t key_len, const void **value, size_t *value_len ) {
+    kv_item_t *item;
+    int idx;
+
+    if ((table == NULL) || (key == NULL) || (value == NULL) || (value_len == NULL)) { return KV_NOT_OK; }
+
+    stats.gets++;
+
+    if ((idx = _find(key, key_len, _hash(key, key_len))) < 0) { return KV_NOT_FOUND; }
+
+    item = table[idx].item;
+
+    if (_expired(item, get_monotonic_ms())) {
+        stats.expired++;
+        _unlink(item);
+        return KV_NOT_FOUND;
+    }
+
+    item->flags |= KV_ITEM_REF;
+    stats.hits++;
+
+    *value = item->data + item->key_len;
+    *value_len = item->value_len;
+
+    return KV_OK;
+}
+
+int kv_set( const void *key, size_t key_len, const void *value, size_t value_len, msec_t ttl_ms ) {
+    uint32_t hash;
+    kv_item_t *item;
+    int cls;
+    int idx;
+
+    if ((table == NULL) || (key == NULL) || ((value == NULL) && (value_len > 0))) { return KV_NOT_OK; }
+    if ((key_len == 0) || (key_len > KV_MAX_KEY_SIZE) || (value_len > KV_MAX_VALUE_SIZE)) { return KV_TOO_LARGE; }
+
+    hash = _hash(key, key_len);
+    cls = _class_of(sizeof(kv_item_t) + key_len + value_len);
+
+    if ((idx = _find(key, key_len, hash)) >= 0) { _unlink(table[idx].item); }
+
+    /* A full table makes room in the class being written, or whichever class has items */
+    if (stats.items >= max_items) {
+        if (_evict(cls) < 0) {
+            for (int i=0; i<KV_NUM_CLASSES; i++) {
+                if (_evict(i) == KV_OK) { break; }
+            }
+        }
+    }
+
+    if ((item = _alloc(cls)) == NULL) { return KV_NO_SPACE; }
+
+    item->hash = hash;
+    item->flags = KV_ITEM_USED;
+    item->cls = (uint8_t)cls;
+    item->key_len = (uint16_t)key_len;
+    item->value_len = (uint32_t)value_len;
+    item->expires_ms = (ttl_ms > 0) ? (get_monotonic_ms() + ttl_ms) : 0;
+    memcpy(item->data, key, key_len);
+    if (value_len > 0) { memcpy(item->data + key_len, value, value_len); }
+
+    _insert(item);
+
+    stats.sets++;
+    stats.items++;
+    stats.bytes += classes[cls].chunk_size;
+
+    return KV_OK;
+}
+
+int kv_del( const void *key, size_t key_len ) {
+    int idx;
+
+    if ((table == NULL) || (key == NULL)) { return KV_NOT_OK; }
+
+    if ((idx = _find(key, key_len, _hash(key, key_len))) < 0) { return KV_NOT_FOUND; }
+
+    _unlink(table[idx].item);
+    stats.deletes++;
+
+    return KV_OK;
+}
+
+/* Answers each message of the request in order, a request that isn't KV messages throughout is
+ * answered up to the first one that isn't, with RPC_STATUS_ERROR
+ */
+int kv_request_handler( const void *request, size_t len, void *response, size_t *response_len, void __attribute__((unused)) *ctx ) {
+    const uint8_t *in = (const uint8_t *)request;
+    uint8_t *out = (uint8_t *)response;
+    codec_kv_value_t answer;
+    codec_msg_t msg;
+    const void *value;
+    size_t value_len;
+    size_t pos = 0;
+    int consumed;
+    int written;
+
+    *response_len = 0;
+
+    while (pos < len) {
+        if ((consumed = codec_decode(in + pos, len - pos, &msg)) < 0) { return RPC_STATUS_ERROR; }
+
+        memset(&answer, 0, sizeof(answer));
+
+        switch (msg.type) {
+            case CODEC_MSG_KV_GET:
+                answer.status = kv_get(msg.body.kv_get.key.data, msg.body.kv_get.key.len, &value, &value_len);
+
+                if (answer.status == KV_OK) {
+                    answer.value.data = (const uint8_t *)value;
+                    answer.value.len = (uint32_t)value_len;
+                }
+                break;
+
+            case CODEC_MSG_KV_SET:
+                answer.status = kv_set(msg.body.kv_set.key.data, msg.body.kv_set.key.len,
+                    msg.body.kv_set.value.data, msg.body.kv_set.value.len, (msec_t)msg.body.kv_set.ttl_ms);
+                break;
+
+            case CODEC_MSG_KV_DEL:
+                answer.status = kv_del(msg.body.kv_del.key.data, msg.body.kv_del.key.len);
+                break;
+
+            default:
+                return RPC_STATUS_ERROR;
+        }
+
+        if ((written = codec_encode_kv_value(&answer, out + *response_len, RPC_MAX_PAYLOAD - *response_len)) < 0) {
+            answer.status = KV_TOO_LARGE;
+            answer.value.len = 0;
+
+            if ((written = codec_encode_kv_value(&answer, out + *response_len, RPC_MAX_PAYLOAD - *response_len)) < 0) {
+                return RPC_STATUS_ERROR;
+            }
+        }
+
+        *response_len += (size_t)written;
+        pos += (size_t)consumed;
+    }
+
+    return RPC_STATUS_OK;
+}
+
+int get_kv_stats( kv_stats_t *kv_stats ) {
+    if (kv_stats == NULL) { return KV_NOT_OK; }
+
+    *kv_stats = stats;
+    kv_stats->memory = (size_t)used_pages * KV_PAGE_SIZE;
+
+    return KV_OK;
+}
+
+/* CRC32C is one instruction per 8 bytes where there's SSE 4.2, finalized so the low bits that
+ * index the table depend on every bit of it
+ */
+static uint32_t _hash( const void *key, size_t key_len ) {
+    uint32_t h = crc32c(0, key, key_len);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static int _find( const void *key, size_t key_len, uint32_t hash ) {
+    uint32_t idx = hash & table_mask;
+    kv_item_t *item;
+
+    while ((item = table[idx].item) != NULL) {
+        if ((table[idx].hash == hash) && (item->key_len == key_len) && (memcmp(item->data, key, key_len) == 0)) {
+            return (int)idx;
+        }
+
+        idx = (idx + 1) & table_mask;
+    }
+
+    return -1;
+}
+
+static void _insert( kv_item_t *item ) {
+    uint32_t idx = item->hash & table_mask;
+
+    while (table[idx].item != NULL) { idx = (idx + 1) & table_mask; }
+
+    table[idx].hash = item->hash;
+    table[idx].item = item;
+}
+
+/* Backward shift, entries after idx that would no longer be found past the gap move into it, so
+ * there are no tombstones and probes stay as short as the load allows
+ */
+static void _remove_at( uint32_t idx ) {
+    uint32_t next = idx;
+    uint32_t home;
+
+    for (;;) {
+        next = (next + 1) & table_mask;
+
+        if (table[next].item == NULL) { break; }
+
+        home = table[next].hash & table_mask;
+
+        if (((next - home) & table_mask) >= ((next - idx) & table_mask)) {
+            table[idx] = table[next];
+            idx = next;
+        }
+    }
+
+    table[idx].item = NULL;
+}
+
+/* Removes the item from the table and frees its chunk */
+static void _unlink( kv_item_t *item ) {
+    kv_class_t *c = &classes[item->cls];
+    uint32_t idx = item->hash & table_mask;
+
+    while (table[idx].item != item) { idx = (idx + 1) & table_mask; }
+
+    _remove_at(idx);
+
+    stats.items--;
+    stats.bytes -= c->chunk_size;
+
+    item->flags = 0;
+    memcpy(item->data, &c->free_list, sizeof(kv_item_t *));
+    c->free_list = item;
+}
+
+static bool _expired( const kv_item_t *item, msec_t now ) {
+    return (item->expires_ms != 0) && (item->expires_ms <= now);
+}
+
+static int _class_of( size_t size ) {
+    int cls = 0;
+
+    while ((cls < (KV_NUM_CLASSES - 1)) && (classes[cls].chunk_size < size)) { cls++; }
+
+    return cls;
+}
+
+/* A free chunk, a new page while the budget lasts, then an evicted item of the class */
+static kv_item_t *_alloc( int cls ) {
+    kv_class_t *c = &classes[cls];
+    kv_item_t *item;
+    uint8_t *page;
+
+    if ((c->free_list == NULL) && (used_pages < max_pages)) {
+        if ((page = malloc(KV_PAGE_SIZE)) != NULL) {
+            used_pages++;
+            _add_page(cls, page);
+        }
+    }
+
+    if (c->free_list == NULL) {
+        if ((c->num_pages == 0) || (_evict(cls) < 0)) {
+            if (_steal_page(cls) < 0) { return NULL; }
+        }
+    }
+
+    item = c->free_list;
+    memcpy(&c->free_list, item->data, sizeof(kv_item_t *));
+
+    return item;
+}
+
+static kv_item_t *_chunk( const kv_class_t *c, uint32_t idx ) {
+    return (kv_item_t *)(c->pages[idx / c->per_page] + ((size_t)(idx % c->per_page) * c->chunk_size));
+}
+
+static void _add_page( int cls, uint8_t *page ) {
+    kv_class_t *c = &classes[cls];
+    kv_item_t *item;
+
+    c->pages[c->num_pages++] = page;
+
+    for (uint32_t i=c->per_page; i>0; i--) {
+        item = (kv_item_t *)(page + ((size_t)(i - 1) * c->chunk_size));
+        item->flags = 0;
+        memcpy(item->data, &c->free_list, sizeof(kv_item_t *));
+        c->free_list = item;
+    }
+}
+
+/* CLOCK, the hand clears the reference of read items and frees the first item that's expired or
+ * wasn't read since it last passed. Two turns find one unless the class has no items.
+ */
+static int _evict( int cls ) {
+    kv_class_t *c = &classes[cls];
+    uint32_t chunks = (uint32_t)c->num_pages * c->per_page;
+    msec_t now = get_monotonic_ms();
+    kv_item_t *item;
+
+    for (uint32_t n=0; n<(2 * chunks); n++) {
+        item = _chunk(c, c->hand);
+        c->hand = (c->hand + 1) % chunks;
+
+        if (!(item->flags & KV_ITEM_USED)) { continue; }
+
+        if (_expired(item, now)) {
+            stats.expired++;
+        } else if (item->flags & KV_ITEM_REF) {
+            item->flags &= (uint8_t)~KV_ITEM_REF;
+            continue;
+        } else {
+            stats.evictions++;
+        }
+
+        _unlink(item);
+        return KV_OK;
+    }
+
+    return KV_NOT_OK;
+}
+
+/* Moves the last page of the class with the most pages to cls, evicting its items. Without it the
+ * classes that filled the budget first would keep it, however the sizes written change. A class
+ * keeps its last page, classes taking it from each other would evict everything on every write.
+ */
+static int _steal_page( int cls ) {
+    kv_class_t *victim = NULL;
+    kv_item_t *item;
+    kv_item_t *next;
+    uint8_t *page;
+
+    for (int i=0; i<KV_NUM_CLASSES; i++) {
+        if ((i == cls) || (classes[i].num_pages <= 1)) { continue; }
+        if ((victim == NULL) || (classes[i].num_pages > victim->num_pages)) { victim = &classes[i]; }
+    }
+
+    if (victim == NULL) { return KV_NOT_OK; }
+
+    page = victim->pages[victim->num_pages - 1];
+
+    for (uint32_t i=0; i<victim->per_page; i++) {
+        item = (kv_item_t *)(page + ((size_t)i * victim->chunk_size));
+
+        if (item->flags & KV_ITEM_USED) {
+            stats.evictions++;
+            _unlink(item);
+        }
+    }
+
+    /* Every chunk of the page is free now, none may stay on the free list */
+    for (item = victim->free_list, victim->free_list = NULL; item != NULL; item = next) {
+        memcpy(&next, item->data, sizeof(kv_item_t *));
+
+        if (((uint8_t *)item < page) || ((uint8_t *)item >= (page + KV_PAGE_SIZE))) {
+            memcpy(item->data, &victim->free_list, sizeof(kv_item_t *));
+            victim->free_list = item;
+        }
+    }
+
+    victim->num_pages--;
+    if (victim->hand >= ((uint32_t)victim->num_pages * victim->per_page)) { victim->hand = 0; }
+
+    _add_page(cls, page);
+
+    return KV_OK;
+}
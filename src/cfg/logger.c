@@ -0,0 +1,301 @@
+#include "logger.h"
+
+/* Single producer, single consumer, head is written by the owning thread, tail by the writer. A
+ * ring is owned by one thread at a time, it's released when the thread exits. */
+typedef struct {
+    uint32_t head;
+    uint32_t owned;
+    char pad[56];
+    uint32_t tail;
+    logger_record_t records[LOGGER_RING_SIZE];
+} logger_ring_t;
+
+/* num_rings is the most rings owned at once, the writer drains that many */
+static logger_ring_t rings[LOGGER_MAX_THREADS];
+static uint32_t num_rings;
+static __thread logger_ring_t *ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static E_LOGGER_LEVEL min_level = LOGGER_INFO;
+static uint32_t rate = LOGGER_DEFAULT_RATE;
+static logger_stats_t stats;
+
+/* Taken by whoever drains the rings, never by producers */
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer;
+static bool running;
+static bool stopping;
+static bool registered;
+
+/* Static Functions */
+static void *_writer_main( void *arg );
+static bool _drain( void );
+static void _print( const logger_record_t *record );
+static logger_ring_t *_claim_ring( void );
+static void _create_ring_key( void );
+static void _release_ring( void *arg );
+static void _before_fork( void );
+static void _after_fork_parent( void );
+static void _after_fork_child( void );
+
+int logger_start( void ) {
+    sigset_t all;
+    sigset_t old;
+    int rc;
+
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) { return LOGGER_OK; }
+
+    if (!registered) {
+        if ((pthread_atfork(_before_fork, _after_fork_parent, _after_fork_child) != 0) || (atexit(logger_stop) != 0)) {
+            return LOGGER_NOT_OK;
+        }
+        registered = true;
+    }
+
+    __atomic_store_n(&stopping, false, __ATOMIC_RELAXED);
+
+    /* The writer inherits the mask */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&writer, NULL, _writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rc != 0) {
+        printf("Failed to start logger\n");
+        return LOGGER_NOT_OK;
+    }
+
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+
+    return LOGGER_OK;
+}
+
+void logger_stop( void ) {
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) { return; }
+
+    __atomic_store_n(&stopping, true, __ATOMIC_RELAXED);
+    (void)pthread_join(writer, NULL);
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+
+    /* Records written while the writer was exiting */
+    logger_flush();
+}
+
+void logger_flush( void ) {
+    pthread_mutex_lock(&drain_lock);
+    while (_drain()) {}
+    fflush(stdout);
+    pthread_mutex_unlock(&drain_lock);
+}
+
+void logger_set_level( E_LOGGER_LEVEL level ) {
+    __atomic_store_n(&min_level, level, __ATOMIC_RELAXED);
+}
+
+void logger_set_rate( uint32_t records_per_sec ) {
+    __atomic_store_n(&rate, records_per_sec, __ATOMIC_RELAXED);
+}
+
+/* Write a record
+ *
+ * The rate limit counts per wall clock second. A site that switches seconds in two threads at once
+ * may let a few extra records through, which is fine for a log.
+ */
+void logger_write( logger_site_t *site, E_LOGGER_LEVEL level, const char *fmt, ... ) {
+    logger_record_t local;
+    logger_record_t *record = &local;
+    logger_ring_t *own = NULL;
+    struct timespec ts;
+    uint32_t limit = __atomic_load_n(&rate, __ATOMIC_RELAXED);
+    uint32_t suppressed = 0;
+    uint64_t second;
+    uint64_t seen;
+    uint32_t head;
+    va_list args;
+    int len;
+
+    if (level < __atomic_load_n(&min_level, __ATOMIC_RELAXED)) { return; }
+
+    /* vDSO, no system call */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    second = (uint64_t)ts.tv_sec;
+
+    if (limit > 0) {
+        seen = __atomic_load_n(&site->second, __ATOMIC_RELAXED);
+
+        if ((seen != second) && __atomic_compare_exchange_n(&site->second, &seen, second, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+            suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+        }
+
+        if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) >= limit) {
+            __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&stats.suppressed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        if ((own = _claim_ring()) == NULL) {
+            __atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        head = own->head;
+
+        if ((head - __atomic_load_n(&own->tail, __ATOMIC_ACQUIRE)) == LOGGER_RING_SIZE) {
+            __atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        record = &own->records[head & (LOGGER_RING_SIZE - 1)];
+    }
+
+    va_start(args, fmt);
+    len = vsnprintf(record->msg, sizeof(record->msg), fmt, args);
+    va_end(args);
+
+    record->time_us = ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+    record->suppressed = suppressed;
+    record->level = (uint16_t)level;
+    record->len = (uint16_t)((len < 0) ? 0 : ((len >= (int)sizeof(record->msg)) ? (sizeof(record->msg) - 1) : len));
+
+    __atomic_fetch_add(&stats.records, 1, __ATOMIC_RELAXED);
+
+    if (own == NULL) {
+        _print(record);
+        return;
+    }
+
+    __atomic_store_n(&own->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int get_logger_stats( logger_stats_t *out ) {
+    if (out == NULL) { return LOGGER_NOT_OK; }
+
+    out->records = __atomic_load_n(&stats.records, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+    out->suppressed = __atomic_load_n(&stats.suppressed, __ATOMIC_RELAXED);
+
+    return LOGGER_OK;
+}
+
+static void *_writer_main( void __attribute__((unused)) *arg ) {
+    struct timespec interval = { 0, LOGGER_INTERVAL_MS * 1000000L };
+    bool drained;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&drain_lock);
+        drained = _drain();
+        fflush(stdout);
+        pthread_mutex_unlock(&drain_lock);
+
+        if (!drained) { nanosleep(&interval, NULL); }
+    }
+
+    return NULL;
+}
+
+/* Prints what's in every ring, returns true if there was anything. Caller holds drain_lock. */
+static bool _drain( void ) {
+    uint32_t count = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+    bool drained = false;
+    logger_ring_t *cur;
+    uint32_t head;
+    uint32_t tail;
+
+    if (count > LOGGER_MAX_THREADS) { count = LOGGER_MAX_THREADS; }
+
+    for (uint32_t i=0; i<count; i++) {
+        cur = &rings[i];
+        head = __atomic_load_n(&cur->head, __ATOMIC_ACQUIRE);
+
+        for (tail = cur->tail; tail != head; tail++) {
+            _print(&cur->records[tail & (LOGGER_RING_SIZE - 1)]);
+            drained = true;
+        }
+
+        __atomic_store_n(&cur->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return drained;
+}
+
+static void _print( const logger_record_t *record ) {
+    fwrite(record->msg, 1, record->len, stdout);
+
+    if (record->suppressed > 0) {
+        printf(" (%u similar suppressed)", record->suppressed);
+    }
+
+    fputc('\n', stdout);
+}
+
+/* A released ring keeps its head, the writer drains what the last owner left as usual */
+static logger_ring_t *_claim_ring( void ) {
+    uint32_t expected;
+    uint32_t count;
+
+    if (ring != NULL) { return ring; }
+
+    (void)pthread_once(&ring_once, _create_ring_key);
+
+    for (uint32_t i=0; i<LOGGER_MAX_THREADS; i++) {
+        expected = 0;
+
+        if (!__atomic_compare_exchange_n(&rings[i].owned, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        count = __atomic_load_n(&num_rings, __ATOMIC_RELAXED);
+
+        while ((count <= i) &&
+               !__atomic_compare_exchange_n(&num_rings, &count, i + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+
+        ring = &rings[i];
+        (void)pthread_setspecific(ring_key, ring);
+
+        return ring;
+    }
+
+    return NULL;
+}
+
+static void _create_ring_key( void ) {
+    (void)pthread_key_create(&ring_key, _release_ring);
+}
+
+/* Called at thread exit, the thread writes no more records */
+static void _release_ring( void *arg ) {
+    logger_ring_t *cur = arg;
+
+    ring = NULL;
+    __atomic_store_n(&cur->owned, 0, __ATOMIC_RELEASE);
+}
+
+/* Pending records are printed first, so they come out before anything the child writes */
+static void _before_fork( void ) {
+    pthread_mutex_lock(&drain_lock);
+    while (_drain()) {}
+    fflush(stdout);
+}
+
+static void _after_fork_parent( void ) {
+    pthread_mutex_unlock(&drain_lock);
+}
+
+/* The writer isn't copied. Pending records are the parent's to print, the child starts empty and
+ * writes directly until it calls logger_start(). */
+static void _after_fork_child( void ) {
+    pthread_mutex_init(&drain_lock, NULL);
+
+    /* Only the forking thread is copied, the other threads' rings are free */
+    for (uint32_t i=0; i<LOGGER_MAX_THREADS; i++) {
+        rings[i].tail = rings[i].head;
+        rings[i].owned = (&rings[i] == ring);
+    }
+
+    running = false;
+    stopping = false;
+}
@@ -0,0 +1,202 @@
+#include "lz.h"
+
+/* Positions of recent 4 byte sequences, indexed by their hash */
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+/* Misses before the search starts skipping ahead, keeps incompressible data cheap */
+#define LZ_SKIP_SHIFT 5
+
+/* Static Functions */
+static inline uint32_t _read32( const uint8_t *p );
+static inline uint32_t _hash( uint32_t value );
+static inline uint8_t *_put_length( uint8_t *op, const uint8_t *oend, size_t len );
+static uint8_t *_put_sequence( uint8_t *op, const uint8_t *oend, const uint8_t *literals, size_t num_literals, size_t offset, size_t match_len );
+
+/* Compress
+ *
+ * Greedy, the first match found is taken and extended as far as it goes. Stale hash entries are
+ * harmless, every candidate is compared before it's used.
+ */
+int lz_compress( const void *src, size_t len, void *dst, size_t cap ) {
+    uint32_t table[LZ_HASH_SIZE];
+    const uint8_t *base = src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *iend = base + len;
+    const uint8_t *ilimit = iend - ((len >= LZ_MIN_MATCH) ? LZ_MIN_MATCH : len);
+    const uint8_t *match;
+    uint8_t *op = dst;
+    uint8_t *oend = op + cap;
+    uint32_t misses = 0;
+    uint32_t h;
+    size_t match_len;
+
+    if ((src == NULL) && (len > 0)) { return LZ_NOT_OK; }
+    if (dst == NULL) { return LZ_NOT_OK; }
+
+    memset(table, 0, sizeof(table));
+
+    while (ip < ilimit) {
+        h = _hash(_read32(ip));
+        match = base + table[h];
+        table[h] = (uint32_t)(ip - base);
+
+        if ((match >= ip) || ((size_t)(ip - match) > LZ_MAX_OFFSET) || (_read32(match) != _read32(ip))) {
+            ip += 1 + (misses++ >> LZ_SKIP_SHIFT);
+            continue;
+        }
+
+        misses = 0;
+        match_len = LZ_MIN_MATCH;
+
+        while (((ip + match_len) < iend) && (match[match_len] == ip[match_len])) {
+            match_len++;
+        }
+
+        if ((op = _put_sequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - match), match_len)) == NULL) {
+            return LZ_NOT_OK;
+        }
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    if ((op = _put_sequence(op, oend, anchor, (size_t)(iend - anchor), 0, 0)) == NULL) {
+        return LZ_NOT_OK;
+    }
+
+    return (int)(op - (uint8_t *)dst);
+}
+
+/* Decompress
+ *
+ * A match may overlap the bytes it produces, a run is an offset of 1, those are copied forward one
+ * byte at a time.
+ */
+int lz_decompress( const void *src, size_t len, void *dst, size_t cap ) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = ip + len;
+    uint8_t *op = dst;
+    uint8_t *oend = op + cap;
+    const uint8_t *match;
+    size_t num_literals;
+    size_t match_len;
+    size_t offset;
+    uint8_t token;
+
+    if ((src == NULL) || (dst == NULL) || (len == 0)) { return LZ_NOT_OK; }
+
+    for (;;) {
+        if (ip == iend) { return LZ_NOT_OK; }
+
+        token = *ip++;
+
+        num_literals = token >> 4;
+        if (num_literals == 15) {
+            do {
+                if (ip == iend) { return LZ_NOT_OK; }
+                num_literals += *ip;
+            } while (*ip++ == 255);
+        }
+
+        if (((size_t)(iend - ip) < num_literals) || ((size_t)(oend - op) < num_literals)) { return LZ_NOT_OK; }
+
+        memcpy(op, ip, num_literals);
+        op += num_literals;
+        ip += num_literals;
+
+        /* Only the last sequence ends after its literals */
+        if (ip == iend) { break; }
+
+        if ((iend - ip) < 2) { return LZ_NOT_OK; }
+
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        if ((offset == 0) || (offset > (size_t)(op - (uint8_t *)dst))) { return LZ_NOT_OK; }
+
+        match_len = token & 15;
+        if (match_len == 15) {
+            do {
+                if (ip == iend) { return LZ_NOT_OK; }
+                match_len += *ip;
+            } while (*ip++ == 255);
+        }
+        match_len += LZ_MIN_MATCH;
+
+        if ((size_t)(oend - op) < match_len) { return LZ_NOT_OK; }
+
+        match = op - offset;
+
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            while (match_len-- > 0) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (int)(op - (uint8_t *)dst);
+}
+
+static inline uint32_t _read32( const uint8_t *p ) {
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+
+    return value;
+}
+
+/* Multiplicative hash, the top bits are the best mixed */
+static inline uint32_t _hash( uint32_t value ) {
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Length bytes past the 15 that fit in the token */
+static inline uint8_t *_put_length( uint8_t *op, const uint8_t *oend, size_t len ) {
+    for (;;) {
+        if (op == oend) { return NULL; }
+
+        if (len < 255) {
+            *op++ = (uint8_t)len;
+            return op;
+        }
+
+        *op++ = 255;
+        len -= 255;
+    }
+}
+
+/* A match_len of 0 writes the last sequence, literals only */
+static uint8_t *_put_sequence( uint8_t *op, const uint8_t *oend, const uint8_t *literals, size_t num_literals, size_t offset, size_t match_len ) {
+    uint8_t *token;
+    size_t extra = (match_len > 0) ? (match_len - LZ_MIN_MATCH) : 0;
+
+    if (op == oend) { return NULL; }
+
+    token = op++;
+    *token = (uint8_t)(((num_literals < 15) ? num_literals : 15) << 4);
+
+    if ((num_literals >= 15) && ((op = _put_length(op, oend, num_literals - 15)) == NULL)) { return NULL; }
+
+    if ((size_t)(oend - op) < num_literals) { return NULL; }
+
+    memcpy(op, literals, num_literals);
+    op += num_literals;
+
+    if (match_len == 0) { return op; }
+
+    if ((oend - op) < 2) { return NULL; }
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+
+    *token |= (uint8_t)((extra < 15) ? extra : 15);
+
+    if ((extra >= 15) && ((op = _put_length(op, oend, extra - 15)) == NULL)) { return NULL; }
+
+    return op;
+}
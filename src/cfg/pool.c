@@ -0,0 +1,410 @@
+#include "pool.h"
+#include "logger.h"
+
+/* Every request that can be in flight on a full pool */
+#define POOL_MAX_CALLS (POOL_MAX_CONNS * RPC_MAX_IN_FLIGHT)
+
+typedef struct pool_s pool_t;
+
+typedef struct {
+    int failures;
+    msec_t eject_ms;
+    msec_t ejected_until;
+} pool_endpoint_t;
+
+typedef struct {
+    sock_id_t id;
+    int endpoint;
+} pool_conn_t;
+
+/* Request in flight, passed to rpc_call() as the callback context */
+typedef struct {
+    pool_t *pool;
+    int conn;
+    rpc_callback_t callback;
+    void *ctx;
+    int next_free;
+} pool_call_t;
+
+struct pool_s {
+    E_POOL_BALANCE balance;
+    bool closing;
+    bool checksum;
+    bool compression;
+    uint32_t rand_state;
+
+    int num_endpoints;
+    pool_endpoint_t endpoints[POOL_MAX_ENDPOINTS];
+
+    int num_conns;
+    int next_conn;
+    pool_conn_t conns[POOL_MAX_CONNS];
+
+    int free_call;
+    pool_call_t *calls;
+
+    pool_stats_t stats;
+};
+
+static pool_t *pools[MAX_NUM_OF_POOLS];
+
+/* Static Functions */
+static pool_t *_get_pool( pool_id_t pool_id );
+static int _pick_conn( pool_t *pool, msec_t now );
+static bool _endpoint_healthy( const pool_endpoint_t *endpoint, msec_t now );
+static void _endpoint_failed( pool_t *pool, pool_endpoint_t *endpoint, msec_t now );
+static void _call_done( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx );
+static uint32_t _rand( pool_t *pool );
+
+pool_id_t pool_create( E_POOL_BALANCE balance ) {
+    pool_t *pool;
+    pool_id_t pool_id;
+
+    for (pool_id=0; pool_id<MAX_NUM_OF_POOLS; pool_id++) {
+        if (pools[pool_id] == NULL) { break; }
+    }
+
+    if (pool_id == MAX_NUM_OF_POOLS) {
+        log_error("No free connection pools");
+        return SOCK_NOT_OK;
+    }
+
+    if ((pool = calloc(1, sizeof(pool_t))) == NULL) { return SOCK_NOT_OK; }
+
+    if ((pool->calls = calloc(POOL_MAX_CALLS, sizeof(pool_call_t))) == NULL) {
+        free(pool);
+        return SOCK_NOT_OK;
+    }
+
+    for (int i=0; i<POOL_MAX_CALLS; i++) {
+        pool->calls[i].next_free = i + 1;
+    }
+    pool->calls[POOL_MAX_CALLS - 1].next_free = -1;
+    pool->free_call = 0;
+
+    pool->balance = balance;
+    pool->rand_state = (uint32_t)get_monotonic_ms() ^ ((uint32_t)getpid() << 16) ^ (uint32_t)pool_id;
+    if (pool->rand_state == 0) { pool->rand_state = 1; }
+
+    pools[pool_id] = pool;
+
+    return pool_id;
+}
+
+/* Add endpoint
+ *
+ * Connections that fail to connect count against the endpoint's health and are kept, so they're
+ * retried from the tick.
+ */
+int pool_add_endpoint( pool_id_t pool_id, E_APP_SOCK_TYPE type, const char *addr_str, int port, int num_conns ) {
+    pool_t *pool;
+    pool_endpoint_t *endpoint;
+    pool_conn_t *conn;
+    msec_t now = get_monotonic_ms();
+    int first_conn;
+
+    if ((pool = _get_pool(pool_id)) == NULL) { return SOCK_NOT_OK; }
+    if ((type != E_TCP_SOCK) && (type != E_LOCAL_SOCK)) { return SOCK_NOT_OK; }
+    if ((num_conns <= 0) || ((pool->num_conns + num_conns) > POOL_MAX_CONNS)) { return SOCK_NOT_OK; }
+    if (pool->num_endpoints == POOL_MAX_ENDPOINTS) { return SOCK_NOT_OK; }
+
+    first_conn = pool->num_conns;
+
+    for (int i=0; i<num_conns; i++) {
+        conn = &pool->conns[first_conn + i];
+
+        if ((conn->id = initialize_sock(type, addr_str, port, CLIENT_SIDE)) < 0) {
+            log_error("Failed to get a socket for %s:%d", addr_str, port);
+
+            /* Nothing was attached yet */
+            for (int j=0; j<i; j++) {
+                close_sock(pool->conns[first_conn + j].id);
+            }
+            return SOCK_NOT_OK;
+        }
+
+        conn->endpoint = pool->num_endpoints;
+        (void)rpc_set_checksum(conn->id, pool->checksum);
+        (void)rpc_set_compression(conn->id, pool->compression);
+    }
+
+    endpoint = &pool->endpoints[pool->num_endpoints];
+    endpoint->failures = 0;
+    endpoint->eject_ms = POOL_EJECT_MS;
+    endpoint->ejected_until = 0;
+
+    pool->num_endpoints++;
+    pool->num_conns += num_conns;
+
+    for (int i=first_conn; i<pool->num_conns; i++) {
+        if (rpc_attach(&pool->conns[i].id) != SOCK_OK) {
+            _endpoint_failed(pool, endpoint, now);
+        }
+    }
+
+    return SOCK_OK;
+}
+
+void pool_destroy( pool_id_t pool_id ) {
+    pool_t *pool;
+
+    if ((pool = _get_pool(pool_id)) == NULL) { return; }
+
+    /* Requests still complete through their callbacks, new ones are refused */
+    pool->closing = true;
+
+    for (int i=0; i<pool->num_conns; i++) {
+        rpc_detach(pool->conns[i].id);
+        (void)rpc_set_checksum(pool->conns[i].id, false);
+        (void)rpc_set_compression(pool->conns[i].id, false);
+        close_sock(pool->conns[i].id);
+    }
+
+    pools[pool_id] = NULL;
+
+    free(pool->calls);
+    free(pool);
+}
+
+int pool_set_checksum( pool_id_t pool_id, bool enable ) {
+    pool_t *pool;
+
+    if ((pool = _get_pool(pool_id)) == NULL) { return SOCK_NOT_OK; }
+
+    pool->checksum = enable;
+
+    for (int i=0; i<pool->num_conns; i++) {
+        (void)rpc_set_checksum(pool->conns[i].id, enable);
+    }
+
+    return SOCK_OK;
+}
+
+int pool_set_compression( pool_id_t pool_id, bool enable ) {
+    pool_t *pool;
+
+    if ((pool = _get_pool(pool_id)) == NULL) { return SOCK_NOT_OK; }
+
+    pool->compression = enable;
+
+    for (int i=0; i<pool->num_conns; i++) {
+        (void)rpc_set_compression(pool->conns[i].id, enable);
+    }
+
+    return SOCK_OK;
+}
+
+/* Call
+ *
+ * A connection that turns out to be lost is skipped and the next pick is tried, a full one means
+ * the whole pool is busy since it was the least loaded.
+ */
+int pool_call( pool_id_t pool_id, const void *buffer, size_t len, msec_t timeout_ms, rpc_callback_t callback, void *ctx ) {
+    pool_t *pool;
+    pool_call_t *call;
+    msec_t now = get_monotonic_ms();
+    int call_idx;
+    int conn;
+    int rc;
+
+    if (((pool = _get_pool(pool_id)) == NULL) || pool->closing) { return SOCK_NOT_OK; }
+    if ((buffer == NULL) && (len > 0)) { return SOCK_NOT_OK; }
+    if ((len > RPC_MAX_PAYLOAD) || (callback == NULL)) { return SOCK_NOT_OK; }
+
+    for (int attempt=0; attempt<pool->num_conns; attempt++) {
+        if ((conn = _pick_conn(pool, now)) < 0) { return SOCK_NOT_OK; }
+
+        if ((call_idx = pool->free_call) < 0) { return SOCK_FAILED_TO_SEND; }
+
+        call = &pool->calls[call_idx];
+        pool->free_call = call->next_free;
+
+        call->pool = pool;
+        call->conn = conn;
+        call->callback = callback;
+        call->ctx = ctx;
+
+        if ((rc = rpc_call(pool->conns[conn].id, buffer, len, timeout_ms, _call_done, call, NULL)) == SOCK_OK) {
+            pool->stats.calls++;
+            return SOCK_OK;
+        }
+
+        /* Not sent, so no callback either */
+        call->next_free = pool->free_call;
+        pool->free_call = call_idx;
+
+        if (rc == SOCK_FAILED_TO_SEND) { return SOCK_FAILED_TO_SEND; }
+    }
+
+    return SOCK_NOT_OK;
+}
+
+/* Tick
+ *
+ * Reconnects lost connections of endpoints that aren't ejected. A failed connect counts as a
+ * failure, so an endpoint that is down is ejected and retried less and less often.
+ */
+void pool_tick_all( void ) {
+    pool_t *pool;
+    pool_conn_t *conn;
+    msec_t now = get_monotonic_ms();
+
+    for (int i=0; i<MAX_NUM_OF_POOLS; i++) {
+        if (((pool = pools[i]) == NULL) || pool->closing) { continue; }
+
+        for (int j=0; j<pool->num_conns; j++) {
+            conn = &pool->conns[j];
+
+            if (rpc_connected(conn->id)) { continue; }
+            if (now < pool->endpoints[conn->endpoint].ejected_until) { continue; }
+
+            if (rpc_attach(&conn->id) == SOCK_OK) {
+                pool->stats.reconnects++;
+            } else {
+                _endpoint_failed(pool, &pool->endpoints[conn->endpoint], now);
+            }
+        }
+    }
+}
+
+int get_pool_stats( pool_id_t pool_id, pool_stats_t *stats ) {
+    pool_t *pool;
+    msec_t now = get_monotonic_ms();
+
+    if ((stats == NULL) || ((pool = _get_pool(pool_id)) == NULL)) { return SOCK_NOT_OK; }
+
+    *stats = pool->stats;
+    stats->healthy_endpoints = 0;
+    stats->connected = 0;
+    stats->in_flight = 0;
+
+    for (int i=0; i<pool->num_endpoints; i++) {
+        if (_endpoint_healthy(&pool->endpoints[i], now)) { stats->healthy_endpoints++; }
+    }
+
+    for (int i=0; i<pool->num_conns; i++) {
+        if (rpc_connected(pool->conns[i].id)) {
+            stats->connected++;
+            stats->in_flight += (uint32_t)rpc_num_in_flight(pool->conns[i].id);
+        }
+    }
+
+    return SOCK_OK;
+}
+
+static pool_t *_get_pool( pool_id_t pool_id ) {
+    if ((pool_id < 0) || (pool_id >= MAX_NUM_OF_POOLS)) { return NULL; }
+
+    return pools[pool_id];
+}
+
+/* Pick connection
+ *
+ * Only connections of healthy endpoints are candidates, unless every endpoint is ejected, then any
+ * connection that is up is. Least outstanding starts its search at a rotating offset, so ties are
+ * spread over the pool.
+ */
+static int _pick_conn( pool_t *pool, msec_t now ) {
+    int candidates[POOL_MAX_CONNS];
+    int num_candidates = 0;
+    int best;
+    int a, b;
+
+    for (int i=0; i<pool->num_conns; i++) {
+        if (rpc_connected(pool->conns[i].id) && _endpoint_healthy(&pool->endpoints[pool->conns[i].endpoint], now)) {
+            candidates[num_candidates++] = i;
+        }
+    }
+
+    if (num_candidates == 0) {
+        for (int i=0; i<pool->num_conns; i++) {
+            if (rpc_connected(pool->conns[i].id)) { candidates[num_candidates++] = i; }
+        }
+    }
+
+    if (num_candidates == 0) { return SOCK_NOT_OK; }
+    if (num_candidates == 1) { return candidates[0]; }
+
+    if (pool->balance == POOL_BALANCE_P2C) {
+        a = (int)(_rand(pool) % (uint32_t)num_candidates);
+        b = (a + 1 + (int)(_rand(pool) % (uint32_t)(num_candidates - 1))) % num_candidates;
+
+        a = candidates[a];
+        b = candidates[b];
+
+        return (rpc_num_in_flight(pool->conns[b].id) < rpc_num_in_flight(pool->conns[a].id)) ? b : a;
+    }
+
+    pool->next_conn = (pool->next_conn + 1) % num_candidates;
+    best = candidates[pool->next_conn];
+
+    for (int i=1; i<num_candidates; i++) {
+        int conn = candidates[(pool->next_conn + i) % num_candidates];
+
+        if (rpc_num_in_flight(pool->conns[conn].id) < rpc_num_in_flight(pool->conns[best].id)) {
+            best = conn;
+        }
+    }
+
+    return best;
+}
+
+static bool _endpoint_healthy( const pool_endpoint_t *endpoint, msec_t now ) {
+    return (endpoint->failures < POOL_EJECT_FAILURES) || (now >= endpoint->ejected_until);
+}
+
+/* Endpoint failed
+ *
+ * Once ejected, failures aren't reset until a request succeeds, so an endpoint that comes back from
+ * ejection and fails again is ejected again right away, for twice as long.
+ */
+static void _endpoint_failed( pool_t *pool, pool_endpoint_t *endpoint, msec_t now ) {
+    endpoint->failures++;
+    pool->stats.failures++;
+
+    if ((endpoint->failures < POOL_EJECT_FAILURES) || (now < endpoint->ejected_until)) { return; }
+
+    endpoint->ejected_until = now + endpoint->eject_ms;
+    endpoint->eject_ms = (endpoint->eject_ms * 2 > POOL_EJECT_MAX_MS) ? POOL_EJECT_MAX_MS : endpoint->eject_ms * 2;
+    pool->stats.ejections++;
+}
+
+/* Call done
+ *
+ * Application errors are answers, so they count as a healthy endpoint. Timeouts and lost
+ * connections count against it.
+ */
+static void _call_done( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx ) {
+    pool_call_t *call = ctx;
+    pool_t *pool = call->pool;
+    pool_endpoint_t *endpoint = &pool->endpoints[pool->conns[call->conn].endpoint];
+    rpc_callback_t callback = call->callback;
+    void *callback_ctx = call->ctx;
+
+    /* Freed first, so the callback can issue the next request */
+    call->next_free = pool->free_call;
+    pool->free_call = (int)(call - pool->calls);
+
+    if (!pool->closing) {
+        if ((status == RPC_STATUS_OK) || (status == RPC_STATUS_ERROR)) {
+            pool->stats.completed++;
+            endpoint->failures = 0;
+            endpoint->eject_ms = POOL_EJECT_MS;
+        } else {
+            _endpoint_failed(pool, endpoint, get_monotonic_ms());
+        }
+    }
+
+    callback(status, req_id, buffer, len, callback_ctx);
+}
+
+/* xorshift32, only has to spread picks */
+static uint32_t _rand( pool_t *pool ) {
+    uint32_t x = pool->rand_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return pool->rand_state = x;
+}
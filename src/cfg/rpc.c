@@ -0,0 +1,704 @@
+#include "rpc.h"
+#include "logger.h"
+
+/* Keeps correlation ids positive, so they can be returned as an int */
+#define RPC_ID_MASK 0x7fffffffU
+#define RPC_SLOT(id) ((id) & (RPC_MAX_IN_FLIGHT - 1))
+
+typedef struct {
+    bool used;
+    uint32_t id;
+    msec_t deadline;
+    rpc_callback_t callback;
+    void *ctx;
+} rpc_request_t;
+
+typedef struct {
+    int fd;
+    bool connected;
+    bool want_write;
+    uint16_t flags;
+    bool peer_lz;
+    uint32_t next_id;
+    int in_flight;
+    rpc_request_t requests[RPC_MAX_IN_FLIGHT];
+
+    size_t in_len;
+    char in_buf[RPC_BUFFER_SIZE];
+    size_t out_len;
+    char out_buf[RPC_BUFFER_SIZE];
+
+    rpc_stats_t stats;
+} rpc_client_t;
+
+/* Server connection, in_buf is grown to whatever a receive adds to the requests still buffered */
+typedef struct {
+    ev_conn_t *conn;
+    size_t in_len;
+    size_t in_size;
+    char *in_buf;
+    size_t out_len;
+    char out_buf[RPC_BUFFER_SIZE];
+} rpc_conn_t;
+
+typedef struct {
+    rpc_request_handler_t handler;
+    void *ctx;
+} rpc_server_t;
+
+static rpc_client_t *rpc_clients[MAX_NUM_OF_SOCKS];
+
+/* Flags sent with every request, kept apart from the client so they survive detaching */
+static uint16_t rpc_flags[MAX_NUM_OF_SOCKS];
+static rpc_server_t rpc_servers[MAX_NUM_OF_SOCKS];
+
+/* Static Functions */
+static int _attach( sock_id_t *id );
+static void _client_handler( int fd, uint32_t events, void *ctx );
+static void _client_receive( sock_id_t id, rpc_client_t *client );
+static int _client_flush( rpc_client_t *client );
+static void _client_disconnect( sock_id_t id, rpc_client_t *client );
+static void _complete( rpc_client_t *client, rpc_request_t *request, E_RPC_STATUS status, const void *buffer, size_t len );
+static void _server_message_handler( ev_conn_t *conn, const void *buffer, size_t len, void *ctx );
+static void _server_conn_writable( ev_conn_t *conn, void *ctx );
+static void _server_conn_closed( ev_conn_t *conn, void *ctx );
+static int _server_process( rpc_conn_t *rpc_conn );
+static int _server_flush( rpc_conn_t *rpc_conn );
+static int _set_flag( sock_id_t id, uint16_t flag, bool enable );
+static uint32_t _put_payload( char *frame, const void *buffer, size_t len, bool compress, uint16_t *flags );
+static void _put_hdr( char *buffer, uint32_t id, uint32_t len, uint16_t status, uint16_t flags );
+static void _get_hdr( const char *buffer, rpc_hdr_t *hdr );
+static uint32_t _frame_crc( const char *frame, uint32_t len );
+static void _seal_frame( char *frame, uint32_t len );
+static bool _frame_valid( const char *frame, const rpc_hdr_t *hdr );
+
+/* Attach
+ *
+ * A client that lost its connection is re-initialized here, so the application only has to attach
+ * again. The checksum and compression settings follow the socket if it comes back with another id.
+ */
+int rpc_attach( sock_id_t *id ) {
+    sock_id_t prev;
+    int rc;
+
+    if (id == NULL) { return SOCK_NOT_OK; }
+    if ((*id < 0) || (*id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+
+    prev = *id;
+    rc = _attach(id);
+
+    if ((*id != prev) && (*id >= 0) && (*id < MAX_NUM_OF_SOCKS)) {
+        rpc_flags[*id] = rpc_flags[prev];
+        rpc_flags[prev] = 0;
+    }
+
+    if (rc == SOCK_OK) { rpc_clients[*id]->flags = rpc_flags[*id]; }
+
+    return rc;
+}
+
+/* The socket is made non-blocking once connected */
+static int _attach( sock_id_t *id ) {
+    rpc_client_t *client;
+    int type;
+    int fd;
+
+    if ((client = rpc_clients[*id]) != NULL) {
+        if (client->connected) { return SOCK_OK; }
+
+        rpc_detach(*id);
+
+        if (reset_sock(id) != SOCK_OK) { return SOCK_NOT_OK; }
+    }
+
+    type = get_sock_app_type(*id);
+
+    if ((type != E_TCP_SOCK) && (type != E_LOCAL_SOCK)) { return SOCK_NOT_OK; }
+
+    if (connect_sock(id) != SOCK_OK) { return SOCK_NOT_OK; }
+
+    if ((fd = get_sock_fd(*id)) < 0) { return SOCK_NOT_OK; }
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) { return SOCK_NOT_OK; }
+
+    if ((client = calloc(1, sizeof(rpc_client_t))) == NULL) { return SOCK_NOT_OK; }
+
+    client->fd = fd;
+    client->connected = true;
+
+    if (event_loop_watch_fd(fd, EPOLLIN, _client_handler, (void *)(intptr_t)*id) < 0) {
+        free(client);
+        return SOCK_NOT_OK;
+    }
+
+    rpc_clients[*id] = client;
+
+    return SOCK_OK;
+}
+
+int rpc_set_checksum( sock_id_t id, bool enable ) {
+    return _set_flag(id, RPC_FLAG_CRC, enable);
+}
+
+int rpc_set_compression( sock_id_t id, bool enable ) {
+    return _set_flag(id, RPC_FLAG_ACCEPT_LZ, enable);
+}
+
+/* Detach
+ *
+ * Completes every request in flight with RPC_STATUS_DISCONNECTED and frees the client, the socket
+ * is left open.
+ */
+void rpc_detach( sock_id_t id ) {
+    rpc_client_t *client;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return; }
+    if ((client = rpc_clients[id]) == NULL) { return; }
+
+    if (client->connected) {
+        client->connected = false;
+        (void)event_loop_unwatch_fd(client->fd);
+    }
+
+    /* Detached first, so callbacks can't reach the client */
+    rpc_clients[id] = NULL;
+
+    for (int i=0; i<RPC_MAX_IN_FLIGHT; i++) {
+        if (client->requests[i].used) {
+            _complete(client, &client->requests[i], RPC_STATUS_DISCONNECTED, NULL, 0);
+        }
+    }
+
+    free(client);
+}
+
+/* Call
+ *
+ * The request is appended to the send buffer and sent right away if the socket isn't full, a full
+ * socket is flushed from the event loop once it's writable.
+ */
+int rpc_call( sock_id_t id, const void *buffer, size_t len, msec_t timeout_ms, rpc_callback_t callback, void *ctx, uint32_t *req_id ) {
+    rpc_client_t *client;
+    rpc_request_t *request;
+    uint32_t next_id;
+    uint32_t wire_len;
+    uint16_t flags;
+    char *frame;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if ((buffer == NULL) && (len > 0)) { return SOCK_NOT_OK; }
+    if ((len > RPC_MAX_PAYLOAD) || (callback == NULL)) { return SOCK_NOT_OK; }
+    if (((client = rpc_clients[id]) == NULL) || !client->connected) { return SOCK_NOT_OK; }
+
+    if (client->in_flight >= RPC_MAX_IN_FLIGHT) { return SOCK_FAILED_TO_SEND; }
+
+    if ((client->out_len + sizeof(rpc_hdr_t) + len) > sizeof(client->out_buf)) {
+        if (_client_flush(client) < 0) {
+            _client_disconnect(id, client);
+            return SOCK_NOT_OK;
+        }
+        if ((client->out_len + sizeof(rpc_hdr_t) + len) > sizeof(client->out_buf)) {
+            return SOCK_FAILED_TO_SEND;
+        }
+    }
+
+    /* Ids wrap, skip those still in flight */
+    while (client->requests[RPC_SLOT(client->next_id)].used) {
+        client->next_id = (client->next_id + 1) & RPC_ID_MASK;
+    }
+
+    next_id = client->next_id;
+    client->next_id = (client->next_id + 1) & RPC_ID_MASK;
+
+    request = &client->requests[RPC_SLOT(next_id)];
+    request->used = true;
+    request->id = next_id;
+    request->deadline = get_monotonic_ms() + timeout_ms;
+    request->callback = callback;
+    request->ctx = ctx;
+
+    frame = client->out_buf + client->out_len;
+    flags = client->flags;
+
+    wire_len = _put_payload(frame, buffer, len, client->peer_lz && (flags & RPC_FLAG_ACCEPT_LZ), &flags);
+    _put_hdr(frame, next_id, wire_len, RPC_STATUS_OK, flags);
+    if (flags & RPC_FLAG_CRC) { _seal_frame(frame, wire_len); }
+    client->out_len += sizeof(rpc_hdr_t) + wire_len;
+
+    if (flags & RPC_FLAG_LZ) {
+        client->stats.compressed++;
+        client->stats.bytes_saved += len - wire_len;
+    }
+
+    client->in_flight++;
+    client->stats.sent++;
+
+    if (req_id != NULL) { *req_id = next_id; }
+
+    /* A failed send has already completed the request as RPC_STATUS_DISCONNECTED */
+    if (!client->want_write && (_client_flush(client) < 0)) {
+        _client_disconnect(id, client);
+    }
+
+    return SOCK_OK;
+}
+
+int rpc_num_in_flight( sock_id_t id ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (rpc_clients[id] == NULL) { return SOCK_NOT_OK; }
+
+    return rpc_clients[id]->in_flight;
+}
+
+bool rpc_connected( sock_id_t id ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return false; }
+
+    return (rpc_clients[id] != NULL) && rpc_clients[id]->connected;
+}
+
+/* Tick
+ *
+ * Expires requests past their deadline. Server connections need no tick, responses that didn't fit
+ * in a socket are sent once it's writable.
+ */
+void rpc_tick_all( void ) {
+    rpc_client_t *client;
+    msec_t now = get_monotonic_ms();
+
+    for (int i=0; i<MAX_NUM_OF_SOCKS; i++) {
+        if (((client = rpc_clients[i]) == NULL) || (client->in_flight == 0)) { continue; }
+
+        for (int j=0; j<RPC_MAX_IN_FLIGHT; j++) {
+            if (!client->requests[j].used || (client->requests[j].deadline > now)) { continue; }
+
+            client->stats.timeouts++;
+            _complete(client, &client->requests[j], RPC_STATUS_TIMEOUT, NULL, 0);
+
+            /* The callback may have detached */
+            if (rpc_clients[i] != client) { break; }
+        }
+    }
+}
+
+int get_rpc_stats( sock_id_t id, rpc_stats_t *stats ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if ((stats == NULL) || (rpc_clients[id] == NULL)) { return SOCK_NOT_OK; }
+
+    *stats = rpc_clients[id]->stats;
+    stats->in_flight = (uint32_t)rpc_clients[id]->in_flight;
+
+    return SOCK_OK;
+}
+
+int rpc_serve( sock_id_t id, rpc_request_handler_t handler, void *ctx ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (handler == NULL) { return SOCK_NOT_OK; }
+
+    rpc_servers[id].handler = handler;
+    rpc_servers[id].ctx = ctx;
+
+    if (event_loop_add_listener(id, _server_message_handler, NULL) < 0) { return SOCK_NOT_OK; }
+    if (event_loop_set_writable_handler(id, _server_conn_writable) < 0) { return SOCK_NOT_OK; }
+
+    return event_loop_set_close_handler(id, _server_conn_closed);
+}
+
+static void _client_handler( int __attribute__((unused)) fd, uint32_t events, void *ctx ) {
+    sock_id_t id = (sock_id_t)(intptr_t)ctx;
+    rpc_client_t *client = rpc_clients[id];
+
+    if ((client == NULL) || !client->connected) { return; }
+
+    if ((events & EPOLLOUT) && (_client_flush(client) < 0)) {
+        _client_disconnect(id, client);
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        _client_receive(id, client);
+    }
+}
+
+/* Receive responses
+ *
+ * Reads until the socket is empty and completes every whole response. Responses for requests that
+ * already timed out are counted as late and discarded.
+ */
+static void _client_receive( sock_id_t id, rpc_client_t *client ) {
+    static char payload[RPC_MAX_PAYLOAD];
+    rpc_request_t *request;
+    const char *response;
+    int response_len;
+    rpc_hdr_t hdr;
+    ssize_t num_bytes;
+    size_t consumed;
+
+    for (;;) {
+        num_bytes = recv(client->fd, client->in_buf + client->in_len, sizeof(client->in_buf) - client->in_len, 0);
+
+        if (num_bytes < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) { return; }
+        }
+
+        if (num_bytes <= 0) {
+            _client_disconnect(id, client);
+            return;
+        }
+
+        client->in_len += (size_t)num_bytes;
+        consumed = 0;
+
+        while ((client->in_len - consumed) >= sizeof(rpc_hdr_t)) {
+            _get_hdr(client->in_buf + consumed, &hdr);
+
+            if (hdr.len > RPC_MAX_PAYLOAD) {
+                log_warn("RPC: invalid response, disconnecting");
+                _client_disconnect(id, client);
+                return;
+            }
+
+            if ((client->in_len - consumed) < (sizeof(rpc_hdr_t) + hdr.len)) { break; }
+
+            if (!_frame_valid(client->in_buf + consumed, &hdr)) {
+                log_warn("RPC: corrupt response, disconnecting");
+                client->stats.corrupt++;
+                _client_disconnect(id, client);
+                return;
+            }
+
+            response = client->in_buf + consumed + sizeof(rpc_hdr_t);
+            response_len = (int)hdr.len;
+
+            if ((hdr.flags & RPC_FLAG_LZ) &&
+                ((response_len = lz_decompress(response, hdr.len, payload, sizeof(payload))) < 0)) {
+                log_warn("RPC: corrupt response, disconnecting");
+                client->stats.corrupt++;
+                _client_disconnect(id, client);
+                return;
+            }
+
+            if (hdr.flags & RPC_FLAG_LZ) { response = payload; }
+            if (hdr.flags & RPC_FLAG_ACCEPT_LZ) { client->peer_lz = true; }
+
+            request = &client->requests[RPC_SLOT(hdr.id)];
+
+            if (request->used && (request->id == hdr.id)) {
+                if (hdr.status == RPC_STATUS_OK) {
+                    client->stats.completed++;
+                } else {
+                    client->stats.errors++;
+                }
+
+                _complete(client, request, (E_RPC_STATUS)hdr.status, response, (size_t)response_len);
+
+                if ((rpc_clients[id] != client) || !client->connected) { return; }
+            } else {
+                client->stats.late++;
+            }
+
+            consumed += sizeof(rpc_hdr_t) + hdr.len;
+        }
+
+        memmove(client->in_buf, client->in_buf + consumed, client->in_len - consumed);
+        client->in_len -= consumed;
+    }
+}
+
+/* Flush requests, watching for writability while anything is left over */
+static int _client_flush( rpc_client_t *client ) {
+    ssize_t num_bytes;
+
+    if (client->out_len > 0) {
+        num_bytes = send(client->fd, client->out_buf, client->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (num_bytes < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) { return SOCK_NOT_OK; }
+            num_bytes = 0;
+        }
+
+        memmove(client->out_buf, client->out_buf + num_bytes, client->out_len - (size_t)num_bytes);
+        client->out_len -= (size_t)num_bytes;
+    }
+
+    if ((client->out_len > 0) != client->want_write) {
+        client->want_write = (client->out_len > 0);
+        (void)event_loop_modify_fd(client->fd, client->want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+    }
+
+    return SOCK_OK;
+}
+
+/* Disconnect
+ *
+ * The fd is no longer watched, every request in flight completes with RPC_STATUS_DISCONNECTED.
+ * The client stays attached, but refuses calls until rpc_attach() reconnects it.
+ */
+static void _client_disconnect( sock_id_t id, rpc_client_t *client ) {
+    client->connected = false;
+    client->in_len = 0;
+    client->out_len = 0;
+    client->stats.disconnects++;
+
+    (void)event_loop_unwatch_fd(client->fd);
+
+    for (int i=0; i<RPC_MAX_IN_FLIGHT; i++) {
+        if (client->requests[i].used) {
+            _complete(client, &client->requests[i], RPC_STATUS_DISCONNECTED, NULL, 0);
+
+            if (rpc_clients[id] != client) { return; }
+        }
+    }
+}
+
+/* The request slot is released before the callback, so the callback can issue the next request */
+static void _complete( rpc_client_t *client, rpc_request_t *request, E_RPC_STATUS status, const void *buffer, size_t len ) {
+    rpc_request_t done = *request;
+
+    request->used = false;
+    client->in_flight--;
+
+    done.callback(status, done.id, buffer, len, done.ctx);
+}
+
+/* Server message handler
+ *
+ * Requests are reassembled per connection and answered in order. Responses are buffered and sent
+ * once all requests of the receive are handled. A connection that sends an invalid frame is closed.
+ * Compression is offered back to clients that offer it.
+ */
+static void _server_message_handler( ev_conn_t *conn, const void *buffer, size_t len, void __attribute__((unused)) *ctx ) {
+    rpc_conn_t *rpc_conn = conn->data;
+    char *in_buf;
+
+    if (rpc_conn == NULL) {
+        if ((rpc_conn = calloc(1, sizeof(rpc_conn_t))) == NULL) {
+            (void)event_loop_close_conn(conn);
+            return;
+        }
+
+        rpc_conn->conn = conn;
+        conn->data = rpc_conn;
+    }
+
+    /* Normally holds less than a frame between receives, only a blocked connection's is larger */
+    if ((rpc_conn->in_len + len) > rpc_conn->in_size) {
+        if ((in_buf = realloc(rpc_conn->in_buf, rpc_conn->in_len + len + RPC_BUFFER_SIZE)) == NULL) {
+            (void)event_loop_close_conn(conn);
+            return;
+        }
+
+        rpc_conn->in_buf = in_buf;
+        rpc_conn->in_size = rpc_conn->in_len + len + RPC_BUFFER_SIZE;
+    }
+
+    memcpy(rpc_conn->in_buf + rpc_conn->in_len, buffer, len);
+    rpc_conn->in_len += len;
+
+    if (_server_process(rpc_conn) < 0) {
+        (void)event_loop_close_conn(conn);
+    }
+}
+
+/* Resumes the requests a blocked connection left buffered, closed if it failed meanwhile */
+static void _server_conn_writable( ev_conn_t *conn, void __attribute__((unused)) *ctx ) {
+    if ((conn->data != NULL) && (_server_process(conn->data) < 0)) {
+        (void)event_loop_close_conn(conn);
+    }
+}
+
+static void _server_conn_closed( ev_conn_t *conn, void __attribute__((unused)) *ctx ) {
+    rpc_conn_t *rpc_conn = conn->data;
+
+    if (rpc_conn == NULL) { return; }
+
+    conn->data = NULL;
+    free(rpc_conn->in_buf);
+    free(rpc_conn);
+}
+
+/* Process requests
+ *
+ * Handles the whole requests that are buffered while a response of any size still fits. A client
+ * that doesn't read its responses fills the buffer, the connection is then blocked, it's no longer
+ * read and the rest of its requests wait until the socket takes the responses. Returns SOCK_NOT_OK
+ * if the connection must be closed.
+ */
+static int _server_process( rpc_conn_t *rpc_conn ) {
+    static char request[RPC_MAX_PAYLOAD];
+    static char response[RPC_MAX_PAYLOAD];
+    rpc_server_t *server = &rpc_servers[rpc_conn->conn->listener];
+    const char *payload;
+    int payload_len;
+    uint32_t wire_len;
+    uint16_t flags;
+    char *frame;
+    rpc_hdr_t hdr;
+    size_t response_len;
+    size_t consumed = 0;
+    bool blocked = false;
+    int status;
+
+    while ((rpc_conn->in_len - consumed) >= sizeof(rpc_hdr_t)) {
+        _get_hdr(rpc_conn->in_buf + consumed, &hdr);
+
+        if (hdr.len > RPC_MAX_PAYLOAD) { return SOCK_NOT_OK; }
+
+        if ((rpc_conn->in_len - consumed) < (sizeof(rpc_hdr_t) + hdr.len)) { break; }
+
+        if (!_frame_valid(rpc_conn->in_buf + consumed, &hdr)) {
+            log_warn("RPC: corrupt request, closing connection");
+            return SOCK_NOT_OK;
+        }
+
+        if ((rpc_conn->out_len + sizeof(rpc_hdr_t) + RPC_MAX_PAYLOAD) > sizeof(rpc_conn->out_buf)) {
+            if (_server_flush(rpc_conn) < 0) { return SOCK_NOT_OK; }
+
+            if ((rpc_conn->out_len + sizeof(rpc_hdr_t) + RPC_MAX_PAYLOAD) > sizeof(rpc_conn->out_buf)) {
+                blocked = true;
+                break;
+            }
+        }
+
+        payload = rpc_conn->in_buf + consumed + sizeof(rpc_hdr_t);
+        payload_len = (int)hdr.len;
+
+        if (hdr.flags & RPC_FLAG_LZ) {
+            if ((payload_len = lz_decompress(payload, hdr.len, request, sizeof(request))) < 0) {
+                log_warn("RPC: corrupt request, closing connection");
+                return SOCK_NOT_OK;
+            }
+            payload = request;
+        }
+
+        response_len = 0;
+        status = server->handler(payload, (size_t)payload_len, response, &response_len, server->ctx);
+
+        if (response_len > RPC_MAX_PAYLOAD) {
+            response_len = 0;
+            status = RPC_STATUS_ERROR;
+        }
+
+        /* Responses are checked if their request was, and compressed if the client accepts it */
+        frame = rpc_conn->out_buf + rpc_conn->out_len;
+        flags = hdr.flags & (RPC_FLAG_CRC | RPC_FLAG_ACCEPT_LZ);
+
+        wire_len = _put_payload(frame, response, response_len, (flags & RPC_FLAG_ACCEPT_LZ) != 0, &flags);
+        _put_hdr(frame, hdr.id, wire_len, (uint16_t)status, flags);
+        if (flags & RPC_FLAG_CRC) { _seal_frame(frame, wire_len); }
+        rpc_conn->out_len += sizeof(rpc_hdr_t) + wire_len;
+
+        consumed += sizeof(rpc_hdr_t) + hdr.len;
+    }
+
+    memmove(rpc_conn->in_buf, rpc_conn->in_buf + consumed, rpc_conn->in_len - consumed);
+    rpc_conn->in_len -= consumed;
+
+    if (_server_flush(rpc_conn) < 0) { return SOCK_NOT_OK; }
+
+    /* Whatever is left is sent, and a blocked connection resumed, from the writable handler */
+    if (event_loop_want_write(rpc_conn->conn, blocked || (rpc_conn->out_len > 0), blocked) < 0) {
+        return SOCK_NOT_OK;
+    }
+
+    return SOCK_OK;
+}
+
+static int _server_flush( rpc_conn_t *rpc_conn ) {
+    ssize_t num_bytes;
+
+    if (rpc_conn->out_len == 0) { return SOCK_OK; }
+
+    num_bytes = send(rpc_conn->conn->fd, rpc_conn->out_buf, rpc_conn->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (num_bytes < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) { return SOCK_OK; }
+        return SOCK_NOT_OK;
+    }
+
+    (void)uncork_sock_conn(rpc_conn->conn->listener, rpc_conn->conn->fd);
+
+    memmove(rpc_conn->out_buf, rpc_conn->out_buf + num_bytes, rpc_conn->out_len - (size_t)num_bytes);
+    rpc_conn->out_len -= (size_t)num_bytes;
+
+    return SOCK_OK;
+}
+
+static int _set_flag( sock_id_t id, uint16_t flag, bool enable ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+
+    if (enable) {
+        rpc_flags[id] |= flag;
+    } else {
+        rpc_flags[id] &= (uint16_t)~flag;
+    }
+
+    if (rpc_clients[id] != NULL) { rpc_clients[id]->flags = rpc_flags[id]; }
+
+    return SOCK_OK;
+}
+
+/* Payload
+ *
+ * Written after the header of frame, compressed if that's allowed and saves at least a byte. Returns
+ * the length on the wire, RPC_FLAG_LZ is added to flags if it was compressed.
+ */
+static uint32_t _put_payload( char *frame, const void *buffer, size_t len, bool compress, uint16_t *flags ) {
+    int num_bytes;
+
+    if (compress && (len >= RPC_LZ_MIN_SIZE) &&
+        ((num_bytes = lz_compress(buffer, len, frame + sizeof(rpc_hdr_t), len - 1)) > 0)) {
+        *flags |= RPC_FLAG_LZ;
+        return (uint32_t)num_bytes;
+    }
+
+    if (len > 0) { memcpy(frame + sizeof(rpc_hdr_t), buffer, len); }
+
+    return (uint32_t)len;
+}
+
+static void _put_hdr( char *buffer, uint32_t id, uint32_t len, uint16_t status, uint16_t flags ) {
+    rpc_hdr_t hdr;
+
+    hdr.id = htonl(id);
+    hdr.len = htonl(len);
+    hdr.status = htons(status);
+    hdr.flags = htons(flags);
+    hdr.crc = 0;
+
+    memcpy(buffer, &hdr, sizeof(hdr));
+}
+
+static void _get_hdr( const char *buffer, rpc_hdr_t *hdr ) {
+    memcpy(hdr, buffer, sizeof(*hdr));
+
+    hdr->id = ntohl(hdr->id);
+    hdr->len = ntohl(hdr->len);
+    hdr->status = ntohs(hdr->status);
+    hdr->flags = ntohs(hdr->flags);
+    hdr->crc = ntohl(hdr->crc);
+}
+
+/* CRC of a frame as sent, with the crc field zeroed */
+static uint32_t _frame_crc( const char *frame, uint32_t len ) {
+    rpc_hdr_t hdr;
+
+    memcpy(&hdr, frame, sizeof(hdr));
+    hdr.crc = 0;
+
+    return crc32c(crc32c(0, &hdr, sizeof(hdr)), frame + sizeof(hdr), len);
+}
+
+/* Fills in the crc of a frame whose payload is in place */
+static void _seal_frame( char *frame, uint32_t len ) {
+    rpc_hdr_t hdr;
+
+    memcpy(&hdr, frame, sizeof(hdr));
+    hdr.crc = htonl(_frame_crc(frame, len));
+    memcpy(frame, &hdr, sizeof(hdr));
+}
+
+static bool _frame_valid( const char *frame, const rpc_hdr_t *hdr ) {
+    if ((hdr->flags & RPC_FLAG_CRC) == 0) { return true; }
+
+    return _frame_crc(frame, hdr->len) == hdr->crc;
+}
@@ -0,0 +1,695 @@
+#include <unistd.h>
+#include <time.h>
+
+#include "rudp.h"
+
+#define RUDP_TYPE_DATA 1
+#define RUDP_TYPE_ACK  2
+
+/* Congestion window is kept in 1/256ths of a message, so additive increase can add less than one */
+#define RUDP_CWND_SCALE 256
+#define RUDP_INITIAL_CWND (4 * RUDP_CWND_SCALE)
+
+#define RUDP_SLOT(seq) ((seq) & (RUDP_WINDOW_SIZE - 1))
+
+/* Data carries the sender's epoch and oldest unacknowledged message in sack, an ack the epoch it acks */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t len;
+    uint32_t epoch;
+    uint32_t seq;
+    uint32_t sack;
+    uint32_t ts;
+} rudp_hdr_t;
+
+typedef struct {
+    bool used;
+    uint8_t dup_acks;
+    uint8_t retries;
+    uint16_t len;
+    msec_t sent_ms;
+    char data[RUDP_MAX_PAYLOAD];
+} rudp_slot_t;
+
+typedef struct {
+    sockaddr_storage_t addr;
+    socklen_t addr_len;
+    msec_t last_active_ms;
+
+    /* Send side */
+    uint32_t epoch;
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    uint32_t recover;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    msec_t srtt;
+    msec_t rttvar;
+    msec_t rto;
+    rudp_slot_t snd_buf[RUDP_WINDOW_SIZE];
+
+    /* Receive side, rcv_nxt is delivered next, rcv_ack is the first message not yet received. 0 is
+     * no remote epoch yet.
+     */
+    uint32_t remote_epoch;
+    uint32_t rcv_nxt;
+    uint32_t rcv_ack;
+    uint32_t ts_echo;
+    bool ack_pending;
+    rudp_slot_t rcv_buf[RUDP_WINDOW_SIZE];
+} rudp_peer_t;
+
+typedef struct {
+    int fd;
+    int next_peer;
+    rudp_peer_t *peers[RUDP_MAX_PEERS];
+    rudp_stats_t stats;
+
+    /* Ring of dropped peers not yet reported, the oldest are overwritten */
+    rudp_drop_t drops[RUDP_MAX_PEERS];
+    int drop_head;
+    int num_drops;
+} rudp_sock_t;
+
+static rudp_sock_t *rudp_socks[MAX_NUM_OF_SOCKS];
+
+/* The epoch _new_epoch() returned last */
+static uint32_t last_epoch;
+
+/* Static Functions */
+static rudp_sock_t *_get_rudp_sock( sock_id_t id );
+static rudp_peer_t *_find_peer( rudp_sock_t *sock, const sockaddr_t *addr, socklen_t addr_len, bool create );
+static void _drop_peer( rudp_sock_t *sock, int idx );
+static uint32_t _undelivered( const rudp_peer_t *peer );
+static uint32_t _new_epoch( void );
+static void _resync( rudp_sock_t *sock, rudp_peer_t *peer, uint32_t epoch, uint32_t seq );
+static void _transmit( rudp_sock_t *sock, rudp_peer_t *peer, uint32_t seq, msec_t now );
+static void _send_ack( rudp_sock_t *sock, rudp_peer_t *peer );
+static void _handle_data( rudp_sock_t *sock, rudp_peer_t *peer, const rudp_hdr_t *hdr, const char *payload, size_t len );
+static void _handle_ack( rudp_sock_t *sock, rudp_peer_t *peer, const rudp_hdr_t *hdr, msec_t now );
+static void _update_rtt( rudp_peer_t *peer, msec_t rtt );
+static uint32_t _send_window( rudp_peer_t *peer );
+
+int rudp_send( sock_id_t id, const sockaddr_t *peer_addr, socklen_t peer_len, const void *buffer, size_t len ) {
+    sockaddr_storage_t addr;
+    rudp_sock_t *sock;
+    rudp_peer_t *peer;
+    rudp_slot_t *slot;
+
+    if ((buffer == NULL) || (len > RUDP_MAX_PAYLOAD)) { return SOCK_NOT_OK; }
+    if ((sock = _get_rudp_sock(id)) == NULL) { return SOCK_NOT_OK; }
+
+    if (peer_addr == NULL) {
+        if (get_sock_addr(id, &addr, &peer_len) < 0) { return SOCK_NOT_OK; }
+        peer_addr = (const sockaddr_t *)&addr;
+    }
+
+    if ((peer = _find_peer(sock, peer_addr, peer_len, true)) == NULL) { return SOCK_NOT_OK; }
+
+    if ((peer->snd_nxt - peer->snd_una) >= _send_window(peer)) {
+        return SOCK_FAILED_TO_SEND;
+    }
+
+    slot = &peer->snd_buf[RUDP_SLOT(peer->snd_nxt)];
+    slot->used = true;
+    slot->sent_ms = 0;
+    slot->dup_acks = 0;
+    slot->retries = 0;
+    slot->len = (uint16_t)len;
+    memcpy(slot->data, buffer, len);
+
+    _transmit(sock, peer, peer->snd_nxt, get_monotonic_ms());
+    peer->snd_nxt++;
+
+    sock->stats.sent++;
+
+    return SOCK_OK;
+}
+
+/* Receive in-order message
+ *
+ * Peers are visited round-robin, so one peer with a full window can't starve the others.
+ */
+int rudp_receive( sock_id_t id, void *buffer, size_t len, sockaddr_storage_t *peer_addr, socklen_t *peer_len ) {
+    rudp_sock_t *sock;
+    rudp_peer_t *peer;
+    rudp_slot_t *slot;
+    if (buffer == NULL) { return SOCK_NOT_OK; }
+    if ((sock = _get_rudp_sock(id)) == NULL) { return SOCK_NOT_OK; }
+
+    for (int i=0; i<RUDP_MAX_PEERS; i++) {
+        int cur = (sock->next_peer + i) % RUDP_MAX_PEERS;
+
+        if ((peer = sock->peers[cur]) == NULL) { continue; }
+
+        slot = &peer->rcv_buf[RUDP_SLOT(peer->rcv_nxt)];
+
+        if (!slot->used) { continue; }
+
+        memcpy(buffer, slot->data, (slot->len > len) ? len : slot->len);
+
+        if (peer_addr != NULL) { memcpy(peer_addr, &peer->addr, peer->addr_len); }
+        if (peer_len != NULL) { *peer_len = peer->addr_len; }
+
+        slot->used = false;
+        peer->rcv_nxt++;
+
+        sock->next_peer = (cur + 1) % RUDP_MAX_PEERS;
+        sock->stats.delivered++;
+
+        return (int)slot->len;
+    }
+
+    return SOCK_NOT_OK;
+}
+
+/* Process datagrams
+ *
+ * Reads every pending datagram without blocking. Acks are sent once per peer after the socket is
+ * drained, rather than once per message, a burst is acknowledged by a single ack. Returns the number
+ * of datagrams processed.
+ */
+int rudp_process( sock_id_t id ) {
+    char datagram[sizeof(rudp_hdr_t) + RUDP_MAX_PAYLOAD];
+    sockaddr_storage_t addr;
+    socklen_t addr_len;
+    rudp_sock_t *sock;
+    rudp_peer_t *peer;
+    rudp_hdr_t hdr;
+    ssize_t num_bytes;
+    msec_t now = get_monotonic_ms();
+    int processed = 0;
+
+    if ((sock = _get_rudp_sock(id)) == NULL) { return SOCK_NOT_OK; }
+
+    for (;;) {
+        addr_len = sizeof(addr);
+
+        num_bytes = recvfrom(sock->fd, datagram, sizeof(datagram), MSG_DONTWAIT, (sockaddr_t *)&addr, &addr_len);
+
+        if (num_bytes < 0) { break; }
+        if (num_bytes < (ssize_t)sizeof(hdr)) { continue; }
+
+        memcpy(&hdr, datagram, sizeof(hdr));
+        hdr.len = ntohs(hdr.len);
+        hdr.epoch = ntohl(hdr.epoch);
+        hdr.seq = ntohl(hdr.seq);
+        hdr.sack = ntohl(hdr.sack);
+        hdr.ts = ntohl(hdr.ts);
+
+        if (hdr.len != (num_bytes - sizeof(hdr))) { continue; }
+
+        /* Only data creates a peer, a stray ack must not take a slot */
+        if ((peer = _find_peer(sock, (sockaddr_t *)&addr, addr_len, (hdr.type == RUDP_TYPE_DATA))) == NULL) {
+            sock->stats.dropped++;
+            continue;
+        }
+
+        peer->last_active_ms = now;
+        processed++;
+
+        if (hdr.type == RUDP_TYPE_DATA) {
+            _handle_data(sock, peer, &hdr, datagram + sizeof(hdr), hdr.len);
+        } else if (hdr.type == RUDP_TYPE_ACK) {
+            _handle_ack(sock, peer, &hdr, now);
+        }
+    }
+
+    for (int i=0; i<RUDP_MAX_PEERS; i++) {
+        if ((sock->peers[i] != NULL) && sock->peers[i]->ack_pending) {
+            _send_ack(sock, sock->peers[i]);
+        }
+    }
+
+    return processed;
+}
+
+/* Retransmit timers
+ *
+ * Retransmits every message that has been in flight longer than the peer's RTO. A timeout is taken as
+ * congestion, the window collapses to one message and the RTO backs off exponentially, once per tick
+ * however many messages timed out. A peer that exhausts RUDP_MAX_RETRIES is considered gone and its
+ * state is dropped, a later message to it starts a new epoch.
+ */
+void rudp_tick( sock_id_t id ) {
+    rudp_sock_t *sock;
+    rudp_peer_t *peer;
+    rudp_slot_t *slot;
+    msec_t now = get_monotonic_ms();
+    bool timed_out;
+    bool failed;
+
+    if ((sock = _get_rudp_sock(id)) == NULL) { return; }
+
+    for (int i=0; i<RUDP_MAX_PEERS; i++) {
+        if ((peer = sock->peers[i]) == NULL) { continue; }
+
+        timed_out = false;
+        failed = false;
+
+        for (uint32_t seq = peer->snd_una; seq != peer->snd_nxt; seq++) {
+            slot = &peer->snd_buf[RUDP_SLOT(seq)];
+
+            if (!slot->used || ((now - slot->sent_ms) < peer->rto)) { continue; }
+
+            if (slot->retries >= RUDP_MAX_RETRIES) {
+                failed = true;
+                break;
+            }
+
+            slot->retries++;
+            _transmit(sock, peer, seq, now);
+
+            sock->stats.retransmits++;
+            timed_out = true;
+        }
+
+        if (failed) {
+            _drop_peer(sock, i);
+            sock->stats.peers_failed++;
+            continue;
+        }
+
+        if (timed_out) {
+            uint32_t in_flight = (peer->snd_nxt - peer->snd_una) * RUDP_CWND_SCALE;
+
+            peer->ssthresh = (in_flight / 2 > 2 * RUDP_CWND_SCALE) ? in_flight / 2 : 2 * RUDP_CWND_SCALE;
+            peer->cwnd = RUDP_CWND_SCALE;
+            peer->recover = peer->snd_nxt;
+            peer->rto = (peer->rto * 2 > RUDP_MAX_RTO_MS) ? RUDP_MAX_RTO_MS : peer->rto * 2;
+
+            sock->stats.timeouts++;
+        }
+
+        if (peer->ack_pending) {
+            _send_ack(sock, peer);
+        }
+    }
+}
+
+void rudp_tick_all( void ) {
+    for (int i=0; i<MAX_NUM_OF_SOCKS; i++) {
+        if (rudp_socks[i] != NULL) {
+            rudp_tick(i);
+        }
+    }
+}
+
+void rudp_close( sock_id_t id ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return; }
+    if (rudp_socks[id] == NULL) { return; }
+
+    for (int i=0; i<RUDP_MAX_PEERS; i++) {
+        free(rudp_socks[id]->peers[i]);
+    }
+
+    free(rudp_socks[id]);
+    rudp_socks[id] = NULL;
+}
+
+int rudp_dropped( sock_id_t id, rudp_drop_t *drop ) {
+    rudp_sock_t *sock;
+
+    if (drop == NULL) { return SOCK_NOT_OK; }
+    if ((sock = _get_rudp_sock(id)) == NULL) { return SOCK_NOT_OK; }
+    if (sock->num_drops == 0) { return SOCK_NOT_OK; }
+
+    *drop = sock->drops[sock->drop_head];
+    sock->drop_head = (sock->drop_head + 1) % RUDP_MAX_PEERS;
+    sock->num_drops--;
+
+    return SOCK_OK;
+}
+
+int get_rudp_stats( sock_id_t id, rudp_stats_t *stats ) {
+    rudp_sock_t *sock;
+
+    if (stats == NULL) { return SOCK_NOT_OK; }
+    if ((sock = _get_rudp_sock(id)) == NULL) { return SOCK_NOT_OK; }
+
+    *stats = sock->stats;
+
+    /* RTT and window of the most recently active peer */
+    for (int i=0, best=-1; i<RUDP_MAX_PEERS; i++) {
+        if ((sock->peers[i] == NULL) ||
+            ((best >= 0) && (sock->peers[i]->last_active_ms < sock->peers[best]->last_active_ms))) {
+            continue;
+        }
+        best = i;
+        stats->srtt_ms = sock->peers[i]->srtt;
+        stats->cwnd = sock->peers[i]->cwnd / RUDP_CWND_SCALE;
+    }
+
+    return SOCK_OK;
+}
+
+/* State is created on first use, the socket must have been initialized as E_RUDP_SOCK */
+static rudp_sock_t *_get_rudp_sock( sock_id_t id ) {
+    int fd;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return NULL; }
+
+    if (rudp_socks[id] != NULL) { return rudp_socks[id]; }
+
+    if (get_sock_app_type(id) != E_RUDP_SOCK) { return NULL; }
+    if ((fd = get_sock_fd(id)) < 0) { return NULL; }
+
+    if ((rudp_socks[id] = calloc(1, sizeof(rudp_sock_t))) == NULL) { return NULL; }
+
+    rudp_socks[id]->fd = fd;
+
+    return rudp_socks[id];
+}
+
+/* Find peer
+ *
+ * Peers are matched by address. When every slot is taken, the least recently active peer with nothing
+ * in flight or undelivered is replaced.
+ */
+static rudp_peer_t *_find_peer( rudp_sock_t *sock, const sockaddr_t *addr, socklen_t addr_len, bool create ) {
+    rudp_peer_t *peer;
+    int free_slot = -1;
+    int idle_slot = -1;
+
+    for (int i=0; i<RUDP_MAX_PEERS; i++) {
+        if ((peer = sock->peers[i]) == NULL) {
+            if (free_slot < 0) { free_slot = i; }
+            continue;
+        }
+
+        if ((peer->addr_len == addr_len) && (memcmp(&peer->addr, addr, addr_len) == 0)) {
+            return peer;
+        }
+
+        if ((peer->snd_una == peer->snd_nxt) && (_undelivered(peer) == 0) &&
+            ((idle_slot < 0) || (peer->last_active_ms < sock->peers[idle_slot]->last_active_ms))) {
+            idle_slot = i;
+        }
+    }
+
+    if (!create) { return NULL; }
+
+    if (free_slot < 0) {
+        if (idle_slot < 0) { return NULL; }
+        _drop_peer(sock, idle_slot);
+        sock->stats.peers_evicted++;
+        free_slot = idle_slot;
+    }
+
+    if ((peer = calloc(1, sizeof(rudp_peer_t))) == NULL) { return NULL; }
+
+    memcpy(&peer->addr, addr, addr_len);
+    peer->addr_len = addr_len;
+    peer->epoch = _new_epoch();
+    peer->cwnd = RUDP_INITIAL_CWND;
+    peer->ssthresh = RUDP_WINDOW_SIZE * RUDP_CWND_SCALE;
+    peer->rto = RUDP_INITIAL_RTO_MS;
+    peer->last_active_ms = get_monotonic_ms();
+
+    sock->peers[free_slot] = peer;
+
+    return peer;
+}
+
+/* Frees the state of a peer and keeps it to be reported by rudp_dropped() */
+static void _drop_peer( rudp_sock_t *sock, int idx ) {
+    rudp_peer_t *peer = sock->peers[idx];
+    rudp_drop_t *drop;
+
+    if (sock->num_drops == RUDP_MAX_PEERS) {
+        sock->drop_head = (sock->drop_head + 1) % RUDP_MAX_PEERS;
+        sock->num_drops--;
+    }
+
+    drop = &sock->drops[(sock->drop_head + sock->num_drops) % RUDP_MAX_PEERS];
+    sock->num_drops++;
+
+    memset(drop, 0, sizeof(*drop));
+    memcpy(&drop->addr, &peer->addr, peer->addr_len);
+    drop->addr_len = peer->addr_len;
+    drop->unacked = peer->snd_nxt - peer->snd_una;
+    drop->undelivered = _undelivered(peer);
+
+    free(peer);
+    sock->peers[idx] = NULL;
+}
+
+/* Messages received, in order or not, that rudp_receive() hasn't returned yet */
+static uint32_t _undelivered( const rudp_peer_t *peer ) {
+    uint32_t count = 0;
+
+    for (int i=0; i<RUDP_WINDOW_SIZE; i++) {
+        if (peer->rcv_buf[i].used) { count++; }
+    }
+
+    return count;
+}
+
+/* Wall clock time in ms, later than any epoch before it in this process, and never 0, which is no
+ * epoch. A restarted process starts later than the sessions it replaces.
+ */
+static uint32_t _new_epoch( void ) {
+    struct timespec ts;
+    uint32_t epoch;
+
+    (void)clock_gettime(CLOCK_REALTIME, &ts);
+    epoch = (uint32_t)(((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000));
+
+    if ((last_epoch != 0) && ((int32_t)(epoch - last_epoch) <= 0)) { epoch = last_epoch + 1; }
+    if (epoch == 0) { epoch = 1; }
+
+    last_epoch = epoch;
+
+    return epoch;
+}
+
+/* Starts receiving epoch at seq, what's buffered from before it is never delivered */
+static void _resync( rudp_sock_t *sock, rudp_peer_t *peer, uint32_t epoch, uint32_t seq ) {
+    for (int i=0; i<RUDP_WINDOW_SIZE; i++) {
+        if (peer->rcv_buf[i].used) {
+            peer->rcv_buf[i].used = false;
+            sock->stats.dropped++;
+        }
+    }
+
+    if (peer->remote_epoch != 0) { sock->stats.resyncs++; }
+
+    peer->remote_epoch = epoch;
+    peer->rcv_nxt = seq;
+    peer->rcv_ack = seq;
+}
+
+static void _transmit( rudp_sock_t *sock, rudp_peer_t *peer, uint32_t seq, msec_t now ) {
+    char datagram[sizeof(rudp_hdr_t) + RUDP_MAX_PAYLOAD];
+    rudp_slot_t *slot = &peer->snd_buf[RUDP_SLOT(seq)];
+    rudp_hdr_t hdr;
+
+    hdr.type = RUDP_TYPE_DATA;
+    hdr.reserved = 0;
+    hdr.len = htons(slot->len);
+    hdr.epoch = htonl(peer->epoch);
+    hdr.seq = htonl(seq);
+    hdr.sack = htonl(peer->snd_una);
+    hdr.ts = htonl((uint32_t)now);
+
+    memcpy(datagram, &hdr, sizeof(hdr));
+    memcpy(datagram + sizeof(hdr), slot->data, slot->len);
+
+    slot->sent_ms = now;
+
+    /* A failed sendto() is a lost datagram, the retransmit timer recovers it */
+    (void)sendto(sock->fd, datagram, sizeof(hdr) + slot->len, MSG_DONTWAIT, (sockaddr_t *)&peer->addr, peer->addr_len);
+}
+
+/* Send ack
+ *
+ * The cumulative ack is the first message not yet received, bit n of the SACK bitmap reports message
+ * ack + 1 + n. The timestamp of the latest data message is echoed for the RTT estimate.
+ */
+static void _send_ack( rudp_sock_t *sock, rudp_peer_t *peer ) {
+    rudp_hdr_t hdr;
+    uint32_t sack = 0;
+
+    for (uint32_t n=0; n<RUDP_SACK_BITS; n++) {
+        uint32_t seq = peer->rcv_ack + 1 + n;
+
+        if ((seq - peer->rcv_nxt) >= RUDP_WINDOW_SIZE) { break; }
+
+        if (peer->rcv_buf[RUDP_SLOT(seq)].used) {
+            sack |= (1U << n);
+        }
+    }
+
+    hdr.type = RUDP_TYPE_ACK;
+    hdr.reserved = 0;
+    hdr.len = 0;
+    hdr.epoch = htonl(peer->remote_epoch);
+    hdr.seq = htonl(peer->rcv_ack);
+    hdr.sack = htonl(sack);
+    hdr.ts = htonl(peer->ts_echo);
+
+    (void)sendto(sock->fd, &hdr, sizeof(hdr), MSG_DONTWAIT, (sockaddr_t *)&peer->addr, peer->addr_len);
+
+    peer->ack_pending = false;
+}
+
+/* Handle data
+ *
+ * Messages are buffered by sequence number until delivered. Anything outside the receive window is
+ * dropped, duplicates are still acknowledged since the previous ack may have been lost.
+ *
+ * A newer epoch, by serial number comparison, starts over at the sender's oldest unacknowledged
+ * message. So does a sender that has acks for messages never received here, only a previous state
+ * of this peer can have sent them. A late message of an older epoch is dropped without an ack, its
+ * session was already replaced.
+ */
+static void _handle_data( rudp_sock_t *sock, rudp_peer_t *peer, const rudp_hdr_t *hdr, const char *payload, size_t len ) {
+    rudp_slot_t *slot;
+    int32_t newer = (int32_t)(hdr->epoch - peer->remote_epoch);
+
+    if ((peer->remote_epoch != 0) && (newer < 0)) {
+        sock->stats.dropped++;
+        return;
+    }
+
+    if ((newer != 0) || ((int32_t)(hdr->sack - peer->rcv_ack) > 0)) {
+        _resync(sock, peer, hdr->epoch, hdr->sack);
+    }
+
+    peer->ack_pending = true;
+    peer->ts_echo = hdr->ts;
+
+    if ((hdr->seq - peer->rcv_nxt) >= RUDP_WINDOW_SIZE) {
+        /* Already delivered, or beyond the buffer */
+        if ((int32_t)(hdr->seq - peer->rcv_nxt) < 0) {
+            sock->stats.duplicates++;
+        } else {
+            sock->stats.dropped++;
+        }
+        return;
+    }
+
+    slot = &peer->rcv_buf[RUDP_SLOT(hdr->seq)];
+
+    if (slot->used || ((int32_t)(hdr->seq - peer->rcv_ack) < 0)) {
+        sock->stats.duplicates++;
+        return;
+    }
+
+    slot->used = true;
+    slot->len = (uint16_t)len;
+    memcpy(slot->data, payload, len);
+
+    sock->stats.received++;
+
+    while (((peer->rcv_ack - peer->rcv_nxt) < RUDP_WINDOW_SIZE) && peer->rcv_buf[RUDP_SLOT(peer->rcv_ack)].used) {
+        peer->rcv_ack++;
+    }
+}
+
+/* Handle ack
+ *
+ * Frees acknowledged messages and grows the congestion window, one message per ack in slow start,
+ * one message per window afterwards. Messages still missing below the highest SACKed message count
+ * duplicate acks, RUDP_DUP_THRESH of them trigger a fast retransmit and halve the window, at most
+ * once per window of data (the recover point).
+ */
+static void _handle_ack( rudp_sock_t *sock, rudp_peer_t *peer, const rudp_hdr_t *hdr, msec_t now ) {
+    rudp_slot_t *slot;
+    uint32_t highest_sacked = hdr->seq;
+    uint32_t newly_acked = 0;
+
+    /* Ack of a previous epoch, or for something never sent */
+    if (hdr->epoch != peer->epoch) { return; }
+    if ((hdr->seq - peer->snd_una) > (peer->snd_nxt - peer->snd_una)) { return; }
+
+    for (uint32_t seq = peer->snd_una; seq != hdr->seq; seq++) {
+        slot = &peer->snd_buf[RUDP_SLOT(seq)];
+        if (slot->used) {
+            slot->used = false;
+            newly_acked++;
+        }
+    }
+
+    for (uint32_t n=0; n<RUDP_SACK_BITS; n++) {
+        uint32_t seq = hdr->seq + 1 + n;
+
+        if (!(hdr->sack & (1U << n))) { continue; }
+        if ((seq - peer->snd_una) >= (peer->snd_nxt - peer->snd_una)) { break; }
+
+        slot = &peer->snd_buf[RUDP_SLOT(seq)];
+        if (slot->used) {
+            slot->used = false;
+            newly_acked++;
+        }
+        highest_sacked = seq;
+    }
+
+    peer->snd_una = hdr->seq;
+    while ((peer->snd_una != peer->snd_nxt) && !peer->snd_buf[RUDP_SLOT(peer->snd_una)].used) {
+        peer->snd_una++;
+    }
+
+    if (newly_acked > 0) {
+        _update_rtt(peer, (msec_t)((uint32_t)now - hdr->ts));
+
+        for (uint32_t n=0; n<newly_acked; n++) {
+            if (peer->cwnd < peer->ssthresh) {
+                peer->cwnd += RUDP_CWND_SCALE;
+            } else {
+                peer->cwnd += (RUDP_CWND_SCALE * RUDP_CWND_SCALE) / peer->cwnd;
+            }
+        }
+
+        if (peer->cwnd > RUDP_WINDOW_SIZE * RUDP_CWND_SCALE) {
+            peer->cwnd = RUDP_WINDOW_SIZE * RUDP_CWND_SCALE;
+        }
+    }
+
+    for (uint32_t seq = peer->snd_una; seq != highest_sacked; seq++) {
+        slot = &peer->snd_buf[RUDP_SLOT(seq)];
+
+        if (!slot->used || (++slot->dup_acks != RUDP_DUP_THRESH)) { continue; }
+
+        _transmit(sock, peer, seq, now);
+        sock->stats.fast_retransmits++;
+
+        if ((int32_t)(seq - peer->recover) >= 0) {
+            peer->ssthresh = (peer->cwnd / 2 > 2 * RUDP_CWND_SCALE) ? peer->cwnd / 2 : 2 * RUDP_CWND_SCALE;
+            peer->cwnd = peer->ssthresh;
+            peer->recover = peer->snd_nxt;
+        }
+    }
+}
+
+/* RTT estimate (RFC 6298)
+ *
+ * The echoed timestamp belongs to the transmission that was acked, so retransmitted messages give
+ * valid samples as well.
+ */
+static void _update_rtt( rudp_peer_t *peer, msec_t rtt ) {
+    msec_t delta;
+
+    if (peer->srtt == 0) {
+        peer->srtt = rtt;
+        peer->rttvar = rtt / 2;
+    } else {
+        delta = (peer->srtt > rtt) ? (peer->srtt - rtt) : (rtt - peer->srtt);
+        peer->rttvar = (3 * peer->rttvar + delta) / 4;
+        peer->srtt = (7 * peer->srtt + rtt) / 8;
+    }
+
+    peer->rto = peer->srtt + 4 * peer->rttvar;
+
+    if (peer->rto < RUDP_MIN_RTO_MS) { peer->rto = RUDP_MIN_RTO_MS; }
+    if (peer->rto > RUDP_MAX_RTO_MS) { peer->rto = RUDP_MAX_RTO_MS; }
+}
+
+static uint32_t _send_window( rudp_peer_t *peer ) {
+    uint32_t cwnd = peer->cwnd / RUDP_CWND_SCALE;
+
+    if (cwnd < 1) { cwnd = 1; }
+
+    return (cwnd < RUDP_WINDOW_SIZE) ? cwnd : RUDP_WINDOW_SIZE;
+}
@@ -0,0 +1,216 @@
+#include "scheduler.h"
+
+typedef struct {
+    bool used;
+    char name[SCHEDULER_NAME_SIZE];
+    E_SCHEDULER_CLASS cls;
+    usec_t period_us;
+    usec_t deadline_us;
+    scheduler_task_t task;
+    void *arg;
+
+    /* Release of the current period, the task is ready once it has passed */
+    usec_t release_us;
+    /* The current period's run yielded and hasn't finished */
+    bool started;
+
+    scheduler_stats_t stats;
+} task_t;
+
+static task_t tasks[SCHEDULER_MAX_TASKS];
+
+static int budget_percent[SCHEDULER_NUM_CLASSES] = { 100, 100, 100 };
+static usec_t used_us[SCHEDULER_NUM_CLASSES];
+static usec_t window_start_us;
+
+/* When the running task should yield, see scheduler_should_yield() */
+static bool running;
+static usec_t yield_at_us;
+
+/* Static Functions */
+static int _pick( usec_t now, bool within_budget );
+static bool _over_budget( E_SCHEDULER_CLASS cls );
+static void _finish( task_t *t, usec_t now );
+static task_t *_get_task( int id );
+
+int scheduler_add_task( const char *name, E_SCHEDULER_CLASS cls, msec_t period_ms, msec_t deadline_ms,
+                        scheduler_task_t task, void *arg ) {
+    task_t *t;
+    int id;
+
+    if ((task == NULL) || (cls < 0) || (cls >= SCHEDULER_NUM_CLASSES) || (period_ms <= 0) || (deadline_ms < 0)) {
+        return SCHEDULER_NOT_OK;
+    }
+
+    for (id=0; id<SCHEDULER_MAX_TASKS; id++) {
+        if (!tasks[id].used) { break; }
+    }
+
+    if (id == SCHEDULER_MAX_TASKS) {
+        printf("No free scheduler slots\n");
+        return SCHEDULER_NOT_OK;
+    }
+
+    t = &tasks[id];
+    memset(t, 0, sizeof(*t));
+
+    strncpy(t->name, (name != NULL) ? name : "task", SCHEDULER_NAME_SIZE - 1);
+    t->cls = cls;
+    t->period_us = (usec_t)period_ms * 1000;
+    t->deadline_us = (usec_t)((deadline_ms > 0) ? deadline_ms : period_ms) * 1000;
+    t->task = task;
+    t->arg = arg;
+
+    /* First released right away */
+    t->release_us = get_monotonic_us();
+    t->used = true;
+
+    return id;
+}
+
+int scheduler_remove_task( int id ) {
+    task_t *t;
+
+    if ((t = _get_task(id)) == NULL) { return SCHEDULER_NOT_OK; }
+
+    t->used = false;
+
+    return SCHEDULER_OK;
+}
+
+int scheduler_set_budget( E_SCHEDULER_CLASS cls, int percent ) {
+    if ((cls < 0) || (cls >= SCHEDULER_NUM_CLASSES) || (percent <= 0) || (percent > 100)) { return SCHEDULER_NOT_OK; }
+
+    budget_percent[cls] = percent;
+
+    return SCHEDULER_OK;
+}
+
+bool scheduler_should_yield( void ) {
+    return running && (get_monotonic_us() >= yield_at_us);
+}
+
+/* Run one task
+ *
+ * Returns 0 after running a task, there may be more that are ready, otherwise the ms until the
+ * next release, or -1 without tasks.
+ */
+int scheduler_run_once( void ) {
+    usec_t now = get_monotonic_us();
+    usec_t next_us = -1;
+    usec_t elapsed_us;
+    E_SCHEDULER_TASK rc;
+    task_t *t;
+    int id;
+
+    if ((now - window_start_us) >= ((usec_t)SCHEDULER_WINDOW_MS * 1000)) {
+        memset(used_us, 0, sizeof(used_us));
+        window_start_us = now;
+    }
+
+    if ((id = _pick(now, true)) < 0) { id = _pick(now, false); }
+
+    if (id < 0) {
+        for (int i=0; i<SCHEDULER_MAX_TASKS; i++) {
+            if (tasks[i].used && ((next_us < 0) || (tasks[i].release_us < next_us))) { next_us = tasks[i].release_us; }
+        }
+
+        if (next_us < 0) { return -1; }
+
+        /* Rounded up, waking early would only come back here */
+        return (int)((next_us - now + 999) / 1000);
+    }
+
+    t = &tasks[id];
+
+    if (!t->started && ((uint64_t)(now - t->release_us) > t->stats.max_latency_us)) {
+        t->stats.max_latency_us = (uint64_t)(now - t->release_us);
+    }
+
+    /* Until the slice is used, or a higher class that still has budget is released */
+    yield_at_us = now + SCHEDULER_SLICE_US;
+
+    for (int i=0; i<SCHEDULER_MAX_TASKS; i++) {
+        if (!tasks[i].used || (tasks[i].cls >= t->cls) || _over_budget(tasks[i].cls)) { continue; }
+        if (tasks[i].release_us < yield_at_us) { yield_at_us = tasks[i].release_us; }
+    }
+
+    running = true;
+    rc = t->task(t->arg);
+    running = false;
+
+    elapsed_us = get_monotonic_us() - now;
+    t->stats.cpu_us += (uint64_t)elapsed_us;
+    used_us[t->cls] += elapsed_us;
+
+    if (rc == SCHEDULER_TASK_YIELD) {
+        t->stats.yields++;
+        t->started = true;
+    } else {
+        _finish(t, now + elapsed_us);
+    }
+
+    return 0;
+}
+
+int get_scheduler_stats( int id, scheduler_stats_t *stats ) {
+    task_t *t;
+
+    if ((stats == NULL) || ((t = _get_task(id)) == NULL)) { return SCHEDULER_NOT_OK; }
+
+    *stats = t->stats;
+
+    return SCHEDULER_OK;
+}
+
+/* Highest class first, earliest deadline within a class */
+static int _pick( usec_t now, bool within_budget ) {
+    task_t *best = NULL;
+    int best_id = -1;
+
+    for (int id=0; id<SCHEDULER_MAX_TASKS; id++) {
+        task_t *t = &tasks[id];
+
+        if (!t->used || (t->release_us > now)) { continue; }
+        if (within_budget && _over_budget(t->cls)) { continue; }
+
+        if ((best == NULL) || (t->cls < best->cls) ||
+            ((t->cls == best->cls) && ((t->release_us + t->deadline_us) < (best->release_us + best->deadline_us)))) {
+            best = t;
+            best_id = id;
+        }
+    }
+
+    return best_id;
+}
+
+static bool _over_budget( E_SCHEDULER_CLASS cls ) {
+    return (budget_percent[cls] < 100) &&
+           (used_us[cls] >= ((usec_t)budget_percent[cls] * ((usec_t)SCHEDULER_WINDOW_MS * 1000)) / 100);
+}
+
+/* Releases the next period. Periods that passed while the task ran are skipped and counted as
+ * missed, rather than run back to back to catch up.
+ */
+static void _finish( task_t *t, usec_t now ) {
+    usec_t skipped;
+
+    t->stats.runs++;
+    t->started = false;
+
+    if (now > (t->release_us + t->deadline_us)) { t->stats.missed++; }
+
+    t->release_us += t->period_us;
+
+    if (now >= (t->release_us + t->period_us)) {
+        skipped = (now - t->release_us) / t->period_us;
+        t->release_us += skipped * t->period_us;
+        t->stats.missed += (uint64_t)skipped;
+    }
+}
+
+static task_t *_get_task( int id ) {
+    if ((id < 0) || (id >= SCHEDULER_MAX_TASKS) || !tasks[id].used) { return NULL; }
+
+    return &tasks[id];
+}
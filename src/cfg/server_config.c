@@ -0,0 +1,465 @@
+#include "server_config.h"
+
+/* Static Functions */
+static int _parse_listener( char *value, listener_config_t *listener );
+static int _parse_capture( char *value, server_config_t *cfg );
+static int _parse_trace( char *value, server_config_t *cfg );
+static int _parse_cpus( const char *value, affinity_config_t *affinity );
+static int _parse_aggregate( char *value, aggregate_config_t *aggregate );
+static int _parse_listener_opt( const char *key, const char *value, sock_opts_t *opts );
+static int _parse_int( const char *str, long min, long max, long *out );
+static char *_trim( char *str );
+
+void get_default_server_config( server_config_t *cfg ) {
+    if (cfg == NULL) { return; }
+
+    memset(cfg, 0, sizeof(*cfg));
+
+    cfg->num_workers = DEFAULT_NUM_OF_WORKERS;
+    cfg->buffer_size = DEFAULT_BUFFER_SIZE;
+    cfg->scheduler_ms = DEFAULT_SCHEDULER_MS;
+    cfg->drain_ms = DEFAULT_DRAIN_MS;
+    cfg->capture_segment_mb = DEFAULT_CAPTURE_SEGMENT_MB;
+    cfg->kv_memory_mb = DEFAULT_KV_MEMORY_MB;
+    cfg->aggregate.type = E_WINDOW_TUMBLING;
+    cfg->aggregate.window_ms = AGGREGATE_DEFAULT_WINDOW_MS;
+    cfg->aggregate.slide_ms = AGGREGATE_DEFAULT_WINDOW_MS;
+    cfg->trace_sample = TRACE_DEFAULT_SAMPLE;
+
+    cfg->num_listeners = 1;
+    cfg->listeners[0].type = E_UDP_SOCK;
+    cfg->listeners[0].port = 9003;
+    strncpy(cfg->listeners[0].addr, "127.0.0.1", LISTENER_ADDR_SIZE - 1);
+    get_sock_profile(E_SOCK_PROFILE_DEFAULT, &cfg->listeners[0].opts);
+}
+
+/* Load server configuration
+ *
+ * The file is parsed into a temporary configuration starting from the defaults, minus the default
+ * listener. A parse error reports the line number and leaves cfg untouched, so a bad edit followed by
+ * a SIGHUP keeps the server running on the previous configuration.
+ */
+int load_server_config( const char *path, server_config_t *cfg ) {
+    server_config_t new_cfg;
+    char line[CONFIG_LINE_SIZE];
+    char *key;
+    char *value;
+    char *sep;
+    int line_num = 0;
+    long num;
+    FILE *fp;
+
+    if ((path == NULL) || (cfg == NULL)) { return CONFIG_NOT_OK; }
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        printf("Failed to open config: %s\n", path);
+        return CONFIG_NOT_OK;
+    }
+
+    get_default_server_config(&new_cfg);
+    new_cfg.num_listeners = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_num++;
+
+        key = _trim(line);
+
+        if ((*key == '\0') || (*key == '#')) { continue; }
+
+        if ((sep = strchr(key, '=')) == NULL) {
+            printf("Config %s:%d: expected key = value\n", path, line_num);
+            fclose(fp);
+            return CONFIG_NOT_OK;
+        }
+
+        *sep = '\0';
+        key = _trim(key);
+        value = _trim(sep + 1);
+
+        if (strcmp(key, "workers") == 0) {
+            if (_parse_int(value, 1, MAX_NUM_OF_WORKERS, &num) < 0) { goto bad_value; }
+            new_cfg.num_workers = (int)num;
+
+        } else if (strcmp(key, "buffer_size") == 0) {
+            if (_parse_int(value, 1, 1024 * 1024, &num) < 0) { goto bad_value; }
+            new_cfg.buffer_size = (size_t)num;
+
+        } else if (strcmp(key, "scheduler_ms") == 0) {
+            if (_parse_int(value, 1, 60 * 1000, &num) < 0) { goto bad_value; }
+            new_cfg.scheduler_ms = (msec_t)num;
+
+        } else if (strcmp(key, "drain_ms") == 0) {
+            if (_parse_int(value, 0, 10 * 60 * 1000, &num) < 0) { goto bad_value; }
+            new_cfg.drain_ms = (msec_t)num;
+
+        } else if (strcmp(key, "kv_memory_mb") == 0) {
+            if (_parse_int(value, MIN_KV_MEMORY_MB, MAX_KV_MEMORY_MB, &num) < 0) { goto bad_value; }
+            new_cfg.kv_memory_mb = (size_t)num;
+
+        } else if (strcmp(key, "aggregate") == 0) {
+            if (_parse_aggregate(value, &new_cfg.aggregate) < 0) { goto bad_value; }
+
+        } else if (strcmp(key, "capture") == 0) {
+            if (_parse_capture(value, &new_cfg) < 0) { goto bad_value; }
+
+        } else if (strcmp(key, "trace") == 0) {
+            if (_parse_trace(value, &new_cfg) < 0) { goto bad_value; }
+
+        } else if (strcmp(key, "cpus") == 0) {
+            if (_parse_cpus(value, &new_cfg.affinity) < 0) { goto bad_value; }
+
+        } else if (strcmp(key, "listener") == 0) {
+            if (new_cfg.num_listeners >= MAX_NUM_OF_LISTENERS) {
+                printf("Config %s:%d: too many listeners\n", path, line_num);
+                fclose(fp);
+                return CONFIG_NOT_OK;
+            }
+            if (_parse_listener(value, &new_cfg.listeners[new_cfg.num_listeners]) < 0) { goto bad_value; }
+            new_cfg.num_listeners++;
+
+        } else {
+            printf("Config %s:%d: unknown key %s\n", path, line_num, key);
+            fclose(fp);
+            return CONFIG_NOT_OK;
+        }
+    }
+
+    fclose(fp);
+
+    if (new_cfg.num_listeners == 0) {
+        printf("Config %s: no listeners\n", path);
+        return CONFIG_NOT_OK;
+    }
+
+    *cfg = new_cfg;
+
+    return CONFIG_OK;
+
+bad_value:
+    printf("Config %s:%d: invalid value for %s\n", path, line_num, key);
+    fclose(fp);
+    return CONFIG_NOT_OK;
+}
+
+bool is_same_listener( const listener_config_t *a, const listener_config_t *b ) {
+    if ((a == NULL) || (b == NULL)) { return false; }
+
+    return (a->type == b->type) && (a->port == b->port) && (a->role == b->role) &&
+        (strcmp(a->addr, b->addr) == 0);
+}
+
+static int _parse_capture( char *value, server_config_t *cfg ) {
+    char *save = NULL;
+    char *path;
+    char *size;
+    long num;
+
+    if ((path = strtok_r(value, " \t", &save)) == NULL) { return CONFIG_NOT_OK; }
+    if (strlen(path) >= LISTENER_ADDR_SIZE) { return CONFIG_NOT_OK; }
+
+    strncpy(cfg->capture_path, path, LISTENER_ADDR_SIZE - 1);
+
+    if ((size = strtok_r(NULL, " \t", &save)) != NULL) {
+        if (_parse_int(size, 1, MAX_CAPTURE_SEGMENT_MB, &num) < 0) { return CONFIG_NOT_OK; }
+        cfg->capture_segment_mb = (size_t)num;
+    }
+
+    return (strtok_r(NULL, " \t", &save) == NULL) ? CONFIG_OK : CONFIG_NOT_OK;
+}
+
+/* Room is left for the worker's suffix */
+static int _parse_trace( char *value, server_config_t *cfg ) {
+    char *save = NULL;
+    char *path;
+    char *sample;
+    long num;
+
+    if ((path = strtok_r(value, " \t", &save)) == NULL) { return CONFIG_NOT_OK; }
+    if (strlen(path) >= (LISTENER_ADDR_SIZE - 8)) { return CONFIG_NOT_OK; }
+
+    strncpy(cfg->trace_path, path, LISTENER_ADDR_SIZE - 1);
+
+    if ((sample = strtok_r(NULL, " \t", &save)) != NULL) {
+        if (_parse_int(sample, 1, 1000000, &num) < 0) { return CONFIG_NOT_OK; }
+        cfg->trace_sample = (int)num;
+    }
+
+    return (strtok_r(NULL, " \t", &save) == NULL) ? CONFIG_OK : CONFIG_NOT_OK;
+}
+
+/* Parse aggregate
+ *
+ * "tumbling <window_ms>" or "sliding <window_ms> <slide_ms>", checked against what aggregate_init()
+ * accepts, so a reload can't leave the server without rollups.
+ */
+static int _parse_aggregate( char *value, aggregate_config_t *aggregate ) {
+    char *save = NULL;
+    char *type;
+    char *window;
+    char *slide;
+    long num;
+
+    if (((type = strtok_r(value, " \t", &save)) == NULL) || ((window = strtok_r(NULL, " \t", &save)) == NULL)) {
+        return CONFIG_NOT_OK;
+    }
+
+    if (_parse_int(window, 1, 24 * 60 * 60 * 1000, &num) < 0) { return CONFIG_NOT_OK; }
+    aggregate->window_ms = (msec_t)num;
+    aggregate->slide_ms = (msec_t)num;
+
+    slide = strtok_r(NULL, " \t", &save);
+
+    if (strcmp(type, "tumbling") == 0) {
+        aggregate->type = E_WINDOW_TUMBLING;
+        if (slide != NULL) { return CONFIG_NOT_OK; }
+    } else if (strcmp(type, "sliding") == 0) {
+        aggregate->type = E_WINDOW_SLIDING;
+        if ((slide == NULL) || (_parse_int(slide, 1, num, &num) < 0)) { return CONFIG_NOT_OK; }
+        aggregate->slide_ms = (msec_t)num;
+    } else {
+        return CONFIG_NOT_OK;
+    }
+
+    if (((aggregate->window_ms % aggregate->slide_ms) != 0) ||
+            ((aggregate->window_ms / aggregate->slide_ms) > AGGREGATE_MAX_BUCKETS)) {
+        return CONFIG_NOT_OK;
+    }
+
+    return (strtok_r(NULL, " \t", &save) == NULL) ? CONFIG_OK : CONFIG_NOT_OK;
+}
+
+/* Parse CPUs
+ *
+ * "none", "auto", or a list of CPUs and ranges, kept in the order given since the first one is the
+ * event loop's.
+ */
+static int _parse_cpus( const char *value, affinity_config_t *affinity ) {
+    const char *p = value;
+    char *end;
+    long first;
+    long last;
+
+    memset(affinity, 0, sizeof(*affinity));
+
+    if (strcmp(value, "none") == 0) {
+        affinity->mode = E_AFFINITY_NONE;
+        return CONFIG_OK;
+    }
+
+    if (strcmp(value, "auto") == 0) {
+        affinity->mode = E_AFFINITY_AUTO;
+        return CONFIG_OK;
+    }
+
+    affinity->mode = E_AFFINITY_LIST;
+
+    while (*p != '\0') {
+        first = strtol(p, &end, 10);
+        if ((end == p) || (first < 0)) { return CONFIG_NOT_OK; }
+        last = first;
+        p = end;
+
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p) { return CONFIG_NOT_OK; }
+            p = end;
+        }
+
+        if ((last < first) || (last >= AFFINITY_MAX_CPUS)) { return CONFIG_NOT_OK; }
+        if ((affinity->num_cpus + (last - first + 1)) > AFFINITY_MAX_SLOTS) { return CONFIG_NOT_OK; }
+
+        for (long cpu=first; cpu<=last; cpu++) {
+            affinity->cpus[affinity->num_cpus++] = (int)cpu;
+        }
+
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return CONFIG_NOT_OK;
+        }
+    }
+
+    return (affinity->num_cpus > 0) ? CONFIG_OK : CONFIG_NOT_OK;
+}
+
+/* Parse a listener
+ *
+ * "<type> <addr> <port> [option=value ...]". The profile option is searched for first, so it can be
+ * placed anywhere on the line without overriding explicit options.
+ */
+static int _parse_listener( char *value, listener_config_t *listener ) {
+    char *tokens[16];
+    char *save = NULL;
+    char *tok;
+    char *sep;
+    int num_tokens = 0;
+    long num;
+
+    memset(listener, 0, sizeof(*listener));
+    get_sock_profile(E_SOCK_PROFILE_DEFAULT, &listener->opts);
+
+    for (tok = strtok_r(value, " \t", &save); tok != NULL; tok = strtok_r(NULL, " \t", &save)) {
+        if (num_tokens >= (int)(sizeof(tokens) / sizeof(tokens[0]))) { return CONFIG_NOT_OK; }
+        tokens[num_tokens++] = tok;
+    }
+
+    if (num_tokens < 3) { return CONFIG_NOT_OK; }
+
+    if (strcmp(tokens[0], "local") == 0) {
+        listener->type = E_LOCAL_SOCK;
+    } else if (strcmp(tokens[0], "tcp") == 0) {
+        listener->type = E_TCP_SOCK;
+    } else if (strcmp(tokens[0], "udp") == 0) {
+        listener->type = E_UDP_SOCK;
+    } else if (strcmp(tokens[0], "rudp") == 0) {
+        listener->type = E_RUDP_SOCK;
+    } else if (strcmp(tokens[0], "broker") == 0) {
+        listener->type = E_LOCAL_SOCK;
+        listener->role = E_LISTENER_BROKER;
+    } else {
+        return CONFIG_NOT_OK;
+    }
+
+    if (strlen(tokens[1]) >= LISTENER_ADDR_SIZE) { return CONFIG_NOT_OK; }
+    strncpy(listener->addr, tokens[1], LISTENER_ADDR_SIZE - 1);
+
+    if (_parse_int(tokens[2], 0, 65535, &num) < 0) { return CONFIG_NOT_OK; }
+    listener->port = (int)num;
+
+    for (int i=3; i<num_tokens; i++) {
+        if (strncmp(tokens[i], "profile=", strlen("profile=")) != 0) { continue; }
+
+        if (_parse_listener_opt("profile", tokens[i] + strlen("profile="), &listener->opts) < 0) {
+            return CONFIG_NOT_OK;
+        }
+    }
+
+    for (int i=3; i<num_tokens; i++) {
+        if ((sep = strchr(tokens[i], '=')) == NULL) { return CONFIG_NOT_OK; }
+
+        *sep = '\0';
+
+        if (strcmp(tokens[i], "profile") == 0) { continue; }
+
+        if (strcmp(tokens[i], "role") == 0) {
+            if (listener->role == E_LISTENER_BROKER) { return CONFIG_NOT_OK; }
+
+            if (strcmp(sep + 1, "message") == 0) {
+                listener->role = E_LISTENER_MESSAGE;
+            } else if ((strcmp(sep + 1, "rpc") == 0) &&
+                    ((listener->type == E_TCP_SOCK) || (listener->type == E_LOCAL_SOCK))) {
+                listener->role = E_LISTENER_RPC;
+            } else if ((strcmp(sep + 1, "kv") == 0) &&
+                    ((listener->type == E_TCP_SOCK) || (listener->type == E_LOCAL_SOCK))) {
+                listener->role = E_LISTENER_KV;
+            } else {
+                return CONFIG_NOT_OK;
+            }
+            continue;
+        }
+
+        if (strcmp(tokens[i], "compact") == 0) {
+            if (_parse_int(sep + 1, 0, 1, &num) < 0) { return CONFIG_NOT_OK; }
+            listener->compact = (num != 0);
+            continue;
+        }
+
+        if (_parse_listener_opt(tokens[i], sep + 1, &listener->opts) < 0) {
+            return CONFIG_NOT_OK;
+        }
+    }
+
+    /* Only the message handler works on connections it doesn't keep */
+    if (listener->compact && ((listener->role != E_LISTENER_MESSAGE) ||
+            ((listener->type != E_TCP_SOCK) && (listener->type != E_LOCAL_SOCK)))) {
+        return CONFIG_NOT_OK;
+    }
+
+    return CONFIG_OK;
+}
+
+static int _parse_listener_opt( const char *key, const char *value, sock_opts_t *opts ) {
+    long num;
+
+    if (strcmp(key, "profile") == 0) {
+        if (strcmp(value, "default") == 0) {
+            get_sock_profile(E_SOCK_PROFILE_DEFAULT, opts);
+        } else if (strcmp(value, "latency") == 0) {
+            get_sock_profile(E_SOCK_PROFILE_LATENCY, opts);
+        } else if (strcmp(value, "throughput") == 0) {
+            get_sock_profile(E_SOCK_PROFILE_THROUGHPUT, opts);
+        } else {
+            return CONFIG_NOT_OK;
+        }
+        return CONFIG_OK;
+    }
+
+    if (strcmp(key, "incoming_cpu") == 0) {
+        if (_parse_int(value, -1, 4096, &num) < 0) { return CONFIG_NOT_OK; }
+        opts->incoming_cpu = (int)num;
+        return CONFIG_OK;
+    }
+
+    if (_parse_int(value, 0, 256 * 1024 * 1024, &num) < 0) { return CONFIG_NOT_OK; }
+
+    if (strcmp(key, "rcvbuf") == 0) {
+        opts->rcvbuf = (int)num;
+    } else if (strcmp(key, "sndbuf") == 0) {
+        opts->sndbuf = (int)num;
+    } else if (strcmp(key, "busy_poll") == 0) {
+        opts->busy_poll_us = (int)num;
+    } else if (strcmp(key, "nodelay") == 0) {
+        opts->nodelay = (num != 0);
+    } else if (strcmp(key, "cork") == 0) {
+        opts->cork = (num != 0);
+    } else if (strcmp(key, "quickack") == 0) {
+        opts->quickack = (num != 0);
+    } else if (strcmp(key, "zerocopy") == 0) {
+        opts->zerocopy = (num != 0);
+    } else if (strcmp(key, "rate") == 0) {
+        opts->rate = (uint32_t)num;
+    } else if (strcmp(key, "burst") == 0) {
+        opts->burst = (uint32_t)num;
+    } else if (strcmp(key, "max_conns") == 0) {
+        opts->max_conns = (int)num;
+    } else if (strcmp(key, "max_conns_per_peer") == 0) {
+        opts->max_conns_per_peer = (int)num;
+    } else {
+        return CONFIG_NOT_OK;
+    }
+
+    return CONFIG_OK;
+}
+
+static int _parse_int( const char *str, long min, long max, long *out ) {
+    char *end;
+    long num;
+
+    if ((str == NULL) || (*str == '\0')) { return CONFIG_NOT_OK; }
+
+    num = strtol(str, &end, 10);
+
+    if ((*end != '\0') || (num < min) || (num > max)) { return CONFIG_NOT_OK; }
+
+    *out = num;
+
+    return CONFIG_OK;
+}
+
+/* Trims leading and trailing whitespace in place */
+static char *_trim( char *str ) {
+    char *end;
+
+    while ((*str == ' ') || (*str == '\t')) { str++; }
+
+    end = str + strlen(str);
+
+    while ((end > str) && ((end[-1] == ' ') || (end[-1] == '\t') || (end[-1] == '\n') || (end[-1] == '\r'))) {
+        end--;
+    }
+
+    *end = '\0';
+
+    return str;
+}
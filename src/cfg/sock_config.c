@@ -1,13 +1,55 @@
+#define _GNU_SOURCE
 #include "sock_config.h"
+#include "rudp.h"
+#include "logger.h"
 
 static sock_config_t *sock_configs[MAX_NUM_OF_SOCKS];
 
+/* Tokens are counted in thousandths, so low rates still refill every ms. A stream peer's may be
+ * negative, it's charged after the receive. */
+#define SOCK_LIMIT_TOKEN 1000
+
+typedef struct {
+    bool used;
+    uint32_t key[5];
+    int conns;
+    int64_t tokens;
+    msec_t last_seen;
+} sock_peer_t;
+
+typedef struct {
+    int conns;
+    uint32_t num_peers;
+    sock_limit_stats_t stats;
+    sock_peer_t peers[SOCK_LIMIT_TABLE_SIZE];
+} sock_limiter_t;
+
+static sock_limiter_t *sock_limiters[MAX_NUM_OF_SOCKS];
+
 /* Static Functions */
-static sock_id_t _initialize_local_sock( int type, const char *path, bool is_server);
-static sock_id_t _initialize_network_sock( int type, const char *addr, int port, bool is_server);
+static sock_id_t _initialize_local_sock( int type, const char *path, bool is_server, const sock_opts_t *opts);
+static sock_id_t _initialize_network_sock( int type, const char *addr, int port, bool is_server, const sock_opts_t *opts);
+
+static void _apply_sock_opts( sock_config_t *sock_cfg, int fd );
+static void _apply_conn_opts( sock_config_t *sock_cfg, int fd );
+static void _rearm_quickack( sock_config_t *sock_cfg, int fd );
+static void _uncork( sock_config_t *sock_cfg, int fd );
+static int _connect_network_sock( sock_id_t *id );
+static uint32_t _drain_zerocopy( sock_id_t id );
+static void _resume_zerocopy( sock_id_t id, uint32_t seq );
+static int _await_zerocopy( sock_id_t id, uint32_t seq );
+static int _data_fd( sock_config_t *sock_cfg );
+static int _close_sock( sock_id_t id, bool unlink_path );
+static int _await_rudp_receive( sock_id_t id, void *buffer, size_t len );
 
 static int _find_open_sock( void );
 
+static msec_t _admit( sock_id_t id, const sockaddr_storage_t *peer, int fd, int64_t cost );
+static sock_limiter_t *_get_limiter( sock_id_t id );
+static void _peer_key( const sockaddr_storage_t *peer, int fd, uint32_t key[5] );
+static sock_peer_t *_find_peer( sock_limiter_t *limiter, const sock_opts_t *opts, const uint32_t key[5], msec_t now, bool create );
+static void _refill_peer( const sock_opts_t *opts, sock_peer_t *peer, msec_t now );
+
 /* Initialize a sock connection, configuration
  *
  * This is the configuration handler for intializing a socket, function will handle setting proper 
@@ -18,23 +60,41 @@ static int _find_open_sock( void );
  * NOTE: When using a LOCAL socket, address and port are ignored.
  */
 sock_id_t initialize_sock(E_APP_SOCK_TYPE app_type, const char *addr, int port, bool is_server) {
+    return initialize_sock_opts(app_type, addr, port, is_server, NULL);
+}
+
+sock_id_t initialize_sock_opts(E_APP_SOCK_TYPE app_type, const char *addr, int port, bool is_server, 
+        const sock_opts_t *opts) {
     sock_id_t id = SOCK_NOT_OK;
+    sock_opts_t default_opts;
+
+    if (opts == NULL) {
+        get_sock_profile(E_SOCK_PROFILE_DEFAULT, &default_opts);
+        opts = &default_opts;
+    }
+
     switch (app_type) {
         case E_LOCAL_SOCK:
-            if ((id = _initialize_local_sock(SOCK_STREAM, addr, is_server)) < 0) {
+            if ((id = _initialize_local_sock(SOCK_STREAM, addr, is_server, opts)) < 0) {
                 return SOCK_NOT_OK;
             }
             break;
         case E_TCP_SOCK:
-            if ((id = _initialize_network_sock(SOCK_STREAM, addr, port, is_server)) < 0) {
+            if ((id = _initialize_network_sock(SOCK_STREAM, addr, port, is_server, opts)) < 0) {
                 return SOCK_NOT_OK;
             }
             break;
         case E_UDP_SOCK:
-            if ((id = _initialize_network_sock(SOCK_DGRAM, addr, port, is_server)) < 0) {
+            if ((id = _initialize_network_sock(SOCK_DGRAM, addr, port, is_server, opts)) < 0) {
                 return SOCK_NOT_OK;
             }
             break;
+        case E_RUDP_SOCK:
+            if ((id = _initialize_network_sock(SOCK_DGRAM, addr, port, is_server, opts)) < 0) {
+                return SOCK_NOT_OK;
+            }
+            sock_configs[id]->app_type = E_RUDP_SOCK;
+            break;
         default:
             break;
     }
@@ -42,6 +102,134 @@ sock_id_t initialize_sock(E_APP_SOCK_TYPE app_type, const char *addr, int port,
     return id;
 }
 
+/* Socket profiles
+ *
+ * DEFAULT leaves every option at the kernel default. LATENCY trades CPU for response time, Nagle is
+ * disabled so small writes leave immediately, delayed acks are suppressed and the receive path busy
+ * polls the device queue. THROUGHPUT trades latency for bulk transfer, large buffers keep the window 
+ * open on long fat links and zero-copy is enabled for large sends.
+ */
+void get_sock_profile( E_SOCK_PROFILE profile, sock_opts_t *opts ) {
+    if (opts == NULL) { return; }
+
+    memset(opts, 0, sizeof(*opts));
+    opts->incoming_cpu = -1;
+
+    switch (profile) {
+        case E_SOCK_PROFILE_LATENCY:
+            opts->nodelay = true;
+            opts->quickack = true;
+            opts->busy_poll_us = 50;
+            break;
+        case E_SOCK_PROFILE_THROUGHPUT:
+            opts->rcvbuf = 4 * 1024 * 1024;
+            opts->sndbuf = 4 * 1024 * 1024;
+            opts->zerocopy = true;
+            break;
+        case E_SOCK_PROFILE_DEFAULT:
+        default:
+            break;
+    }
+}
+
+/* Apply socket options
+ *
+ * Applies the stored options to fd. Must be called before bind()/connect() so that the buffer sizes
+ * are used for the TCP window scale negotiation. Tuning is best effort, an option the kernel refuses 
+ * (e.g. SO_BUSY_POLL without CAP_NET_ADMIN) is reported and skipped, the socket is still usable.
+ */
+static void _apply_sock_opts( sock_config_t *sock_cfg, int fd ) {
+    sock_opts_t *opts = &sock_cfg->opts;
+    int enable = 1;
+
+    if (opts->rcvbuf > 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opts->rcvbuf, sizeof(opts->rcvbuf)) < 0) {
+            printf("Failed to set SO_RCVBUF\n");
+        }
+    }
+
+    if (opts->sndbuf > 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opts->sndbuf, sizeof(opts->sndbuf)) < 0) {
+            printf("Failed to set SO_SNDBUF\n");
+        }
+    }
+
+    /* Local sockets have no device queue, nor a TCP stack */
+    if (sock_cfg->app_type == E_LOCAL_SOCK) { return; }
+
+    if (opts->busy_poll_us > 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &opts->busy_poll_us, sizeof(opts->busy_poll_us)) < 0) {
+            printf("Failed to set SO_BUSY_POLL\n");
+        }
+    }
+
+    if (opts->incoming_cpu >= 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &opts->incoming_cpu, sizeof(opts->incoming_cpu)) < 0) {
+            printf("Failed to set SO_INCOMING_CPU\n");
+        }
+    }
+
+    if (sock_cfg->app_type != E_TCP_SOCK) { return; }
+
+    if (opts->zerocopy) {
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0) {
+            printf("Failed to set SO_ZEROCOPY\n");
+            opts->zerocopy = false;
+        }
+    }
+
+    _apply_conn_opts(sock_cfg, fd);
+}
+
+/* Apply connection options
+ *
+ * Options that are per connection, rather than inherited from the listener. TCP_QUICKACK is not 
+ * permanent, the kernel may fall back to delayed acks, so it alone is re-armed after every receive.
+ * A corked connection holds partial frames for up to 200 ms, it's uncorked after every logical send
+ * to push out the tail and corked again for the next one.
+ */
+static void _apply_conn_opts( sock_config_t *sock_cfg, int fd ) {
+    sock_opts_t *opts = &sock_cfg->opts;
+    int enable = 1;
+
+    if (sock_cfg->app_type != E_TCP_SOCK) { return; }
+
+    /* TCP_CORK holds partial frames until uncorked, it overrides TCP_NODELAY */
+    if (opts->cork) {
+        if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable)) < 0) {
+            printf("Failed to set TCP_CORK\n");
+        }
+    } else if (opts->nodelay) {
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) < 0) {
+            printf("Failed to set TCP_NODELAY\n");
+        }
+    }
+
+    _rearm_quickack(sock_cfg, fd);
+}
+
+static void _rearm_quickack( sock_config_t *sock_cfg, int fd ) {
+    int enable = 1;
+
+    if ((sock_cfg->app_type != E_TCP_SOCK) || !sock_cfg->opts.quickack) { return; }
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &enable, sizeof(enable)) < 0) {
+        printf("Failed to set TCP_QUICKACK\n");
+    }
+}
+
+static void _uncork( sock_config_t *sock_cfg, int fd ) {
+    int disable = 0;
+    int enable = 1;
+
+    if ((sock_cfg->app_type != E_TCP_SOCK) || !sock_cfg->opts.cork) { return; }
+
+    if ((setsockopt(fd, IPPROTO_TCP, TCP_CORK, &disable, sizeof(disable)) < 0) ||
+            (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable)) < 0)) {
+        printf("Failed to flush TCP_CORK\n");
+    }
+}
+
 /* Initialize a sock connection
  * 
  * The following will initialize a sock with the given domain, type, family, address, and port. Functionality
@@ -55,7 +243,8 @@ sock_id_t initialize_sock(E_APP_SOCK_TYPE app_type, const char *addr, int port,
  *      with listen().
  * 4. Connections are accepted with accept()
  */
-static sock_id_t _initialize_network_sock( int type, const char *addr, int port, bool is_server ) {
+static sock_id_t _initialize_network_sock( int type, const char *addr, int port, bool is_server, 
+        const sock_opts_t *opts ) {
     sock_config_t *sock_cfg;
     void *listen_addr;
     
@@ -79,7 +268,8 @@ static sock_id_t _initialize_network_sock( int type, const char *addr, int port,
         return SOCK_NOT_OK;
     }
 
-    sock_cfg = sock_configs[open_sock_id] = malloc(sizeof(sock_config_t));
+    sock_cfg = sock_configs[open_sock_id] = calloc(1, sizeof(sock_config_t));
+    sock_cfg->opts = *opts;
     
     if (domain == AF_INET) {
     
@@ -90,9 +280,7 @@ static sock_id_t _initialize_network_sock( int type, const char *addr, int port,
         ((sockaddr_in_t *)listen_addr)->sin_port = htons(port);
         ((sockaddr_in_t *)listen_addr)->sin_addr = ipv4;
 
-        sock_cfg->addr_str = malloc(strlen(addr) * sizeof(char));
-    
-        strncpy(sock_cfg->addr_str, addr, strlen(addr) * sizeof(char));
+        sock_cfg->addr_str = strdup(addr);
 
     } else if (domain == AF_INET6) {
 
@@ -103,17 +291,17 @@ static sock_id_t _initialize_network_sock( int type, const char *addr, int port,
         ((sockaddr_in6_t *)listen_addr)->sin6_port = htons(port);
         ((sockaddr_in6_t *)listen_addr)->sin6_addr = ipv6;
         
-        sock_cfg->addr_str = malloc(strlen(addr) * sizeof(char));
-        strncpy(sock_cfg->addr_str, addr, strlen(addr) * sizeof(char));
+        sock_cfg->addr_str = strdup(addr);
 
     } else  {
         free(sock_cfg);
         return SOCK_NOT_OK;
     }
     
-    sock_cfg->conn_addr = malloc(sizeof(sockaddr_t));
-    sock_cfg->conn_addr_len = sizeof(sock_cfg->conn_addr);
+    sock_cfg->conn_addr = malloc(sizeof(sockaddr_storage_t));
+    sock_cfg->conn_addr_len = sizeof(sockaddr_storage_t);
     sock_cfg->conn_buff = malloc(MAX_SERVER_MESSAGE_SIZE * sizeof(char));
+    sock_cfg->conn_buff_len = MAX_SERVER_MESSAGE_SIZE;
     
     sock_cfg->listen_opt = 1;
     sock_cfg->is_server = is_server;
@@ -143,8 +331,35 @@ static sock_id_t _initialize_network_sock( int type, const char *addr, int port,
         return SOCK_NOT_OK;
     }
 
+    _apply_sock_opts(sock_cfg, sock_cfg->listen_fd);
+
     if (is_server) {
 
+        /* An IPv6 wildcard listener would also claim the IPv4 port, keep the families separate so
+         * "::" and "0.0.0.0" listeners can run side by side. */
+        if (domain == AF_INET6) {
+            if (setsockopt(sock_cfg->listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &sock_cfg->listen_opt, 
+                    sizeof(sock_cfg->listen_opt)) < 0) {
+                printf("Failed to set IPV6_V6ONLY\n");
+            }
+        }
+
+        /* Socket Options (Reuse Address)
+         * To manipulate options at the socks API level, level is specified as SOL_SOCK. The
+         * option SO_REUSEADDR will bypass the restrictions of the OS for an address already in use,
+         * e.g. connections of a previous server in TIME_WAIT. It only has an effect before bind(),
+         * without it a restarted server fails to bind until the OS releases the address.
+         */
+        if (sock_cfg->app_type == E_TCP_SOCK) {
+            if ((status = setsockopt(sock_cfg->listen_fd, 
+                    SOL_SOCKET, SO_REUSEADDR, &sock_cfg->listen_opt, sizeof(sock_cfg->listen_opt))) < 0) {
+
+                printf("Failed to set socket options\n");
+                close_sock(open_sock_id);
+                return SOCK_NOT_OK;
+            }
+        }
+
         /* Bind a name to a sock
          * 
          * When a sock is created with socket(), it exists in a namespace, however no address
@@ -164,20 +379,6 @@ static sock_id_t _initialize_network_sock( int type, const char *addr, int port,
         /* UDP Connections don't use listen() */
         if (sock_cfg->app_type == E_TCP_SOCK ) {
         
-            /* Socket Options (Reuse Address)
-            * To manipulate options at the socks API level, level is specified as SOL_SOCK. The
-            * option SO_REUSEADDR will bypass the restrictions of the OS for an address already in use.
-            * This is useful during development, as you don't want to wait for the OS to release the
-            * address after restarting the server. This option should be removed in a production setting.
-            */
-            if ((status = setsockopt(sock_cfg->listen_fd, 
-                    SOL_SOCKET, SO_REUSEADDR, &sock_cfg->listen_opt, sizeof(sock_cfg->listen_opt))) < 0) {
-
-                printf("Failed to set socket options\n");
-                close_sock(open_sock_id);
-                return SOCK_NOT_OK;
-            }
-
             /* Listen for connection on a sock
             *
             * Marks the sock referred to by the fs, as a passive socket, that is, as a socket that
@@ -204,7 +405,7 @@ static sock_id_t _initialize_network_sock( int type, const char *addr, int port,
  *
  * Initialize local socket to listen on any address. 
  */
-static sock_id_t _initialize_local_sock( int type, const char* path, bool is_server ) {
+static sock_id_t _initialize_local_sock( int type, const char* path, bool is_server, const sock_opts_t *opts ) {
     sock_config_t *sock_cfg;
     sockaddr_un_t *listen_addr;
     
@@ -217,23 +418,26 @@ static sock_id_t _initialize_local_sock( int type, const char* path, bool is_ser
         return SOCK_NOT_OK;
     }
     
-    sock_cfg = sock_configs[open_sock_id] = malloc(sizeof(sock_config_t));
+    sock_cfg = sock_configs[open_sock_id] = calloc(1, sizeof(sock_config_t));
+    sock_cfg->opts = *opts;
     
     sock_cfg->app_type = E_LOCAL_SOCK;
     sock_cfg->domain = AF_LOCAL;
     sock_cfg->is_server = is_server;
     sock_cfg->type = type;
 
-    sock_cfg->conn_addr = malloc(sizeof(sockaddr_t));
-    sock_cfg->conn_addr_len = sizeof(sock_cfg->conn_addr);
-    sock_cfg->conn_buff = malloc(128 * sizeof(char));
+    sock_cfg->conn_addr = malloc(sizeof(sockaddr_storage_t));
+    sock_cfg->conn_addr_len = sizeof(sockaddr_storage_t);
+    sock_cfg->conn_buff = malloc(MAX_SERVER_MESSAGE_SIZE * sizeof(char));
+    sock_cfg->conn_buff_len = MAX_SERVER_MESSAGE_SIZE;
     
     listen_addr = sock_cfg->listen_addr = (sockaddr_un_t *)malloc(sizeof(sockaddr_un_t));
+    memset(listen_addr, 0, sizeof(*listen_addr));
     listen_addr->sun_family = AF_LOCAL;
+    strncpy(listen_addr->sun_path, path, sizeof(listen_addr->sun_path) - 1);
     sock_cfg->listen_len = sizeof(*listen_addr);
     
-    sock_cfg->addr_str = malloc(strlen(path) * sizeof(char));
-    strncpy(sock_cfg->addr_str, path, strlen(path) * sizeof(char));
+    sock_cfg->addr_str = strdup(path);
 
     /* Enable options for sock descriptor */
     sock_cfg->listen_opt = 1;
@@ -245,6 +449,8 @@ static sock_id_t _initialize_local_sock( int type, const char* path, bool is_ser
         return SOCK_NOT_OK;
     }
 
+    _apply_sock_opts(sock_cfg, sock_cfg->listen_fd);
+
     if (is_server) {
 
         if ((status = bind(sock_cfg->listen_fd, 
@@ -256,7 +462,7 @@ static sock_id_t _initialize_local_sock( int type, const char* path, bool is_ser
         }
         
         if ((status = setsockopt(sock_cfg->listen_fd, 
-                SOL_SOCKET, (SO_REUSEADDR | SO_REUSEPORT), &sock_cfg->listen_opt, sizeof(int))) < 0) {
+                SOL_SOCKET, SO_REUSEADDR, &sock_cfg->listen_opt, sizeof(int))) < 0) {
 
             printf("Failed to set socket options\n");
             close_sock(open_sock_id);
@@ -287,12 +493,13 @@ static sock_id_t _initialize_local_sock( int type, const char* path, bool is_ser
 int await_network_receive(sock_id_t id, void *buffer, size_t len) {
     sock_config_t *sock_cfg;
     
-    if (id > MAX_NUM_OF_SOCKS) { return SOCK_NOT_OK; }
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
     if (buffer == NULL) { return SOCK_NOT_OK; }
 
     sock_cfg  = sock_configs[id];
     
     if (sock_cfg == NULL) { return SOCK_NOT_OK; }
+    if (sock_cfg->app_type == E_RUDP_SOCK) { return _await_rudp_receive(id, buffer, len); }
     if ((sock_cfg->app_type != E_TCP_SOCK) && (sock_cfg->app_type != E_UDP_SOCK)) { return SOCK_NOT_OK; } 
 
     /* Clear buffer */ 
@@ -332,14 +539,17 @@ int await_network_receive(sock_id_t id, void *buffer, size_t len) {
         * If there are no pending connections present in the queue, will be blocking, unless the sock
         * was marked as non-blocking. If marked as non-blocking and no pending connections, will fail.
         * 
+        * The connection isn't inherited by programs exec'd later, e.g. a server upgrade.
         */
-        sock_cfg->conn_fd = accept(sock_cfg->listen_fd, sock_cfg->conn_addr, &sock_cfg->conn_addr_len);
+        sock_cfg->conn_fd = accept4(sock_cfg->listen_fd, sock_cfg->conn_addr, &sock_cfg->conn_addr_len, SOCK_CLOEXEC);
 
         if (sock_cfg->conn_fd < 0) {
-            printf("Failed to accept connection.\n");
+            log_error("Failed to accept connection.");
             return -1;
         }
 
+        _apply_conn_opts(sock_cfg, sock_cfg->conn_fd);
+
         sock_cfg->is_connected = true;
     }
 
@@ -359,10 +569,13 @@ int await_network_receive(sock_id_t id, void *buffer, size_t len) {
      * The only difference between recv() and read() is the presence of flags. 
      *
      */
-    sock_cfg->conn_num_bytes = recv(sock_cfg->listen_fd, sock_cfg->conn_buff, sizeof(sock_cfg->conn_buff), 0);
+    sock_cfg->conn_num_bytes = recv(_data_fd(sock_cfg), sock_cfg->conn_buff, sock_cfg->conn_buff_len, 0);
     
     if (sock_cfg->conn_num_bytes > 0) {
 
+        /* Quick ack mode is cleared by the kernel, re-arm for the next message */
+        _rearm_quickack(sock_cfg, _data_fd(sock_cfg));
+
         // printf("Number of bytes receieved: %d\n", sock_cfg->conn_num_bytes);
         // printf("Received buffer : %s\n", sock_cfg->conn_buff);
         
@@ -378,7 +591,7 @@ int await_network_receive(sock_id_t id, void *buffer, size_t len) {
     }
     else if (sock_cfg->conn_num_bytes == 0) {
         // Connection has been terminated and needs to be closed
-        printf("Closing connection, client disconnected\n");
+        log_info("Closing connection, client disconnected");
         close(sock_cfg->conn_fd);
         sock_cfg->is_connected = false;
         // make non-zero return code to inticate that the connection is closed.
@@ -397,7 +610,7 @@ int await_network_receive(sock_id_t id, void *buffer, size_t len) {
 int await_local_receive(sock_id_t id, void *buffer, size_t len) {
     sock_config_t *sock_cfg;
     
-    if (id > MAX_NUM_OF_SOCKS) { return SOCK_NOT_OK; }
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
     if (buffer == NULL) { return SOCK_NOT_OK; }
 
     sock_cfg  = sock_configs[id];
@@ -424,17 +637,17 @@ int await_local_receive(sock_id_t id, void *buffer, size_t len) {
     }
 
     if ( !sock_cfg->is_connected ) {
-        sock_cfg->conn_fd = accept(sock_cfg->listen_fd, sock_cfg->conn_addr, &sock_cfg->conn_addr_len);
+        sock_cfg->conn_fd = accept4(sock_cfg->listen_fd, sock_cfg->conn_addr, &sock_cfg->conn_addr_len, SOCK_CLOEXEC);
 
         if (sock_cfg->conn_fd < 0) {
-            printf("Failed to accept connection.\n");
+            log_error("Failed to accept connection.");
             return -1;
         }
 
         sock_cfg->is_connected = true;
     }
 
-    sock_cfg->conn_num_bytes = recv(sock_cfg->conn_fd, sock_cfg->conn_buff, sizeof(sock_cfg->conn_buff), 0);
+    sock_cfg->conn_num_bytes = recv(sock_cfg->conn_fd, sock_cfg->conn_buff, sock_cfg->conn_buff_len, 0);
     
     if (sock_cfg->conn_num_bytes > 0) {
 
@@ -452,17 +665,61 @@ int await_local_receive(sock_id_t id, void *buffer, size_t len) {
     }
 }
 
-int await_network_send(sock_id_t *id, const void *buffer, size_t len) {
+/* Connect socket
+ *
+ * For modules that send on the fd of a client socket directly. Connects a stream client if it isn't
+ * connected yet, see _connect_network_sock().
+ */
+int connect_sock( sock_id_t *id ) {
+    if (id == NULL) { return SOCK_NOT_OK; }
+    if ((*id < 0) || (*id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (sock_configs[*id] == NULL) { return SOCK_NOT_OK; }
+
+    return _connect_network_sock(id);
+}
+
+int reset_sock( sock_id_t *id ) {
     sock_config_t *sock_cfg;
+    E_APP_SOCK_TYPE app_type;
+    sock_opts_t opts;
+    uint32_t zc_seq;
+    bool is_server;
+    char *addr_str;
+    int port;
 
     if (id == NULL) { return SOCK_NOT_OK; }
-    if (*id > MAX_NUM_OF_SOCKS) { return SOCK_NOT_OK; }
-    if (buffer == NULL) { return SOCK_NOT_OK; }
-    
+    if ((*id < 0) || (*id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+
     sock_cfg = sock_configs[*id];
 
     if (sock_cfg == NULL) { return SOCK_NOT_OK; }
-    if ((sock_cfg->app_type != E_TCP_SOCK) && (sock_cfg->app_type != E_UDP_SOCK)) { return SOCK_NOT_OK; } 
+
+    app_type = sock_cfg->app_type;
+    port = sock_cfg->port;
+    is_server = sock_cfg->is_server;
+    opts = sock_cfg->opts;
+    addr_str = strdup(sock_cfg->addr_str);
+    zc_seq = _drain_zerocopy(*id);
+
+    close_sock(*id);
+
+    *id = initialize_sock_opts(app_type, addr_str, port, is_server, &opts);
+
+    free(addr_str);
+    _resume_zerocopy(*id, zc_seq);
+
+    return (*id < 0) ? SOCK_NOT_OK : SOCK_OK;
+}
+
+/* Connect network socket
+ *
+ * Client side sockets connect() to the server before sending, a failed connect() re-initializes the
+ * socket and updates id. Server side sockets are already passively listening and are left untouched.
+ * Only stream sockets connect, LOCAL sockets are connected the same way as TCP. Returns SOCK_OK when
+ * the socket is ready to send, SOCK_NOT_OK otherwise.
+ */
+static int _connect_network_sock( sock_id_t *id ) {
+    sock_config_t *sock_cfg = sock_configs[*id];
 
     /* Server side doesn't connect to socket, as it's already passively listening. */
     if ((!sock_cfg->is_server)) {
@@ -500,32 +757,31 @@ int await_network_send(sock_id_t *id, const void *buffer, size_t len) {
         * 
         * NOTE: UDP doesn't connect() 
         */
-        if ( (!sock_cfg->is_connected) && (sock_cfg->app_type == E_TCP_SOCK)  ) {
+        if ( (!sock_cfg->is_connected) && (sock_cfg->type == SOCK_STREAM)  ) {
             if ((sock_cfg->status = connect(sock_cfg->listen_fd, (const sockaddr_t *)sock_cfg->listen_addr, sock_cfg->listen_len)) < 0) {
 
                 int port; 
-                char *addr_str = malloc(strlen(sock_cfg->addr_str) * sizeof(char));
+                char *addr_str = strdup(sock_cfg->addr_str);
                 bool is_server = sock_cfg->is_server;
+                sock_opts_t opts = sock_cfg->opts;
                 
                 /* TODO: useful standard printout message with what happened, ID, addr, port, etc */
                 // printf("Socket ID(%d) failed to connect. \n", *id);
                 
                 E_APP_SOCK_TYPE app_type = sock_cfg->app_type;
 
-                strncpy(addr_str, sock_cfg->addr_str, strlen(sock_cfg->addr_str) * sizeof(char));
                 port = sock_cfg->port;
+                uint32_t zc_seq = _drain_zerocopy(*id);
 
                 /* Failed to connect to sock, closing socket, and reconnecting */
                 close_sock(*id);
 
                 /* Application is given update id for sock, informed that socket was reconnected */
-                *id = initialize_sock(app_type, addr_str, port, is_server);
+                *id = initialize_sock_opts(app_type, addr_str, port, is_server, &opts);
 
                 free(addr_str);
+                _resume_zerocopy(*id, zc_seq);
 
-                sock_cfg = sock_configs[*id];
-                sock_cfg->is_connected = false;
-                
                 return SOCK_NOT_OK;
             }
 
@@ -533,6 +789,41 @@ int await_network_send(sock_id_t *id, const void *buffer, size_t len) {
         }
     }
 
+    return SOCK_OK;
+}
+
+int await_network_send(sock_id_t *id, const void *buffer, size_t len) {
+    sock_config_t *sock_cfg;
+
+    if (id == NULL) { return SOCK_NOT_OK; }
+    if ((*id < 0) || (*id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (buffer == NULL) { return SOCK_NOT_OK; }
+    
+    sock_cfg = sock_configs[*id];
+
+    if (sock_cfg == NULL) { return SOCK_NOT_OK; }
+
+    /* Reliable UDP is connectionless, acks are read first so the window can open */
+    if (sock_cfg->app_type == E_RUDP_SOCK) {
+        (void)rudp_process(*id);
+        return rudp_send(*id, NULL, 0, buffer, len);
+    }
+
+    if ((sock_cfg->app_type != E_TCP_SOCK) && (sock_cfg->app_type != E_UDP_SOCK)) { return SOCK_NOT_OK; } 
+
+    /* Large sends skip the copy into the kernel, the buffer is the caller's again once it's released */
+    if ((sock_cfg->app_type == E_TCP_SOCK) && sock_cfg->opts.zerocopy && (len >= ZEROCOPY_MIN_SEND_SIZE)) {
+        uint32_t seq;
+
+        if (await_network_send_zc(id, buffer, len, &seq) != SOCK_OK) { return SOCK_NOT_OK; }
+
+        return _await_zerocopy(*id, seq);
+    }
+
+    if (_connect_network_sock(id) != SOCK_OK) { return SOCK_NOT_OK; }
+
+    sock_cfg = sock_configs[*id];
+
     /* Send a message on a sock 
      *
      * Transmit a message to another sock. send() can only be used hwen the socket is in a connected state (so that the intended 
@@ -541,15 +832,237 @@ int await_network_send(sock_id_t *id, const void *buffer, size_t len) {
      * the message does not fit into the send buffer of the sock, send() blocks. Unless the socket is in nonblocking I/O mode.
      */
     if ((sock_cfg->conn_num_bytes = send(sock_cfg->listen_fd, buffer, len, 0)) < 0) {
-        printf("Failed to send\n");
+        log_error("Failed to send");
         return SOCK_NOT_OK;
     }
 
-    printf("Sent %d bytes\n", sock_cfg->conn_num_bytes);
+    _uncork(sock_cfg, sock_cfg->listen_fd);
+
+    log_debug("Sent %d bytes", sock_cfg->conn_num_bytes);
         
     return SOCK_OK;
 }
 
+/* Drain zero-copy sends
+ *
+ * Completions are queued on the socket, they're lost when it's closed. Reads what's already queued,
+ * and returns the sequence number the reconnected socket continues at.
+ */
+static uint32_t _drain_zerocopy( sock_id_t id ) {
+    sock_config_t *sock_cfg = sock_configs[id];
+    uint32_t pending;
+
+    (void)poll_zerocopy_completions(id);
+
+    if ((pending = sock_cfg->zc_next_seq - sock_cfg->zc_done_seq) > 0) {
+        log_warn("Socket ID(%d) reconnected with %u zero-copy sends in flight, they may not be delivered", id, pending);
+    }
+
+    return sock_cfg->zc_next_seq;
+}
+
+/* The kernel numbers a new socket's sends from 0, zc_base maps them past the old socket's */
+static void _resume_zerocopy( sock_id_t id, uint32_t seq ) {
+    sock_config_t *sock_cfg;
+
+    if ((id < 0) || ((sock_cfg = sock_configs[id]) == NULL)) { return; }
+
+    sock_cfg->zc_base = seq;
+    sock_cfg->zc_next_seq = seq;
+    sock_cfg->zc_done_seq = seq;
+    sock_cfg->zc_done_mask = 0;
+}
+
+/* Completions are signalled as POLLERR, which poll() reports without asking for it */
+static int _await_zerocopy( sock_id_t id, uint32_t seq ) {
+    msec_t deadline = get_monotonic_ms() + ZEROCOPY_WAIT_MS;
+    struct pollfd pfd;
+    msec_t now;
+
+    while (!is_zerocopy_complete(id, seq)) {
+        if ((now = get_monotonic_ms()) >= deadline) {
+            log_warn("Socket ID(%d) zero-copy send %u not complete after %d ms", id, seq, ZEROCOPY_WAIT_MS);
+            return SOCK_NOT_OK;
+        }
+
+        pfd.fd = _data_fd(sock_configs[id]);
+        pfd.events = 0;
+
+        if ((poll(&pfd, 1, (int)(deadline - now)) < 0) && (errno != EINTR)) { return SOCK_NOT_OK; }
+        if (poll_zerocopy_completions(id) < 0) { return SOCK_NOT_OK; }
+    }
+
+    return SOCK_OK;
+}
+
+/* Await Network Send (zero-copy)
+ *
+ * MSG_ZEROCOPY pins the pages of buffer instead of copying them into the kernel, the kernel reports
+ * on the socket error queue once it no longer references them. Every successful zero-copy send() is
+ * assigned the next sequence number by the kernel, the same counter offset by zc_base is kept in
+ * zc_next_seq. If send()
+ * is partial, the remainder is sent again and seq is the last sequence used. Completions are tracked
+ * as a contiguous low-water mark, so a seq is only complete once every earlier send is complete.
+ *
+ * Falls back to copying when zero-copy isn't enabled, len is too small to benefit, too many sends
+ * are in flight, or the kernel is out of option memory (ENOBUFS).
+ */
+int await_network_send_zc( sock_id_t *id, const void *buffer, size_t len, uint32_t *seq ) {
+    sock_config_t *sock_cfg;
+    const char *data = buffer;
+    size_t sent = 0;
+    ssize_t num_bytes;
+    int flags = MSG_ZEROCOPY;
+    int fd;
+
+    if (id == NULL) { return SOCK_NOT_OK; }
+    if ((*id < 0) || (*id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (buffer == NULL) { return SOCK_NOT_OK; }
+    if (seq == NULL) { return SOCK_NOT_OK; }
+
+    sock_cfg = sock_configs[*id];
+
+    if (sock_cfg == NULL) { return SOCK_NOT_OK; }
+    if ((sock_cfg->app_type != E_TCP_SOCK) && (sock_cfg->app_type != E_UDP_SOCK)) { return SOCK_NOT_OK; } 
+
+    if (_connect_network_sock(id) != SOCK_OK) { return SOCK_NOT_OK; }
+
+    sock_cfg = sock_configs[*id];
+    fd = _data_fd(sock_cfg);
+
+    *seq = ZEROCOPY_SEQ_COPIED;
+
+    if ((sock_cfg->zc_next_seq - sock_cfg->zc_done_seq) >= ZEROCOPY_MAX_IN_FLIGHT) {
+        (void)poll_zerocopy_completions(*id);
+    }
+
+    if ((!sock_cfg->opts.zerocopy) || (sock_cfg->app_type != E_TCP_SOCK) || (len < ZEROCOPY_MIN_SEND_SIZE) ||
+            ((sock_cfg->zc_next_seq - sock_cfg->zc_done_seq) >= ZEROCOPY_MAX_IN_FLIGHT)) {
+        flags = 0;
+    }
+
+    while (sent < len) {
+        num_bytes = send(fd, data + sent, len - sent, flags);
+
+        if ((num_bytes < 0) && (flags == MSG_ZEROCOPY) && (errno == ENOBUFS)) {
+            /* Out of option memory for pinned pages, copy the remainder */
+            flags = 0;
+            continue;
+        }
+
+        if (num_bytes < 0) {
+            log_error("Failed to send");
+            sock_cfg->conn_num_bytes = sent;
+            return SOCK_NOT_OK;
+        }
+
+        if (flags == MSG_ZEROCOPY) {
+            *seq = sock_cfg->zc_next_seq++;
+        }
+
+        sent += num_bytes;
+    }
+
+    sock_cfg->conn_num_bytes = sent;
+    _uncork(sock_cfg, fd);
+
+    return SOCK_OK;
+}
+
+/* Poll zero-copy completions
+ *
+ * Drains the socket error queue without blocking. Each notification covers the inclusive range of 
+ * sequence numbers [ee_info, ee_data], ranges may arrive out of order, so they are recorded in a 
+ * bitmap relative to the low-water mark. If the kernel reports that it had to copy the data anyway 
+ * (e.g. loopback, or a device without scatter-gather), zero-copy only adds overhead and is disabled
+ * for the socket once that happens consistently.
+ */
+int poll_zerocopy_completions( sock_id_t id ) {
+    sock_config_t *sock_cfg;
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    char control[128];
+    uint32_t cur_seq;
+    int completed = 0;
+    int fd;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+
+    sock_cfg = sock_configs[id];
+
+    if (sock_cfg == NULL) { return SOCK_NOT_OK; }
+    if (sock_cfg->app_type != E_TCP_SOCK) { return 0; }
+    if (sock_cfg->zc_next_seq == sock_cfg->zc_done_seq) { return 0; }
+
+    fd = _data_fd(sock_cfg);
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) { break; }
+            return SOCK_NOT_OK;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+
+            if (!(((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR)) ||
+                  ((cm->cmsg_level == SOL_IPV6) && (cm->cmsg_type == IPV6_RECVERR)))) {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+
+            if ((serr->ee_errno != 0) || (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)) { continue; }
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                if (++sock_cfg->zc_copied >= ZEROCOPY_MAX_IN_FLIGHT) {
+                    sock_cfg->opts.zerocopy = false;
+                }
+            } else {
+                sock_cfg->zc_copied = 0;
+            }
+
+            for (cur_seq = sock_cfg->zc_base + serr->ee_info; cur_seq != (sock_cfg->zc_base + serr->ee_data + 1); cur_seq++) {
+                uint32_t offset = cur_seq - sock_cfg->zc_done_seq;
+
+                if (offset < ZEROCOPY_MAX_IN_FLIGHT) {
+                    sock_cfg->zc_done_mask |= (1ULL << offset);
+                    completed++;
+                }
+            }
+        }
+    }
+
+    /* Advance the low-water mark over every contiguous completion */
+    while (sock_cfg->zc_done_mask & 1ULL) {
+        sock_cfg->zc_done_mask >>= 1;
+        sock_cfg->zc_done_seq++;
+    }
+
+    return completed;
+}
+
+/* Zero-copy send complete
+ *
+ * Returns true once the buffer passed with seq, and every buffer sent before it, can be reused. 
+ */
+bool is_zerocopy_complete( sock_id_t id, uint32_t seq ) {
+    sock_config_t *sock_cfg;
+
+    if (seq == ZEROCOPY_SEQ_COPIED) { return true; }
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return false; }
+
+    sock_cfg = sock_configs[id];
+
+    if (sock_cfg == NULL) { return false; }
+
+    return ((int32_t)(seq - sock_cfg->zc_done_seq) < 0);
+}
+
 /* Await Local Send
  * 
  */
@@ -558,7 +1071,7 @@ int await_local_send( sock_id_t *id, const void *buffer, size_t len ) {
     sockaddr_un_t *listen_addr;
     
     if (id == NULL) { return SOCK_NOT_OK; }
-    if (*id > MAX_NUM_OF_SOCKS) { return SOCK_NOT_OK; }
+    if ((*id < 0) || (*id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
     if (buffer == NULL) { return SOCK_NOT_OK; }
     
     sock_cfg = sock_configs[*id];
@@ -592,9 +1105,8 @@ int await_local_send( sock_id_t *id, const void *buffer, size_t len ) {
                 (const sockaddr_t *)listen_addr, sock_cfg->listen_len)) < 0) {
 
                 bool is_server = sock_cfg->is_server;
-                char *path = malloc(strlen(sock_cfg->addr_str) * sizeof(char));
-
-                strncpy(path, sock_cfg->addr_str, strlen(sock_cfg->addr_str) * sizeof(char));
+                char *path = strdup(sock_cfg->addr_str);
+                sock_opts_t opts = sock_cfg->opts;
 
                 /* TODO: useful standard printout message with what happened, ID, addr, port, etc */
                 printf("Local socket ID(%d) failed to connect. \n", *id);
@@ -603,11 +1115,9 @@ int await_local_send( sock_id_t *id, const void *buffer, size_t len ) {
                 close_sock(*id);
 
                 /* Application is given update id for sock, informed that socket was reconnected */
-                *id = initialize_sock(E_LOCAL_SOCK, path, 0, is_server);
+                *id = initialize_sock_opts(E_LOCAL_SOCK, path, 0, is_server, &opts);
             
-                sock_cfg->is_connected = false;
                 free(path);
-                
                 return SOCK_NOT_OK;
             }
 
@@ -616,11 +1126,11 @@ int await_local_send( sock_id_t *id, const void *buffer, size_t len ) {
     }
 
     if ((sock_cfg->conn_num_bytes = send(sock_cfg->listen_fd, buffer, len, 0)) < 0) {
-        printf("Failed to send\n");
+        log_error("Failed to send");
         return SOCK_NOT_OK;
     }
 
-    printf("num bytes: %d\n", sock_cfg->conn_num_bytes);
+    log_debug("num bytes: %d", sock_cfg->conn_num_bytes);
 
     return SOCK_OK;
 }
@@ -631,14 +1141,32 @@ int await_local_send( sock_id_t *id, const void *buffer, size_t len ) {
  * ignored. All resources in sock_cfg are freed. Returns SOCK_OK on success, and SOCK_NOT_OK on failure.
  */
 int close_sock(sock_id_t id) {
+    return _close_sock(id, true);
+}
+
+/* Release a socket
+ *
+ * Same as close_sock(), but a LOCAL server path is left in place. Used when another process holds a
+ * duplicate of the socket, e.g. after handing listeners over to a new server process.
+ */
+int release_sock(sock_id_t id) {
+    return _close_sock(id, false);
+}
+
+static int _close_sock( sock_id_t id, bool unlink_path ) {
     sock_config_t *sock_cfg;
     
-    if (id > MAX_NUM_OF_SOCKS) { return SOCK_NOT_OK; }
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
     
     sock_cfg = sock_configs[id];
 
     if (sock_cfg == NULL) { return SOCK_NOT_OK; }
 
+    rudp_close(id);
+
+    free(sock_limiters[id]);
+    sock_limiters[id] = NULL;
+
     /* Close a file descriptor (fd)
      *
      * Closes a fd, so that it no longer refers to any file and may be reused. Any record locks held on
@@ -661,7 +1189,7 @@ int close_sock(sock_id_t id) {
      * at the specified path before the client attempts to connect. If the server hasn't started or hasn't created the 
      * socket file yet, the client will receive an ENOENT error.
      */
-    if ((sock_cfg->app_type == E_LOCAL_SOCK) && sock_cfg->is_server ) {
+    if ((sock_cfg->app_type == E_LOCAL_SOCK) && sock_cfg->is_server && unlink_path) {
         if (unlink(sock_cfg->addr_str) < 0) {
             // Don't care since we want to de-link anyways
             // printf("Failed to unlink path: %s\n", path);
@@ -679,6 +1207,294 @@ int close_sock(sock_id_t id) {
     return SOCK_OK;
 }
 
+/* Adopt a socket
+ *
+ * Creates a server socket configuration around fd, an already bound (and listening) socket that was
+ * inherited from another process. Nothing is bound or unlinked, the fd keeps its state and pending
+ * connections. The address family is read back from the socket. opts are stored, but not applied,
+ * the socket is already tuned. Returns the id of the socket, or SOCK_NOT_OK.
+ */
+sock_id_t adopt_sock( E_APP_SOCK_TYPE app_type, int fd, const char *addr, int port, const sock_opts_t *opts ) {
+    sock_config_t *sock_cfg;
+    sockaddr_storage_t local;
+    socklen_t local_len = sizeof(local);
+    int open_sock_id;
+
+    if ((fd < 0) || (addr == NULL)) { return SOCK_NOT_OK; }
+
+    if (getsockname(fd, (sockaddr_t *)&local, &local_len) < 0) { return SOCK_NOT_OK; }
+
+    if ((open_sock_id = _find_open_sock()) == SOCK_NOT_OK) {
+        return SOCK_NOT_OK;
+    }
+
+    sock_cfg = sock_configs[open_sock_id] = calloc(1, sizeof(sock_config_t));
+
+    if (opts != NULL) {
+        sock_cfg->opts = *opts;
+    } else {
+        get_sock_profile(E_SOCK_PROFILE_DEFAULT, &sock_cfg->opts);
+    }
+
+    sock_cfg->app_type = app_type;
+    sock_cfg->domain = local.ss_family;
+    sock_cfg->type = ((app_type == E_UDP_SOCK) || (app_type == E_RUDP_SOCK)) ? SOCK_DGRAM : SOCK_STREAM;
+    sock_cfg->is_server = true;
+    sock_cfg->port = port;
+    sock_cfg->listen_fd = fd;
+    sock_cfg->listen_opt = 1;
+
+    sock_cfg->listen_addr = malloc(sizeof(sockaddr_storage_t));
+    memcpy(sock_cfg->listen_addr, &local, local_len);
+    sock_cfg->listen_len = local_len;
+
+    sock_cfg->addr_str = strdup(addr);
+
+    sock_cfg->conn_addr = malloc(sizeof(sockaddr_storage_t));
+    sock_cfg->conn_addr_len = sizeof(sockaddr_storage_t);
+    sock_cfg->conn_buff = malloc(MAX_SERVER_MESSAGE_SIZE * sizeof(char));
+    sock_cfg->conn_buff_len = MAX_SERVER_MESSAGE_SIZE;
+
+    return open_sock_id;
+}
+
+/* Set socket options
+ *
+ * Replaces the stored options of an open socket and applies them to the listening socket, and to the
+ * accepted connection if there is one. Buffer sizes set after listen() only apply to connections 
+ * accepted afterwards. Returns SOCK_OK on success, SOCK_NOT_OK if id is invalid.
+ */
+int set_sock_opts( sock_id_t id, const sock_opts_t *opts ) {
+    sock_config_t *sock_cfg;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (opts == NULL) { return SOCK_NOT_OK; }
+
+    sock_cfg = sock_configs[id];
+
+    if (sock_cfg == NULL) { return SOCK_NOT_OK; }
+
+    sock_cfg->opts = *opts;
+    _apply_sock_opts(sock_cfg, sock_cfg->listen_fd);
+
+    if (sock_cfg->is_server && sock_cfg->is_connected && (sock_cfg->type == SOCK_STREAM)) {
+        _apply_conn_opts(sock_cfg, sock_cfg->conn_fd);
+    }
+
+    return SOCK_OK;
+}
+
+/* Get socket poll fd
+ *
+ * Returns the fd that becomes readable when the next await_*_receive() on id will not block. That
+ * is the accepted connection of a connected stream server, otherwise the socket itself. 
+ */
+int get_sock_poll_fd( sock_id_t id ) {
+    sock_config_t *sock_cfg;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+
+    sock_cfg = sock_configs[id];
+
+    if (sock_cfg == NULL) { return SOCK_NOT_OK; }
+
+    return _data_fd(sock_cfg);
+}
+
+/* Get socket fd and type
+ *
+ * Accessors for modules that drive sockets themselves, e.g. an event loop. Return SOCK_NOT_OK if id
+ * is invalid.
+ */
+int get_sock_fd( sock_id_t id ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (sock_configs[id] == NULL) { return SOCK_NOT_OK; }
+
+    return sock_configs[id]->listen_fd;
+}
+
+int get_sock_app_type( sock_id_t id ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (sock_configs[id] == NULL) { return SOCK_NOT_OK; }
+
+    return sock_configs[id]->app_type;
+}
+
+/* Get socket address
+ *
+ * Copies the address id was initialized with, the bound address of a server or the destination of a
+ * client. len is the size of addr on input, the size of the address on output.
+ */
+int get_sock_addr( sock_id_t id, sockaddr_storage_t *addr, socklen_t *len ) {
+    sock_config_t *sock_cfg;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if ((addr == NULL) || (len == NULL)) { return SOCK_NOT_OK; }
+
+    sock_cfg = sock_configs[id];
+
+    if ((sock_cfg == NULL) || (sock_cfg->listen_addr == NULL)) { return SOCK_NOT_OK; }
+
+    memset(addr, 0, sizeof(*addr));
+    memcpy(addr, sock_cfg->listen_addr, sock_cfg->listen_len);
+    *len = sock_cfg->listen_len;
+
+    return SOCK_OK;
+}
+
+/* Apply connection options to an accepted fd
+ *
+ * For connections accepted outside of the await_* APIs, so they are tuned like the listener.
+ */
+int apply_sock_conn_opts( sock_id_t id, int fd ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (sock_configs[id] == NULL) { return SOCK_NOT_OK; }
+
+    _apply_conn_opts(sock_configs[id], fd);
+
+    return SOCK_OK;
+}
+
+int rearm_sock_quickack( sock_id_t id, int fd ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (sock_configs[id] == NULL) { return SOCK_NOT_OK; }
+
+    _rearm_quickack(sock_configs[id], fd);
+
+    return SOCK_OK;
+}
+
+int uncork_sock_conn( sock_id_t id, int fd ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS)) { return SOCK_NOT_OK; }
+    if (sock_configs[id] == NULL) { return SOCK_NOT_OK; }
+
+    _uncork(sock_configs[id], fd);
+
+    return SOCK_OK;
+}
+
+/* Admit connection
+ *
+ * The connection limit is checked before the peer is looked up, so a flood of connections is
+ * refused without touching the peer table. A LOCAL connection may reuse the fd of a closed one, it
+ * starts with a full bucket.
+ */
+bool admit_sock_conn( sock_id_t id, const sockaddr_storage_t *peer, int fd ) {
+    sock_limiter_t *limiter;
+    sock_peer_t *peer_entry;
+    sock_opts_t *opts;
+    uint32_t key[5];
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS) || (peer == NULL)) { return true; }
+    if ((sock_configs[id] == NULL) || !sock_configs[id]->is_server) { return true; }
+
+    opts = &sock_configs[id]->opts;
+
+    if ((opts->rate == 0) && (opts->max_conns == 0) && (opts->max_conns_per_peer == 0)) { return true; }
+
+    /* Without memory for the table the socket is left unlimited */
+    if ((limiter = _get_limiter(id)) == NULL) { return true; }
+
+    if ((opts->max_conns > 0) && (limiter->conns >= opts->max_conns)) {
+        limiter->stats.conns_refused++;
+        return false;
+    }
+
+    _peer_key(peer, fd, key);
+
+    if ((peer_entry = _find_peer(limiter, opts, key, get_monotonic_ms(), true)) == NULL) {
+        limiter->stats.conns_refused++;
+        return false;
+    }
+
+    if ((opts->max_conns_per_peer > 0) && (peer_entry->conns >= opts->max_conns_per_peer)) {
+        limiter->stats.conns_refused++;
+        return false;
+    }
+
+    if (key[0] == AF_UNIX) {
+        peer_entry->tokens = (int64_t)(opts->burst ? opts->burst : opts->rate) * SOCK_LIMIT_TOKEN;
+    }
+
+    peer_entry->conns++;
+    limiter->conns++;
+
+    return true;
+}
+
+void release_sock_conn( sock_id_t id, const sockaddr_storage_t *peer, int fd ) {
+    sock_limiter_t *limiter;
+    sock_peer_t *peer_entry;
+    uint32_t key[5];
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS) || (peer == NULL)) { return; }
+    if ((sock_configs[id] == NULL) || ((limiter = sock_limiters[id]) == NULL)) { return; }
+
+    _peer_key(peer, fd, key);
+
+    /* Connections accepted before the limits were set were never counted */
+    if ((peer_entry = _find_peer(limiter, &sock_configs[id]->opts, key, get_monotonic_ms(), false)) != NULL) {
+        if (peer_entry->conns > 0) { peer_entry->conns--; }
+    }
+
+    if (limiter->conns > 0) { limiter->conns--; }
+}
+
+msec_t admit_sock_message( sock_id_t id, const sockaddr_storage_t *peer, int fd ) {
+    return _admit(id, peer, fd, SOCK_LIMIT_TOKEN);
+}
+
+msec_t admit_sock_stream( sock_id_t id, const sockaddr_storage_t *peer, int fd ) {
+    return _admit(id, peer, fd, 0);
+}
+
+void charge_sock_stream( sock_id_t id, const sockaddr_storage_t *peer, int fd, size_t len ) {
+    sock_limiter_t *limiter;
+    sock_peer_t *peer_entry;
+    uint32_t key[5];
+    uint64_t cost;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS) || (peer == NULL)) { return; }
+    if ((sock_configs[id] == NULL) || (sock_configs[id]->opts.rate == 0)) { return; }
+    if ((limiter = sock_limiters[id]) == NULL) { return; }
+
+    _peer_key(peer, fd, key);
+
+    /* Rounded up, a receive always costs something */
+    cost = (((uint64_t)len * SOCK_LIMIT_TOKEN) + SOCK_LIMIT_MESSAGE_SIZE - 1) / SOCK_LIMIT_MESSAGE_SIZE;
+
+    if ((peer_entry = _find_peer(limiter, &sock_configs[id]->opts, key, get_monotonic_ms(), false)) != NULL) {
+        peer_entry->tokens -= (int64_t)cost;
+    }
+}
+
+int get_sock_limit_stats( sock_id_t id, sock_limit_stats_t *stats ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS) || (stats == NULL)) { return SOCK_NOT_OK; }
+    if (sock_configs[id] == NULL) { return SOCK_NOT_OK; }
+
+    if (sock_limiters[id] == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return SOCK_OK;
+    }
+
+    *stats = sock_limiters[id]->stats;
+    stats->conns = (uint32_t)sock_limiters[id]->conns;
+    stats->peers = sock_limiters[id]->num_peers;
+
+    return SOCK_OK;
+}
+
+/* Data fd of a socket
+ *
+ * Stream servers exchange data on the accepted connection, everything else on the socket itself.
+ */
+static int _data_fd( sock_config_t *sock_cfg ) {
+    if (sock_cfg->is_server && sock_cfg->is_connected && (sock_cfg->type == SOCK_STREAM)) {
+        return sock_cfg->conn_fd;
+    }
+    return sock_cfg->listen_fd;
+}
+
 /* Searches available socks for an open buffer */
 static int _find_open_sock( void ){
     for (int i=0; i<MAX_NUM_OF_SOCKS; i++) {
@@ -688,3 +1504,171 @@ static int _find_open_sock( void ){
     }
     return SOCK_NOT_OK;
 }
+
+/* Await reliable UDP receive
+ *
+ * Blocks until the next in-order message arrives. Retransmit timers keep running while waiting, so
+ * messages sent from the same socket are still delivered. Fails once the server's state is dropped,
+ * what it was sent since its last ack may be lost.
+ */
+static int _await_rudp_receive( sock_id_t id, void *buffer, size_t len ) {
+    struct pollfd pfd;
+    rudp_drop_t drop;
+
+    memset(buffer, 0, len);
+
+    pfd.fd = sock_configs[id]->listen_fd;
+    pfd.events = POLLIN;
+
+    for (;;) {
+        (void)rudp_process(id);
+
+        if (rudp_receive(id, buffer, len, NULL, NULL) >= 0) { return SOCK_OK; }
+
+        if ((poll(&pfd, 1, RUDP_TICK_MS) < 0) && (errno != EINTR)) { return SOCK_NOT_OK; }
+
+        rudp_tick(id);
+
+        if (rudp_dropped(id, &drop) == SOCK_OK) {
+            log_warn("Lost reliable UDP server, %u messages unacknowledged", drop.unacked);
+            return SOCK_NOT_OK;
+        }
+    }
+}
+
+/* Admit
+ *
+ * Takes cost from the peer's bucket if it has a token. A peer the table has no room for is treated
+ * like an empty bucket, so it's retried rather than admitted unlimited.
+ */
+static msec_t _admit( sock_id_t id, const sockaddr_storage_t *peer, int fd, int64_t cost ) {
+    sock_limiter_t *limiter;
+    sock_peer_t *peer_entry;
+    sock_opts_t *opts;
+    uint32_t key[5];
+    int64_t tokens = 0;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_SOCKS) || (peer == NULL)) { return 0; }
+    if ((sock_configs[id] == NULL) || !sock_configs[id]->is_server) { return 0; }
+
+    opts = &sock_configs[id]->opts;
+
+    if (opts->rate == 0) { return 0; }
+    if ((limiter = _get_limiter(id)) == NULL) { return 0; }
+
+    _peer_key(peer, fd, key);
+
+    if ((peer_entry = _find_peer(limiter, opts, key, get_monotonic_ms(), true)) != NULL) {
+        if (peer_entry->tokens >= SOCK_LIMIT_TOKEN) {
+            peer_entry->tokens -= cost;
+            limiter->stats.admitted++;
+            return 0;
+        }
+        tokens = peer_entry->tokens;
+    }
+
+    limiter->stats.rate_limited++;
+
+    return (msec_t)((SOCK_LIMIT_TOKEN - tokens + opts->rate - 1) / opts->rate);
+}
+
+static sock_limiter_t *_get_limiter( sock_id_t id ) {
+    if (sock_limiters[id] == NULL) {
+        sock_limiters[id] = calloc(1, sizeof(sock_limiter_t));
+    }
+
+    return sock_limiters[id];
+}
+
+/* Peer key
+ *
+ * The family followed by the address. IPv4-mapped addresses of a dual-stack listener are keyed as
+ * IPv4, so a peer has the same bucket on every listener family.
+ */
+static void _peer_key( const sockaddr_storage_t *peer, int fd, uint32_t key[5] ) {
+    const sockaddr_in6_t *sin6 = (const sockaddr_in6_t *)peer;
+
+    memset(key, 0, 5 * sizeof(uint32_t));
+
+    if (peer->ss_family == AF_INET) {
+        key[0] = AF_INET;
+        memcpy(&key[1], &((const sockaddr_in_t *)peer)->sin_addr, sizeof(struct in_addr));
+    } else if ((peer->ss_family == AF_INET6) && IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+        key[0] = AF_INET;
+        memcpy(&key[1], &sin6->sin6_addr.s6_addr[12], sizeof(struct in_addr));
+    } else if (peer->ss_family == AF_INET6) {
+        key[0] = AF_INET6;
+        memcpy(&key[1], &sin6->sin6_addr, sizeof(struct in6_addr));
+    } else {
+        key[0] = AF_UNIX;
+        key[1] = (uint32_t)fd;
+    }
+}
+
+/* Find peer
+ *
+ * Linear probe from the FNV-1a hash of the key. Peers are never removed, only replaced, so an empty
+ * slot ends the probe. With create, a missing peer takes the first empty slot in the probe, or
+ * replaces the least recently seen peer without connections.
+ */
+static sock_peer_t *_find_peer( sock_limiter_t *limiter, const sock_opts_t *opts, const uint32_t key[5], msec_t now, bool create ) {
+    sock_peer_t *peer;
+    sock_peer_t *victim = NULL;
+    uint32_t hash = 2166136261U;
+
+    for (int i=0; i<5; i++) {
+        hash = (hash ^ key[i]) * 16777619U;
+    }
+    hash ^= hash >> 16;
+
+    for (int i=0; i<SOCK_LIMIT_MAX_PROBE; i++) {
+        peer = &limiter->peers[(hash + i) & (SOCK_LIMIT_TABLE_SIZE - 1)];
+
+        if (!peer->used) {
+            victim = peer;
+            break;
+        }
+
+        if (memcmp(peer->key, key, sizeof(peer->key)) == 0) {
+            _refill_peer(opts, peer, now);
+            return peer;
+        }
+
+        if ((peer->conns == 0) && ((victim == NULL) || (peer->last_seen < victim->last_seen))) {
+            victim = peer;
+        }
+    }
+
+    if (!create) { return NULL; }
+
+    if (victim == NULL) {
+        limiter->stats.peers_refused++;
+        return NULL;
+    }
+
+    if (victim->used) {
+        limiter->stats.peers_evicted++;
+    } else {
+        limiter->num_peers++;
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->used = true;
+    memcpy(victim->key, key, sizeof(victim->key));
+    victim->tokens = (int64_t)(opts->burst ? opts->burst : opts->rate) * SOCK_LIMIT_TOKEN;
+    victim->last_seen = now;
+
+    return victim;
+}
+
+static void _refill_peer( const sock_opts_t *opts, sock_peer_t *peer, msec_t now ) {
+    int64_t size = (int64_t)(opts->burst ? opts->burst : opts->rate) * SOCK_LIMIT_TOKEN;
+
+    if (now > peer->last_seen) {
+        peer->tokens += (int64_t)(now - peer->last_seen) * opts->rate;
+    }
+
+    if (peer->tokens > size) { peer->tokens = size; }
+
+    peer->last_seen = now;
+}
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+
+#include "supervisor.h"
+#include "logger.h"
+
+/* Longest part of an exit message, a reason or the restart delay */
+#define SUPERVISOR_MSG_SIZE 48
+
+typedef struct {
+    bool used;
+    bool stopping;
+    char name[SUPERVISOR_NAME_SIZE];
+    supervisor_policy_t policy;
+    child_main_t entry;
+    void *arg;
+
+    int pidfd;
+    msec_t backoff_ms;
+    msec_t restart_ms;
+    bool restart_pending;
+
+    supervisor_stats_t stats;
+} child_t;
+
+static child_t children[SUPERVISOR_MAX_CHILDREN];
+static int sigchld_fd = -1;
+
+static const supervisor_policy_t default_policy = {
+    .restart = SUPERVISOR_RESTART_ALWAYS,
+    .min_backoff_ms = SUPERVISOR_DEFAULT_MIN_BACKOFF_MS,
+    .max_backoff_ms = SUPERVISOR_DEFAULT_MAX_BACKOFF_MS,
+    .death_signal = SIGTERM,
+};
+
+/* Static Functions */
+static int _fork_child( int id );
+static void _child_exited( int id, int status, const struct rusage *usage );
+static bool _reap( int id, bool block );
+static void _pidfd_handler( int fd, uint32_t events, void *ctx );
+static void _sigchld_handler( int fd, uint32_t events, void *ctx );
+static child_t *_get_child( int id );
+
+int supervisor_init( void ) {
+    sigset_t mask;
+
+    if (sigchld_fd >= 0) { return SUPERVISOR_OK; }
+
+    /* SIGCHLD is only read from the signalfd, the default action would discard it */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) { return SUPERVISOR_NOT_OK; }
+
+    if ((sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        log_error("Failed to create signalfd");
+        return SUPERVISOR_NOT_OK;
+    }
+
+    if (event_loop_watch_fd(sigchld_fd, EPOLLIN, _sigchld_handler, NULL) < 0) {
+        (void)close(sigchld_fd);
+        sigchld_fd = -1;
+        return SUPERVISOR_NOT_OK;
+    }
+
+    return SUPERVISOR_OK;
+}
+
+int supervisor_spawn( const char *name, const supervisor_policy_t *policy, child_main_t entry, void *arg ) {
+    child_t *child;
+    int id;
+
+    if ((sigchld_fd < 0) || (entry == NULL)) { return SUPERVISOR_NOT_OK; }
+
+    for (id=0; id<SUPERVISOR_MAX_CHILDREN; id++) {
+        if (!children[id].used) { break; }
+    }
+
+    if (id == SUPERVISOR_MAX_CHILDREN) {
+        log_error("No free supervisor slots");
+        return SUPERVISOR_NOT_OK;
+    }
+
+    child = &children[id];
+    memset(child, 0, sizeof(*child));
+
+    strncpy(child->name, (name != NULL) ? name : "child", SUPERVISOR_NAME_SIZE - 1);
+    child->policy = (policy != NULL) ? *policy : default_policy;
+    child->entry = entry;
+    child->arg = arg;
+    child->pidfd = -1;
+    child->backoff_ms = child->policy.min_backoff_ms;
+
+    if (_fork_child(id) < 0) { return SUPERVISOR_NOT_OK; }
+
+    child->used = true;
+
+    return id;
+}
+
+/* Stop a child
+ *
+ * A child that doesn't exit on SIGTERM blocks the caller, same as waitpid().
+ */
+int supervisor_stop( int id ) {
+    child_t *child;
+
+    if ((child = _get_child(id)) == NULL) { return SUPERVISOR_NOT_OK; }
+
+    child->stopping = true;
+    child->restart_pending = false;
+
+    if (child->stats.pid > 0) {
+        (void)kill(child->stats.pid, SIGTERM);
+        (void)_reap(id, true);
+    }
+
+    child->used = false;
+
+    return SUPERVISOR_OK;
+}
+
+/* Restarts children whose backoff has passed */
+void supervisor_tick( void ) {
+    msec_t now = get_monotonic_ms();
+    child_t *child;
+
+    for (int id=0; id<SUPERVISOR_MAX_CHILDREN; id++) {
+        child = &children[id];
+
+        if (!child->used || !child->restart_pending || (now < child->restart_ms)) { continue; }
+
+        child->restart_pending = false;
+        child->stats.restarts++;
+
+        if (_fork_child(id) < 0) {
+            /* Tried again after the next backoff */
+            child->restart_pending = true;
+            child->restart_ms = now + child->backoff_ms;
+        }
+    }
+}
+
+int get_supervisor_stats( int id, supervisor_stats_t *stats ) {
+    child_t *child;
+
+    if ((stats == NULL) || ((child = _get_child(id)) == NULL)) { return SUPERVISOR_NOT_OK; }
+
+    *stats = child->stats;
+
+    return SUPERVISOR_OK;
+}
+
+/* Fork a child
+ *
+ * PR_SET_PDEATHSIG is tied to the thread that forked, the event loop's. The parent may have died
+ * before prctl(), then the child is already orphaned and exits right away.
+ */
+static int _fork_child( int id ) {
+    child_t *child = &children[id];
+    pid_t parent = getpid();
+    sigset_t mask;
+    pid_t pid;
+
+    fflush(stdout);
+
+    if ((pid = fork()) < 0) {
+        log_error("Failed to fork %s", child->name);
+        return SUPERVISOR_NOT_OK;
+    }
+
+    if (pid == 0) {
+        (void)prctl(PR_SET_PDEATHSIG, (child->policy.death_signal > 0) ? child->policy.death_signal : SIGTERM);
+        if (getppid() != parent) { _exit(EXIT_FAILURE); }
+
+        /* Only closed, the epoll instance is shared with the parent */
+        (void)close(sigchld_fd);
+        for (int i=0; i<SUPERVISOR_MAX_CHILDREN; i++) {
+            if (children[i].pidfd >= 0) { (void)close(children[i].pidfd); }
+        }
+
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        (void)sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+        child->entry(child->arg);
+        exit(EXIT_SUCCESS);
+    }
+
+    child->stats.pid = pid;
+    child->stats.started_ms = get_monotonic_ms();
+
+    /* Without pidfd, SIGCHLD on the signalfd finds the exit */
+#ifdef SYS_pidfd_open
+    child->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    child->pidfd = -1;
+#endif
+
+    if ((child->pidfd >= 0) && (event_loop_watch_fd(child->pidfd, EPOLLIN, _pidfd_handler, (void *)(intptr_t)id) < 0)) {
+        (void)close(child->pidfd);
+        child->pidfd = -1;
+    }
+
+    return SUPERVISOR_OK;
+}
+
+/* Child exited
+ *
+ * A child that exits quickly is restarted after a backoff that doubles each time, so a child that
+ * fails on start doesn't fork in a loop.
+ */
+static void _child_exited( int id, int status, const struct rusage *usage ) {
+    child_t *child = &children[id];
+    msec_t now = get_monotonic_ms();
+    msec_t uptime = now - child->stats.started_ms;
+    bool failed = !WIFEXITED(status) || (WEXITSTATUS(status) != 0);
+    char restarting[SUPERVISOR_MSG_SIZE] = "";
+    char how[SUPERVISOR_MSG_SIZE];
+    bool restart;
+
+    if (child->pidfd >= 0) {
+        (void)event_loop_unwatch_fd(child->pidfd);
+        (void)close(child->pidfd);
+        child->pidfd = -1;
+    }
+
+    child->stats.pid = 0;
+    child->stats.status = status;
+    child->stats.user_us += ((uint64_t)usage->ru_utime.tv_sec * 1000000) + (uint64_t)usage->ru_utime.tv_usec;
+    child->stats.system_us += ((uint64_t)usage->ru_stime.tv_sec * 1000000) + (uint64_t)usage->ru_stime.tv_usec;
+    if (usage->ru_maxrss > child->stats.max_rss_kb) { child->stats.max_rss_kb = usage->ru_maxrss; }
+
+    if (child->stopping) { return; }
+
+    restart = (child->policy.restart == SUPERVISOR_RESTART_ALWAYS) ||
+              ((child->policy.restart == SUPERVISOR_RESTART_ON_FAILURE) && failed);
+
+    if (uptime >= SUPERVISOR_STABLE_MS) {
+        child->backoff_ms = 0;
+    }
+
+    if (WIFSIGNALED(status)) {
+        snprintf(how, sizeof(how), "killed by signal %d", WTERMSIG(status));
+    } else {
+        snprintf(how, sizeof(how), "exited with status %d", WEXITSTATUS(status));
+    }
+
+    if (restart) {
+        snprintf(restarting, sizeof(restarting), ", restarting in %ld ms", (long)child->backoff_ms);
+    }
+
+    if (failed) {
+        log_warn("%s %s after %ld ms, cpu %lu ms, max rss %ld KB%s", child->name, how, (long)uptime,
+            (unsigned long)((child->stats.user_us + child->stats.system_us) / 1000), child->stats.max_rss_kb, restarting);
+    } else {
+        log_info("%s %s after %ld ms, cpu %lu ms, max rss %ld KB%s", child->name, how, (long)uptime,
+            (unsigned long)((child->stats.user_us + child->stats.system_us) / 1000), child->stats.max_rss_kb, restarting);
+    }
+
+    if (!restart) {
+        child->used = false;
+        return;
+    }
+
+    child->restart_pending = true;
+    child->restart_ms = now + child->backoff_ms;
+
+    /* The delay for the next quick exit */
+    child->backoff_ms = (child->backoff_ms == 0) ? child->policy.min_backoff_ms : (child->backoff_ms * 2);
+    if (child->backoff_ms > child->policy.max_backoff_ms) { child->backoff_ms = child->policy.max_backoff_ms; }
+
+    if (child->restart_ms <= now) { supervisor_tick(); }
+}
+
+/* Reaps the child if it exited, returns true if it did */
+static bool _reap( int id, bool block ) {
+    child_t *child = &children[id];
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    if (child->stats.pid <= 0) { return false; }
+
+    do {
+        pid = wait4(child->stats.pid, &status, block ? 0 : WNOHANG, &usage);
+    } while ((pid < 0) && (errno == EINTR));
+
+    if (pid != child->stats.pid) { return false; }
+
+    _child_exited(id, status, &usage);
+
+    return true;
+}
+
+static void _pidfd_handler( int __attribute__((unused)) fd, uint32_t __attribute__((unused)) events, void *ctx ) {
+    (void)_reap((int)(intptr_t)ctx, false);
+}
+
+/* SIGCHLD is coalesced, every child without a pidfd is checked */
+static void _sigchld_handler( int fd, uint32_t __attribute__((unused)) events, void __attribute__((unused)) *ctx ) {
+    struct signalfd_siginfo info;
+
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {}
+
+    for (int id=0; id<SUPERVISOR_MAX_CHILDREN; id++) {
+        if (children[id].used && (children[id].pidfd < 0)) { (void)_reap(id, false); }
+    }
+}
+
+static child_t *_get_child( int id ) {
+    if ((id < 0) || (id >= SUPERVISOR_MAX_CHILDREN) || !children[id].used) { return NULL; }
+
+    return &children[id];
+}
@@ -54,6 +54,18 @@ msec_t stop_timer( void ) {
     return 0;
 }
 
+msec_t get_monotonic_ms( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((msec_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+usec_t get_monotonic_us( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((usec_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
 void delay_ms(msec_t sleep_time) {
     struct timespec ts;
     ts.tv_sec = sleep_time / 1000;
@@ -1,5 +1,39 @@
+#define _GNU_SOURCE
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
 #include "threads_config.h"
 
+#define QUEUE_CACHE_LINE 64
+
+/* Polls of an empty queue before a receiver sleeps, a message due any moment costs no system call */
+#define QUEUE_SPIN_COUNT 256
+
+/* Slot of a queue, followed by msg_size bytes and padded to a whole number of cache lines */
+typedef struct {
+    uint64_t seq;
+    uint32_t len;
+    uint32_t reserved;
+} queue_slot_t;
+
+/* Queue
+ *
+ * Head and tail each have a cache line to themselves, so consumers and producers don't invalidate
+ * each other's. wake is the futex word, bumped by a sender that finds a receiver asleep.
+ */
+typedef struct {
+    uint64_t tail __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint64_t head __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint32_t wake __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint32_t sleepers;
+
+    uint64_t mask __attribute__((aligned(QUEUE_CACHE_LINE)));
+    size_t msg_size;
+    size_t slot_size;
+    char *slots;
+} queue_t;
+
 /* Number of allocated pipes */
 static int num_allocated_pipes;
 
@@ -12,6 +46,16 @@ static node_t *head;
 /* Locking mechanism to prevent potential forks applications from getting out of sync */
 static bool pipes_locked;
 
+/* Queues by id */
+static queue_t *queues[MAX_NUM_OF_QUEUES];
+
+/* Static Functions */
+static node_t *_find_pipe( pipe_id_t id );
+static queue_slot_t *_queue_slot( queue_t *queue, uint64_t pos );
+static int _try_recv_queue( queue_t *queue, void *buffer, size_t len );
+static void _futex_wait( uint32_t *word, uint32_t val, int timeout_ms );
+static void _futex_wake( uint32_t *word );
+
 /* Allocate a pipe and return id
  * 
  * Creates a pipe in the stored linked-list. The linked-list is ordered, and must be
@@ -43,7 +87,7 @@ pipe_id_t create_pipe( void ) {
                  * the one directional linked-list. When a dead pipe is encounted, that already allocated 
                  * node will be utilized.
                  */
-                if (!cur->pipfd) {
+                if (cur->pipfd[READ_END_OF_PIPE] < 0) {
                     if (pipe(cur->pipfd) == -1) {
                         /* Inform app that a pipe wasn't created */
                         id = THREAD_NOT_OK;
@@ -60,7 +104,7 @@ pipe_id_t create_pipe( void ) {
 
             } else {
                 /* Found open pipefd at the end of the list. Free node */
-                cur = malloc(sizeof(node_t));
+                cur = calloc(1, sizeof(node_t));
 
                 prv->nxt = cur;
 
@@ -80,7 +124,7 @@ pipe_id_t create_pipe( void ) {
 
     } else {
         /* Linked-list is empty */
-        head = malloc(sizeof(node_t));
+        head = calloc(1, sizeof(node_t));
 
         /* Create pipe
          *
@@ -159,6 +203,9 @@ int free_pipe ( pipe_id_t id ) {
     if (nxt) {
         close(cur->pipfd[READ_END_OF_PIPE]);
         close(cur->pipfd[WRITE_END_OF_PIPE]);
+        cur->pipfd[READ_END_OF_PIPE] = -1;
+        cur->pipfd[WRITE_END_OF_PIPE] = -1;
+        cur->checksum = false;
         num_dead_pipes++;
 
     } else {
@@ -281,6 +328,105 @@ int read_pipe ( pipe_id_t id, void *buffer, size_t len ) {
     return num_bytes;
 }
 
+int set_pipe_checksum ( pipe_id_t id, bool enable ) {
+    node_t *cur;
+
+    if ((cur = _find_pipe(id)) == NULL) { return THREAD_NOT_OK; }
+
+    cur->checksum = enable;
+
+    return THREAD_OK;
+}
+
+int get_pipe_read_fd ( pipe_id_t id ) {
+    node_t *cur;
+
+    if ((cur = _find_pipe(id)) == NULL) { return THREAD_NOT_OK; }
+
+    return cur->pipfd[READ_END_OF_PIPE];
+}
+
+int write_pipe_record ( pipe_id_t id, const void *buffer, size_t len ) {
+    char record[PIPE_BUF];
+    pipe_record_hdr_t hdr;
+    node_t *cur;
+    ssize_t num_bytes;
+
+    if ((buffer == NULL) && (len > 0)) { return THREAD_NOT_OK; }
+    if (len > MAX_PIPE_RECORD_SIZE) { return THREAD_NOT_OK; }
+    if ((cur = _find_pipe(id)) == NULL) { return THREAD_NOT_OK; }
+
+    hdr.len = (uint16_t)len;
+    hdr.flags = cur->checksum ? PIPE_RECORD_CRC : 0;
+    hdr.crc = 0;
+
+    if (cur->checksum) {
+        hdr.crc = crc32c(crc32c(0, &hdr, sizeof(hdr)), buffer, len);
+    }
+
+    memcpy(record, &hdr, sizeof(hdr));
+    if (len > 0) { memcpy(record + sizeof(hdr), buffer, len); }
+
+    fcntl(cur->pipfd[WRITE_END_OF_PIPE], F_SETFL, O_NONBLOCK);
+
+    if ((num_bytes = write(cur->pipfd[WRITE_END_OF_PIPE], record, sizeof(hdr) + len)) < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) { return 0; }
+        return THREAD_NOT_OK;
+    }
+
+    return (int)len;
+}
+
+/* Read record (non-blocking)
+ *
+ * Records are written whole, so a header that's there means its payload is too. A record that
+ * fails its check is consumed, the next read returns the record after it.
+ */
+int read_pipe_record ( pipe_id_t id, void *buffer, size_t len ) {
+    char payload[MAX_PIPE_RECORD_SIZE];
+    pipe_record_hdr_t hdr;
+    node_t *cur;
+    ssize_t num_bytes;
+    uint32_t crc;
+
+    if ((buffer == NULL) && (len > 0)) { return THREAD_NOT_OK; }
+    if ((cur = _find_pipe(id)) == NULL) { return THREAD_NOT_OK; }
+
+    fcntl(cur->pipfd[READ_END_OF_PIPE], F_SETFL, O_NONBLOCK);
+
+    if ((num_bytes = read(cur->pipfd[READ_END_OF_PIPE], &hdr, sizeof(hdr))) < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) { return 0; }
+        return THREAD_NOT_OK;
+    }
+
+    if (num_bytes == 0) { return 0; }
+
+    /* Half a header, or a length no writer could have sent, means the pipe is out of step */
+    if (((size_t)num_bytes != sizeof(hdr)) || (hdr.len > MAX_PIPE_RECORD_SIZE)) {
+        return THREAD_CORRUPT_RECORD;
+    }
+
+    if (hdr.len > 0) {
+        if ((num_bytes = read(cur->pipfd[READ_END_OF_PIPE], payload, hdr.len)) != (ssize_t)hdr.len) {
+            return THREAD_CORRUPT_RECORD;
+        }
+    }
+
+    if (hdr.flags & PIPE_RECORD_CRC) {
+        crc = hdr.crc;
+        hdr.crc = 0;
+
+        if (crc32c(crc32c(0, &hdr, sizeof(hdr)), payload, hdr.len) != crc) {
+            return THREAD_CORRUPT_RECORD;
+        }
+    }
+
+    if (len > hdr.len) { len = hdr.len; }
+    if (len > 0) { memcpy(buffer, payload, len); }
+
+    return (int)len;
+}
+
 /* Lock protection of linked-list
  *
  * If the APIs are used with features such as fork(), then the child and parent process will
@@ -298,4 +444,218 @@ int unlock_pipes ( void ) {
     return THREAD_OK;
 }
 
+queue_id_t create_queue ( size_t capacity, size_t msg_size ) {
+    queue_t *queue;
+    size_t size = 2;
+    queue_id_t id;
+
+    if ((capacity == 0) || (capacity > (1U << 30)) || (msg_size == 0) || (msg_size > MAX_QUEUE_MSG_SIZE)) {
+        return THREAD_NOT_OK;
+    }
+
+    for (id=0; id < MAX_NUM_OF_QUEUES; id++) {
+        if (queues[id] == NULL) { break; }
+    }
 
+    if (id == MAX_NUM_OF_QUEUES) { return THREAD_NOT_OK; }
+
+    while (size < capacity) { size <<= 1; }
+
+    if ((queue = aligned_alloc(QUEUE_CACHE_LINE, sizeof(queue_t))) == NULL) { return THREAD_NOT_OK; }
+
+    memset(queue, 0, sizeof(queue_t));
+    queue->mask = size - 1;
+    queue->msg_size = msg_size;
+    queue->slot_size = (sizeof(queue_slot_t) + msg_size + QUEUE_CACHE_LINE - 1) & ~((size_t)QUEUE_CACHE_LINE - 1);
+
+    if ((queue->slots = aligned_alloc(QUEUE_CACHE_LINE, size * queue->slot_size)) == NULL) {
+        free(queue);
+        return THREAD_NOT_OK;
+    }
+
+    /* Slot i is free for the producer at position i */
+    for (uint64_t pos=0; pos < size; pos++) {
+        _queue_slot(queue, pos)->seq = pos;
+    }
+
+    queues[id] = queue;
+
+    return id;
+}
+
+int free_queue ( queue_id_t id ) {
+    if ((id < 0) || (id >= MAX_NUM_OF_QUEUES) || (queues[id] == NULL)) { return THREAD_NOT_OK; }
+
+    free(queues[id]->slots);
+    free(queues[id]);
+    queues[id] = NULL;
+
+    return THREAD_OK;
+}
+
+/* Send to queue (non-blocking)
+ *
+ * A slot whose seq equals the tail position is free. The producer that moves the tail past it owns
+ * it, fills it, and hands it to consumers by setting seq one past the position.
+ */
+int send_queue ( queue_id_t id, const void *buffer, size_t len ) {
+    queue_t *queue;
+    queue_slot_t *slot;
+    uint64_t pos;
+    int64_t diff;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_QUEUES) || ((queue = queues[id]) == NULL)) { return THREAD_NOT_OK; }
+    if ((buffer == NULL) || (len == 0) || (len > queue->msg_size)) { return THREAD_NOT_OK; }
+
+    pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = _queue_slot(queue, pos);
+        diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* The slot still holds the message of the previous lap */
+            return 0;
+        } else {
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->len = (uint32_t)len;
+    memcpy(slot + 1, buffer, len);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* Pairs with the fence in recv_queue(), either the receiver sees the message or we see it asleep */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&queue->sleepers, __ATOMIC_RELAXED) > 0) {
+        __atomic_add_fetch(&queue->wake, 1, __ATOMIC_RELEASE);
+        _futex_wake(&queue->wake);
+    }
+
+    return (int)len;
+}
+
+/* Receive from queue
+ *
+ * A receiver announces itself in sleepers before it looks at the queue a last time, then sleeps
+ * unless wake changed since, so a message sent in between is never missed.
+ */
+int recv_queue ( queue_id_t id, void *buffer, size_t len, int timeout_ms ) {
+    struct timespec now;
+    queue_t *queue;
+    int64_t deadline_ms = 0;
+    int64_t left_ms = -1;
+    uint32_t wake;
+    int rc;
+
+    if ((id < 0) || (id >= MAX_NUM_OF_QUEUES) || ((queue = queues[id]) == NULL)) { return THREAD_NOT_OK; }
+    if ((buffer == NULL) || (len == 0)) { return THREAD_NOT_OK; }
+
+    if ((rc = _try_recv_queue(queue, buffer, len)) >= 0) { return rc; }
+    if (timeout_ms == 0) { return 0; }
+
+    for (int spin=0; spin < QUEUE_SPIN_COUNT; spin++) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        if ((rc = _try_recv_queue(queue, buffer, len)) >= 0) { return rc; }
+    }
+
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        deadline_ms = ((int64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000) + timeout_ms;
+    }
+
+    for (;;) {
+        if (timeout_ms > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left_ms = deadline_ms - (((int64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000));
+            if (left_ms <= 0) { return 0; }
+        }
+
+        wake = __atomic_load_n(&queue->wake, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&queue->sleepers, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if ((rc = _try_recv_queue(queue, buffer, len)) < 0) {
+            _futex_wait(&queue->wake, wake, (int)left_ms);
+        }
+
+        __atomic_sub_fetch(&queue->sleepers, 1, __ATOMIC_RELAXED);
+
+        if (rc < 0) { rc = _try_recv_queue(queue, buffer, len); }
+        if (rc >= 0) { return rc; }
+    }
+}
+
+static node_t *_find_pipe( pipe_id_t id ) {
+    node_t *cur = head;
+
+    if ((id < 0) || (id >= num_allocated_pipes)) { return NULL; }
+
+    for (pipe_id_t cur_id=0; (cur != NULL) && (cur_id < id); cur_id++) {
+        cur = cur->nxt;
+    }
+
+    return cur;
+}
+
+static queue_slot_t *_queue_slot( queue_t *queue, uint64_t pos ) {
+    return (queue_slot_t *)(queue->slots + ((pos & queue->mask) * queue->slot_size));
+}
+
+/* Takes a message if one is waiting, returns its length, truncated to len, or -1 if the queue is empty.
+ * A slot whose seq is one past the head position is full, the consumer that moves the head past it
+ * copies it out and frees it for the producers of the next lap.
+ */
+static int _try_recv_queue( queue_t *queue, void *buffer, size_t len ) {
+    queue_slot_t *slot;
+    uint64_t pos;
+    int64_t diff;
+
+    pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = _queue_slot(queue, pos);
+        diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (len > slot->len) { len = slot->len; }
+    memcpy(buffer, slot + 1, len);
+    __atomic_store_n(&slot->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+
+    return (int)len;
+}
+
+/* Sleeps while *word is val, a timeout of -1 sleeps until woken. Private, the queue isn't shared
+ * between processes.
+ */
+static void _futex_wait( uint32_t *word, uint32_t val, int timeout_ms ) {
+    struct timespec timeout;
+
+    if (timeout_ms >= 0) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+    }
+
+    (void)syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, (timeout_ms >= 0) ? &timeout : NULL, NULL, 0);
+}
+
+static void _futex_wake( uint32_t *word ) {
+    (void)syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
@@ -0,0 +1,185 @@
+#include "trace.h"
+
+#define TRACE_PATH_SIZE 256
+
+static const char *stage_names[E_TRACE_NUM_STAGES] = { "client", "network", "handler", "pipe" };
+
+static bool enabled;
+static int sample_every = TRACE_DEFAULT_SAMPLE;
+static uint64_t num_begun;
+
+static trace_histogram_t histograms[E_TRACE_NUM_STAGES];
+
+/* Histograms at the previous report, and the longest latency since */
+static trace_histogram_t reported[E_TRACE_NUM_STAGES];
+static uint64_t report_max_us[E_TRACE_NUM_STAGES];
+
+/* Ring of sampled traces, num_samples counts every one kept so far */
+static trace_record_t samples[TRACE_MAX_SAMPLES];
+static uint64_t num_samples;
+static uint64_t dumped_samples;
+
+/* Static Functions */
+static int _bin( uint64_t latency_us );
+static uint64_t _percentile( const uint64_t *bins, uint64_t count, int percent );
+
+int trace_init( bool enable, int sample ) {
+    if (sample <= 0) { return TRACE_NOT_OK; }
+
+    enabled = enable;
+    sample_every = sample;
+
+    return TRACE_OK;
+}
+
+int trace_begin( const void *buffer, size_t len, trace_record_t *record ) {
+    codec_trace_t ctx;
+    int consumed;
+
+    if ((buffer == NULL) || (record == NULL)) { return TRACE_NOT_OK; }
+
+    record->flags = 0;
+
+    if (codec_peek(buffer, len) != CODEC_MSG_TRACE) { return 0; }
+    if ((consumed = codec_decode_trace(buffer, len, &ctx)) < 0) { return TRACE_NOT_OK; }
+    if (!enabled) { return consumed; }
+
+    memset(record, 0, sizeof(*record));
+    record->id = ctx.id;
+    record->flags = TRACE_FLAG_ACTIVE;
+    record->stamps[E_TRACE_QUEUED] = ctx.queued_us;
+    record->stamps[E_TRACE_SENT] = ctx.sent_us;
+    record->stamps[E_TRACE_RECEIVED] = (uint64_t)get_monotonic_us();
+
+    if ((num_begun++ % (uint64_t)sample_every) == 0) { record->flags |= TRACE_FLAG_SAMPLED; }
+
+    return consumed;
+}
+
+void trace_stamp( trace_record_t *record, E_TRACE_POINT point ) {
+    if ((record == NULL) || !(record->flags & TRACE_FLAG_ACTIVE) || (point >= E_TRACE_NUM_POINTS)) { return; }
+
+    record->stamps[point] = (uint64_t)get_monotonic_us();
+}
+
+/* A stage whose stamps are missing or out of order, e.g. of a client on another machine, is skipped */
+int trace_add( const trace_record_t *record ) {
+    trace_histogram_t *histogram;
+    uint64_t latency_us;
+
+    if ((record == NULL) || !(record->flags & TRACE_FLAG_ACTIVE)) { return TRACE_NOT_OK; }
+
+    for (int s=0; s<E_TRACE_NUM_STAGES; s++) {
+        if ((record->stamps[s] == 0) || (record->stamps[s + 1] < record->stamps[s])) { continue; }
+
+        latency_us = record->stamps[s + 1] - record->stamps[s];
+        histogram = &histograms[s];
+
+        histogram->count++;
+        histogram->bins[_bin(latency_us)]++;
+        if (latency_us > histogram->max_us) { histogram->max_us = latency_us; }
+        if (latency_us > report_max_us[s]) { report_max_us[s] = latency_us; }
+    }
+
+    if (record->flags & TRACE_FLAG_SAMPLED) {
+        samples[num_samples % TRACE_MAX_SAMPLES] = *record;
+        num_samples++;
+    }
+
+    return TRACE_OK;
+}
+
+void trace_report( void ) {
+    uint64_t bins[TRACE_HISTOGRAM_BINS];
+    uint64_t count;
+
+    for (int s=0; s<E_TRACE_NUM_STAGES; s++) {
+        if ((count = histograms[s].count - reported[s].count) == 0) { continue; }
+
+        for (int i=0; i<TRACE_HISTOGRAM_BINS; i++) {
+            bins[i] = histograms[s].bins[i] - reported[s].bins[i];
+        }
+
+        printf("Trace %s: %lu messages, p50 < %lu us, p99 < %lu us, max %lu us\n", stage_names[s],
+            (unsigned long)count, (unsigned long)_percentile(bins, count, 50),
+            (unsigned long)_percentile(bins, count, 99), (unsigned long)report_max_us[s]);
+
+        reported[s] = histograms[s];
+        report_max_us[s] = 0;
+    }
+}
+
+/* Written next to path and renamed over it, so a viewer never loads half a file */
+int trace_dump( const char *path ) {
+    char tmp_path[TRACE_PATH_SIZE];
+    const trace_record_t *record;
+    uint64_t first;
+    FILE *fp;
+
+    if (path == NULL) { return TRACE_NOT_OK; }
+    if (num_samples == dumped_samples) { return TRACE_OK; }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    if ((fp = fopen(tmp_path, "w")) == NULL) {
+        printf("Failed to open trace: %s\n", tmp_path);
+        return TRACE_NOT_OK;
+    }
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"messages\"}}");
+
+    first = (num_samples > TRACE_MAX_SAMPLES) ? (num_samples - TRACE_MAX_SAMPLES) : 0;
+
+    for (uint64_t n=first; n<num_samples; n++) {
+        record = &samples[n % TRACE_MAX_SAMPLES];
+
+        for (int s=0; s<E_TRACE_NUM_STAGES; s++) {
+            if ((record->stamps[s] == 0) || (record->stamps[s + 1] < record->stamps[s])) { continue; }
+
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"trace\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%lu,\"dur\":%lu}",
+                stage_names[s], (unsigned long)record->id, (unsigned long)record->stamps[s],
+                (unsigned long)(record->stamps[s + 1] - record->stamps[s]));
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+
+    if ((fclose(fp) != 0) || (rename(tmp_path, path) != 0)) {
+        printf("Failed to write trace: %s\n", path);
+        (void)remove(tmp_path);
+        return TRACE_NOT_OK;
+    }
+
+    dumped_samples = num_samples;
+
+    return TRACE_OK;
+}
+
+int get_trace_histogram( E_TRACE_STAGE stage, trace_histogram_t *histogram ) {
+    if ((histogram == NULL) || (stage >= E_TRACE_NUM_STAGES)) { return TRACE_NOT_OK; }
+
+    *histogram = histograms[stage];
+
+    return TRACE_OK;
+}
+
+static int _bin( uint64_t latency_us ) {
+    int bin = (latency_us == 0) ? 0 : (64 - __builtin_clzll(latency_us));
+
+    return (bin < TRACE_HISTOGRAM_BINS) ? bin : (TRACE_HISTOGRAM_BINS - 1);
+}
+
+/* Upper bound of the bin the percentile falls in */
+static uint64_t _percentile( const uint64_t *bins, uint64_t count, int percent ) {
+    uint64_t rank = ((count * (uint64_t)percent) + 99) / 100;
+    uint64_t seen = 0;
+
+    for (int i=0; i<TRACE_HISTOGRAM_BINS; i++) {
+        seen += bins[i];
+
+        if (seen >= rank) { return 1ULL << i; }
+    }
+
+    return 1ULL << (TRACE_HISTOGRAM_BINS - 1);
+}
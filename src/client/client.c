@@ -10,114 +10,255 @@
 
 #include "server.h"
 #include "sock_config.h"
+#include "codec.h"
+#include "event_loop.h"
+#include "logger.h"
+#include "rpc.h"
+#include "pool.h"
+#include "scheduler.h"
 #include "support.h"
 #include "threads_config.h"
 
-static sock_id_t id;
+static pool_id_t pool;
 
-const char my_sock[] = "/tmp/my_socket";
+/* Deadline of every request to the server */
+#define CLIENT_REQUEST_TIMEOUT_MS 250
+
+/* Connections to each server endpoint */
+#define CLIENT_CONNS_PER_ENDPOINT 2
+
+/* Share of the CPU background tasks get while network and application tasks have work */
+#define CLIENT_BACKGROUND_BUDGET 10
+
+/* Telemetry samples waiting for server_service() */
+#define CLIENT_MAX_SAMPLES 8
+#define CLIENT_SOURCE_SIZE 32
+
+/* One in this many HELLOs carries a trace context, samples always do */
+#define CLIENT_TRACE_EVERY 64
+
+/* HELLOs awaiting a reply, more only queue up behind them and time out */
+#define CLIENT_MAX_IN_FLIGHT 64
+
+typedef struct {
+    const char *metric;
+    int64_t value;
+    usec_t queued_us;
+} client_sample_t;
+
+static client_sample_t samples[CLIENT_MAX_SAMPLES];
+static int num_samples;
+static char client_source[CLIENT_SOURCE_SIZE];
+static uint64_t trace_id;
+
+static unsigned long num_replies;
+static unsigned long num_failed;
+static uint32_t hello_seq;
+static int hellos_in_flight;
+static msec_t total_rtt_ms;
+
+static volatile sig_atomic_t shutdown_requested;
+
+const char rpc_sock[] = "/tmp/rpc_socket";
 
 void int_handler(int __attribute__((unused)) sigType) {
-    fprintf(stderr, "Closing client\n");
-    close_sock(id);
-    exit(EXIT_FAILURE);
+    shutdown_requested = 1;
 }
 
 /* Application Client Tasks */
-void __attribute__((weak)) appClientTask10Ms( void ) {
+bool __attribute__((weak)) appClientTask10Ms( void ) {
     //printf("running app task\n");
+    return false;
+}
+
+static void server_reply( E_RPC_STATUS status, uint32_t __attribute__((unused)) req_id, const void *buffer,
+                          size_t len, void __attribute__((unused)) *ctx ) {
+    codec_hello_ack_t ack;
+
+    hellos_in_flight--;
+
+    if ((status == RPC_STATUS_OK) && (codec_decode_hello_ack(buffer, len, &ack) > 0)) {
+        num_replies++;
+        total_rtt_ms += get_monotonic_ms() - (msec_t)ack.sent_ms;
+    } else {
+        num_failed++;
+    }
+}
+
+/* Samples only need to arrive, the server answers them with nothing */
+static void sample_reply( E_RPC_STATUS status, uint32_t __attribute__((unused)) req_id, const void __attribute__((unused)) *buffer,
+                          size_t __attribute__((unused)) len, void __attribute__((unused)) *ctx ) {
+    if (status != RPC_STATUS_OK) { num_failed++; }
+}
+
+/* Queues a sample for the next server_service(), the oldest is dropped when the queue is full */
+static void push_sample( const char *metric, int64_t value ) {
+    if (num_samples == CLIENT_MAX_SAMPLES) {
+        memmove(&samples[0], &samples[1], (CLIENT_MAX_SAMPLES - 1) * sizeof(client_sample_t));
+        num_samples--;
+    }
+
+    samples[num_samples].metric = metric;
+    samples[num_samples].value = value;
+    samples[num_samples].queued_us = get_monotonic_us();
+    num_samples++;
+}
+
+/* Writes a trace context to buffer, ids are unique per client */
+static int encode_trace( usec_t queued_us, uint8_t *buffer, size_t len ) {
+    codec_trace_t trace;
+
+    trace.id = ((uint64_t)getpid() << 32) | (trace_id++ & 0xffffffffULL);
+    trace.queued_us = (uint64_t)queued_us;
+    trace.sent_us = (uint64_t)get_monotonic_us();
+
+    return codec_encode_trace(&trace, buffer, len);
 }
 
 static int server_service( void ) {
 
     char message[8] = "marsh";
-    int rc;
+    uint8_t hello_buf[CODEC_TRACE_MAX_SIZE + CODEC_HELLO_MAX_SIZE];
+    uint8_t sample_buf[CODEC_TRACE_MAX_SIZE + CODEC_SAMPLE_MAX_SIZE];
+    codec_hello_t hello;
+    codec_sample_t sample;
+    int sent = 0;
+    int trace_len;
+    int len;
 
-    // if ((rc = await_local_send(&id, message, 8)) < 0) {
-    //     printf("Failed to send data to server\n");
-    //     return -1;
-    // }
+    /* Samples go first, before the pipelines fill up with HELLOs */
+    sample.source.data = (const uint8_t *)client_source;
+    sample.source.len = (uint32_t)strlen(client_source);
 
-    if ((rc = await_network_send(&id, message, 8)) < 0) {
-        printf("Failed to send data to server\n");
-        return -1;
-    }         
+    while (sent < num_samples) {
+        sample.metric.data = (const uint8_t *)samples[sent].metric;
+        sample.metric.len = (uint32_t)strlen(samples[sent].metric);
+        sample.value = samples[sent].value;
+
+        /* Traced from the stats task that queued it, the client stage is the wait for this one */
+        if ((trace_len = encode_trace(samples[sent].queued_us, sample_buf, sizeof(sample_buf))) < 0) { return -1; }
+        if ((len = codec_encode_sample(&sample, sample_buf + trace_len, sizeof(sample_buf) - (size_t)trace_len)) < 0) { return -1; }
+        len += trace_len;
+
+        if (pool_call(pool, sample_buf, (size_t)len, CLIENT_REQUEST_TIMEOUT_MS, sample_reply, NULL) != SOCK_OK) { break; }
+
+        sent++;
+    }
+
+    num_samples -= sent;
+    memmove(&samples[0], &samples[sent], (size_t)num_samples * sizeof(client_sample_t));
+
+    hello.name.data = (const uint8_t *)message;
+    hello.name.len = (uint32_t)strlen(message);
+
+    /* Keep a window of HELLOs in flight across the pool, replies complete through server_reply() */
+    while (hellos_in_flight < CLIENT_MAX_IN_FLIGHT) {
+        hello.seq = hello_seq;
+        hello.sent_ms = (uint64_t)get_monotonic_ms();
+
+        trace_len = 0;
+
+        if (((hello_seq % CLIENT_TRACE_EVERY) == 0) &&
+                ((trace_len = encode_trace(get_monotonic_us(), hello_buf, sizeof(hello_buf))) < 0)) {
+            return -1;
+        }
+
+        if ((len = codec_encode_hello(&hello, hello_buf + trace_len, sizeof(hello_buf) - (size_t)trace_len)) < 0) { return -1; }
+        len += trace_len;
+
+        if (pool_call(pool, hello_buf, (size_t)len, CLIENT_REQUEST_TIMEOUT_MS, server_reply, NULL) != SOCK_OK) { break; }
+
+        hellos_in_flight++;
+        hello_seq++;
+    }
 
     return 0;
 }
 
+/* Scheduler Tasks */
+static E_SCHEDULER_TASK network_task( void __attribute__((unused)) *arg ) {
+    /* Completes replies and expired requests */
+    (void)event_loop_run_once(0);
+    rpc_tick_all();
+    pool_tick_all();
+    (void)server_service();
+
+    return SCHEDULER_TASK_DONE;
+}
+
+/* The hook isn't preempted, it yields by returning true, see appClientTask10Ms() */
+static E_SCHEDULER_TASK app_task( void __attribute__((unused)) *arg ) {
+    return appClientTask10Ms() ? SCHEDULER_TASK_YIELD : SCHEDULER_TASK_DONE;
+}
+
+static E_SCHEDULER_TASK stats_task( void __attribute__((unused)) *arg ) {
+    pool_stats_t stats;
+
+    (void)get_pool_stats(pool, &stats);
+
+    push_sample("replies", (int64_t)num_replies);
+    push_sample("failed", (int64_t)num_failed);
+    if (num_replies > 0) { push_sample("rtt_ms", (int64_t)(total_rtt_ms / (msec_t)num_replies)); }
+
+    log_info("Replies: %lu, failed: %lu, avg rtt: %ld ms, in flight: %u, connected: %u, healthy endpoints: %u",
+           num_replies, num_failed, num_replies ? (long)(total_rtt_ms / (msec_t)num_replies) : 0L,
+           stats.in_flight, stats.connected, stats.healthy_endpoints);
+    total_rtt_ms = 0;
+    num_replies = 0;
+    num_failed = 0;
+
+    return SCHEDULER_TASK_DONE;
+}
+
 int main( int argc, char *agv[] ) {
 
     signal(SIGINT, int_handler);
 
-    // if ((id = initialize_sock(E_LOCAL_SOCK, my_sock, 0, CLIENT_SIDE)) < 0) {
-    //     printf("Failed to get a socket.\n");
-    //     return -1;
-    // }    
-
-    // if ((id = initialize_sock(E_TCP_SOCK, "0.0.0.0", 9003, CLIENT_SIDE)) < 0) {
-    //    printf("Failed to get a socket.\n");
-    //    return -1;
-    // }      
-    
-    // if ((id = initialize_sock(E_TCP_SOCK, "54.80.21.43", 9003, CLIENT_SIDE)) < 0) {
-    //     printf("Failed to get a socket.\n");
-    //     return -1;
-    // }      
-
-    // if ((id = initialize_sock(E_TCP_SOCK, "::", 9003, CLIENT_SIDE)) < 0) {
-    //     printf("Failed to get a socket.\n");
-    //     return -1;
-    // }   
-
-    if ((id = initialize_sock(E_UDP_SOCK, "::", 9003, CLIENT_SIDE)) < 0) {
-        printf("Failed to get a socket.\n");
-        return -1;
-    }   
+    /* Messages are written and stdout is flushed by the logger's thread, not the scheduler loop */
+    (void)logger_start();
 
-    /* Setup App Client Metrics */
+    if (event_loop_init(MAX_SERVER_MESSAGE_SIZE) < 0) {
+        printf("Failed to initialize event loop.\n");
+        return -1;
+    }
 
-    /* Initialize scheduler */ 
-    set_start_time();
+    /* RPC listeners of the server, endpoints that are down are retried from the tick */
+    if ((pool = pool_create(POOL_BALANCE_LEAST_OUTSTANDING)) < 0) {
+        printf("Failed to create connection pool.\n");
+        return -1;
+    }
 
-    msec_t task_counter_10ms    = 0;
-    msec_t task_counter_500ms   = 0;
-    msec_t task_counter_1000ms      = 0;
+    /* Checked frames, the TCP endpoint crosses the network stack, large payloads are compressed */
+    (void)pool_set_checksum(pool, true);
+    (void)pool_set_compression(pool, true);
+    (void)pool_add_endpoint(pool, E_TCP_SOCK, "127.0.0.1", 9007, CLIENT_CONNS_PER_ENDPOINT);
+    (void)pool_add_endpoint(pool, E_LOCAL_SOCK, rpc_sock, 0, CLIENT_CONNS_PER_ENDPOINT);
 
-    /* Task Scheduler */
-    for (;;) {
+    /* Setup App Client Metrics, the server rolls them up per client */
+    snprintf(client_source, sizeof(client_source), "client-%d", (int)getpid());
 
-        // printf("Current elasped time: %ld\n", get_elasped_time());
-        
-        if (task_counter_10ms >= SCHEDULER_INTERVAL_10_MS) {
-            // TODO: Record app code exection time
-            // start_timer(); 
-            appClientTask10Ms();
-            // printf("Elasped time: %lu\n", stop_timer());
-            task_counter_10ms = 0;
-        }
+    /* Initialize scheduler
+     *
+     * Servicing the network is due before the application task, whatever their order here, and
+     * stats only get what's left over.
+     */
+    (void)scheduler_add_task("network", SCHEDULER_CLASS_CRITICAL, SCHEDULER_INTERVAL_10_MS, 0, network_task, NULL);
+    (void)scheduler_add_task("app", SCHEDULER_CLASS_NORMAL, SCHEDULER_INTERVAL_10_MS, 0, app_task, NULL);
+    (void)scheduler_add_task("stats", SCHEDULER_CLASS_BACKGROUND, SCHEDULER_INTERVAL_1000_MS, 0, stats_task, NULL);
+    (void)scheduler_set_budget(SCHEDULER_CLASS_BACKGROUND, CLIENT_BACKGROUND_BUDGET);
 
-        if (task_counter_500ms >= SCHEDULER_INTERVAL_500_MS) {
-            (void)server_service();
-            task_counter_500ms = 0;
-        }
+    /* Task Scheduler, replies are handled while no task is due */
+    while (!shutdown_requested) {
+        int wait_ms;
 
-        if (task_counter_1000ms >= SCHEDULER_INTERVAL_1000_MS) {
-            // printf("1s task\n");
-            task_counter_1000ms = 0;
-        }
-        
-        /* Maintains execution rate */
-        if (check_elasped_time(TASK_SCHEDULER_1MS_RATE)) {
-            // increment counters
-            task_counter_10ms++;
-            task_counter_500ms++; 
-            task_counter_1000ms++;
-            set_start_time(); // Reset scheduler
+        if ((wait_ms = scheduler_run_once()) != 0) {
+            (void)event_loop_run_once(wait_ms);
         }
-
-        fflush(stdout); // Flush the output buffer
     }
 
+    /* Requests still in flight are completed as failed */
+    fprintf(stderr, "Closing client\n");
+    pool_destroy(pool);
+
     return 0;
 }
@@ -0,0 +1,800 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "event_loop.h"
+#include "sock_config.h"
+#include "support.h"
+
+#define PROXY_BUFFER_SIZE (64 * 1024)
+#define PROXY_MAX_SESSIONS 1024
+
+/* Packets held back at once, across every session and direction */
+#define PROXY_MAX_PENDING 65536
+
+/* Bytes a TCP session may have waiting on a full socket before it's closed */
+#define PROXY_MAX_BACKLOG (4 * 1024 * 1024)
+
+/* A lost TCP segment arrives after a retransmission timeout instead of never */
+#define PROXY_TCP_RTO_US (200 * 1000)
+
+/* UDP sessions without traffic are forgotten after this long */
+#define PROXY_UDP_IDLE_US (60ULL * 1000 * 1000)
+
+/* Longest wait in the event loop, so stats and idle sessions are handled on time */
+#define PROXY_MAX_WAIT_MS 100
+
+typedef enum {
+    E_PROXY_UP = 0,
+    E_PROXY_DOWN,
+    E_PROXY_NUM_DIRS,
+} E_PROXY_DIR;
+
+/* Close of a TCP direction, its sender's FIN travels behind its data and is passed on once it's sent */
+typedef enum {
+    E_PROXY_OPEN = 0,
+    E_PROXY_FIN_QUEUED,
+    E_PROXY_FIN_DUE,
+    E_PROXY_SHUT,
+} E_PROXY_FIN;
+
+/* Faults, applied the same way in both directions */
+typedef struct {
+    uint64_t delay_us;
+    uint64_t jitter_us;
+    double loss;
+    double dup;
+    double reorder;
+    double reset;
+    uint64_t rate_bps;
+} proxy_faults_t;
+
+typedef struct {
+    bool used;
+    uint32_t gen;
+    int upstream_fd;
+    ev_conn_t *conn;
+
+    /* Copy of the client's fd, the event loop closes conn once the client's side is closed */
+    int client_fd;
+    sockaddr_storage_t peer;
+    socklen_t peer_len;
+    uint64_t last_active_us;
+
+    /* When each direction's link is free again, and the latest TCP delivery, which keeps order */
+    uint64_t link_free_us[E_PROXY_NUM_DIRS];
+    uint64_t last_due_us[E_PROXY_NUM_DIRS];
+
+    /* TCP bytes a full socket didn't take, sent before anything newer */
+    char *backlog[E_PROXY_NUM_DIRS];
+    size_t backlog_len[E_PROXY_NUM_DIRS];
+
+    E_PROXY_FIN fin[E_PROXY_NUM_DIRS];
+} proxy_session_t;
+
+typedef struct {
+    uint64_t due_us;
+    uint64_t seq;
+    int session;
+    uint32_t gen;
+    E_PROXY_DIR dir;
+    size_t len;
+    char data[];
+} proxy_packet_t;
+
+typedef struct {
+    uint64_t packets[E_PROXY_NUM_DIRS];
+    uint64_t bytes[E_PROXY_NUM_DIRS];
+    uint64_t lost;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t resets;
+    uint64_t overflows;
+    uint64_t sessions;
+} proxy_stats_t;
+
+static E_APP_SOCK_TYPE proxy_type;
+static sock_id_t listener_id = SOCK_NOT_OK;
+static int listener_fd = -1;
+static sockaddr_storage_t upstream_addr;
+static socklen_t upstream_len;
+static proxy_faults_t faults;
+
+static proxy_session_t sessions[PROXY_MAX_SESSIONS];
+static int num_backlogged;
+
+/* Min-heap on due time, ties in arrival order */
+static proxy_packet_t *pending[PROXY_MAX_PENDING];
+static int num_pending;
+static uint64_t next_seq;
+
+static uint64_t rand_state;
+static proxy_stats_t stats;
+static proxy_stats_t reported;
+
+static volatile sig_atomic_t shutdown_requested;
+
+/* Static Functions */
+static uint64_t proxy_now_us( void );
+static double proxy_rand( void );
+static bool proxy_chance( double percent );
+static int proxy_parse_addr( const char *addr, const char *port, sockaddr_storage_t *out, socklen_t *len );
+static int proxy_parse_opt( const char *opt );
+static int proxy_open_session( ev_conn_t *conn );
+static int proxy_find_datagram_session( const sockaddr_storage_t *peer, socklen_t peer_len );
+static void proxy_close_session( int index );
+static void proxy_half_close( int index, E_PROXY_DIR dir );
+static void proxy_shutdown_stream( int index, E_PROXY_DIR dir );
+static void proxy_inject( int index, E_PROXY_DIR dir, const void *buffer, size_t len );
+static bool proxy_push( int index, E_PROXY_DIR dir, uint64_t due_us, const void *buffer, size_t len );
+static void proxy_deliver( proxy_packet_t *packet );
+static void proxy_send_stream( int index, E_PROXY_DIR dir, const char *buffer, size_t len );
+static void proxy_flush_backlogs( void );
+static void proxy_heap_push( proxy_packet_t *packet );
+static proxy_packet_t *proxy_heap_pop( void );
+static void proxy_message_handler( ev_conn_t *conn, const void *buffer, size_t len, void *ctx );
+static void proxy_conn_closed( ev_conn_t *conn, void *ctx );
+static void proxy_upstream_handler( int fd, uint32_t events, void *ctx );
+static void proxy_report( void );
+
+void int_handler(int __attribute__((unused)) sigType) {
+    shutdown_requested = 1;
+}
+
+/* Fault injection proxy
+ *
+ * Sits between a client and a server on loopback and forwards every message through a set of
+ * faults, delay with jitter, loss, duplication, reordering, a bandwidth cap, and for TCP resets.
+ * Messages are held in a queue ordered by when they're due and released from the event loop.
+ *
+ * UDP datagrams are faulted one by one, each client address gets its own upstream socket so replies
+ * find their way back. TCP can't lose, duplicate, or reorder bytes without breaking the stream, so a
+ * lost read arrives after a retransmission timeout instead, every read keeps its order, and dup and
+ * reorder don't apply. A side that closes its connection only closes that direction, once the bytes
+ * ahead of its FIN are delivered, the session ends when both are. reset closes both sides of the
+ * connection at once, for testing reconnects.
+ *
+ *   proxy <tcp|udp> <listen addr> <listen port> <server addr> <server port> [option=value ...]
+ *
+ * Options are delay=ms, jitter=ms, loss=%, dup=%, reorder=%, reset=%, rate=kbit/s, and seed=N.
+ */
+int main( int argc, char *argv[] )
+{
+    proxy_packet_t *packet;
+    uint64_t now_us;
+    uint64_t last_report_us;
+    int timeout_ms;
+    long port;
+
+    if (argc < 6) {
+        printf("Usage: %s <tcp|udp> <listen addr> <listen port> <server addr> <server port> [delay=ms] "
+            "[jitter=ms] [loss=%%] [dup=%%] [reorder=%%] [reset=%%] [rate=kbit/s] [seed=N]\n", argv[0]);
+        return -1;
+    }
+
+    if (strcmp(argv[1], "tcp") == 0) {
+        proxy_type = E_TCP_SOCK;
+    } else if (strcmp(argv[1], "udp") == 0) {
+        proxy_type = E_UDP_SOCK;
+    } else {
+        printf("Invalid type %s\n", argv[1]);
+        return -1;
+    }
+
+    rand_state = proxy_now_us() ^ ((uint64_t)getpid() << 32);
+
+    for (int i=6; i<argc; i++) {
+        if (proxy_parse_opt(argv[i]) < 0) {
+            printf("Invalid option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (rand_state == 0) { rand_state = 1; }
+
+    if (proxy_parse_addr(argv[4], argv[5], &upstream_addr, &upstream_len) < 0) {
+        printf("Invalid server address %s:%s\n", argv[4], argv[5]);
+        return -1;
+    }
+
+    port = strtol(argv[3], NULL, 10);
+
+    signal(SIGINT, int_handler);
+    signal(SIGTERM, int_handler);
+
+    if (event_loop_init(PROXY_BUFFER_SIZE) < 0) {
+        printf("Failed to initialize event loop.\n");
+        return -1;
+    }
+
+    if ((listener_id = initialize_sock(proxy_type, argv[2], (int)port, SERVER_SIDE)) < 0) {
+        printf("Failed to listen on %s:%ld\n", argv[2], port);
+        return -1;
+    }
+
+    listener_fd = get_sock_fd(listener_id);
+
+    if ((event_loop_add_listener(listener_id, proxy_message_handler, NULL) < 0) ||
+        ((proxy_type == E_TCP_SOCK) && (event_loop_set_close_handler(listener_id, proxy_conn_closed) < 0))) {
+        printf("Failed to add listener\n");
+        return -1;
+    }
+
+    printf("Proxying %s %s:%ld to %s:%s, delay %lu ms, jitter %lu ms, loss %.2f%%, dup %.2f%%, reorder %.2f%%, "
+        "reset %.2f%%, rate %lu kbit/s\n", argv[1], argv[2], port, argv[4], argv[5],
+        (unsigned long)(faults.delay_us / 1000), (unsigned long)(faults.jitter_us / 1000), faults.loss, faults.dup,
+        faults.reorder, faults.reset, (unsigned long)(faults.rate_bps / 1000));
+    fflush(stdout);
+
+    last_report_us = proxy_now_us();
+
+    while (!shutdown_requested) {
+        now_us = proxy_now_us();
+
+        while ((num_pending > 0) && (pending[0]->due_us <= now_us)) {
+            packet = proxy_heap_pop();
+            proxy_deliver(packet);
+            free(packet);
+        }
+
+        if (num_backlogged > 0) { proxy_flush_backlogs(); }
+
+        timeout_ms = PROXY_MAX_WAIT_MS;
+
+        if (num_pending > 0) {
+            /* Rounded up, waking early would only spin */
+            uint64_t wait_us = (pending[0]->due_us > now_us) ? (pending[0]->due_us - now_us) : 0;
+            if (wait_us < ((uint64_t)timeout_ms * 1000)) { timeout_ms = (int)((wait_us + 999) / 1000); }
+        }
+
+        if ((num_backlogged > 0) && (timeout_ms > 1)) { timeout_ms = 1; }
+
+        (void)event_loop_run_once(timeout_ms);
+
+        now_us = proxy_now_us();
+
+        if ((now_us - last_report_us) >= 1000000) {
+            last_report_us = now_us;
+
+            for (int i=0; i<PROXY_MAX_SESSIONS; i++) {
+                if (sessions[i].used && (proxy_type == E_UDP_SOCK) &&
+                    ((now_us - sessions[i].last_active_us) > PROXY_UDP_IDLE_US)) {
+                    proxy_close_session(i);
+                }
+            }
+
+            /* Quiet while idle */
+            if (memcmp(&stats, &reported, sizeof(stats)) != 0) {
+                proxy_report();
+                reported = stats;
+            }
+        }
+    }
+
+    proxy_report();
+
+    return 0;
+}
+
+static uint64_t proxy_now_us( void ) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
+
+/* xorshift64*, uniform in [0, 1) */
+static double proxy_rand( void ) {
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+
+    return (double)((rand_state * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+static bool proxy_chance( double percent ) {
+    return (percent > 0) && ((proxy_rand() * 100.0) < percent);
+}
+
+static int proxy_parse_addr( const char *addr, const char *port, sockaddr_storage_t *out, socklen_t *len ) {
+    sockaddr_in_t *in = (sockaddr_in_t *)out;
+    sockaddr_in6_t *in6 = (sockaddr_in6_t *)out;
+    char *end;
+    long num = strtol(port, &end, 10);
+
+    if ((*end != '\0') || (num <= 0) || (num > 65535)) { return -1; }
+
+    memset(out, 0, sizeof(*out));
+
+    if (inet_pton(AF_INET, addr, &in->sin_addr) == 1) {
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)num);
+        *len = sizeof(*in);
+    } else if (inet_pton(AF_INET6, addr, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons((uint16_t)num);
+        *len = sizeof(*in6);
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int proxy_parse_opt( const char *opt ) {
+    const char *sep = strchr(opt, '=');
+    char *end;
+    double value;
+
+    if (sep == NULL) { return -1; }
+
+    value = strtod(sep + 1, &end);
+
+    if ((*end != '\0') || (end == (sep + 1)) || (value < 0)) { return -1; }
+
+    if (strncmp(opt, "delay=", 6) == 0) {
+        faults.delay_us = (uint64_t)(value * 1000);
+    } else if (strncmp(opt, "jitter=", 7) == 0) {
+        faults.jitter_us = (uint64_t)(value * 1000);
+    } else if (strncmp(opt, "loss=", 5) == 0) {
+        faults.loss = value;
+    } else if (strncmp(opt, "dup=", 4) == 0) {
+        faults.dup = value;
+    } else if (strncmp(opt, "reorder=", 8) == 0) {
+        faults.reorder = value;
+    } else if (strncmp(opt, "reset=", 6) == 0) {
+        faults.reset = value;
+    } else if (strncmp(opt, "rate=", 5) == 0) {
+        faults.rate_bps = (uint64_t)(value * 1000);
+    } else if (strncmp(opt, "seed=", 5) == 0) {
+        rand_state = (uint64_t)value;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Open a session
+ *
+ * The upstream connection is opened on the first message, it's blocking only while connecting,
+ * which is immediate on loopback.
+ */
+static int proxy_open_session( ev_conn_t *conn ) {
+    proxy_session_t *session;
+    int type = (proxy_type == E_TCP_SOCK) ? SOCK_STREAM : SOCK_DGRAM;
+    int index;
+    int fd;
+
+    for (index=0; index<PROXY_MAX_SESSIONS; index++) {
+        if (!sessions[index].used) { break; }
+    }
+
+    if (index == PROXY_MAX_SESSIONS) {
+        printf("No free proxy sessions\n");
+        return -1;
+    }
+
+    if ((fd = socket(upstream_addr.ss_family, type | SOCK_CLOEXEC, 0)) < 0) { return -1; }
+
+    if (connect(fd, (sockaddr_t *)&upstream_addr, upstream_len) < 0) {
+        printf("Failed to connect to server: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if ((fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) ||
+        (event_loop_watch_fd(fd, EPOLLIN, proxy_upstream_handler, (void *)(intptr_t)index) < 0)) {
+        close(fd);
+        return -1;
+    }
+
+    session = &sessions[index];
+    session->client_fd = -1;
+
+    if ((proxy_type == E_TCP_SOCK) && ((session->client_fd = fcntl(conn->fd, F_DUPFD_CLOEXEC, 0)) < 0)) {
+        (void)event_loop_unwatch_fd(fd);
+        close(fd);
+        return -1;
+    }
+
+    session->used = true;
+    session->gen++;
+    session->upstream_fd = fd;
+    session->last_active_us = proxy_now_us();
+
+    for (int dir=0; dir<E_PROXY_NUM_DIRS; dir++) {
+        session->fin[dir] = E_PROXY_OPEN;
+    }
+
+    if (proxy_type == E_TCP_SOCK) {
+        session->conn = conn;
+        conn->data = (void *)(intptr_t)(index + 1);
+    } else {
+        session->conn = NULL;
+        session->peer = conn->peer;
+        session->peer_len = conn->peer_len;
+    }
+
+    stats.sessions++;
+
+    return index;
+}
+
+static int proxy_find_datagram_session( const sockaddr_storage_t *peer, socklen_t peer_len ) {
+    for (int i=0; i<PROXY_MAX_SESSIONS; i++) {
+        if (sessions[i].used && (sessions[i].peer_len == peer_len) && (memcmp(&sessions[i].peer, peer, peer_len) == 0)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Packets still queued for the session are dropped on delivery, the generation won't match */
+static void proxy_close_session( int index ) {
+    proxy_session_t *session = &sessions[index];
+    ev_conn_t *conn = session->conn;
+
+    if (!session->used) { return; }
+
+    session->used = false;
+    session->conn = NULL;
+
+    (void)event_loop_unwatch_fd(session->upstream_fd);
+    close(session->upstream_fd);
+
+    if (session->client_fd >= 0) {
+        close(session->client_fd);
+        session->client_fd = -1;
+    }
+
+    for (int dir=0; dir<E_PROXY_NUM_DIRS; dir++) {
+        if (session->backlog_len[dir] > 0) { num_backlogged--; }
+        free(session->backlog[dir]);
+        session->backlog[dir] = NULL;
+        session->backlog_len[dir] = 0;
+        session->link_free_us[dir] = 0;
+        session->last_due_us[dir] = 0;
+    }
+
+    if (conn != NULL) {
+        conn->data = NULL;
+        (void)event_loop_close_conn(conn);
+    }
+}
+
+/* Half close
+ *
+ * The sender of dir closed its side. Its FIN is queued behind the packets it sent, with the same
+ * delay, so every byte it sent is still delivered first.
+ */
+static void proxy_half_close( int index, E_PROXY_DIR dir ) {
+    proxy_session_t *session = &sessions[index];
+    uint64_t due_us = proxy_now_us() + faults.delay_us;
+
+    if (!session->used || (session->fin[dir] != E_PROXY_OPEN)) { return; }
+
+    if (due_us < session->last_due_us[dir]) { due_us = session->last_due_us[dir]; }
+    session->last_due_us[dir] = due_us;
+
+    if (proxy_push(index, dir, due_us, NULL, 0)) { session->fin[dir] = E_PROXY_FIN_QUEUED; }
+}
+
+/* Passes a delivered FIN on once the backlog of dir is sent, and ends the session once both are */
+static void proxy_shutdown_stream( int index, E_PROXY_DIR dir ) {
+    proxy_session_t *session = &sessions[index];
+    int fd = (dir == E_PROXY_UP) ? session->upstream_fd : session->client_fd;
+
+    if ((session->fin[dir] != E_PROXY_FIN_DUE) || (session->backlog_len[dir] > 0)) { return; }
+
+    (void)shutdown(fd, SHUT_WR);
+    session->fin[dir] = E_PROXY_SHUT;
+
+    if ((session->fin[E_PROXY_UP] == E_PROXY_SHUT) && (session->fin[E_PROXY_DOWN] == E_PROXY_SHUT)) {
+        proxy_close_session(index);
+    }
+}
+
+/* Inject faults
+ *
+ * The link sends one message at a time at the capped rate, delay and jitter are added once it's
+ * on the wire. A reordered datagram skips the delay, so it overtakes those ahead of it.
+ */
+static void proxy_inject( int index, E_PROXY_DIR dir, const void *buffer, size_t len ) {
+    proxy_session_t *session = &sessions[index];
+    uint64_t now_us = proxy_now_us();
+    uint64_t start_us;
+    uint64_t due_us;
+    bool reordered = false;
+
+    session->last_active_us = now_us;
+
+    if (proxy_type == E_TCP_SOCK) {
+        if (proxy_chance(faults.reset)) {
+            stats.resets++;
+            proxy_close_session(index);
+            return;
+        }
+    } else {
+        if (proxy_chance(faults.loss)) {
+            stats.lost++;
+            return;
+        }
+
+        reordered = proxy_chance(faults.reorder);
+        if (reordered) { stats.reordered++; }
+    }
+
+    start_us = (session->link_free_us[dir] > now_us) ? session->link_free_us[dir] : now_us;
+
+    if (faults.rate_bps > 0) {
+        session->link_free_us[dir] = start_us + (((uint64_t)len * 8 * 1000000) / faults.rate_bps);
+        start_us = session->link_free_us[dir];
+    }
+
+    due_us = start_us;
+
+    if (!reordered) {
+        due_us += faults.delay_us;
+        if (faults.jitter_us > 0) { due_us += (uint64_t)(proxy_rand() * (double)faults.jitter_us); }
+    }
+
+    if (proxy_type == E_TCP_SOCK) {
+        if (proxy_chance(faults.loss)) {
+            stats.lost++;
+            due_us += PROXY_TCP_RTO_US;
+        }
+
+        /* Jitter must not reorder a stream */
+        if (due_us < session->last_due_us[dir]) { due_us = session->last_due_us[dir]; }
+        session->last_due_us[dir] = due_us;
+    }
+
+    if (!proxy_push(index, dir, due_us, buffer, len)) { return; }
+
+    if ((proxy_type == E_UDP_SOCK) && proxy_chance(faults.dup)) {
+        stats.duplicated++;
+        (void)proxy_push(index, dir, due_us, buffer, len);
+    }
+}
+
+/* A full queue drops datagrams, and closes TCP sessions since their bytes can't be dropped */
+static bool proxy_push( int index, E_PROXY_DIR dir, uint64_t due_us, const void *buffer, size_t len ) {
+    proxy_packet_t *packet;
+
+    if ((num_pending == PROXY_MAX_PENDING) || ((packet = malloc(sizeof(proxy_packet_t) + len)) == NULL)) {
+        stats.overflows++;
+        if (proxy_type == E_TCP_SOCK) { proxy_close_session(index); }
+        return false;
+    }
+
+    packet->due_us = due_us;
+    packet->seq = next_seq++;
+    packet->session = index;
+    packet->gen = sessions[index].gen;
+    packet->dir = dir;
+    packet->len = len;
+    if (len > 0) { memcpy(packet->data, buffer, len); }
+
+    proxy_heap_push(packet);
+
+    return true;
+}
+
+static void proxy_deliver( proxy_packet_t *packet ) {
+    proxy_session_t *session = &sessions[packet->session];
+
+    if (!session->used || (session->gen != packet->gen)) { return; }
+
+    /* The FIN of a TCP direction */
+    if (packet->len == 0) {
+        session->fin[packet->dir] = E_PROXY_FIN_DUE;
+        proxy_shutdown_stream(packet->session, packet->dir);
+        return;
+    }
+
+    stats.packets[packet->dir]++;
+    stats.bytes[packet->dir] += packet->len;
+
+    if (proxy_type == E_TCP_SOCK) {
+        proxy_send_stream(packet->session, packet->dir, packet->data, packet->len);
+    } else if (packet->dir == E_PROXY_UP) {
+        (void)send(session->upstream_fd, packet->data, packet->len, MSG_DONTWAIT);
+    } else {
+        (void)sendto(listener_fd, packet->data, packet->len, MSG_DONTWAIT, (sockaddr_t *)&session->peer,
+            session->peer_len);
+    }
+}
+
+/* Send on a stream
+ *
+ * Whatever a full socket doesn't take is kept in the backlog, and later bytes queue behind it.
+ */
+static void proxy_send_stream( int index, E_PROXY_DIR dir, const char *buffer, size_t len ) {
+    proxy_session_t *session = &sessions[index];
+    int fd = (dir == E_PROXY_UP) ? session->upstream_fd : session->client_fd;
+    ssize_t num_bytes = 0;
+    char *backlog;
+
+    if (session->backlog_len[dir] == 0) {
+        if ((num_bytes = send(fd, buffer, len, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                proxy_close_session(index);
+                return;
+            }
+            num_bytes = 0;
+        }
+
+        if ((size_t)num_bytes == len) { return; }
+    }
+
+    if ((session->backlog_len[dir] + len - (size_t)num_bytes) > PROXY_MAX_BACKLOG) {
+        stats.overflows++;
+        proxy_close_session(index);
+        return;
+    }
+
+    if ((backlog = realloc(session->backlog[dir], session->backlog_len[dir] + len - (size_t)num_bytes)) == NULL) {
+        proxy_close_session(index);
+        return;
+    }
+
+    if (session->backlog_len[dir] == 0) { num_backlogged++; }
+
+    memcpy(backlog + session->backlog_len[dir], buffer + num_bytes, len - (size_t)num_bytes);
+    session->backlog[dir] = backlog;
+    session->backlog_len[dir] += len - (size_t)num_bytes;
+}
+
+static void proxy_flush_backlogs( void ) {
+    proxy_session_t *session;
+    ssize_t num_bytes;
+    int fd;
+
+    for (int i=0; i<PROXY_MAX_SESSIONS; i++) {
+        session = &sessions[i];
+
+        for (int dir=0; dir<E_PROXY_NUM_DIRS; dir++) {
+            if (!session->used || (session->backlog_len[dir] == 0)) { continue; }
+
+            fd = (dir == E_PROXY_UP) ? session->upstream_fd : session->client_fd;
+
+            if ((num_bytes = send(fd, session->backlog[dir], session->backlog_len[dir], MSG_DONTWAIT | MSG_NOSIGNAL)) < 0) {
+                if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) { proxy_close_session(i); }
+                continue;
+            }
+
+            memmove(session->backlog[dir], session->backlog[dir] + num_bytes, session->backlog_len[dir] - (size_t)num_bytes);
+            session->backlog_len[dir] -= (size_t)num_bytes;
+
+            if (session->backlog_len[dir] == 0) {
+                num_backlogged--;
+                proxy_shutdown_stream(i, dir);
+            }
+        }
+    }
+}
+
+static inline bool proxy_before( const proxy_packet_t *a, const proxy_packet_t *b ) {
+    return (a->due_us < b->due_us) || ((a->due_us == b->due_us) && (a->seq < b->seq));
+}
+
+static void proxy_heap_push( proxy_packet_t *packet ) {
+    int i = num_pending++;
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+
+        if (!proxy_before(packet, pending[parent])) { break; }
+
+        pending[i] = pending[parent];
+        i = parent;
+    }
+
+    pending[i] = packet;
+}
+
+static proxy_packet_t *proxy_heap_pop( void ) {
+    proxy_packet_t *top = pending[0];
+    proxy_packet_t *last = pending[--num_pending];
+    int i = 0;
+
+    for (;;) {
+        int child = (2 * i) + 1;
+
+        if (child >= num_pending) { break; }
+        if (((child + 1) < num_pending) && proxy_before(pending[child + 1], pending[child])) { child++; }
+        if (!proxy_before(pending[child], last)) { break; }
+
+        pending[i] = pending[child];
+        i = child;
+    }
+
+    if (num_pending > 0) { pending[i] = last; }
+
+    return top;
+}
+
+static void proxy_message_handler( ev_conn_t *conn, const void *buffer, size_t len, void __attribute__((unused)) *ctx ) {
+    int index;
+
+    if (proxy_type == E_TCP_SOCK) {
+        index = (int)(intptr_t)conn->data - 1;
+    } else {
+        index = proxy_find_datagram_session(&conn->peer, conn->peer_len);
+    }
+
+    if ((index < 0) && ((index = proxy_open_session(conn)) < 0)) {
+        if (proxy_type == E_TCP_SOCK) { (void)event_loop_close_conn(conn); }
+        return;
+    }
+
+    proxy_inject(index, E_PROXY_UP, buffer, len);
+}
+
+/* The client closed its side, replies still reach it on client_fd */
+static void proxy_conn_closed( ev_conn_t *conn, void __attribute__((unused)) *ctx ) {
+    int index = (int)(intptr_t)conn->data - 1;
+
+    if (index < 0) { return; }
+
+    /* The event loop closes conn itself */
+    conn->data = NULL;
+    sessions[index].conn = NULL;
+    proxy_half_close(index, E_PROXY_UP);
+}
+
+/* Replies from the server, a server that closed its side closes the client's once they're sent */
+static void proxy_upstream_handler( int fd, uint32_t __attribute__((unused)) events, void *ctx ) {
+    static char buffer[PROXY_BUFFER_SIZE];
+    int index = (int)(intptr_t)ctx;
+    ssize_t num_bytes;
+
+    for (;;) {
+        if (!sessions[index].used || (sessions[index].upstream_fd != fd)) { return; }
+
+        num_bytes = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+        if (num_bytes < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) { return; }
+        }
+
+        if ((num_bytes == 0) && (proxy_type == E_TCP_SOCK)) {
+            /* Still written to until the client closes its side */
+            (void)event_loop_unwatch_fd(fd);
+            proxy_half_close(index, E_PROXY_DOWN);
+            return;
+        }
+
+        if ((num_bytes < 0) && (proxy_type == E_TCP_SOCK)) {
+            proxy_close_session(index);
+            return;
+        }
+
+        /* A datagram socket reports a refused port, the session stays for the next one */
+        if (num_bytes < 0) { return; }
+
+        proxy_inject(index, E_PROXY_DOWN, buffer, (size_t)num_bytes);
+    }
+}
+
+static void proxy_report( void ) {
+    printf("Up %lu (%lu bytes), down %lu (%lu bytes), lost %lu, duplicated %lu, reordered %lu, resets %lu, "
+        "overflows %lu, sessions %lu, queued %d\n",
+        (unsigned long)stats.packets[E_PROXY_UP], (unsigned long)stats.bytes[E_PROXY_UP],
+        (unsigned long)stats.packets[E_PROXY_DOWN], (unsigned long)stats.bytes[E_PROXY_DOWN],
+        (unsigned long)stats.lost, (unsigned long)stats.duplicated, (unsigned long)stats.reordered,
+        (unsigned long)stats.resets, (unsigned long)stats.overflows, (unsigned long)stats.sessions, num_pending);
+    fflush(stdout);
+}
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "capture.h"
+
+/* Stream connections open at once, a power of 2 */
+#define REPLAY_MAX_CONNS 1024
+
+/* Responses are read and discarded, so the server never blocks on a full socket */
+#define REPLAY_DRAIN_SIZE (64 * 1024)
+
+typedef struct {
+    bool used;
+    uint16_t listener;
+    int32_t conn;
+    int fd;
+} replay_conn_t;
+
+typedef struct {
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t skipped;
+    uint64_t failed;
+    uint64_t conns;
+} replay_stats_t;
+
+static capture_listener_t listeners[MAX_NUM_OF_SOCKS];
+static bool described[MAX_NUM_OF_SOCKS];
+static int datagram_fds[MAX_NUM_OF_SOCKS];
+static replay_conn_t conns[REPLAY_MAX_CONNS];
+static const char *host;
+static char drain_buffer[REPLAY_DRAIN_SIZE];
+static replay_stats_t stats;
+
+/* Connect to a listener
+ *
+ * The replay goes to the same port or path as the capture. Wildcard listen addresses are replaced by
+ * loopback, host replaces any network address.
+ */
+static int replay_connect( const capture_listener_t *listener ) {
+    sockaddr_storage_t addr;
+    socklen_t addr_len;
+    const char *addr_str = (host != NULL) ? host : listener->addr;
+    int type = (listener->type == E_UDP_SOCK) ? SOCK_DGRAM : SOCK_STREAM;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+
+    if (listener->type == E_LOCAL_SOCK) {
+        sockaddr_un_t *un = (sockaddr_un_t *)&addr;
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, listener->addr, sizeof(un->sun_path) - 1);
+        addr_len = sizeof(*un);
+    } else {
+        sockaddr_in_t *in = (sockaddr_in_t *)&addr;
+        sockaddr_in6_t *in6 = (sockaddr_in6_t *)&addr;
+
+        if (strcmp(addr_str, "0.0.0.0") == 0) { addr_str = "127.0.0.1"; }
+        if (strcmp(addr_str, "::") == 0) { addr_str = "::1"; }
+
+        if (inet_pton(AF_INET, addr_str, &in->sin_addr) == 1) {
+            in->sin_family = AF_INET;
+            in->sin_port = htons(listener->port);
+            addr_len = sizeof(*in);
+        } else if (inet_pton(AF_INET6, addr_str, &in6->sin6_addr) == 1) {
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(listener->port);
+            addr_len = sizeof(*in6);
+        } else {
+            printf("Invalid address %s\n", addr_str);
+            return -1;
+        }
+    }
+
+    if ((fd = socket(addr.ss_family, type | SOCK_CLOEXEC, 0)) < 0) { return -1; }
+
+    if (connect(fd, (sockaddr_t *)&addr, addr_len) < 0) {
+        printf("Failed to connect to %s:%d: %s\n", listener->addr, listener->port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    stats.conns++;
+
+    return fd;
+}
+
+/* Stream connections are keyed by the listener and the fd they had on the capturing server. Closed
+ * connections keep their slot, with conn -1, so later entries stay reachable, and are reused. */
+static replay_conn_t *replay_find_conn( uint16_t listener, int32_t conn, bool create ) {
+    uint32_t slot = (((uint32_t)listener * 2654435761U) ^ (uint32_t)conn) & (REPLAY_MAX_CONNS - 1);
+    replay_conn_t *free_entry = NULL;
+    replay_conn_t *entry;
+
+    for (int i=0; i<REPLAY_MAX_CONNS; i++) {
+        entry = &conns[(slot + i) & (REPLAY_MAX_CONNS - 1)];
+
+        if (entry->used && (entry->listener == listener) && (entry->conn == conn)) { return entry; }
+
+        if (!entry->used || (entry->conn < 0)) {
+            if (free_entry == NULL) { free_entry = entry; }
+            if (!entry->used) { break; }
+        }
+    }
+
+    if (!create || (free_entry == NULL)) { return NULL; }
+
+    free_entry->used = true;
+    free_entry->listener = listener;
+    free_entry->conn = conn;
+    free_entry->fd = replay_connect(&listeners[listener]);
+
+    return free_entry;
+}
+
+static void replay_close_conn( uint16_t listener, int32_t conn ) {
+    replay_conn_t *entry;
+
+    if ((entry = replay_find_conn(listener, conn, false)) == NULL) { return; }
+
+    if (entry->fd >= 0) { close(entry->fd); }
+
+    entry->conn = -1;
+    entry->fd = -1;
+}
+
+static void replay_drain( int fd ) {
+    while (recv(fd, drain_buffer, sizeof(drain_buffer), MSG_DONTWAIT) > 0) {}
+}
+
+static int replay_send( int fd, const uint8_t *buffer, size_t len ) {
+    ssize_t num_bytes;
+
+    while (len > 0) {
+        if ((num_bytes = send(fd, buffer, len, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+
+        buffer += num_bytes;
+        len -= (size_t)num_bytes;
+    }
+
+    return 0;
+}
+
+static void replay_message( const capture_record_t *record, const void *payload ) {
+    const capture_listener_t *listener = &listeners[record->listener];
+    replay_conn_t *entry;
+    int fd;
+
+    if (!described[record->listener] || (listener->type == E_RUDP_SOCK)) {
+        stats.skipped++;
+        return;
+    }
+
+    if (record->conn < 0) {
+        if (datagram_fds[record->listener] < 0) {
+            datagram_fds[record->listener] = replay_connect(listener);
+        }
+        fd = datagram_fds[record->listener];
+    } else {
+        entry = replay_find_conn(record->listener, record->conn, true);
+        fd = (entry != NULL) ? entry->fd : -1;
+    }
+
+    if ((fd < 0) || (replay_send(fd, payload, record->len) < 0)) {
+        stats.failed++;
+        return;
+    }
+
+    replay_drain(fd);
+
+    stats.messages++;
+    stats.bytes += record->len;
+}
+
+static uint64_t replay_now_us( void ) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
+
+static void replay_wait_until( uint64_t target_us ) {
+    struct timespec ts;
+
+    if (target_us <= replay_now_us()) { return; }
+
+    ts.tv_sec = (time_t)(target_us / 1000000);
+    ts.tv_nsec = (long)(target_us % 1000000) * 1000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+/* Replay
+ *
+ * Sends every captured message to the listener it was received on, each stream connection of the
+ * capture gets its own connection. speed scales the gaps between messages, 1 keeps the original
+ * timing, 10 is ten times faster, 0 sends as fast as the server takes them.
+ *
+ *   replay <capture path> [speed] [host]
+ */
+int main( int argc, char *argv[] )
+{
+    capture_reader_t reader;
+    capture_record_t record;
+    const void *payload;
+    double speed = 1.0;
+    uint64_t first_us = 0;
+    uint64_t last_us = 0;
+    uint64_t start_us = 0;
+    uint64_t elapsed_us;
+    int rc;
+
+    if (argc < 2) {
+        printf("Usage: %s <capture path> [speed] [host]\n", argv[0]);
+        return -1;
+    }
+
+    if (argc > 2) {
+        speed = strtod(argv[2], NULL);
+        if (speed < 0) {
+            printf("Invalid speed %s\n", argv[2]);
+            return -1;
+        }
+    }
+
+    if (argc > 3) { host = argv[3]; }
+
+    for (int i=0; i<MAX_NUM_OF_SOCKS; i++) {
+        datagram_fds[i] = -1;
+    }
+
+    if (capture_reader_open(&reader, argv[1]) < 0) {
+        printf("Invalid capture path %s\n", argv[1]);
+        return -1;
+    }
+
+    while ((rc = capture_read(&reader, &record, &payload)) == CAPTURE_OK) {
+        if (record.listener >= MAX_NUM_OF_SOCKS) { continue; }
+
+        switch (record.kind) {
+            case CAPTURE_RECORD_LISTENER:
+                if (record.len >= sizeof(capture_listener_t)) {
+                    memcpy(&listeners[record.listener], payload, sizeof(capture_listener_t));
+                    listeners[record.listener].addr[CAPTURE_PATH_SIZE - 1] = '\0';
+                    described[record.listener] = true;
+                }
+                break;
+
+            case CAPTURE_RECORD_CLOSE:
+                replay_close_conn(record.listener, record.conn);
+                break;
+
+            case CAPTURE_RECORD_MESSAGE:
+                if (start_us == 0) {
+                    first_us = record.time_us;
+                    start_us = replay_now_us();
+                }
+
+                /* Segments of two server processes may overlap in time during an upgrade */
+                if ((speed > 0) && (record.time_us > first_us)) {
+                    replay_wait_until(start_us + (uint64_t)((double)(record.time_us - first_us) / speed));
+                }
+
+                if (record.time_us > last_us) { last_us = record.time_us; }
+
+                replay_message(&record, payload);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    capture_reader_close(&reader);
+
+    elapsed_us = (start_us > 0) ? (replay_now_us() - start_us) : 0;
+
+    printf("Replayed %lu messages, %lu bytes over %lu connections in %.3f s, captured over %.3f s\n",
+        (unsigned long)stats.messages, (unsigned long)stats.bytes, (unsigned long)stats.conns,
+        (double)elapsed_us / 1e6, (first_us > 0) ? (double)(last_us - first_us) / 1e6 : 0.0);
+
+    if ((stats.skipped > 0) || (stats.failed > 0)) {
+        printf("Skipped %lu messages, failed to send %lu\n", (unsigned long)stats.skipped, (unsigned long)stats.failed);
+    }
+
+    if (elapsed_us > 0) {
+        printf("%.0f messages/s\n", (double)stats.messages * 1e6 / (double)elapsed_us);
+    }
+
+    return (rc == CAPTURE_END) ? 0 : -1;
+}
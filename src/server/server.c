@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -6,36 +7,239 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <poll.h>
 #include <netinet/in.h>
 
+#include "affinity.h"
+#include "aggregate.h"
+#include "broker.h"
+#include "capture.h"
+#include "codec.h"
+#include "event_loop.h"
+#include "kv.h"
+#include "logger.h"
+#include "rpc.h"
+#include "rudp.h"
 #include "server.h"
+#include "server_config.h"
+#include "supervisor.h"
 #include "sock_config.h"
 #include "support.h"
 #include "threads_config.h"
+#include "trace.h"
 
-static sock_id_t id;
-static pid_t child_pid;
-static pipe_id_t parent_to_child;
-static pipe_id_t child_to_parent;
+static server_config_t server_cfg;
+static const char *config_path = DEFAULT_SERVER_CONFIG_PATH;
 
-const char my_sock[] = "/tmp/my_socket";
+static sock_id_t listener_ids[MAX_NUM_OF_LISTENERS];
+static int num_workers;
+static int worker_ids[MAX_NUM_OF_WORKERS];
+static pipe_id_t parent_to_child[MAX_NUM_OF_WORKERS];
 
+/* Slot 0 is the event loop, then one per worker */
+static affinity_slot_t placement[1 + MAX_NUM_OF_WORKERS];
+
+/* Listener fds passed to a new server process on upgrade, "<type> <fd> <port> <role> <addr>,..." */
+#define LISTEN_FDS_ENV "SERVER_LISTEN_FDS"
+/* Pipe the new server process writes to once it serves the inherited listeners */
+#define READY_FD_ENV "SERVER_READY_FD"
+
+#define LISTEN_FDS_ENV_SIZE (MAX_NUM_OF_LISTENERS * (LISTENER_ADDR_SIZE + 32))
+
+typedef struct {
+    listener_config_t listener;
+    int fd;
+    bool adopted;
+} inherited_fd_t;
+
+static inherited_fd_t inherited_fds[MAX_NUM_OF_LISTENERS];
+static int num_inherited_fds;
+
+static char **server_argv;
+
+static volatile sig_atomic_t reload_requested;
+static volatile sig_atomic_t shutdown_requested;
+static volatile sig_atomic_t upgrade_requested;
+
+static bool draining;
+static msec_t drain_deadline;
+static pid_t upgrade_pid;
+static int upgrade_ready_fd = -1;
+
+static const char *listener_type_str[] = { "local", "tcp", "udp", "rudp" };
+
+/* Admission counters at the previous report, per socket id */
+static sock_limit_stats_t reported_limits[MAX_NUM_OF_SOCKS];
+
+/* Key-value cache budget, read once, the cache is allocated when a kv listener is first served */
+static size_t kv_memory_mb;
+
+/* KV traffic is reported at most once per KV_REPORT_MS, however short the scheduler tick */
+#define KV_REPORT_MS 1000
+
+static kv_stats_t reported_kv;
+static msec_t reported_kv_ms;
+
+/* Static Functions */
+static sock_id_t adopt_inherited_fd( const listener_config_t *listener );
+static int kv_traced_handler( const void *request, size_t len, void *response, size_t *response_len, void *ctx );
+static void worker_main( void *arg );
+static void place_processes( const affinity_config_t *affinity );
+
+/* Graceful shutdown
+ *
+ * The first SIGINT/SIGTERM drains connections from the scheduler, a second one exits immediately
+ * for when draining takes too long.
+ */
 void int_handler(int __attribute__((unused)) sigType) {
-    if (child_pid > 0) {
-        fprintf(stderr, "Closing server\n");
-        (void)close_sock(id);
+    if (shutdown_requested) {
+        _exit(EXIT_FAILURE);
+    }
+    shutdown_requested = 1;
+}
+
+/* Upgrade is deferred to the scheduler */
+void usr2_handler(int __attribute__((unused)) sigType) {
+    upgrade_requested = 1;
+}
+
+/* Reload is deferred to the scheduler, nothing here is async-signal-safe */
+void hup_handler(int __attribute__((unused)) sigType) {
+    reload_requested = 1;
+}
+
+/* Hand trace to a worker
+ *
+ * Stamps the completion of the handler, then writes the trace to a worker's pipe, the worker adds it
+ * to the histograms, off the event loop. A full pipe drops the trace.
+ */
+static void finish_trace( trace_record_t *trace ) {
+    int worker;
+
+    if (!(trace->flags & TRACE_FLAG_ACTIVE) || (num_workers == 0)) { return; }
+
+    trace_stamp(trace, E_TRACE_HANDLED);
+
+    worker = (int)(trace->id % (uint64_t)num_workers);
+
+    (void)write_pipe_record(parent_to_child[worker], trace, sizeof(*trace));
+}
+
+static void handle_message( const void *msg, size_t len ) {
+    codec_msg_t decoded;
+
+    if (codec_decode(msg, len, &decoded) > 0) {
+        if (decoded.type == CODEC_MSG_HELLO) {
+            log_info("Hello %u from %.*s", decoded.body.hello.seq, (int)decoded.body.hello.name.len,
+                (const char *)decoded.body.hello.name.data);
+            return;
+        }
+
+        /* Samples are only kept as rollups */
+        if (decoded.type == CODEC_MSG_SAMPLE) {
+            (void)aggregate_add(decoded.body.sample.source.data, decoded.body.sample.source.len,
+                decoded.body.sample.metric.data, decoded.body.sample.metric.len, decoded.body.sample.value);
+            return;
+        }
+    }
+
+    log_info("Buffer: %s", (const char *)msg);
+}
+
+/* Server message handler
+ *
+ * Common handler for every listener, messages from local, TCP, and UDP clients are handled the same.
+ * Co-located clients can use the local listener and skip the network stack. A trace context in front
+ * of the message is taken off before it's handled.
+ */
+static void server_message_handler( ev_conn_t __attribute__((unused)) *conn, const void *msg, size_t len, void __attribute__((unused)) *ctx ) {
+    trace_record_t trace;
+    int traced;
+
+    if ((traced = trace_begin(msg, len, &trace)) < 0) { return; }
+
+    handle_message((const uint8_t *)msg + traced, len - (size_t)traced);
+    finish_trace(&trace);
+}
+
+static int handle_request( const void *request, size_t len, void *response, size_t *response_len ) {
+    codec_hello_t hello;
+    codec_hello_ack_t ack;
+    codec_sample_t sample;
+    int num_bytes;
+
+    if (codec_decode_hello(request, len, &hello) > 0) {
+        ack.seq = hello.seq;
+        ack.sent_ms = hello.sent_ms;
+        ack.status = RPC_STATUS_OK;
+
+        if ((num_bytes = codec_encode_hello_ack(&ack, response, RPC_MAX_PAYLOAD)) < 0) { return RPC_STATUS_ERROR; }
+
+        *response_len = (size_t)num_bytes;
+        return RPC_STATUS_OK;
+    }
+
+    if (codec_decode_sample(request, len, &sample) > 0) {
+        (void)aggregate_add(sample.source.data, sample.source.len, sample.metric.data, sample.metric.len, sample.value);
+        return RPC_STATUS_OK;
     }
-    exit(EXIT_FAILURE);
+
+    memcpy(response, request, len);
+    *response_len = len;
+
+    return RPC_STATUS_OK;
+}
+
+/* Server request handler
+ *
+ * Handler of RPC listeners. HELLO is answered with HELLO_ACK, a SAMPLE is aggregated and answered
+ * with an empty response, anything else is echoed back as the response. A trace context in front of
+ * the request is taken off, it isn't echoed.
+ */
+static int server_request_handler( const void *request, size_t len, void *response, size_t *response_len, void __attribute__((unused)) *ctx ) {
+    trace_record_t trace;
+    int traced;
+    int status;
+
+    if ((traced = trace_begin(request, len, &trace)) < 0) { return RPC_STATUS_ERROR; }
+
+    status = handle_request((const uint8_t *)request + traced, len - (size_t)traced, response, response_len);
+    finish_trace(&trace);
+
+    return status;
 }
 
-/* Child process isn't blocked waiting for socket, can perform background tasks */
-void child_process() {
-    int counter = 0;
+/* KV request handler
+ *
+ * Handler of kv listeners, kv_request_handler() with the trace context taken off the same way.
+ */
+static int kv_traced_handler( const void *request, size_t len, void *response, size_t *response_len, void *ctx ) {
+    trace_record_t trace;
+    int traced;
+    int status;
+
+    if ((traced = trace_begin(request, len, &trace)) < 0) { return RPC_STATUS_ERROR; }
 
-    // if ((id = initialize_sock(E_INET_SOCK, UDP_PORT_NUM, SERVER_SIDE)) < 0) {
-    //     printf("Failed to start socket\n");
-    //     return -1;
-    // }
+    status = kv_request_handler((const uint8_t *)request + traced, len - (size_t)traced, response, response_len, ctx);
+    finish_trace(&trace);
+
+    return status;
+}
+
+/* Child process isn't blocked waiting for socket, can perform background tasks
+ *
+ * Sleeps in poll() on the pipe from the parent until a record comes in or the next report is due.
+ * The supervisor watches the workers' liveness, and kills them with SIGTERM when the parent dies,
+ * they don't watch for it.
+ */
+void child_process( int worker ) {
+    char trace_path[LISTENER_ADDR_SIZE + 16] = "";
+    trace_record_t trace;
+    struct pollfd pfd;
+    msec_t next_report;
+    msec_t now;
 
     /* TODO: can turn a child process into a a port handler, aka a UDP server. The parent can be responsible for 
      * managing the application layer. So what does the server actually do based on the connection. So the child 
@@ -43,111 +247,678 @@ void child_process() {
      * the actually application memory and code is in an entirely different process.
      */
 
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGUSR2, SIG_IGN);
+
+    /* The parent's writer isn't forked */
+    (void)logger_start();
+
+    if (server_cfg.trace_path[0] != '\0') {
+        snprintf(trace_path, sizeof(trace_path), "%s.%d", server_cfg.trace_path, worker);
+    }
+
+    pfd.fd = get_pipe_read_fd(parent_to_child[worker]);
+    pfd.events = POLLIN;
+    next_report = get_monotonic_ms() + SCHEDULER_INTERVAL_1000_MS;
+
     for (;;) {
+        now = get_monotonic_ms();
+
+        if ((now < next_report) && (poll(&pfd, 1, (int)(next_report - now)) < 0) && (errno != EINTR)) {
+            log_error("Worker %d failed to poll its pipe", worker);
+            exit(EXIT_FAILURE);
+        }
+
+        /* Traces of messages the parent handled, the pipe is the last stage */
+        while (read_pipe_record(parent_to_child[worker], &trace, sizeof(trace)) == (int)sizeof(trace)) {
+            trace_stamp(&trace, E_TRACE_IPC_READ);
+            (void)trace_add(&trace);
+        }
 
         /* Maintains execution rate */
-        if (check_elasped_time(TASK_SCHEDULER_1000MS_RATE)) {
+        if ((now = get_monotonic_ms()) >= next_report) {
+            trace_report();
+            if (trace_path[0] != '\0') { (void)trace_dump(trace_path); }
 
-            if ((write_pipe(child_to_parent, (void *)&counter, sizeof(counter))) > 0) {
-                // printf("Child to parent: %d\n", counter);
-                counter = 0;
+            next_report = now + SCHEDULER_INTERVAL_1000_MS;
+        }
+    }
+}
+
+/* Report limits
+ *
+ * Prints what each listener shed since the previous report, quiet while nothing is shed.
+ */
+static void report_limits( void ) {
+    sock_limit_stats_t stats;
+    sock_limit_stats_t *prev;
+    sock_id_t id;
+
+    for (int i=0; i<server_cfg.num_listeners; i++) {
+        id = listener_ids[i];
+
+        if (get_sock_limit_stats(id, &stats) != SOCK_OK) { continue; }
+
+        prev = &reported_limits[id];
+
+        /* Counters restart when a socket id is reused */
+        if ((stats.rate_limited < prev->rate_limited) || (stats.conns_refused < prev->conns_refused)) {
+            memset(prev, 0, sizeof(*prev));
+        }
+
+        if ((stats.rate_limited != prev->rate_limited) || (stats.conns_refused != prev->conns_refused)) {
+            log_warn("Listener %s:%d rate limited %u receives, refused %u connections, %u peers, %u connections",
+                server_cfg.listeners[i].addr, server_cfg.listeners[i].port,
+                stats.rate_limited - prev->rate_limited, stats.conns_refused - prev->conns_refused,
+                stats.peers, stats.conns);
+        }
+
+        *prev = stats;
+    }
+}
+
+/* Report KV
+ *
+ * Logs the key-value cache's traffic since the previous report, quiet while it's idle. Counts of
+ * skipped ticks add up into the next report.
+ */
+static void report_kv( void ) {
+    kv_stats_t stats;
+    msec_t now = get_monotonic_ms();
+
+    if ((now - reported_kv_ms) < KV_REPORT_MS) { return; }
+
+    if ((get_kv_stats(&stats) < 0) || ((stats.gets == reported_kv.gets) && (stats.sets == reported_kv.sets) &&
+            (stats.deletes == reported_kv.deletes))) {
+        return;
+    }
+
+    log_info("KV %lu gets, %lu hits, %lu sets, %lu evicted, %lu expired, %u items in %zu of %zu KB",
+        (unsigned long)(stats.gets - reported_kv.gets), (unsigned long)(stats.hits - reported_kv.hits),
+        (unsigned long)(stats.sets - reported_kv.sets), (unsigned long)(stats.evictions - reported_kv.evictions),
+        (unsigned long)(stats.expired - reported_kv.expired), stats.items, stats.bytes / 1024, stats.memory / 1024);
+
+    reported_kv = stats;
+    reported_kv_ms = now;
+}
+
+/* Print rollup, the rollups are what's kept of the samples */
+static void print_rollup( const rollup_t *rollup, void __attribute__((unused)) *ctx ) {
+    log_info("Rollup %s %s [%ld, %ld) ms: count %lu, sum %ld, min %ld, max %ld, p50 %ld, p90 %ld, p99 %ld",
+        rollup->source, rollup->metric, (long)rollup->start_ms, (long)rollup->end_ms, (unsigned long)rollup->count,
+        (long)rollup->sum, (long)rollup->min, (long)rollup->max, (long)rollup->p50, (long)rollup->p90, (long)rollup->p99);
+}
+
+static void worker_main( void *arg ) {
+    int worker = (int)(intptr_t)arg;
+
+    (void)affinity_pin(&placement[1 + worker]);
+    child_process(worker);
+}
+
+/* Place processes
+ *
+ * Pins the event loop, which receives on every socket, before its buffers are allocated, workers
+ * pin themselves when they start.
+ */
+static void place_processes( const affinity_config_t *affinity ) {
+    if (affinity_plan(affinity, placement, 1 + MAX_NUM_OF_WORKERS) < 0) {
+        printf("Failed to plan CPU placement, not pinning\n");
+        for (int i=0; i<(1 + MAX_NUM_OF_WORKERS); i++) {
+            placement[i].cpu = -1;
+            placement[i].node = -1;
+        }
+    }
+
+    (void)affinity_pin(&placement[0]);
+
+    if (placement[0].cpu >= 0) {
+        printf("Event loop on CPU %d, node %d\n", placement[0].cpu, placement[0].node);
+    }
+}
+
+/* Start workers
+ *
+ * Forks workers until there are count running. Pipes for every worker slot are created up front,
+ * so a worker restarted by a reload or by the supervisor reuses the pipes of its slot. A worker
+ * that dies is restarted right away, with backoff if it keeps dying.
+ */
+static int start_workers( int count ) {
+    char name[SUPERVISOR_NAME_SIZE];
+    int id;
+
+    while (num_workers < count) {
+        snprintf(name, sizeof(name), "Worker %d", num_workers);
+
+        if ((id = supervisor_spawn(name, NULL, worker_main, (void *)(intptr_t)num_workers)) < 0) {
+            printf("Failed to fork process.\n");
+            return -1;
+        }
+
+        worker_ids[num_workers++] = id;
+    }
+
+    return 0;
+}
+
+/* Stop workers, terminating the highest slots until there are count running */
+static void stop_workers( int count ) {
+    while (num_workers > count) {
+        num_workers--;
+        (void)supervisor_stop(worker_ids[num_workers]);
+    }
+}
+
+/* Serve listener
+ *
+ * Registers the listener with the event loop, with the handlers of its role.
+ */
+static int serve_listener( sock_id_t id, const listener_config_t *listener ) {
+    switch (listener->role) {
+        case E_LISTENER_BROKER:
+            if (broker_open(id) < 0) { return -1; }
+            if (event_loop_add_listener(id, broker_message_handler, NULL) < 0) { return -1; }
+            return event_loop_set_close_handler(id, broker_conn_closed);
+        case E_LISTENER_RPC:
+            return rpc_serve(id, server_request_handler, NULL);
+        case E_LISTENER_KV:
+            if (kv_init(kv_memory_mb * 1024 * 1024) < 0) {
+                printf("Failed to allocate the key-value cache\n");
+                return -1;
             }
-                
-            if (counter > 10) {
-                // parent process is dead
-                exit(EXIT_FAILURE);
+            return rpc_serve(id, kv_traced_handler, NULL);
+        default:
+            if (event_loop_add_listener(id, server_message_handler, NULL) < 0) { return -1; }
+            return listener->compact ? event_loop_set_compact(id, true) : 0;
+    }
+}
+
+/* Apply configuration
+ *
+ * Moves the running server to new_cfg. Listeners present in both configurations keep their socket,
+ * and therefore their connections, only their options are updated. Listeners that were removed are
+ * closed and new ones are opened. A listener that fails to open is dropped from the configuration.
+ */
+static int apply_server_config( const server_config_t *new_cfg ) {
+    sock_id_t new_ids[MAX_NUM_OF_LISTENERS];
+    server_config_t cfg = *new_cfg;
+    bool kept[MAX_NUM_OF_LISTENERS] = { false };
+    int num_listeners = 0;
+
+    /* Workers pin themselves when forked, so they're restarted to move them, and to dump traces elsewhere */
+    if ((memcmp(&cfg.affinity, &server_cfg.affinity, sizeof(cfg.affinity)) != 0) ||
+            (strcmp(cfg.trace_path, server_cfg.trace_path) != 0)) {
+        stop_workers(0);
+    }
+
+    (void)trace_init(cfg.trace_path[0] != '\0', cfg.trace_sample);
+
+    place_processes(&cfg.affinity);
+
+    if (event_loop_init(cfg.buffer_size) < 0) {
+        printf("Failed to allocate receive buffer\n");
+        return -1;
+    }
+
+    if (supervisor_init() < 0) {
+        printf("Failed to start supervisor\n");
+        return -1;
+    }
+
+    for (int i=0; i<new_cfg->num_listeners; i++) {
+        listener_config_t *listener = &cfg.listeners[i];
+        sock_id_t id = SOCK_NOT_OK;
+
+        /* The kernel processes packets on the event loop's CPU, which is where they're read */
+        if ((listener->opts.incoming_cpu < 0) && (placement[0].cpu >= 0)) {
+            listener->opts.incoming_cpu = placement[0].cpu;
+        }
+
+        for (int j=0; j<server_cfg.num_listeners; j++) {
+            if (!kept[j] && is_same_listener(listener, &server_cfg.listeners[j])) {
+                kept[j] = true;
+                id = listener_ids[j];
+                (void)set_sock_opts(id, &listener->opts);
+                if (listener->compact != server_cfg.listeners[j].compact) {
+                    (void)event_loop_set_compact(id, listener->compact);
+                }
+                break;
             }
-            
-            counter++;
-            set_start_time(); // Reset scheduler
         }
 
+        if (id < 0) {
+            /* Handed over by the previous server process, or opened fresh */
+            if ((id = adopt_inherited_fd(listener)) < 0) {
+                id = initialize_sock_opts(listener->type, listener->addr, listener->port, SERVER_SIDE,
+                    &listener->opts);
+            }
 
-        fflush(stdout); // Flush the output buffer
+            if (id < 0) {
+                printf("Failed to start listener %s:%d\n", listener->addr, listener->port);
+                continue;
+            }
+
+            if (serve_listener(id, listener) < 0) {
+                printf("Failed to add listener %s:%d\n", listener->addr, listener->port);
+                (void)event_loop_remove_listener(id);
+                broker_close(id);
+                (void)close_sock(id);
+                continue;
+            }
+
+            printf("Listening on %s:%d\n", listener->addr, listener->port);
+        }
+
+        cfg.listeners[num_listeners] = *listener;
+        new_ids[num_listeners++] = id;
+    }
+
+    for (int j=0; j<server_cfg.num_listeners; j++) {
+        if (!kept[j]) {
+            printf("Closing listener %s:%d\n", server_cfg.listeners[j].addr, server_cfg.listeners[j].port);
+            (void)event_loop_remove_listener(listener_ids[j]);
+            broker_close(listener_ids[j]);
+            (void)close_sock(listener_ids[j]);
+        }
+    }
+
+    cfg.num_listeners = num_listeners;
+    memcpy(listener_ids, new_ids, sizeof(new_ids));
+
+    /* New windows start over, the samples of the open ones are dropped */
+    if ((server_cfg.aggregate.window_ms == 0) || !aggregate_same_config(&cfg.aggregate, &server_cfg.aggregate)) {
+        if (aggregate_init(&cfg.aggregate) < 0) {
+            printf("Failed to allocate rollup windows\n");
+            return -1;
+        }
+    }
+
+    /* A changed path or segment size starts a new capture, a failed one is retried on reload */
+    if (cfg.capture_path[0] == '\0') {
+        capture_stop();
+    } else if (!capture_active() || (strcmp(cfg.capture_path, server_cfg.capture_path) != 0) ||
+               (cfg.capture_segment_mb != server_cfg.capture_segment_mb)) {
+        if (capture_start(cfg.capture_path, cfg.capture_segment_mb * 1024 * 1024) == CAPTURE_OK) {
+            printf("Capturing to %s\n", cfg.capture_path);
+        } else {
+            printf("Failed to capture to %s\n", cfg.capture_path);
+        }
+    }
+
+    stop_workers(cfg.num_workers);
+    server_cfg = cfg;
+
+    if (start_workers(cfg.num_workers) < 0) { return -1; }
+
+    return (num_listeners > 0) ? 0 : -1;
+}
+
+/* Load inherited fds
+ *
+ * Parses the listener fds passed by a previous server process during an upgrade. The variable is
+ * removed, so it isn't passed on to workers or a later upgrade.
+ */
+static void load_inherited_fds( void ) {
+    char *env;
+    char *save = NULL;
+    char *entry;
+    char type[8];
+    int role;
+    inherited_fd_t *inherited;
+
+    if ((env = getenv(LISTEN_FDS_ENV)) == NULL) { return; }
+
+    env = strdup(env);
+    unsetenv(LISTEN_FDS_ENV);
+
+    for (entry = strtok_r(env, ",", &save); entry != NULL; entry = strtok_r(NULL, ",", &save)) {
+        if (num_inherited_fds >= MAX_NUM_OF_LISTENERS) { break; }
+
+        inherited = &inherited_fds[num_inherited_fds];
+        memset(inherited, 0, sizeof(*inherited));
+
+        if (sscanf(entry, "%7s %d %d %d %107s", type, &inherited->fd, &inherited->listener.port, &role,
+                inherited->listener.addr) != 5) {
+            continue;
+        }
+
+        inherited->listener.role = (E_LISTENER_ROLE)role;
+
+        for (int i=0; i<(int)(sizeof(listener_type_str) / sizeof(listener_type_str[0])); i++) {
+            if (strcmp(type, listener_type_str[i]) == 0) {
+                inherited->listener.type = (E_APP_SOCK_TYPE)i;
+                num_inherited_fds++;
+                break;
+            }
+        }
+    }
+
+    free(env);
+}
+
+/* Adopt an inherited fd
+ *
+ * Returns the socket id of the inherited fd matching listener, or SOCK_NOT_OK if there is none.
+ * The socket keeps its pending connections, clients never see the listener go away.
+ */
+static sock_id_t adopt_inherited_fd( const listener_config_t *listener ) {
+    sock_id_t id;
+
+    for (int i=0; i<num_inherited_fds; i++) {
+        if (inherited_fds[i].adopted || !is_same_listener(listener, &inherited_fds[i].listener)) { continue; }
+
+        if ((id = adopt_sock(listener->type, inherited_fds[i].fd, listener->addr, listener->port,
+                &listener->opts)) < 0) {
+            return SOCK_NOT_OK;
+        }
+
+        (void)set_sock_opts(id, &listener->opts);
+        inherited_fds[i].adopted = true;
+
+        return id;
+    }
+
+    return SOCK_NOT_OK;
+}
+
+/* Finish inheriting
+ *
+ * Closes inherited fds that are no longer configured, and tells the previous server process that it
+ * can stop accepting.
+ */
+static void finish_inherit( void ) {
+    void (*prev_sigpipe)( int );
+    char *env;
+    char ready = 1;
+    int fd;
+
+    for (int i=0; i<num_inherited_fds; i++) {
+        if (inherited_fds[i].adopted) { continue; }
+
+        (void)close(inherited_fds[i].fd);
+
+        if (inherited_fds[i].listener.type == E_LOCAL_SOCK) {
+            (void)unlink(inherited_fds[i].listener.addr);
+        }
+    }
+    num_inherited_fds = 0;
+
+    if ((env = getenv(READY_FD_ENV)) == NULL) { return; }
+
+    fd = atoi(env);
+    unsetenv(READY_FD_ENV);
+
+    /* A previous server that was shut down meanwhile has exited, which mustn't end this one */
+    prev_sigpipe = signal(SIGPIPE, SIG_IGN);
+
+    if (write(fd, &ready, sizeof(ready)) < 0) {
+        printf("Failed to notify previous server\n");
+    }
+    (void)close(fd);
+
+    (void)signal(SIGPIPE, prev_sigpipe);
+}
+
+/* Begin draining
+ *
+ * Stops accepting on every listener, connections already accepted are served until they close or
+ * drain_ms expires. Broker connections are closed right away. On handoff the listeners are released
+ * rather than closed, so the path of a local listener stays in place for the new server process.
+ */
+static void begin_drain( bool handoff ) {
+    for (int i=0; i<server_cfg.num_listeners; i++) {
+        if (server_cfg.listeners[i].role == E_LISTENER_BROKER) {
+            /* Subscribers never finish, they reconnect to the new server */
+            (void)event_loop_remove_listener(listener_ids[i]);
+            broker_close(listener_ids[i]);
+        } else {
+            (void)event_loop_stop_listener(listener_ids[i]);
+        }
+
+        if (handoff) {
+            (void)release_sock(listener_ids[i]);
+        } else {
+            (void)close_sock(listener_ids[i]);
+        }
+    }
+
+    server_cfg.num_listeners = 0;
+
+    draining = true;
+    drain_deadline = get_monotonic_ms() + server_cfg.drain_ms;
 
-    }    
+    printf("Draining %d connections\n", event_loop_num_conns());
+}
+
+static void finish_drain( void ) {
+    if (event_loop_num_conns() > 0) {
+        printf("Drain deadline expired, closing %d connections\n", event_loop_num_conns());
+        event_loop_close_all_conns();
+    }
+
+    stop_workers(0);
+    capture_stop();
+
+    logger_flush();
+    fprintf(stderr, "Closing server\n");
+    exit(EXIT_SUCCESS);
+}
+
+/* Upgrade ready handler
+ *
+ * The new server process writes a byte once it serves the listeners. EOF means it exited before
+ * that, e.g. the binary failed to exec or the config is invalid, and this process keeps serving.
+ * Only an exited process closes the pipe, so it's reaped right away. If a shutdown began draining
+ * meanwhile the listeners were already handed over.
+ */
+static void upgrade_ready_handler( int fd, uint32_t __attribute__((unused)) events, void __attribute__((unused)) *ctx ) {
+    char ready = 0;
+    ssize_t num_bytes = read(fd, &ready, sizeof(ready));
+
+    if ((num_bytes < 0) && (errno == EAGAIN)) { return; }
+
+    (void)event_loop_unwatch_fd(fd);
+    (void)close(fd);
+    upgrade_ready_fd = -1;
+
+    if ((num_bytes == 1) && ready) {
+        printf("Upgraded server %d is ready\n", upgrade_pid);
+        if (!draining) { begin_drain(true); }
+        return;
+    }
+
+    printf("Upgrade failed, server %d exited\n", upgrade_pid);
+
+    /* A read error leaves it running */
+    if (num_bytes != 0) { (void)kill(upgrade_pid, SIGTERM); }
+
+    while ((waitpid(upgrade_pid, NULL, 0) < 0) && (errno == EINTR)) {}
+    upgrade_pid = 0;
+}
+
+/* Start upgrade
+ *
+ * Zero-downtime restart. Execs the server binary again, as a child, with the listening fds inherited
+ * and described in LISTEN_FDS_ENV. The kernel keeps queueing connections on the shared listeners
+ * while the new process starts, once it reports ready this process stops accepting and drains.
+ */
+static void start_upgrade( void ) {
+    char env[LISTEN_FDS_ENV_SIZE] = "";
+    char entry[LISTENER_ADDR_SIZE + 32];
+    char ready_fd_str[16];
+    int ready[2];
+    int keep_fds[MAX_NUM_OF_LISTENERS];
+    int max_fd;
+    bool keep;
+    pid_t pid;
+
+    if (draining || (upgrade_pid > 0)) { return; }
+
+    for (int i=0; i<server_cfg.num_listeners; i++) {
+        const listener_config_t *listener = &server_cfg.listeners[i];
+
+        keep_fds[i] = get_sock_fd(listener_ids[i]);
+        snprintf(entry, sizeof(entry), "%s%s %d %d %d %s", (i > 0) ? "," : "", listener_type_str[listener->type],
+            keep_fds[i], listener->port, (int)listener->role, listener->addr);
+        strncat(env, entry, sizeof(env) - strlen(env) - 1);
+    }
+
+    if (pipe2(ready, O_CLOEXEC) < 0) {
+        printf("Failed to create upgrade pipe\n");
+        return;
+    }
+
+    fflush(stdout);
+
+    if ((pid = fork()) == -1) {
+        printf("Failed to fork upgrade process.\n");
+        (void)close(ready[READ_END_OF_PIPE]);
+        (void)close(ready[WRITE_END_OF_PIPE]);
+        return;
+    }
+
+    if (pid == 0) {
+        /* Only the listeners and the ready pipe survive exec */
+        max_fd = (int)sysconf(_SC_OPEN_MAX);
+        for (int fd=3; fd<max_fd; fd++) {
+            keep = (fd == ready[WRITE_END_OF_PIPE]);
+            for (int i=0; i<server_cfg.num_listeners; i++) {
+                keep = keep || (fd == keep_fds[i]);
+            }
+            if (!keep) { (void)close(fd); }
+        }
+
+        (void)fcntl(ready[WRITE_END_OF_PIPE], F_SETFD, 0);
+        snprintf(ready_fd_str, sizeof(ready_fd_str), "%d", ready[WRITE_END_OF_PIPE]);
+
+        setenv(LISTEN_FDS_ENV, env, 1);
+        setenv(READY_FD_ENV, ready_fd_str, 1);
+
+        execvp(server_argv[0], server_argv);
+        _exit(127);
+    }
+
+    (void)close(ready[WRITE_END_OF_PIPE]);
+
+    if (event_loop_watch_fd(ready[READ_END_OF_PIPE], EPOLLIN, upgrade_ready_handler, NULL) < 0) {
+        (void)close(ready[READ_END_OF_PIPE]);
+        return;
+    }
+
+    upgrade_pid = pid;
+    upgrade_ready_fd = ready[READ_END_OF_PIPE];
+
+    printf("Upgrading, started server %d\n", pid);
 }
 
 int main( int argc, char *argv[] )
 {
-    char buffer[128] = "";
-    int rc;
-    int ipc_buffer;
+    server_config_t cfg;
+    msec_t last_tick;
+    msec_t elapsed;
+    msec_t timeout;
+
+    server_argv = argv;
 
     signal(SIGINT, int_handler);
+    signal(SIGTERM, int_handler);
+    signal(SIGHUP, hup_handler);
+    signal(SIGUSR2, usr2_handler);
     
     /* This can cause weird behavior as SIGPIPE is used in sockets */
     // signal(SIGPIPE, sigpipe_handler);
 
-    if ((parent_to_child = create_pipe()) < 0) {
-        printf("Failed to create parent_to_child pipe\n");
-        return -1;
+    /* Messages are written and stdout is flushed by the logger's thread, not the scheduler loop */
+    (void)logger_start();
+
+    if (argc > 1) {
+        config_path = argv[1];
     }
 
-    if ((child_to_parent = create_pipe()) < 0) {
-        printf("Failed to create child_to_parent pipe\n");
-        return -1;
+    if (load_server_config(config_path, &cfg) < 0) {
+        if (argc > 1) {
+            exit(EXIT_FAILURE);
+        }
+        printf("Using default configuration\n");
+        get_default_server_config(&cfg);
     }
 
-    if ((child_pid = fork()) == -1) {
-        printf("Failed to fork process.\n");
-        return -1;
-    } else if (child_pid == 0) {
-        child_process();
-        return 0;
-    } else {
-        // Parent continue ...
-    }    
-        
-    // if ((id = initialize_sock(E_LOCAL_SOCK, my_sock, 0, SERVER_SIDE)) < 0) {
-    //     printf("Failed to start socket\n");
-        //  kill(child_pid, SIGTERM);
-        //  exit(EXIT_FAILURE);
-    // }
-    
-    // if ((id = initialize_sock(E_TCP_SOCK, "0.0.0.0", 9003, SERVER_SIDE)) < 0) {
-    //     printf("Failed to start socket\n");
-        //  kill(child_pid, SIGTERM);
-        //  exit(EXIT_FAILURE);
-    // }
-
-    // if ((id = initialize_sock(E_TCP_SOCK, "::", 9003, SERVER_SIDE)) < 0) {
-    //     printf("Failed to start socket\n");
-    //     kill(child_pid, SIGTERM);
-    //     exit(EXIT_FAILURE);
-    // }
-
-    if ((id = initialize_sock(E_UDP_SOCK, "127.0.0.1", 9003, SERVER_SIDE)) < 0) {
+    kv_memory_mb = cfg.kv_memory_mb;
+
+    for (int i=0; i<MAX_NUM_OF_WORKERS; i++) {
+        if ((parent_to_child[i] = create_pipe()) < 0) {
+            printf("Failed to create parent_to_child pipe\n");
+            return -1;
+        }
+
+        /* Set before the workers fork, so both ends agree */
+        (void)set_pipe_checksum(parent_to_child[i], true);
+    }
+
+    load_inherited_fds();
+
+    if (apply_server_config(&cfg) < 0) {
         printf("Failed to get a socket.\n");
-         kill(child_pid, SIGTERM);
-         exit(EXIT_FAILURE);
-    }     
+        stop_workers(0);
+        exit(EXIT_FAILURE);
+    }
+
+    finish_inherit();
 
-   /* Initialize scheduler */ 
-    set_start_time();
+    /* Initialize scheduler
+     *
+     * The parent blocks in the event loop between ticks, so the scheduler is driven by the monotonic
+     * clock rather than CPU time. */
+    last_tick = get_monotonic_ms();
 
     /* Task Scheduler */
     for (;;) {
 
-        if (check_elasped_time(TASK_SCHEDULER_1000MS_RATE)) {
+        /* The listeners of an upgrade in flight are the new server's as well, so they're handed over */
+        if (shutdown_requested && !draining) {
+            begin_drain(upgrade_pid > 0);
+        }
 
-            // if ((rc = await_local_receive(id, buffer, sizeof(buffer))) >= 0) {
-            //     printf("Buffer: %s\n", buffer);
-            // }
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            start_upgrade();
+        }
 
-            if ((rc = await_network_receive(id, buffer, sizeof(buffer))) >= 0) {
-                printf("Buffer: %s\n", buffer);
-            }            
+        if (draining && ((event_loop_num_conns() == 0) || (get_monotonic_ms() >= drain_deadline))) {
+            finish_drain();
+        }
 
-            if ((read_pipe(child_to_parent, (void *)&ipc_buffer, sizeof(ipc_buffer))) > 0) {
-                //printf("Parent read from child: %d\n", ipc_buffer);
-            }
+        if (reload_requested && !draining) {
+            reload_requested = 0;
+            printf("Reloading %s\n", config_path);
 
-            set_start_time(); // Reset scheduler
+            if (load_server_config(config_path, &cfg) == CONFIG_OK) {
+                (void)apply_server_config(&cfg);
+            }
         }
-            
-        fflush(stdout); // Flush the output buffer
 
+        elapsed = get_monotonic_ms() - last_tick;
+        timeout = (elapsed < server_cfg.scheduler_ms) ? (server_cfg.scheduler_ms - elapsed) : 0;
+
+        /* Dispatch messages from every listener until the next tick is due, waking up often enough
+         * for reliable UDP retransmits */
+        (void)event_loop_run_once((timeout < RUDP_TICK_MS) ? (int)timeout : RUDP_TICK_MS);
+
+        rudp_tick_all();
+        broker_tick_all();
+        rpc_tick_all();
+        supervisor_tick();
+
+        if ((get_monotonic_ms() - last_tick) >= server_cfg.scheduler_ms) {
+
+            report_limits();
+            report_kv();
+            (void)aggregate_tick(get_monotonic_ms(), print_rollup, NULL);
+
+            last_tick = get_monotonic_ms(); // Reset scheduler
+        }
     }
 
     return 0;
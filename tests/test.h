@@ -0,0 +1,23 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Unit Tests
+ *
+ * Each test is an executable run by ctest, failing when main() returns non-zero. CHECK() prints
+ * the condition that failed with its line and counts it, main() returns TEST_RESULT().
+ */
+static int test_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() ((test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE)
+
+#endif // _TEST_H_
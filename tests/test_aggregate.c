@@ -0,0 +1,212 @@
+#include "aggregate.h"
+#include "test.h"
+
+#define TEST_MAX_ROLLUPS 16
+#define TEST_SAMPLES 10000
+
+/* The sketch's bins are a quarter of a power of two wide, estimates are the middle of a bin */
+#define TEST_RELATIVE_ERROR 0.125
+
+typedef struct {
+    int count;
+    rollup_t rollups[TEST_MAX_ROLLUPS];
+    char metrics[TEST_MAX_ROLLUPS][AGGREGATE_NAME_SIZE];
+} test_rollups_t;
+
+/* Static Functions */
+static msec_t _init( E_WINDOW_TYPE type, msec_t window_ms, msec_t slide_ms );
+static void _collect( const rollup_t *rollup, void *ctx );
+static const rollup_t *_find( const test_rollups_t *rollups, const char *metric );
+static bool _near( int64_t estimate, int64_t exact );
+static void _add( const char *metric, int64_t value );
+static void _test_quantiles( void );
+static void _test_negative( void );
+static void _test_windows( void );
+static void _test_config( void );
+
+int main( void ) {
+    _test_quantiles();
+    _test_negative();
+    _test_windows();
+    _test_config();
+
+    return TEST_RESULT();
+}
+
+/* Returns the start of the open slide, retried if a slide ended while aggregate_init() ran */
+static msec_t _init( E_WINDOW_TYPE type, msec_t window_ms, msec_t slide_ms ) {
+    aggregate_config_t cfg = { type, window_ms, slide_ms };
+    msec_t slide = (type == E_WINDOW_TUMBLING) ? window_ms : slide_ms;
+    msec_t before;
+
+    do {
+        before = get_monotonic_ms() / slide;
+        CHECK(aggregate_init(&cfg) == AGGREGATE_OK);
+    } while ((get_monotonic_ms() / slide) != before);
+
+    return before * slide;
+}
+
+static void _collect( const rollup_t *rollup, void *ctx ) {
+    test_rollups_t *rollups = ctx;
+
+    if (rollups->count == TEST_MAX_ROLLUPS) { return; }
+
+    /* The names are only valid during the call */
+    strncpy(rollups->metrics[rollups->count], rollup->metric, AGGREGATE_NAME_SIZE - 1);
+    rollups->rollups[rollups->count] = *rollup;
+    rollups->rollups[rollups->count].metric = rollups->metrics[rollups->count];
+    rollups->rollups[rollups->count].source = NULL;
+    rollups->count++;
+}
+
+static const rollup_t *_find( const test_rollups_t *rollups, const char *metric ) {
+    for (int i=0; i<rollups->count; i++) {
+        if (strcmp(rollups->rollups[i].metric, metric) == 0) { return &rollups->rollups[i]; }
+    }
+
+    return NULL;
+}
+
+static bool _near( int64_t estimate, int64_t exact ) {
+    double error = (double)(estimate - exact);
+
+    if (error < 0) { error = -error; }
+
+    return error <= (TEST_RELATIVE_ERROR * (double)((exact < 0) ? -exact : exact));
+}
+
+static void _add( const char *metric, int64_t value ) {
+    CHECK(aggregate_add("test", 4, metric, strlen(metric), value) == AGGREGATE_OK);
+}
+
+/* Uniform samples at two scales, the quantiles of 1..N are known, the larger up to 2^30 */
+static void _test_quantiles( void ) {
+    test_rollups_t rollups = { 0 };
+    const rollup_t *rollup;
+    msec_t start = _init(E_WINDOW_TUMBLING, 60000, 0);
+
+    for (int64_t i=1; i<=TEST_SAMPLES; i++) {
+        _add("small", i);
+        _add("large", i * 100000);
+    }
+
+    CHECK(aggregate_tick(start + 59999, _collect, &rollups) == AGGREGATE_OK);
+    CHECK(rollups.count == 0);
+
+    CHECK(aggregate_tick(start + 60000, _collect, &rollups) == AGGREGATE_OK);
+    CHECK(rollups.count == 2);
+
+    CHECK((rollup = _find(&rollups, "small")) != NULL);
+    if (rollup != NULL) {
+        CHECK((rollup->start_ms == start) && (rollup->end_ms == (start + 60000)));
+        CHECK(rollup->count == TEST_SAMPLES);
+        CHECK(rollup->sum == ((int64_t)TEST_SAMPLES * (TEST_SAMPLES + 1)) / 2);
+        CHECK((rollup->min == 1) && (rollup->max == TEST_SAMPLES));
+        CHECK(_near(rollup->p50, 5000) && _near(rollup->p90, 9000) && _near(rollup->p99, 9900));
+    }
+
+    CHECK((rollup = _find(&rollups, "large")) != NULL);
+    if (rollup != NULL) {
+        CHECK(_near(rollup->p50, 500000000) && _near(rollup->p90, 900000000) && _near(rollup->p99, 990000000));
+    }
+}
+
+/* Negative samples are ordered below the rest, not folded onto their magnitudes */
+static void _test_negative( void ) {
+    test_rollups_t rollups = { 0 };
+    const rollup_t *rollup;
+    msec_t start = _init(E_WINDOW_TUMBLING, 60000, 0);
+
+    for (int64_t i=1; i<=TEST_SAMPLES; i++) {
+        _add("negative", -i);
+        _add("mixed", i - 1001);
+    }
+
+    CHECK(aggregate_tick(start + 60000, _collect, &rollups) == AGGREGATE_OK);
+    CHECK(rollups.count == 2);
+
+    CHECK((rollup = _find(&rollups, "negative")) != NULL);
+    if (rollup != NULL) {
+        CHECK((rollup->min == -TEST_SAMPLES) && (rollup->max == -1));
+        CHECK(_near(rollup->p50, -5000) && _near(rollup->p90, -1000) && _near(rollup->p99, -100));
+    }
+
+    CHECK((rollup = _find(&rollups, "mixed")) != NULL);
+    if (rollup != NULL) {
+        CHECK((rollup->min == -1000) && (rollup->max == (TEST_SAMPLES - 1001)));
+        CHECK(_near(rollup->p50, 3999) && _near(rollup->p90, 7999) && _near(rollup->p99, 8899));
+    }
+}
+
+/* A sliding window of 3 slides keeps a sample for 3 rollups, and forgets a series a window after it */
+static void _test_windows( void ) {
+    test_rollups_t rollups = { 0 };
+    aggregate_config_t bad = { E_WINDOW_SLIDING, 300, 70 };
+    aggregate_stats_t stats;
+    msec_t start = _init(E_WINDOW_SLIDING, 300, 100);
+    uint64_t expected[] = { 1, 3, 3, 2, 0 };
+
+    _add("slide", 10);
+
+    for (int i=0; i<5; i++) {
+        rollups.count = 0;
+        CHECK(aggregate_tick(start + ((i + 1) * 100), _collect, &rollups) == AGGREGATE_OK);
+
+        if (expected[i] == 0) {
+            CHECK(rollups.count == 0);
+        } else {
+            CHECK(rollups.count == 1);
+            CHECK((rollups.rollups[0].count == expected[i]) && (rollups.rollups[0].end_ms == (start + ((i + 1) * 100))));
+            CHECK(rollups.rollups[0].start_ms == (rollups.rollups[0].end_ms - 300));
+        }
+
+        /* Two samples in the second slide only */
+        if (i == 0) {
+            _add("slide", 20);
+            _add("slide", 30);
+        }
+    }
+
+    CHECK(get_aggregate_stats(&stats) == AGGREGATE_OK);
+    CHECK((stats.series == 0) && (stats.samples == 3) && (stats.rollups == 4));
+
+    /* A gap longer than the window closes each bucket once, then empty windows are skipped */
+    _add("gap", 1);
+    rollups.count = 0;
+    CHECK(aggregate_tick(start + 100000, _collect, &rollups) == AGGREGATE_OK);
+    CHECK(rollups.count == 3);
+
+    /* A window must be a whole number of at most AGGREGATE_MAX_BUCKETS slides */
+    CHECK(aggregate_init(&bad) == AGGREGATE_NOT_OK);
+    bad.slide_ms = 300 / (AGGREGATE_MAX_BUCKETS + 1);
+    bad.window_ms = bad.slide_ms * (AGGREGATE_MAX_BUCKETS + 1);
+    CHECK(aggregate_init(&bad) == AGGREGATE_NOT_OK);
+}
+
+/* Padding doesn't count, and neither does a tumbling window's slide */
+static void _test_config( void ) {
+    aggregate_config_t a;
+    aggregate_config_t b;
+
+    memset(&a, 0x00, sizeof(a));
+    memset(&b, 0xaa, sizeof(b));
+
+    a.type = b.type = E_WINDOW_SLIDING;
+    a.window_ms = b.window_ms = 1000;
+    a.slide_ms = b.slide_ms = 100;
+    CHECK(aggregate_same_config(&a, &b));
+
+    b.slide_ms = 200;
+    CHECK(!aggregate_same_config(&a, &b));
+
+    a.type = b.type = E_WINDOW_TUMBLING;
+    CHECK(aggregate_same_config(&a, &b));
+
+    b.window_ms = 2000;
+    CHECK(!aggregate_same_config(&a, &b));
+
+    b.window_ms = 1000;
+    b.type = E_WINDOW_SLIDING;
+    CHECK(!aggregate_same_config(&a, &b));
+}
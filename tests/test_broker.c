@@ -0,0 +1,325 @@
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "broker.h"
+#include "test.h"
+
+#define TEST_PATH_SIZE 64
+#define TEST_RECV_TIMEOUT_MS 200
+
+/* Far more than a subscriber's socket and queue hold, far less than wraps the ring */
+#define TEST_MAX_PUBLISHES 10000
+
+typedef struct {
+    sock_id_t server;
+    sock_id_t publisher;
+    char path[TEST_PATH_SIZE];
+} test_broker_t;
+
+static test_broker_t test;
+
+/* Static Functions */
+static void _pump( void );
+static sock_id_t _subscriber( const char *topic, E_BROKER_POLICY policy );
+static void _close( sock_id_t id );
+static void _publish( const char *topic, const void *buffer, size_t len );
+static void _stats( broker_stats_t *stats );
+static void _test_round_trip( void );
+static void _test_drop( void );
+static void _test_conflate( void );
+static void _test_disconnect( void );
+static void _test_ring_reclaim( void );
+static void _test_topic_reclaim( void );
+
+int main( void ) {
+    snprintf(test.path, sizeof(test.path), "/tmp/test_broker_%d.sock", (int)getpid());
+    (void)unlink(test.path);
+
+    CHECK(event_loop_init(4 * BROKER_MAX_FRAME) == EVENT_OK);
+    CHECK((test.server = initialize_sock(E_LOCAL_SOCK, test.path, 0, SERVER_SIDE)) >= 0);
+    CHECK(broker_open(test.server) == SOCK_OK);
+    CHECK(event_loop_add_listener(test.server, broker_message_handler, NULL) == EVENT_OK);
+    CHECK(event_loop_set_close_handler(test.server, broker_conn_closed) == EVENT_OK);
+    CHECK((test.publisher = initialize_sock(E_LOCAL_SOCK, test.path, 0, CLIENT_SIDE)) >= 0);
+
+    _test_round_trip();
+    _test_drop();
+    _test_conflate();
+    _test_disconnect();
+    _test_ring_reclaim();
+    _test_topic_reclaim();
+
+    _close(test.publisher);
+    broker_close(test.server);
+    (void)event_loop_remove_listener(test.server);
+    (void)close_sock(test.server);
+
+    return TEST_RESULT();
+}
+
+/* Runs the broker until it has nothing left to do */
+static void _pump( void ) {
+    while (event_loop_run_once(0) > 0) { }
+}
+
+/* A receive that finds nothing fails after TEST_RECV_TIMEOUT_MS instead of blocking */
+static sock_id_t _subscriber( const char *topic, E_BROKER_POLICY policy ) {
+    struct timeval timeout = { 0, TEST_RECV_TIMEOUT_MS * 1000 };
+    sock_id_t id;
+
+    CHECK((id = initialize_sock(E_LOCAL_SOCK, test.path, 0, CLIENT_SIDE)) >= 0);
+    CHECK(setsockopt(get_sock_fd(id), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    CHECK(broker_subscribe(&id, topic, policy) == SOCK_OK);
+    _pump();
+
+    return id;
+}
+
+static void _close( sock_id_t id ) {
+    broker_release(id);
+    (void)close_sock(id);
+    _pump();
+}
+
+static void _publish( const char *topic, const void *buffer, size_t len ) {
+    CHECK(broker_publish(&test.publisher, topic, buffer, len) == SOCK_OK);
+    _pump();
+}
+
+static void _stats( broker_stats_t *stats ) {
+    CHECK(get_broker_stats(test.server, stats) == SOCK_OK);
+}
+
+/* A message reaches the subscriber of its topic through the ring, others only go to the ring */
+static void _test_round_trip( void ) {
+    sock_id_t sub = _subscriber("prices", BROKER_POLICY_DROP);
+    broker_stats_t stats;
+    broker_msg_t msg = { 0 };
+
+    _publish("other", "ignored", 7);
+    _publish("prices", "hello", 5);
+
+    CHECK(broker_receive(sub, &msg) == SOCK_OK);
+    CHECK((strcmp(msg.topic, "prices") == 0) && (msg.len == 5) && (memcmp(msg.data, "hello", 5) == 0));
+    CHECK((msg.seq == 1) && (msg.dropped == 0));
+    CHECK(broker_msg_valid(sub, &msg));
+
+    /* An empty message is a message */
+    _publish("prices", NULL, 0);
+    CHECK((broker_receive(sub, &msg) == SOCK_OK) && (msg.len == 0) && (msg.seq == 2));
+
+    _stats(&stats);
+    CHECK((stats.published == 3) && (stats.notified == 2) && (stats.subscribers == 1));
+
+    /* Unsubscribed, the next message isn't sent */
+    CHECK(broker_unsubscribe(&sub, "prices") == SOCK_OK);
+    _pump();
+    _publish("prices", "gone", 4);
+    CHECK(broker_receive(sub, &msg) == SOCK_NOT_OK);
+
+    /* Over the limits of a frame */
+    CHECK(broker_publish(&test.publisher, "", "x", 1) == SOCK_NOT_OK);
+    CHECK(broker_publish(&test.publisher, "prices", "x", BROKER_MAX_PAYLOAD + 1) == SOCK_NOT_OK);
+
+    _close(sub);
+
+    _stats(&stats);
+    CHECK(stats.subscribers == 0);
+}
+
+/* A subscriber that doesn't read fills its socket and its queue, then misses messages. Each one it
+ * missed is counted once in the dropped of the next message it gets.
+ */
+static void _test_drop( void ) {
+    sock_id_t sub = _subscriber("drop", BROKER_POLICY_DROP);
+    broker_stats_t before;
+    broker_stats_t stats;
+    broker_msg_t msg = { 0 };
+    uint32_t published = 0;
+    uint32_t seen = 0;
+    uint64_t last_seq = 0;
+
+    _stats(&before);
+
+    do {
+        _publish("drop", &published, sizeof(published));
+        published++;
+        _stats(&stats);
+    } while ((stats.dropped == before.dropped) && (published < TEST_MAX_PUBLISHES));
+
+    CHECK(stats.dropped > before.dropped);
+
+    /* A few more than the queue holds, so messages are dropped between ones that are queued */
+    for (int i=0; i<BROKER_MAX_PENDING; i++) {
+        _publish("drop", &published, sizeof(published));
+        published++;
+    }
+
+    while (broker_receive(sub, &msg) == SOCK_OK) {
+        CHECK(msg.seq > last_seq);
+        last_seq = msg.seq;
+        seen += 1 + msg.dropped;
+        broker_tick_all();
+    }
+
+    /* Messages dropped after the last queued one are reported with the next one */
+    _publish("drop", &published, sizeof(published));
+    published++;
+
+    CHECK(broker_receive(sub, &msg) == SOCK_OK);
+    seen += 1 + msg.dropped;
+
+    CHECK(seen == published);
+
+    _close(sub);
+}
+
+/* A conflating subscriber that doesn't read gets the latest message of each topic, and what it
+ * missed in dropped
+ */
+static void _test_conflate( void ) {
+    sock_id_t sub = _subscriber("a", BROKER_POLICY_CONFLATE);
+    const char *topics[] = { "a", "b" };
+    uint32_t last[2] = { 0, 0 };
+    broker_stats_t before;
+    broker_stats_t stats;
+    broker_msg_t msg = { 0 };
+    uint32_t published = 0;
+    uint32_t seen = 0;
+    uint32_t value;
+    int t;
+
+    CHECK(broker_subscribe(&sub, "b", BROKER_POLICY_CONFLATE) == SOCK_OK);
+    _pump();
+
+    _stats(&before);
+
+    do {
+        _publish(topics[published % 2], &published, sizeof(published));
+        published++;
+        _stats(&stats);
+    } while ((stats.conflated < (before.conflated + 10)) && (published < TEST_MAX_PUBLISHES));
+
+    CHECK(stats.conflated >= (before.conflated + 10));
+    CHECK(stats.dropped == before.dropped);
+
+    while (broker_receive(sub, &msg) == SOCK_OK) {
+        t = (strcmp(msg.topic, "b") == 0) ? 1 : 0;
+
+        memcpy(&value, msg.data, sizeof(value));
+        CHECK((value % 2) == (uint32_t)t);
+        CHECK(broker_msg_valid(sub, &msg));
+
+        last[t] = value;
+        seen += 1 + msg.dropped;
+        broker_tick_all();
+    }
+
+    CHECK(seen == published);
+    CHECK((last[(published - 1) % 2] == (published - 1)) && (last[published % 2] == (published - 2)));
+
+    _close(sub);
+}
+
+/* A subscriber that can't keep up is disconnected, after what was sent to it */
+static void _test_disconnect( void ) {
+    sock_id_t sub = _subscriber("slow", BROKER_POLICY_DISCONNECT);
+    broker_stats_t before;
+    broker_stats_t stats;
+    broker_msg_t msg = { 0 };
+    uint32_t published = 0;
+    uint64_t last_seq = 0;
+    char byte;
+
+    _stats(&before);
+
+    do {
+        _publish("slow", &published, sizeof(published));
+        published++;
+        _stats(&stats);
+    } while ((stats.disconnected == before.disconnected) && (published < TEST_MAX_PUBLISHES));
+
+    CHECK(stats.disconnected == (before.disconnected + 1));
+    CHECK(stats.subscribers == 0);
+
+    /* Nothing is missing up to the disconnect */
+    while (broker_receive(sub, &msg) == SOCK_OK) {
+        CHECK(msg.dropped == 0);
+        CHECK((last_seq == 0) || (msg.seq == (last_seq + 1)));
+        last_seq = msg.seq;
+    }
+
+    CHECK(last_seq > 0);
+    CHECK(recv(get_sock_fd(sub), &byte, 1, MSG_DONTWAIT) == 0);
+
+    _close(sub);
+}
+
+/* Messages larger than the ring in total wrap it. The oldest are overwritten and no longer valid,
+ * a subscriber that keeps up misses nothing.
+ */
+static void _test_ring_reclaim( void ) {
+    static char payload[BROKER_MAX_PAYLOAD];
+    sock_id_t sub = _subscriber("ring", BROKER_POLICY_DROP);
+    broker_msg_t first = { 0 };
+    broker_msg_t msg = { 0 };
+    int count = (2 * BROKER_RING_SIZE) / BROKER_MAX_PAYLOAD;
+
+    for (int i=0; i<count; i++) {
+        memset(payload, 'a' + (i % 26), sizeof(payload));
+        _publish("ring", payload, sizeof(payload));
+
+        if (broker_receive(sub, &msg) != SOCK_OK) {
+            CHECK(false);
+            break;
+        }
+
+        CHECK((msg.len == sizeof(payload)) && (msg.dropped == 0));
+        CHECK(memcmp(msg.data, payload, sizeof(payload)) == 0);
+        CHECK(broker_msg_valid(sub, &msg));
+
+        if (i == 0) { first = msg; }
+    }
+
+    CHECK(!broker_msg_valid(sub, &first));
+    CHECK(broker_msg_valid(sub, &msg));
+
+    _close(sub);
+}
+
+/* Topics are reused once nobody subscribes to them, while every one is used a new one is refused */
+static void _test_topic_reclaim( void ) {
+    sock_id_t sub = _subscriber("t0", BROKER_POLICY_DROP);
+    broker_stats_t before;
+    broker_stats_t stats;
+    broker_msg_t msg = { 0 };
+    char topic[BROKER_TOPIC_SIZE];
+
+    for (int i=1; i<BROKER_MAX_TOPICS; i++) {
+        snprintf(topic, sizeof(topic), "t%d", i);
+        CHECK(broker_subscribe(&sub, topic, BROKER_POLICY_DROP) == SOCK_OK);
+    }
+    _pump();
+
+    _stats(&before);
+
+    CHECK(broker_subscribe(&sub, "extra", BROKER_POLICY_DROP) == SOCK_OK);
+    _pump();
+    _publish("extra", "refused", 7);
+
+    _stats(&stats);
+    CHECK((stats.published == (before.published + 1)) && (stats.notified == before.notified));
+
+    for (int i=0; i<BROKER_MAX_TOPICS; i++) {
+        snprintf(topic, sizeof(topic), "t%d", i);
+        CHECK(broker_unsubscribe(&sub, topic) == SOCK_OK);
+    }
+
+    CHECK(broker_subscribe(&sub, "extra", BROKER_POLICY_DROP) == SOCK_OK);
+    _pump();
+    _publish("extra", "taken", 5);
+
+    CHECK((broker_receive(sub, &msg) == SOCK_OK) && (strcmp(msg.topic, "extra") == 0) && (msg.len == 5) && (memcmp(msg.data, "taken", 5) == 0));
+
+    _close(sub);
+}
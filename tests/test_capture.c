@@ -0,0 +1,384 @@
+#include <unistd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "capture.h"
+#include "test.h"
+
+#define TEST_PATH_SIZE 64
+#define TEST_UDP_PORT 19631
+#define TEST_WAIT_MS 1000
+#define TEST_MESSAGES 20
+#define TEST_MESSAGE_SIZE 32
+
+/* Records of this size fill a segment of CAPTURE_MIN_SEGMENT_SIZE in about 16 */
+#define TEST_LARGE_SIZE (64 * 1024)
+
+typedef struct {
+    sock_id_t local;
+    sock_id_t udp;
+    char local_path[TEST_PATH_SIZE];
+    char capture_path[TEST_PATH_SIZE];
+    char replay_path[TEST_PATH_SIZE];
+    char segment_path[TEST_PATH_SIZE];
+    int received;
+} test_capture_t;
+
+static test_capture_t test;
+
+/* Static Functions */
+static void _handler( ev_conn_t *conn, const void *buffer, size_t len, void *ctx );
+static bool _wait( int received );
+static int _connect_local( void );
+static int _send_udp( int fd, const void *buffer, size_t len );
+static void _message( int i, char *buffer );
+static void _remove( const char *path );
+static void _test_round_trip( void );
+static void _test_replay( void );
+static void _test_segments( void );
+
+int main( void ) {
+    snprintf(test.local_path, sizeof(test.local_path), "/tmp/test_capture_%d.sock", (int)getpid());
+    snprintf(test.capture_path, sizeof(test.capture_path), "/tmp/test_capture_%d", (int)getpid());
+    snprintf(test.replay_path, sizeof(test.replay_path), "/tmp/test_capture_%d_replay", (int)getpid());
+    snprintf(test.segment_path, sizeof(test.segment_path), "/tmp/test_capture_%d_segments", (int)getpid());
+    (void)unlink(test.local_path);
+
+    CHECK(event_loop_init(2 * TEST_LARGE_SIZE) == EVENT_OK);
+    CHECK((test.local = initialize_sock(E_LOCAL_SOCK, test.local_path, 0, SERVER_SIDE)) >= 0);
+    CHECK((test.udp = initialize_sock(E_UDP_SOCK, "127.0.0.1", TEST_UDP_PORT, SERVER_SIDE)) >= 0);
+    CHECK(event_loop_add_listener(test.local, _handler, NULL) == EVENT_OK);
+    CHECK(event_loop_add_listener(test.udp, _handler, NULL) == EVENT_OK);
+
+    _test_round_trip();
+    _test_replay();
+    _test_segments();
+
+    _remove(test.capture_path);
+    _remove(test.replay_path);
+    _remove(test.segment_path);
+
+    (void)event_loop_remove_listener(test.local);
+    (void)event_loop_remove_listener(test.udp);
+    (void)close_sock(test.local);
+    (void)close_sock(test.udp);
+
+    return TEST_RESULT();
+}
+
+static void _handler( ev_conn_t __attribute__((unused)) *conn, const void __attribute__((unused)) *buffer, size_t __attribute__((unused)) len, void __attribute__((unused)) *ctx ) {
+    test.received++;
+}
+
+/* Runs the loop until received messages arrived, one receive per message */
+static bool _wait( int received ) {
+    msec_t deadline = get_monotonic_ms() + TEST_WAIT_MS;
+
+    while ((test.received < received) && (get_monotonic_ms() < deadline)) { (void)event_loop_run_once(10); }
+
+    return test.received == received;
+}
+
+static int _connect_local( void ) {
+    struct sockaddr_un addr = { 0 };
+    int fd;
+
+    addr.sun_family = AF_LOCAL;
+    strncpy(addr.sun_path, test.local_path, sizeof(addr.sun_path) - 1);
+
+    if ((fd = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0) { return -1; }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        (void)close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int _send_udp( int fd, const void *buffer, size_t len ) {
+    struct sockaddr_in addr = { 0 };
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_UDP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    return (sendto(fd, buffer, len, 0, (struct sockaddr *)&addr, sizeof(addr)) == (ssize_t)len) ? 0 : -1;
+}
+
+static void _message( int i, char *buffer ) {
+    memset(buffer, 0, TEST_MESSAGE_SIZE);
+    snprintf(buffer, TEST_MESSAGE_SIZE, "message %d", i);
+}
+
+/* Every segment of a capture */
+static void _remove( const char *path ) {
+    char segment[TEST_PATH_SIZE + 16];
+
+    for (int i=0; i<16; i++) {
+        snprintf(segment, sizeof(segment), "%s.%d", path, i);
+        (void)unlink(segment);
+    }
+}
+
+/* Messages of a LOCAL connection and of UDP datagrams, then the close of the connection, read back
+ * in order with their listeners described first
+ */
+static void _test_round_trip( void ) {
+    char message[TEST_MESSAGE_SIZE];
+    capture_reader_t reader;
+    capture_record_t record;
+    capture_listener_t listener;
+    capture_stats_t stats;
+    const void *payload;
+    int32_t stream_conn = -1;
+    uint64_t last_us = 0;
+    int messages = 0;
+    int closes = 0;
+    int listeners = 0;
+    int local_fd;
+    int udp_fd;
+    int rc;
+
+    _remove(test.capture_path);
+    test.received = 0;
+
+    CHECK(capture_start(test.capture_path, CAPTURE_MIN_SEGMENT_SIZE - 1) == CAPTURE_NOT_OK);
+    CHECK(capture_start(test.capture_path, CAPTURE_MIN_SEGMENT_SIZE) == CAPTURE_OK);
+    CHECK(capture_active());
+
+    CHECK((local_fd = _connect_local()) >= 0);
+    CHECK((udp_fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+
+    /* Alternating, one receive each */
+    for (int i=0; i<TEST_MESSAGES; i++) {
+        _message(i, message);
+
+        if ((i % 2) == 0) {
+            CHECK(send(local_fd, message, sizeof(message), MSG_NOSIGNAL) == (ssize_t)sizeof(message));
+        } else {
+            CHECK(_send_udp(udp_fd, message, sizeof(message)) == 0);
+        }
+
+        CHECK(_wait(i + 1));
+    }
+
+    (void)close(local_fd);
+    (void)close(udp_fd);
+
+    /* The close is seen on the next receive */
+    for (int i=0; i<10; i++) { (void)event_loop_run_once(10); }
+
+    CHECK(get_capture_stats(&stats) == CAPTURE_OK);
+    CHECK((stats.records == TEST_MESSAGES) && (stats.bytes == (TEST_MESSAGES * sizeof(message))));
+    CHECK((stats.segments == 1) && (stats.dropped == 0));
+
+    capture_stop();
+    CHECK(!capture_active());
+
+    CHECK(capture_reader_open(&reader, test.capture_path) == CAPTURE_OK);
+
+    while ((rc = capture_read(&reader, &record, &payload)) == CAPTURE_OK) {
+        CHECK(record.time_us >= last_us);
+        last_us = record.time_us;
+
+        if (record.kind == CAPTURE_RECORD_LISTENER) {
+            CHECK(record.len == sizeof(listener));
+            memcpy(&listener, payload, sizeof(listener));
+
+            if (record.listener == test.local) {
+                CHECK((listener.type == E_LOCAL_SOCK) && (strcmp(listener.addr, test.local_path) == 0));
+            } else {
+                CHECK((record.listener == test.udp) && (listener.type == E_UDP_SOCK));
+                CHECK((listener.port == TEST_UDP_PORT) && (strcmp(listener.addr, "127.0.0.1") == 0));
+            }
+
+            listeners++;
+            continue;
+        }
+
+        if (record.kind == CAPTURE_RECORD_CLOSE) {
+            CHECK((record.listener == test.local) && (record.conn == stream_conn) && (record.len == 0));
+            closes++;
+            continue;
+        }
+
+        CHECK(record.kind == CAPTURE_RECORD_MESSAGE);
+
+        _message(messages, message);
+        CHECK((record.len == sizeof(message)) && (memcmp(payload, message, sizeof(message)) == 0));
+
+        if ((messages % 2) == 0) {
+            CHECK((record.listener == test.local) && (record.family == AF_UNIX) && (record.conn >= 0));
+            CHECK((stream_conn < 0) || (record.conn == stream_conn));
+            stream_conn = record.conn;
+        } else {
+            CHECK((record.listener == test.udp) && (record.family == AF_INET) && (record.conn == -1));
+            CHECK(memcmp(record.addr, "\x7f\x00\x00\x01", 4) == 0);
+        }
+
+        messages++;
+    }
+
+    CHECK(rc == CAPTURE_END);
+    CHECK((messages == TEST_MESSAGES) && (listeners == 2) && (closes == 1));
+
+    capture_reader_close(&reader);
+}
+
+/* Replaying a capture to the same listeners, while capturing again, captures the same messages */
+static void _test_replay( void ) {
+    capture_reader_t original;
+    capture_reader_t replayed;
+    capture_record_t record;
+    capture_record_t again;
+    const void *payload;
+    const void *payload_again;
+    int local_fd = -1;
+    int udp_fd;
+    int messages = 0;
+    int rc;
+
+    _remove(test.replay_path);
+    test.received = 0;
+
+    CHECK(capture_start(test.replay_path, CAPTURE_MIN_SEGMENT_SIZE) == CAPTURE_OK);
+    CHECK((udp_fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    CHECK(capture_reader_open(&original, test.capture_path) == CAPTURE_OK);
+
+    while (capture_read(&original, &record, &payload) == CAPTURE_OK) {
+        if (record.kind == CAPTURE_RECORD_CLOSE) {
+            (void)close(local_fd);
+            local_fd = -1;
+            continue;
+        }
+
+        if (record.kind != CAPTURE_RECORD_MESSAGE) { continue; }
+
+        if (record.listener == test.local) {
+            if (local_fd < 0) { CHECK((local_fd = _connect_local()) >= 0); }
+            CHECK(send(local_fd, payload, record.len, MSG_NOSIGNAL) == (ssize_t)record.len);
+        } else {
+            CHECK(_send_udp(udp_fd, payload, record.len) == 0);
+        }
+
+        CHECK(_wait(++messages));
+    }
+
+    for (int i=0; i<10; i++) { (void)event_loop_run_once(10); }
+
+    capture_stop();
+    capture_reader_close(&original);
+    (void)close(udp_fd);
+
+    /* Both captures have the same records, apart from times, fds, and ports */
+    CHECK(capture_reader_open(&original, test.capture_path) == CAPTURE_OK);
+    CHECK(capture_reader_open(&replayed, test.replay_path) == CAPTURE_OK);
+
+    while ((rc = capture_read(&original, &record, &payload)) == CAPTURE_OK) {
+        CHECK(capture_read(&replayed, &again, &payload_again) == CAPTURE_OK);
+        CHECK((again.kind == record.kind) && (again.listener == record.listener) && (again.len == record.len));
+
+        if ((again.kind == CAPTURE_RECORD_MESSAGE) && (again.len == record.len)) {
+            CHECK(memcmp(payload, payload_again, record.len) == 0);
+        }
+    }
+
+    CHECK(rc == CAPTURE_END);
+    CHECK(capture_read(&replayed, &again, &payload_again) == CAPTURE_END);
+
+    capture_reader_close(&original);
+    capture_reader_close(&replayed);
+}
+
+/* A segment is readable while it's written. A full one is truncated to its records and the next
+ * is opened, described on its own, a message larger than a segment is dropped. A capture started
+ * again on the same path skips the segments that exist.
+ */
+static void _test_segments( void ) {
+    static char large[TEST_LARGE_SIZE];
+    static char huge[CAPTURE_MIN_SEGMENT_SIZE];
+    char segment[TEST_PATH_SIZE + 16];
+    ev_conn_t conn = { 0 };
+    capture_reader_t reader;
+    capture_record_t record;
+    capture_stats_t stats;
+    capture_hdr_t hdr;
+    const void *payload;
+    struct stat st;
+    uint32_t segment_num = UINT32_MAX;
+    int messages = 0;
+    int count = 40;
+    int fd;
+
+    _remove(test.segment_path);
+
+    conn.fd = -1;
+    conn.listener = test.udp;
+    conn.type = E_UDP_SOCK;
+    conn.peer.ss_family = AF_INET;
+
+    CHECK(capture_start(test.segment_path, CAPTURE_MIN_SEGMENT_SIZE) == CAPTURE_OK);
+
+    capture_message(&conn, "live", 4);
+
+    CHECK(capture_reader_open(&reader, test.segment_path) == CAPTURE_OK);
+    CHECK((capture_read(&reader, &record, &payload) == CAPTURE_OK) && (record.kind == CAPTURE_RECORD_LISTENER));
+    CHECK((capture_read(&reader, &record, &payload) == CAPTURE_OK) && (record.len == 4) && (memcmp(payload, "live", 4) == 0));
+    CHECK(capture_read(&reader, &record, &payload) == CAPTURE_END);
+    capture_reader_close(&reader);
+
+    for (int i=0; i<count; i++) {
+        memset(large, 'a' + (i % 26), sizeof(large));
+        capture_message(&conn, large, sizeof(large));
+    }
+
+    capture_message(&conn, huge, sizeof(huge));
+
+    CHECK(get_capture_stats(&stats) == CAPTURE_OK);
+    CHECK((stats.records == (uint64_t)(count + 1)) && (stats.dropped == 1) && (stats.segments == 3));
+
+    capture_stop();
+
+    /* Closed segments are as long as their records */
+    for (uint32_t i=0; i<3; i++) {
+        snprintf(segment, sizeof(segment), "%s.%u", test.segment_path, i);
+
+        CHECK((fd = open(segment, O_RDONLY)) >= 0);
+        CHECK(read(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr));
+        CHECK(fstat(fd, &st) == 0);
+        CHECK((hdr.segment == i) && (hdr.used == (uint64_t)st.st_size) && (hdr.used <= CAPTURE_MIN_SEGMENT_SIZE));
+        (void)close(fd);
+    }
+
+    /* Appended after the segments of the first capture */
+    CHECK(capture_start(test.segment_path, CAPTURE_MIN_SEGMENT_SIZE) == CAPTURE_OK);
+    capture_message(&conn, "next", 4);
+    capture_stop();
+
+    /* Each segment starts with the listener, then the messages in order */
+    CHECK(capture_reader_open(&reader, test.segment_path) == CAPTURE_OK);
+
+    while (capture_read(&reader, &record, &payload) == CAPTURE_OK) {
+        if (reader.segment != segment_num) {
+            CHECK(record.kind == CAPTURE_RECORD_LISTENER);
+            segment_num = reader.segment;
+            continue;
+        }
+
+        CHECK(record.kind == CAPTURE_RECORD_MESSAGE);
+
+        if ((messages == 0) || (messages == (count + 1))) {
+            CHECK((record.len == 4) && (memcmp(payload, (messages == 0) ? "live" : "next", 4) == 0));
+        } else {
+            CHECK((record.len == sizeof(large)) && (((const char *)payload)[0] == ('a' + ((messages - 1) % 26))));
+        }
+
+        messages++;
+    }
+
+    CHECK((messages == (count + 2)) && (segment_num == 3));
+
+    capture_reader_close(&reader);
+}
@@ -0,0 +1,132 @@
+#include "codec.h"
+#include "test.h"
+
+/* Static Functions */
+static void _test_round_trip( void );
+static void _test_limits( void );
+static void _test_truncated( void );
+static void _test_dispatch( void );
+
+int main( void ) {
+    _test_round_trip();
+    _test_limits();
+    _test_truncated();
+    _test_dispatch();
+
+    return TEST_RESULT();
+}
+
+/* Every field type at the ends of its range */
+static void _test_round_trip( void ) {
+    uint8_t buffer[CODEC_KV_SET_MAX_SIZE];
+    codec_hello_t hello = { 0 };
+    codec_hello_t hello_out;
+    codec_sample_t sample = { 0 };
+    codec_sample_t sample_out;
+    codec_kv_set_t set = { 0 };
+    codec_kv_set_t set_out;
+    static uint8_t value[4096];
+    int64_t values[] = { 0, -1, 63, -64, 64, -65, INT64_MAX, INT64_MIN };
+    int len;
+
+    hello.seq = UINT32_MAX;
+    hello.sent_ms = UINT64_MAX;
+    hello.name.data = (const uint8_t *)"client";
+    hello.name.len = 6;
+
+    CHECK((len = codec_encode_hello(&hello, buffer, sizeof(buffer))) > 0);
+    CHECK(len <= CODEC_HELLO_MAX_SIZE);
+    CHECK(codec_decode_hello(buffer, (size_t)len, &hello_out) == len);
+    CHECK(hello_out.seq == hello.seq);
+    CHECK(hello_out.sent_ms == hello.sent_ms);
+    CHECK((hello_out.name.len == 6) && (memcmp(hello_out.name.data, "client", 6) == 0));
+
+    sample.source.data = (const uint8_t *)"src";
+    sample.source.len = 3;
+    sample.metric.data = (const uint8_t *)"metric";
+    sample.metric.len = 6;
+
+    for (size_t i=0; i<(sizeof(values) / sizeof(values[0])); i++) {
+        sample.value = values[i];
+
+        CHECK((len = codec_encode_sample(&sample, buffer, sizeof(buffer))) > 0);
+        CHECK(codec_decode_sample(buffer, (size_t)len, &sample_out) == len);
+        CHECK(sample_out.value == values[i]);
+    }
+
+    /* Zigzag keeps small values of either sign in one byte */
+    sample.value = -64;
+    CHECK(codec_encode_sample(&sample, buffer, sizeof(buffer)) == (1 + 1 + 3 + 1 + 6 + 1));
+
+    for (size_t i=0; i<sizeof(value); i++) { value[i] = (uint8_t)(i * 7); }
+
+    set.ttl_ms = 1000;
+    set.key.data = (const uint8_t *)"key";
+    set.key.len = 3;
+    set.value.data = value;
+    set.value.len = sizeof(value);
+
+    CHECK((len = codec_encode_kv_set(&set, buffer, sizeof(buffer))) > 0);
+    CHECK(codec_decode_kv_set(buffer, (size_t)len, &set_out) == len);
+    CHECK(set_out.ttl_ms == 1000);
+    CHECK((set_out.value.len == sizeof(value)) && (memcmp(set_out.value.data, value, sizeof(value)) == 0));
+}
+
+/* BYTES fields longer than their max, and buffers too small, are refused */
+static void _test_limits( void ) {
+    uint8_t buffer[CODEC_HELLO_MAX_SIZE];
+    char name[34];
+    codec_hello_t hello = { 0 };
+
+    memset(name, 'a', sizeof(name));
+    hello.name.data = (const uint8_t *)name;
+
+    hello.name.len = 32;
+    CHECK(codec_encode_hello(&hello, buffer, sizeof(buffer)) > 0);
+
+    hello.name.len = 33;
+    CHECK(codec_encode_hello(&hello, buffer, sizeof(buffer)) == CODEC_NOT_OK);
+
+    hello.name.len = 32;
+    CHECK(codec_encode_hello(&hello, buffer, 8) == CODEC_NOT_OK);
+}
+
+/* No prefix of a message decodes */
+static void _test_truncated( void ) {
+    uint8_t buffer[CODEC_TRACE_MAX_SIZE];
+    codec_trace_t trace = { UINT64_MAX, 1ULL << 40, 300 };
+    codec_trace_t out;
+    int len;
+
+    CHECK((len = codec_encode_trace(&trace, buffer, sizeof(buffer))) > 0);
+
+    for (int i=0; i<len; i++) {
+        CHECK(codec_decode_trace(buffer, (size_t)i, &out) == CODEC_NOT_OK);
+    }
+
+    CHECK(codec_decode_trace(buffer, (size_t)len, &out) == len);
+    CHECK((out.id == trace.id) && (out.queued_us == trace.queued_us) && (out.sent_us == trace.sent_us));
+}
+
+static void _test_dispatch( void ) {
+    uint8_t buffer[CODEC_HELLO_ACK_MAX_SIZE];
+    codec_hello_ack_t ack = { 7, 42, -3 };
+    codec_hello_t hello;
+    codec_msg_t msg;
+    int len;
+
+    CHECK((len = codec_encode_hello_ack(&ack, buffer, sizeof(buffer))) > 0);
+    CHECK(codec_peek(buffer, (size_t)len) == CODEC_MSG_HELLO_ACK);
+
+    CHECK(codec_decode(buffer, (size_t)len, &msg) == len);
+    CHECK(msg.type == CODEC_MSG_HELLO_ACK);
+    CHECK((msg.body.hello_ack.seq == 7) && (msg.body.hello_ack.sent_ms == 42) && (msg.body.hello_ack.status == -3));
+
+    /* Another message's decoder, and an unknown id */
+    CHECK(codec_decode_hello(buffer, (size_t)len, &hello) == CODEC_NOT_OK);
+
+    buffer[0] = 0xff;
+    CHECK(codec_decode(buffer, (size_t)len, &msg) == CODEC_NOT_OK);
+    CHECK(msg.type == CODEC_MSG_NONE);
+    CHECK(codec_peek(buffer, 0) == CODEC_NOT_OK);
+}
@@ -0,0 +1,169 @@
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "coro.h"
+#include "test.h"
+
+/* Far more than the socket buffers hold, so a send is partial and then waits for EPOLLOUT */
+#define TEST_SEND_SIZE (4 * 1024 * 1024)
+#define TEST_RECV_CHUNK 65536
+#define TEST_SNDBUF_SIZE 65536
+#define TEST_TIMEOUT_MS 5000
+
+typedef struct {
+    int fd;
+    uint8_t *buf;
+    size_t received;
+    bool waited;
+} test_conn_t;
+
+/* Static Functions */
+static int _connect_pair( int fds[2] );
+static E_CORO_STATE _sender( coro_t *co );
+static E_CORO_STATE _receiver( coro_t *co );
+static E_CORO_STATE _timeout( coro_t *co );
+static void _test_send( void );
+static void _test_timeout( void );
+
+int main( void ) {
+    CHECK(event_loop_init(TEST_RECV_CHUNK) == EVENT_OK);
+
+    _test_send();
+    _test_timeout();
+
+    return TEST_RESULT();
+}
+
+/* Loopback TCP with a small send buffer, accepted end in fds[1] */
+static int _connect_pair( int fds[2] ) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int size = TEST_SNDBUF_SIZE;
+    int listener;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((listener = socket(AF_INET, SOCK_STREAM, 0)) < 0) { return -1; }
+
+    if ((bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(listener, 1) < 0) ||
+            (getsockname(listener, (struct sockaddr *)&addr, &addr_len) < 0) ||
+            ((fds[0] = socket(AF_INET, SOCK_STREAM, 0)) < 0)) {
+        (void)close(listener);
+        return -1;
+    }
+
+    (void)setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    if ((connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) < 0) || ((fds[1] = accept(listener, NULL, NULL)) < 0)) {
+        (void)close(fds[0]);
+        (void)close(listener);
+        return -1;
+    }
+
+    (void)close(listener);
+
+    return 0;
+}
+
+/* Sends with the length in co->result, which every partial send overwrites */
+static E_CORO_STATE _sender( coro_t *co ) {
+    test_conn_t *c = (test_conn_t *)co->arg;
+
+    CORO_BEGIN(co);
+    co->result = TEST_SEND_SIZE;
+    CORO_SEND(co, c->fd, c->buf, (size_t)co->result, TEST_TIMEOUT_MS);
+    CORO_END(co);
+}
+
+/* Lets the sender fill the socket buffers first */
+static E_CORO_STATE _receiver( coro_t *co ) {
+    test_conn_t *c = (test_conn_t *)co->arg;
+
+    CORO_BEGIN(co);
+    CORO_SLEEP(co, 20);
+    while (c->received < TEST_SEND_SIZE) {
+        CORO_RECV(co, c->fd, c->buf + c->received, TEST_RECV_CHUNK, TEST_TIMEOUT_MS);
+        if (co->result <= 0) { break; }
+        c->received += (size_t)co->result;
+    }
+    CORO_END(co);
+}
+
+static E_CORO_STATE _timeout( coro_t *co ) {
+    test_conn_t *c = (test_conn_t *)co->arg;
+
+    CORO_BEGIN(co);
+    CORO_RECV(co, c->fd, c->buf, TEST_RECV_CHUNK, 10);
+    c->waited = true;
+    CORO_END(co);
+}
+
+static void _test_send( void ) {
+    test_conn_t out = { 0 };
+    test_conn_t in = { 0 };
+    coro_t sender;
+    coro_t receiver;
+    msec_t deadline;
+    int fds[2];
+
+    CHECK(_connect_pair(fds) == 0);
+
+    out.fd = fds[0];
+    out.buf = malloc(TEST_SEND_SIZE);
+    in.fd = fds[1];
+    in.buf = calloc(1, TEST_SEND_SIZE);
+
+    for (size_t i=0; i<TEST_SEND_SIZE; i++) { out.buf[i] = (uint8_t)((i * 7) + (i >> 12)); }
+
+    CHECK(coro_start(&sender, _sender, &out) == CORO_OK);
+
+    /* Still waiting, its send was cut short and then hit EAGAIN */
+    CHECK(sender.line > 0);
+
+    CHECK(coro_start(&receiver, _receiver, &in) == CORO_OK);
+
+    deadline = get_monotonic_ms() + TEST_TIMEOUT_MS;
+
+    while (((sender.line >= 0) || (receiver.line >= 0)) && (get_monotonic_ms() < deadline)) {
+        (void)event_loop_run_once(100);
+    }
+
+    CHECK(sender.line == -1);
+    CHECK(receiver.line == -1);
+    CHECK(sender.result == TEST_SEND_SIZE);
+    CHECK(in.received == TEST_SEND_SIZE);
+    CHECK(memcmp(out.buf, in.buf, TEST_SEND_SIZE) == 0);
+
+    free(out.buf);
+    free(in.buf);
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+}
+
+static void _test_timeout( void ) {
+    uint8_t buf[TEST_RECV_CHUNK];
+    test_conn_t c = { 0 };
+    coro_t co;
+    msec_t deadline;
+    int fds[2];
+
+    CHECK(_connect_pair(fds) == 0);
+
+    c.fd = fds[1];
+    c.buf = buf;
+
+    CHECK(coro_start(&co, _timeout, &c) == CORO_OK);
+
+    deadline = get_monotonic_ms() + TEST_TIMEOUT_MS;
+
+    while ((co.line >= 0) && (get_monotonic_ms() < deadline)) { (void)event_loop_run_once(100); }
+
+    CHECK(c.waited);
+    CHECK(co.result == CORO_TIMEOUT);
+
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+}
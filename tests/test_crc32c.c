@@ -0,0 +1,86 @@
+#include "crc32c.h"
+#include "test.h"
+
+#define TEST_BUFFER_SIZE 4096
+
+typedef uint32_t (*test_crc_t)( uint32_t crc, const void *buffer, size_t len );
+
+/* Static Functions */
+static void _test_vectors( test_crc_t crc_fn );
+static void _test_incremental( test_crc_t crc_fn );
+static void _test_same( void );
+
+/* crc32c() takes the instruction where the CPU has it, crc32c_sw() is always the table */
+int main( void ) {
+    _test_vectors(crc32c);
+    _test_incremental(crc32c);
+
+    _test_vectors(crc32c_sw);
+    _test_incremental(crc32c_sw);
+
+    _test_same();
+
+    return TEST_RESULT();
+}
+
+/* The check value of the catalogue, and the test patterns of RFC 3720 B.4 */
+static void _test_vectors( test_crc_t crc_fn ) {
+    uint8_t buffer[32];
+
+    CHECK(crc_fn(0, "123456789", 9) == 0xe3069283);
+    CHECK(crc_fn(0, buffer, 0) == 0);
+
+    memset(buffer, 0, sizeof(buffer));
+    CHECK(crc_fn(0, buffer, sizeof(buffer)) == 0x8a9136aa);
+
+    memset(buffer, 0xff, sizeof(buffer));
+    CHECK(crc_fn(0, buffer, sizeof(buffer)) == 0x62a8ab43);
+
+    for (int i=0; i<32; i++) { buffer[i] = (uint8_t)i; }
+    CHECK(crc_fn(0, buffer, sizeof(buffer)) == 0x46dd794e);
+
+    for (int i=0; i<32; i++) { buffer[i] = (uint8_t)(31 - i); }
+    CHECK(crc_fn(0, buffer, sizeof(buffer)) == 0x113fdb5c);
+}
+
+/* Any split, at any alignment, continues to the CRC of the whole buffer */
+static void _test_incremental( test_crc_t crc_fn ) {
+    static uint8_t buffer[TEST_BUFFER_SIZE + 8];
+    uint32_t whole;
+    uint32_t crc;
+
+    for (size_t i=0; i<sizeof(buffer); i++) { buffer[i] = (uint8_t)((i * 31) ^ (i >> 3)); }
+
+    for (size_t offset=0; offset<8; offset++) {
+        whole = crc_fn(0, buffer + offset, TEST_BUFFER_SIZE);
+
+        for (size_t split=0; split<=TEST_BUFFER_SIZE; split += 61) {
+            crc = crc_fn(0, buffer + offset, split);
+            crc = crc_fn(crc, buffer + offset + split, TEST_BUFFER_SIZE - split);
+            CHECK(crc == whole);
+        }
+
+        crc = 0;
+        for (size_t i=0; i<TEST_BUFFER_SIZE; i++) { crc = crc_fn(crc, buffer + offset + i, 1); }
+        CHECK(crc == whole);
+    }
+}
+
+/* Both paths agree on every length and alignment, whichever crc32c() uses */
+static void _test_same( void ) {
+    static uint8_t buffer[TEST_BUFFER_SIZE + 8];
+    uint64_t state = 88172645463325252ULL;
+
+    for (size_t i=0; i<sizeof(buffer); i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        buffer[i] = (uint8_t)state;
+    }
+
+    for (size_t offset=0; offset<8; offset++) {
+        for (size_t len=0; len<=TEST_BUFFER_SIZE; len += 37) {
+            CHECK(crc32c(0x12345678, buffer + offset, len) == crc32c_sw(0x12345678, buffer + offset, len));
+        }
+    }
+}
@@ -0,0 +1,287 @@
+#include "kv.h"
+#include "crc32c.h"
+#include "test.h"
+
+/* The smallest cache, a page for every class */
+#define TEST_MEMORY (KV_NUM_CLASSES * KV_PAGE_SIZE)
+
+/* Table size and hash as kv.c has them, for keys that probe across the end of the table */
+#define TEST_AVG_ITEM_SIZE 128
+
+/* With 9 byte keys, items of the 256 and the 128 byte class, no other test writes the 128 byte one */
+#define TEST_VALUE_SIZE 100
+#define TEST_SMALL_VALUE_SIZE 80
+#define TEST_KEY_SIZE 16
+
+/* Static Functions */
+static uint32_t _table_mask( void );
+static uint32_t _hash( const void *key, size_t key_len );
+static bool _has( const char *key, const char *value );
+static void _test_basic( void );
+static void _test_wrapped_probes( void );
+static void _test_ttl( void );
+static void _test_too_large( void );
+static void _test_batch( void );
+static void _test_eviction( void );
+
+int main( void ) {
+    CHECK(kv_init(TEST_MEMORY - 1) == KV_NOT_OK);
+    CHECK(kv_init(TEST_MEMORY) == KV_OK);
+    CHECK(kv_init(TEST_MEMORY) == KV_OK);
+    CHECK(kv_init(2 * TEST_MEMORY) == KV_NOT_OK);
+
+    /* Probing first, it needs the slots at the ends of the table empty */
+    _test_wrapped_probes();
+    _test_basic();
+    _test_ttl();
+    _test_too_large();
+    _test_batch();
+    _test_eviction();
+
+    return TEST_RESULT();
+}
+
+static uint32_t _table_mask( void ) {
+    uint32_t max_items = (uint32_t)(TEST_MEMORY / TEST_AVG_ITEM_SIZE);
+    uint32_t size = 1;
+
+    while (size < (max_items / 3) * 4) { size <<= 1; }
+
+    return size - 1;
+}
+
+static uint32_t _hash( const void *key, size_t key_len ) {
+    uint32_t h = crc32c(0, key, key_len);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static bool _has( const char *key, const char *value ) {
+    const void *found;
+    size_t len;
+
+    if (kv_get(key, strlen(key), &found, &len) != KV_OK) { return false; }
+
+    return (len == strlen(value)) && (memcmp(found, value, len) == 0);
+}
+
+/* Set, get, overwrite, and delete, the stats follow */
+static void _test_basic( void ) {
+    kv_stats_t before;
+    kv_stats_t stats;
+    const void *value;
+    size_t len;
+
+    CHECK(get_kv_stats(&before) == KV_OK);
+
+    CHECK(kv_set("a", 1, "1", 1, 0) == KV_OK);
+    CHECK(_has("a", "1"));
+
+    CHECK(kv_set("a", 1, "22", 2, 0) == KV_OK);
+    CHECK(_has("a", "22"));
+
+    CHECK(get_kv_stats(&stats) == KV_OK);
+    CHECK(stats.items == 1);
+
+    /* An empty value is still a value */
+    CHECK(kv_set("empty", 5, NULL, 0, 0) == KV_OK);
+    CHECK((kv_get("empty", 5, &value, &len) == KV_OK) && (len == 0));
+
+    CHECK(kv_del("a", 1) == KV_OK);
+    CHECK(kv_get("a", 1, &value, &len) == KV_NOT_FOUND);
+    CHECK(kv_del("a", 1) == KV_NOT_FOUND);
+    CHECK(kv_del("empty", 5) == KV_OK);
+
+    CHECK(get_kv_stats(&stats) == KV_OK);
+    CHECK((stats.items == 0) && (stats.bytes == 0));
+    CHECK((stats.deletes == (before.deletes + 2)) && (stats.sets == (before.sets + 3)));
+}
+
+/* Three keys whose probes start at the last slot, and one that starts at the first, so they wrap
+ * around. Deleting the head shifts the others back across the end, each is still found.
+ */
+static void _test_wrapped_probes( void ) {
+    char keys[4][TEST_KEY_SIZE];
+    uint32_t mask = _table_mask();
+    int found = 0;
+    bool first = false;
+    char key[TEST_KEY_SIZE];
+
+    for (uint32_t n=0; (found < 3) || !first; n++) {
+        snprintf(key, sizeof(key), "wrap%u", n);
+
+        if (((_hash(key, strlen(key)) & mask) == mask) && (found < 3)) {
+            memcpy(keys[found++], key, sizeof(key));
+        } else if (((_hash(key, strlen(key)) & mask) == 0) && !first) {
+            memcpy(keys[3], key, sizeof(key));
+            first = true;
+        }
+    }
+
+    /* Slots mask, 0, 1, and the last key home at 0 in slot 2 */
+    for (int i=0; i<4; i++) { CHECK(kv_set(keys[i], strlen(keys[i]), keys[i], strlen(keys[i]), 0) == KV_OK); }
+    for (int i=0; i<4; i++) { CHECK(_has(keys[i], keys[i])); }
+
+    CHECK(kv_del(keys[0], strlen(keys[0])) == KV_OK);
+    for (int i=1; i<4; i++) { CHECK(_has(keys[i], keys[i])); }
+
+    CHECK(kv_del(keys[1], strlen(keys[1])) == KV_OK);
+    CHECK(_has(keys[2], keys[2]) && _has(keys[3], keys[3]));
+
+    /* Back at the end of the probes from the last slot, then shifted across it by a delete */
+    CHECK(kv_set(keys[0], strlen(keys[0]), "again", 5, 0) == KV_OK);
+    CHECK(kv_del(keys[3], strlen(keys[3])) == KV_OK);
+    CHECK(_has(keys[0], "again") && _has(keys[2], keys[2]));
+    CHECK(!_has(keys[1], keys[1]) && !_has(keys[3], keys[3]));
+
+    CHECK(kv_del(keys[0], strlen(keys[0])) == KV_OK);
+    CHECK(kv_del(keys[2], strlen(keys[2])) == KV_OK);
+}
+
+static void _test_ttl( void ) {
+    kv_stats_t before;
+    kv_stats_t after;
+
+    CHECK(get_kv_stats(&before) == KV_OK);
+
+    CHECK(kv_set("ttl", 3, "short", 5, 20) == KV_OK);
+    CHECK(kv_set("forever", 7, "long", 4, 0) == KV_OK);
+    CHECK(_has("ttl", "short"));
+
+    delay_ms(40);
+
+    CHECK(!_has("ttl", "short"));
+    CHECK(_has("forever", "long"));
+
+    CHECK(get_kv_stats(&after) == KV_OK);
+    CHECK((after.expired == (before.expired + 1)) && (after.items == (before.items + 1)));
+
+    CHECK(kv_del("forever", 7) == KV_OK);
+}
+
+/* Keys and values over the limits of the messages are refused, and leave nothing behind */
+static void _test_too_large( void ) {
+    static uint8_t big[KV_MAX_VALUE_SIZE + 1];
+    char key[KV_MAX_KEY_SIZE + 1];
+    kv_stats_t stats;
+
+    memset(key, 'k', sizeof(key));
+
+    CHECK(kv_set(key, 0, "v", 1, 0) == KV_TOO_LARGE);
+    CHECK(kv_set(key, KV_MAX_KEY_SIZE + 1, "v", 1, 0) == KV_TOO_LARGE);
+    CHECK(kv_set("k", 1, big, KV_MAX_VALUE_SIZE + 1, 0) == KV_TOO_LARGE);
+
+    CHECK(kv_set(key, KV_MAX_KEY_SIZE, big, KV_MAX_VALUE_SIZE, 0) == KV_OK);
+    CHECK(kv_del(key, KV_MAX_KEY_SIZE) == KV_OK);
+
+    CHECK(get_kv_stats(&stats) == KV_OK);
+    CHECK(stats.items == 0);
+}
+
+/* A batch is answered in order, values that no longer fit the response are KV_TOO_LARGE */
+static void _test_batch( void ) {
+    static uint8_t value[KV_MAX_VALUE_SIZE];
+    static uint8_t request[4 * CODEC_KV_SET_MAX_SIZE];
+    static uint8_t response[RPC_MAX_PAYLOAD];
+    codec_kv_set_t set = { 0 };
+    codec_kv_get_t get = { 0 };
+    codec_kv_del_t del = { 0 };
+    codec_kv_value_t answer;
+    size_t response_len;
+    size_t len = 0;
+    size_t pos = 0;
+    int expected[] = { KV_OK, KV_OK, KV_TOO_LARGE, KV_OK, KV_NOT_FOUND };
+    int rc;
+
+    memset(value, 'v', sizeof(value));
+
+    set.key.data = (const uint8_t *)"big";
+    set.key.len = 3;
+    set.value.data = value;
+    set.value.len = sizeof(value);
+    get.key = set.key;
+    del.key = set.key;
+
+    /* Set, then 2 gets of a value that fits the response once, then a delete and a get */
+    CHECK((rc = codec_encode_kv_set(&set, request + len, sizeof(request) - len)) > 0);
+    len += (size_t)rc;
+    for (int i=0; i<2; i++) {
+        CHECK((rc = codec_encode_kv_get(&get, request + len, sizeof(request) - len)) > 0);
+        len += (size_t)rc;
+    }
+    CHECK((rc = codec_encode_kv_del(&del, request + len, sizeof(request) - len)) > 0);
+    len += (size_t)rc;
+    CHECK((rc = codec_encode_kv_get(&get, request + len, sizeof(request) - len)) > 0);
+    len += (size_t)rc;
+
+    CHECK(kv_request_handler(request, len, response, &response_len, NULL) == RPC_STATUS_OK);
+    CHECK(response_len <= RPC_MAX_PAYLOAD);
+
+    for (int i=0; i<5; i++) {
+        CHECK((rc = codec_decode_kv_value(response + pos, response_len - pos, &answer)) > 0);
+        if (rc <= 0) { break; }
+        pos += (size_t)rc;
+
+        CHECK(answer.status == expected[i]);
+        CHECK(answer.value.len == ((i == 1) ? sizeof(value) : 0));
+    }
+
+    CHECK(pos == response_len);
+
+    /* A message that isn't a KV request fails the batch */
+    CHECK((rc = codec_encode_kv_value(&answer, request, sizeof(request))) > 0);
+    CHECK(kv_request_handler(request, (size_t)rc, response, &response_len, NULL) == RPC_STATUS_ERROR);
+}
+
+/* One class fills the budget and evicts with CLOCK, a key read every pass stays. Then a write of
+ * another class, which has no pages, steals a page of the full class.
+ */
+static void _test_eviction( void ) {
+    char value[TEST_VALUE_SIZE];
+    char key[TEST_KEY_SIZE];
+    kv_stats_t before;
+    kv_stats_t stats;
+    const void *found;
+    size_t len;
+    int n = 0;
+
+    memset(value, 'x', sizeof(value));
+
+    CHECK(kv_set("hot000000", 9, value, sizeof(value), 0) == KV_OK);
+
+    /* Until a few thousand items were evicted */
+    do {
+        snprintf(key, sizeof(key), "key%06d", n++);
+        CHECK(kv_set(key, strlen(key), value, sizeof(value), 0) == KV_OK);
+        if ((n % 1000) == 0) { CHECK(kv_get("hot000000", 9, &found, &len) == KV_OK); }
+        CHECK(get_kv_stats(&stats) == KV_OK);
+    } while ((stats.evictions < 5000) && (n < 1000000));
+
+    CHECK(stats.memory == TEST_MEMORY);
+    CHECK(stats.bytes <= stats.memory);
+    CHECK(kv_get("hot000000", 9, &found, &len) == KV_OK);
+    CHECK(kv_get("key000000", 9, &found, &len) == KV_NOT_FOUND);
+
+    snprintf(key, sizeof(key), "key%06d", n - 1);
+    CHECK(kv_get(key, strlen(key), &found, &len) == KV_OK);
+
+    /* An item of the 128 byte class, which has no page, while the budget is used */
+    before = stats;
+    CHECK(kv_set("small", 5, value, TEST_SMALL_VALUE_SIZE, 0) == KV_OK);
+    CHECK((kv_get("small", 5, &found, &len) == KV_OK) && (len == TEST_SMALL_VALUE_SIZE));
+
+    CHECK(get_kv_stats(&stats) == KV_OK);
+    CHECK(stats.memory == TEST_MEMORY);
+    CHECK(stats.evictions > before.evictions);
+    CHECK(stats.items == (before.items - (uint32_t)(stats.evictions - before.evictions) + 1));
+
+    /* The class that lost the page keeps working */
+    CHECK(kv_set("after", 5, value, sizeof(value), 0) == KV_OK);
+    CHECK(kv_get("after", 5, &found, &len) == KV_OK);
+}
@@ -0,0 +1,104 @@
+#include "lz.h"
+#include "test.h"
+
+#define TEST_SIZE (128 * 1024)
+
+static uint8_t input[TEST_SIZE];
+static uint8_t compressed[LZ_MAX_SIZE(TEST_SIZE)];
+static uint8_t output[TEST_SIZE];
+
+/* Static Functions */
+static int _round_trip( size_t len );
+static void _test_patterns( void );
+static void _test_limits( void );
+static void _test_malformed( void );
+
+int main( void ) {
+    _test_patterns();
+    _test_limits();
+    _test_malformed();
+
+    return TEST_RESULT();
+}
+
+/* Returns the compressed size, or LZ_NOT_OK if input didn't come back as it was */
+static int _round_trip( size_t len ) {
+    int clen;
+
+    if ((clen = lz_compress(input, len, compressed, sizeof(compressed))) < 0) { return LZ_NOT_OK; }
+    if (lz_decompress(compressed, (size_t)clen, output, sizeof(output)) != (int)len) { return LZ_NOT_OK; }
+    if (memcmp(input, output, len) != 0) { return LZ_NOT_OK; }
+
+    return clen;
+}
+
+/* Text, runs that overlap their own match, incompressible bytes, and matches at the offset limit */
+static void _test_patterns( void ) {
+    static const char text[] = "the quick brown fox jumps over the lazy dog, ";
+    uint64_t state = 88172645463325252ULL;
+    int clen;
+
+    CHECK(_round_trip(0) >= 0);
+
+    input[0] = 'x';
+    CHECK(_round_trip(1) >= 0);
+
+    for (size_t i=0; i<TEST_SIZE; i++) { input[i] = (uint8_t)text[i % (sizeof(text) - 1)]; }
+    CHECK(((clen = _round_trip(TEST_SIZE)) > 0) && (clen < (TEST_SIZE / 10)));
+
+    memset(input, 'a', TEST_SIZE);
+    CHECK(((clen = _round_trip(TEST_SIZE)) > 0) && (clen < (TEST_SIZE / 100)));
+
+    for (size_t i=0; i<TEST_SIZE; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        input[i] = (uint8_t)state;
+    }
+    CHECK(((clen = _round_trip(TEST_SIZE)) > 0) && (clen <= (int)LZ_MAX_SIZE(TEST_SIZE)));
+
+    /* The first LZ_MAX_OFFSET + 1 random bytes again, a match just past the reach of an offset */
+    memcpy(input + LZ_MAX_OFFSET + 1, input, TEST_SIZE - (LZ_MAX_OFFSET + 1));
+    CHECK(_round_trip(TEST_SIZE) > 0);
+
+    /* Every length up to a few sequences, so each length encoding and tail is hit */
+    for (size_t len=0; len<600; len++) {
+        for (size_t i=0; i<len; i++) { input[i] = (uint8_t)text[(i / 3) % 7]; }
+        CHECK(_round_trip(len) >= 0);
+    }
+}
+
+/* Output that doesn't fit is refused, never written past cap */
+static void _test_limits( void ) {
+    int clen;
+
+    for (size_t i=0; i<TEST_SIZE; i++) { input[i] = (uint8_t)(i * 2654435761U >> 24); }
+
+    memset(compressed, 0xee, sizeof(compressed));
+    CHECK(lz_compress(input, TEST_SIZE, compressed, 64) == LZ_NOT_OK);
+    CHECK(compressed[64] == 0xee);
+
+    memset(input, 'b', TEST_SIZE);
+    CHECK((clen = lz_compress(input, TEST_SIZE, compressed, sizeof(compressed))) > 0);
+
+    memset(output, 0xee, sizeof(output));
+    CHECK(lz_decompress(compressed, (size_t)clen, output, TEST_SIZE - 1) == LZ_NOT_OK);
+    CHECK(output[TEST_SIZE - 1] == 0xee);
+}
+
+/* Cut or corrupted input fails instead of reading or writing out of bounds */
+static void _test_malformed( void ) {
+    static const uint8_t bad_offset[] = { 0x10, 'a', 0x05, 0x00 };
+    static const uint8_t zero_offset[] = { 0x10, 'a', 0x00, 0x00 };
+    int clen;
+
+    for (size_t i=0; i<4096; i++) { input[i] = (uint8_t)"abcabcabd"[i % 9]; }
+    CHECK((clen = lz_compress(input, 4096, compressed, sizeof(compressed))) > 0);
+
+    for (int len=0; len<clen; len++) {
+        (void)lz_decompress(compressed, (size_t)len, output, 4096);
+    }
+
+    CHECK(lz_decompress(bad_offset, sizeof(bad_offset), output, sizeof(output)) == LZ_NOT_OK);
+    CHECK(lz_decompress(zero_offset, sizeof(zero_offset), output, sizeof(output)) == LZ_NOT_OK);
+}
@@ -0,0 +1,288 @@
+#include <unistd.h>
+
+#include "pool.h"
+#include "test.h"
+
+#define TEST_PATH_SIZE 64
+#define TEST_WAIT_MS 2000
+#define TEST_TIMEOUT_MS 10000
+
+/* Short enough that a request to the endpoint that never answers times out quickly */
+#define TEST_SHORT_TIMEOUT_MS 20
+
+/* Endpoints A and B answer with their index, C accepts connections and never answers */
+typedef enum {
+    E_TEST_A = 0,
+    E_TEST_B,
+    E_TEST_C,
+    E_TEST_NUM_ENDPOINTS,
+} E_TEST_ENDPOINT;
+
+typedef struct {
+    sock_id_t servers[E_TEST_NUM_ENDPOINTS];
+    char paths[E_TEST_NUM_ENDPOINTS][TEST_PATH_SIZE];
+    int indexes[E_TEST_NUM_ENDPOINTS];
+    int completed;
+    int answered[E_TEST_NUM_ENDPOINTS];
+    int statuses[RPC_STATUS_DISCONNECTED + 1];
+} test_pool_t;
+
+static test_pool_t test;
+
+/* Static Functions */
+static int _handler( const void *request, size_t len, void *response, size_t *response_len, void *ctx );
+static void _callback( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx );
+static void _reset( void );
+static bool _wait( int completed );
+static pool_id_t _create( E_POOL_BALANCE balance, E_TEST_ENDPOINT first, E_TEST_ENDPOINT last, int num_conns );
+static void _test_least_outstanding( void );
+static void _test_p2c( void );
+static void _test_ejection( void );
+static void _test_all_ejected( void );
+static void _test_reconnect( void );
+static void _test_destroy( void );
+
+int main( void ) {
+    CHECK(event_loop_init(RPC_BUFFER_SIZE) == EVENT_OK);
+
+    for (int i=0; i<E_TEST_NUM_ENDPOINTS; i++) {
+        snprintf(test.paths[i], sizeof(test.paths[i]), "/tmp/test_pool_%d_%d.sock", (int)getpid(), i);
+        (void)unlink(test.paths[i]);
+
+        test.indexes[i] = i;
+        CHECK((test.servers[i] = initialize_sock(E_LOCAL_SOCK, test.paths[i], 0, SERVER_SIDE)) >= 0);
+        if (i != E_TEST_C) { CHECK(rpc_serve(test.servers[i], _handler, &test.indexes[i]) == SOCK_OK); }
+    }
+
+    _test_least_outstanding();
+    _test_p2c();
+    _test_ejection();
+    _test_all_ejected();
+    _test_reconnect();
+    _test_destroy();
+
+    for (int i=0; i<E_TEST_NUM_ENDPOINTS; i++) {
+        (void)event_loop_remove_listener(test.servers[i]);
+        (void)close_sock(test.servers[i]);
+    }
+
+    return TEST_RESULT();
+}
+
+static int _handler( const void __attribute__((unused)) *request, size_t __attribute__((unused)) len, void *response, size_t *response_len, void *ctx ) {
+    memcpy(response, ctx, sizeof(int));
+    *response_len = sizeof(int);
+
+    return RPC_STATUS_OK;
+}
+
+static void _callback( E_RPC_STATUS status, uint32_t __attribute__((unused)) req_id, const void *buffer, size_t len, void __attribute__((unused)) *ctx ) {
+    int endpoint;
+
+    test.statuses[status]++;
+    test.completed++;
+
+    if ((status == RPC_STATUS_OK) && (len == sizeof(endpoint))) {
+        memcpy(&endpoint, buffer, sizeof(endpoint));
+        if ((endpoint >= 0) && (endpoint < E_TEST_NUM_ENDPOINTS)) { test.answered[endpoint]++; }
+    }
+}
+
+static void _reset( void ) {
+    test.completed = 0;
+    memset(test.answered, 0, sizeof(test.answered));
+    memset(test.statuses, 0, sizeof(test.statuses));
+}
+
+/* Runs the loop and the ticks until completed calls completed, or TEST_WAIT_MS passed */
+static bool _wait( int completed ) {
+    msec_t deadline = get_monotonic_ms() + TEST_WAIT_MS;
+
+    while ((test.completed < completed) && (get_monotonic_ms() < deadline)) {
+        (void)event_loop_run_once(5);
+        rpc_tick_all();
+        pool_tick_all();
+    }
+
+    return test.completed == completed;
+}
+
+/* A pool of num_conns connections to each endpoint from first to last */
+static pool_id_t _create( E_POOL_BALANCE balance, E_TEST_ENDPOINT first, E_TEST_ENDPOINT last, int num_conns ) {
+    pool_id_t pool;
+
+    CHECK((pool = pool_create(balance)) >= 0);
+
+    for (int i=first; i<=last; i++) {
+        CHECK(pool_add_endpoint(pool, E_LOCAL_SOCK, test.paths[i], 0, num_conns) == SOCK_OK);
+    }
+
+    return pool;
+}
+
+/* Requests issued at once are spread evenly over the connections of both endpoints */
+static void _test_least_outstanding( void ) {
+    pool_id_t pool = _create(POOL_BALANCE_LEAST_OUTSTANDING, E_TEST_A, E_TEST_B, 2);
+    pool_stats_t stats;
+    int count = 40;
+
+    _reset();
+
+    for (int i=0; i<count; i++) { CHECK(pool_call(pool, "x", 1, TEST_TIMEOUT_MS, _callback, NULL) == SOCK_OK); }
+
+    CHECK(get_pool_stats(pool, &stats) == SOCK_OK);
+    CHECK((stats.connected == 4) && (stats.healthy_endpoints == 2) && (stats.in_flight == (uint32_t)count));
+
+    CHECK(_wait(count));
+    CHECK((test.answered[E_TEST_A] == (count / 2)) && (test.answered[E_TEST_B] == (count / 2)));
+
+    CHECK(get_pool_stats(pool, &stats) == SOCK_OK);
+    CHECK((stats.calls == (uint32_t)count) && (stats.completed == (uint32_t)count) && (stats.in_flight == 0));
+
+    pool_destroy(pool);
+}
+
+/* Two random picks, the less loaded one wins, so neither endpoint gets far more than the other */
+static void _test_p2c( void ) {
+    pool_id_t pool = _create(POOL_BALANCE_P2C, E_TEST_A, E_TEST_B, 2);
+    int count = 400;
+
+    _reset();
+
+    for (int i=0; i<count; i++) { CHECK(pool_call(pool, "x", 1, TEST_TIMEOUT_MS, _callback, NULL) == SOCK_OK); }
+
+    CHECK(_wait(count));
+    CHECK((test.answered[E_TEST_A] + test.answered[E_TEST_B]) == count);
+    CHECK(abs(test.answered[E_TEST_A] - test.answered[E_TEST_B]) <= (count / 10));
+
+    pool_destroy(pool);
+}
+
+/* Timeouts eject the endpoint that never answers. Once its ejection ends it's tried again, and
+ * ejected again on its first failure.
+ */
+static void _test_ejection( void ) {
+    pool_id_t pool = _create(POOL_BALANCE_LEAST_OUTSTANDING, E_TEST_A, E_TEST_C, 1);
+    pool_stats_t stats;
+    msec_t ejected;
+    int calls = 0;
+
+    _reset();
+
+    /* One at a time, ties alternate between the endpoints */
+    do {
+        CHECK(pool_call(pool, "x", 1, TEST_SHORT_TIMEOUT_MS, _callback, NULL) == SOCK_OK);
+        CHECK(_wait(++calls));
+        CHECK(get_pool_stats(pool, &stats) == SOCK_OK);
+    } while ((stats.ejections == 0) && (calls < 100));
+
+    ejected = get_monotonic_ms();
+
+    CHECK((stats.ejections == 1) && (stats.healthy_endpoints == 2));
+    CHECK(test.statuses[RPC_STATUS_TIMEOUT] == POOL_EJECT_FAILURES);
+    CHECK(test.answered[E_TEST_C] == 0);
+
+    /* Only A and B get requests until the ejection ends */
+    _reset();
+
+    for (int i=0; i<10; i++) {
+        CHECK(pool_call(pool, "x", 1, TEST_SHORT_TIMEOUT_MS, _callback, NULL) == SOCK_OK);
+        CHECK(_wait(i + 1));
+    }
+
+    CHECK((test.answered[E_TEST_A] + test.answered[E_TEST_B]) == 10);
+
+    while (get_monotonic_ms() <= (ejected + POOL_EJECT_MS)) { delay_ms(1); }
+
+    CHECK(get_pool_stats(pool, &stats) == SOCK_OK);
+    CHECK(stats.healthy_endpoints == 3);
+
+    /* Back on the next tie, and out again after a single timeout */
+    _reset();
+    calls = 0;
+
+    do {
+        CHECK(pool_call(pool, "x", 1, TEST_SHORT_TIMEOUT_MS, _callback, NULL) == SOCK_OK);
+        CHECK(_wait(++calls));
+        CHECK(get_pool_stats(pool, &stats) == SOCK_OK);
+    } while ((stats.ejections == 1) && (calls < 10));
+
+    CHECK((stats.ejections == 2) && (stats.healthy_endpoints == 2));
+    CHECK(test.statuses[RPC_STATUS_TIMEOUT] == 1);
+
+    pool_destroy(pool);
+}
+
+/* With every endpoint ejected, requests still go to connections that are up. An endpoint nobody
+ * listens on is ejected by its failed connects.
+ */
+static void _test_all_ejected( void ) {
+    pool_id_t pool = _create(POOL_BALANCE_LEAST_OUTSTANDING, E_TEST_C, E_TEST_C, 1);
+    pool_stats_t stats;
+
+    _reset();
+
+    for (int i=0; i<POOL_EJECT_FAILURES; i++) {
+        CHECK(pool_call(pool, "x", 1, TEST_SHORT_TIMEOUT_MS, _callback, NULL) == SOCK_OK);
+        CHECK(_wait(i + 1));
+    }
+
+    CHECK(get_pool_stats(pool, &stats) == SOCK_OK);
+    CHECK((stats.healthy_endpoints == 0) && (stats.connected == 1));
+
+    CHECK(pool_call(pool, "x", 1, TEST_SHORT_TIMEOUT_MS, _callback, NULL) == SOCK_OK);
+    CHECK(_wait(POOL_EJECT_FAILURES + 1));
+
+    pool_destroy(pool);
+
+    CHECK((pool = pool_create(POOL_BALANCE_LEAST_OUTSTANDING)) >= 0);
+    CHECK(pool_add_endpoint(pool, E_LOCAL_SOCK, "/tmp/test_pool_nobody.sock", 0, POOL_EJECT_FAILURES) == SOCK_OK);
+
+    CHECK(get_pool_stats(pool, &stats) == SOCK_OK);
+    CHECK((stats.ejections == 1) && (stats.connected == 0) && (stats.healthy_endpoints == 0));
+    CHECK(pool_call(pool, "x", 1, TEST_TIMEOUT_MS, _callback, NULL) == SOCK_NOT_OK);
+
+    pool_destroy(pool);
+}
+
+/* Connections the server closed are reconnected from the tick */
+static void _test_reconnect( void ) {
+    pool_id_t pool = _create(POOL_BALANCE_LEAST_OUTSTANDING, E_TEST_A, E_TEST_A, 2);
+    msec_t deadline = get_monotonic_ms() + TEST_WAIT_MS;
+    pool_stats_t stats;
+
+    _reset();
+    CHECK(pool_call(pool, "x", 1, TEST_TIMEOUT_MS, _callback, NULL) == SOCK_OK);
+    CHECK(_wait(1));
+
+    /* Accepted by now, and closed */
+    event_loop_close_all_conns();
+
+    do {
+        (void)event_loop_run_once(5);
+        pool_tick_all();
+        CHECK(get_pool_stats(pool, &stats) == SOCK_OK);
+    } while ((stats.reconnects < 2) && (get_monotonic_ms() < deadline));
+
+    CHECK((stats.reconnects == 2) && (stats.connected == 2));
+
+    CHECK(pool_call(pool, "x", 1, TEST_TIMEOUT_MS, _callback, NULL) == SOCK_OK);
+    CHECK(_wait(2) && (test.answered[E_TEST_A] == 2));
+
+    pool_destroy(pool);
+}
+
+/* Destroying a pool completes what's in flight, and refuses new requests */
+static void _test_destroy( void ) {
+    pool_id_t pool = _create(POOL_BALANCE_P2C, E_TEST_A, E_TEST_B, 2);
+    int count = 10;
+
+    _reset();
+
+    for (int i=0; i<count; i++) { CHECK(pool_call(pool, "x", 1, TEST_TIMEOUT_MS, _callback, NULL) == SOCK_OK); }
+
+    pool_destroy(pool);
+
+    CHECK((test.completed == count) && (test.statuses[RPC_STATUS_DISCONNECTED] == count));
+    CHECK(pool_call(pool, "x", 1, TEST_TIMEOUT_MS, _callback, NULL) == SOCK_NOT_OK);
+}
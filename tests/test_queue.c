@@ -0,0 +1,171 @@
+#include <pthread.h>
+
+#include "threads_config.h"
+#include "support.h"
+#include "test.h"
+
+#define TEST_CAPACITY 64
+#define TEST_THREADS 4
+#define TEST_MESSAGES 20000
+#define TEST_WAIT_MS 1000
+
+typedef struct {
+    uint32_t producer;
+    uint32_t seq;
+} test_msg_t;
+
+typedef struct {
+    queue_id_t queue;
+    uint32_t producer;
+    uint64_t received;
+    uint64_t out_of_order;
+    uint64_t sum[TEST_THREADS];
+} test_worker_t;
+
+/* Static Functions */
+static void _test_single_thread( void );
+static void _test_timeout( void );
+static void _test_stress( void );
+static void *_produce( void *arg );
+static void *_consume( void *arg );
+
+int main( void ) {
+    _test_single_thread();
+    _test_timeout();
+    _test_stress();
+
+    return TEST_RESULT();
+}
+
+/* Order, full, empty, truncation, and the arguments that are refused */
+static void _test_single_thread( void ) {
+    char buffer[16];
+    queue_id_t queue;
+    int value;
+
+    CHECK((queue = create_queue(3, sizeof(int))) >= 0);
+
+    /* Rounded up to 4 */
+    for (value=0; value<4; value++) {
+        CHECK(send_queue(queue, &value, sizeof(value)) == (int)sizeof(value));
+    }
+    CHECK(send_queue(queue, &value, sizeof(value)) == 0);
+
+    for (int i=0; i<4; i++) {
+        CHECK(recv_queue(queue, &value, sizeof(value), 0) == (int)sizeof(value));
+        CHECK(value == i);
+    }
+    CHECK(recv_queue(queue, &value, sizeof(value), 0) == 0);
+
+    /* Empty messages would read as an empty queue */
+    CHECK(send_queue(queue, &value, 0) == THREAD_NOT_OK);
+    CHECK(recv_queue(queue, &value, 0, 0) == THREAD_NOT_OK);
+    CHECK(send_queue(queue, buffer, sizeof(buffer)) == THREAD_NOT_OK);
+    CHECK(send_queue(queue, NULL, sizeof(value)) == THREAD_NOT_OK);
+
+    value = 0x01020304;
+    CHECK(send_queue(queue, &value, sizeof(value)) == (int)sizeof(value));
+    memset(buffer, 0, sizeof(buffer));
+    CHECK(recv_queue(queue, buffer, 2, 0) == 2);
+    CHECK(memcmp(buffer, &value, 2) == 0);
+
+    CHECK(free_queue(queue) == THREAD_OK);
+    CHECK(send_queue(queue, &value, sizeof(value)) == THREAD_NOT_OK);
+}
+
+static void _test_timeout( void ) {
+    msec_t start;
+    queue_id_t queue;
+    int value;
+
+    CHECK((queue = create_queue(TEST_CAPACITY, sizeof(int))) >= 0);
+
+    start = get_monotonic_ms();
+    CHECK(recv_queue(queue, &value, sizeof(value), 50) == 0);
+    CHECK((get_monotonic_ms() - start) >= 40);
+
+    CHECK(free_queue(queue) == THREAD_OK);
+}
+
+/* Every producer's messages arrive once, and a consumer sees each producer's in the order sent */
+static void _test_stress( void ) {
+    test_worker_t producers[TEST_THREADS];
+    test_worker_t consumers[TEST_THREADS];
+    pthread_t producer_threads[TEST_THREADS];
+    pthread_t consumer_threads[TEST_THREADS];
+    uint64_t expected = ((uint64_t)TEST_MESSAGES * (TEST_MESSAGES - 1)) / 2;
+    uint64_t received = 0;
+    uint64_t sum;
+    queue_id_t queue;
+
+    CHECK((queue = create_queue(TEST_CAPACITY, sizeof(test_msg_t))) >= 0);
+
+    memset(producers, 0, sizeof(producers));
+    memset(consumers, 0, sizeof(consumers));
+
+    for (int i=0; i<TEST_THREADS; i++) {
+        consumers[i].queue = queue;
+        CHECK(pthread_create(&consumer_threads[i], NULL, _consume, &consumers[i]) == 0);
+    }
+
+    for (int i=0; i<TEST_THREADS; i++) {
+        producers[i].queue = queue;
+        producers[i].producer = (uint32_t)i;
+        CHECK(pthread_create(&producer_threads[i], NULL, _produce, &producers[i]) == 0);
+    }
+
+    for (int i=0; i<TEST_THREADS; i++) {
+        (void)pthread_join(producer_threads[i], NULL);
+    }
+
+    for (int i=0; i<TEST_THREADS; i++) {
+        (void)pthread_join(consumer_threads[i], NULL);
+        received += consumers[i].received;
+        CHECK(consumers[i].out_of_order == 0);
+    }
+
+    CHECK(received == ((uint64_t)TEST_THREADS * TEST_MESSAGES));
+
+    for (int p=0; p<TEST_THREADS; p++) {
+        sum = 0;
+        for (int i=0; i<TEST_THREADS; i++) { sum += consumers[i].sum[p]; }
+        CHECK(sum == expected);
+    }
+
+    CHECK(free_queue(queue) == THREAD_OK);
+}
+
+static void *_produce( void *arg ) {
+    test_worker_t *worker = arg;
+    test_msg_t msg = { worker->producer, 0 };
+
+    while (msg.seq < TEST_MESSAGES) {
+        if (send_queue(worker->queue, &msg, sizeof(msg)) == (int)sizeof(msg)) {
+            msg.seq++;
+        }
+    }
+
+    return NULL;
+}
+
+/* Runs until the queue stays empty, the producers are done by then */
+static void *_consume( void *arg ) {
+    test_worker_t *worker = arg;
+    int64_t last[TEST_THREADS];
+    test_msg_t msg;
+
+    for (int i=0; i<TEST_THREADS; i++) { last[i] = -1; }
+
+    while (recv_queue(worker->queue, &msg, sizeof(msg), TEST_WAIT_MS) == (int)sizeof(msg)) {
+        if ((msg.producer >= TEST_THREADS) || ((int64_t)msg.seq <= last[msg.producer])) {
+            worker->out_of_order++;
+            continue;
+        }
+
+        last[msg.producer] = msg.seq;
+        worker->sum[msg.producer] += msg.seq;
+        worker->received++;
+    }
+
+    return NULL;
+}
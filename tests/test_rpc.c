@@ -0,0 +1,337 @@
+#include <unistd.h>
+#include <sys/un.h>
+
+#include "rpc.h"
+#include "test.h"
+
+#define TEST_PATH_SIZE 64
+#define TEST_WAIT_MS 2000
+#define TEST_TIMEOUT_MS 10000
+#define TEST_CHAIN 50
+
+typedef struct {
+    int calls;
+    E_RPC_STATUS status;
+    uint32_t id;
+    size_t len;
+    uint32_t value;
+} test_result_t;
+
+typedef struct {
+    sock_id_t server;
+    sock_id_t client;
+    char path[TEST_PATH_SIZE];
+    int completed;
+    int chained;
+    test_result_t results[RPC_MAX_IN_FLIGHT + 1];
+} test_rpc_t;
+
+static test_rpc_t test;
+
+/* Static Functions */
+static int _handler( const void *request, size_t len, void *response, size_t *response_len, void *ctx );
+static void _callback( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx );
+static void _chain_callback( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx );
+static void _detach_callback( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx );
+static void _reset( void );
+static bool _wait( int completed );
+static int _call( uint32_t value, msec_t timeout_ms );
+static void _test_round_trip( void );
+static void _test_correlation( void );
+static void _test_reentrancy( void );
+static void _test_payload_bound( void );
+static void _test_checksum_compression( void );
+static void _test_disconnect( void );
+
+int main( void ) {
+    snprintf(test.path, sizeof(test.path), "/tmp/test_rpc_%d.sock", (int)getpid());
+    (void)unlink(test.path);
+
+    CHECK(event_loop_init(RPC_BUFFER_SIZE) == EVENT_OK);
+    CHECK((test.server = initialize_sock(E_LOCAL_SOCK, test.path, 0, SERVER_SIDE)) >= 0);
+    CHECK(rpc_serve(test.server, _handler, NULL) == SOCK_OK);
+    CHECK((test.client = initialize_sock(E_LOCAL_SOCK, test.path, 0, CLIENT_SIDE)) >= 0);
+    CHECK(rpc_attach(&test.client) == SOCK_OK);
+
+    _test_round_trip();
+    _test_correlation();
+    _test_reentrancy();
+    _test_payload_bound();
+    _test_checksum_compression();
+    _test_disconnect();
+
+    rpc_detach(test.client);
+    (void)close_sock(test.client);
+    (void)event_loop_remove_listener(test.server);
+    (void)close_sock(test.server);
+
+    return TEST_RESULT();
+}
+
+/* Echoes the request. "error" fails, "huge" answers more than a response may hold. */
+static int _handler( const void *request, size_t len, void *response, size_t *response_len, void __attribute__((unused)) *ctx ) {
+    if ((len == 5) && (memcmp(request, "error", 5) == 0)) { return RPC_STATUS_ERROR; }
+
+    if ((len == 4) && (memcmp(request, "huge", 4) == 0)) {
+        *response_len = RPC_MAX_PAYLOAD + 1;
+        return RPC_STATUS_OK;
+    }
+
+    memcpy(response, request, len);
+    *response_len = len;
+
+    return RPC_STATUS_OK;
+}
+
+/* ctx is the result of the call, responses of 4 bytes are the value that was sent */
+static void _callback( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx ) {
+    test_result_t *result = ctx;
+
+    result->calls++;
+    result->status = status;
+    result->id = req_id;
+    result->len = len;
+    if (len == sizeof(result->value)) { memcpy(&result->value, buffer, len); }
+
+    test.completed++;
+}
+
+/* Issues the next call of the chain from the callback of the previous one */
+static void _chain_callback( E_RPC_STATUS status, uint32_t __attribute__((unused)) req_id, const void *buffer, size_t len, void __attribute__((unused)) *ctx ) {
+    uint32_t value;
+
+    CHECK((status == RPC_STATUS_OK) && (len == sizeof(value)));
+    if (len != sizeof(value)) { return; }
+
+    memcpy(&value, buffer, sizeof(value));
+    CHECK(value == (uint32_t)test.chained);
+
+    if (++test.chained < TEST_CHAIN) {
+        value = (uint32_t)test.chained;
+        CHECK(rpc_call(test.client, &value, sizeof(value), TEST_TIMEOUT_MS, _chain_callback, NULL, NULL) == SOCK_OK);
+    }
+}
+
+/* Detaches the client from the callback of its first response, the others are still in flight */
+static void _detach_callback( E_RPC_STATUS status, uint32_t req_id, const void *buffer, size_t len, void *ctx ) {
+    bool first = (test.completed == 0);
+
+    _callback(status, req_id, buffer, len, ctx);
+
+    if (first) {
+        CHECK(status == RPC_STATUS_OK);
+        rpc_detach(test.client);
+    }
+}
+
+static void _reset( void ) {
+    memset(test.results, 0, sizeof(test.results));
+    test.completed = 0;
+}
+
+/* Runs the loop until completed calls completed, or TEST_WAIT_MS passed */
+static bool _wait( int completed ) {
+    msec_t deadline = get_monotonic_ms() + TEST_WAIT_MS;
+
+    while ((test.completed < completed) && (get_monotonic_ms() < deadline)) {
+        (void)event_loop_run_once(10);
+        rpc_tick_all();
+    }
+
+    return test.completed == completed;
+}
+
+/* Call with value as the payload, results[value] is completed */
+static int _call( uint32_t value, msec_t timeout_ms ) {
+    return rpc_call(test.client, &value, sizeof(value), timeout_ms, _callback, &test.results[value], &test.results[value].id);
+}
+
+/* Pipelined calls complete once each, with their own response */
+static void _test_round_trip( void ) {
+    rpc_stats_t stats;
+    int count = 100;
+
+    _reset();
+
+    for (int i=0; i<count; i++) { CHECK(_call((uint32_t)i, TEST_TIMEOUT_MS) == SOCK_OK); }
+    CHECK(rpc_num_in_flight(test.client) == count);
+
+    CHECK(_wait(count));
+
+    for (int i=0; i<count; i++) {
+        CHECK((test.results[i].calls == 1) && (test.results[i].status == RPC_STATUS_OK));
+        CHECK((test.results[i].len == sizeof(uint32_t)) && (test.results[i].value == (uint32_t)i));
+    }
+
+    CHECK(get_rpc_stats(test.client, &stats) == SOCK_OK);
+    CHECK((stats.sent == (uint32_t)count) && (stats.completed == (uint32_t)count) && (stats.in_flight == 0));
+}
+
+/* A request times out, and its slot is taken by a new request before the late response arrives.
+ * The response has the old id, it's counted as late and doesn't complete the new request.
+ */
+static void _test_correlation( void ) {
+    rpc_stats_t before;
+    rpc_stats_t stats;
+    uint32_t value = RPC_MAX_IN_FLIGHT;
+
+    _reset();
+    CHECK(get_rpc_stats(test.client, &before) == SOCK_OK);
+
+    CHECK(_call(value, 0) == SOCK_OK);
+    rpc_tick_all();
+    CHECK((test.results[value].calls == 1) && (test.results[value].status == RPC_STATUS_TIMEOUT));
+
+    for (uint32_t i=0; i<RPC_MAX_IN_FLIGHT; i++) { CHECK(_call(i, TEST_TIMEOUT_MS) == SOCK_OK); }
+
+    /* Every slot is taken, by requests with ids after the one that timed out */
+    CHECK(_call(value, TEST_TIMEOUT_MS) == SOCK_FAILED_TO_SEND);
+    CHECK((test.results[RPC_MAX_IN_FLIGHT - 1].id & (RPC_MAX_IN_FLIGHT - 1)) == (test.results[value].id & (RPC_MAX_IN_FLIGHT - 1)));
+    CHECK(test.results[RPC_MAX_IN_FLIGHT - 1].id == (test.results[value].id + RPC_MAX_IN_FLIGHT));
+
+    CHECK(_wait(RPC_MAX_IN_FLIGHT + 1));
+
+    for (int i=0; i<RPC_MAX_IN_FLIGHT; i++) {
+        CHECK((test.results[i].calls == 1) && (test.results[i].status == RPC_STATUS_OK) && (test.results[i].value == (uint32_t)i));
+    }
+
+    CHECK(test.results[value].calls == 1);
+
+    CHECK(get_rpc_stats(test.client, &stats) == SOCK_OK);
+    CHECK((stats.late == (before.late + 1)) && (stats.timeouts == (before.timeouts + 1)));
+}
+
+/* Callbacks may call again, and may detach the client while responses are still being handled */
+static void _test_reentrancy( void ) {
+    msec_t deadline = get_monotonic_ms() + TEST_WAIT_MS;
+    uint32_t value = 0;
+    int count = 10;
+
+    test.chained = 0;
+    CHECK(rpc_call(test.client, &value, sizeof(value), TEST_TIMEOUT_MS, _chain_callback, NULL, NULL) == SOCK_OK);
+
+    while ((test.chained < TEST_CHAIN) && (get_monotonic_ms() < deadline)) { (void)event_loop_run_once(10); }
+
+    CHECK(test.chained == TEST_CHAIN);
+    CHECK(rpc_num_in_flight(test.client) == 0);
+
+    /* The responses arrive in one receive, the first callback detaches, the rest are disconnected */
+    _reset();
+
+    for (int i=0; i<count; i++) {
+        value = (uint32_t)i;
+        CHECK(rpc_call(test.client, &value, sizeof(value), TEST_TIMEOUT_MS, _detach_callback, &test.results[i], NULL) == SOCK_OK);
+    }
+
+    CHECK(_wait(count));
+    CHECK(!rpc_connected(test.client));
+    CHECK(test.results[0].status == RPC_STATUS_OK);
+
+    for (int i=1; i<count; i++) {
+        CHECK((test.results[i].calls == 1) && (test.results[i].status == RPC_STATUS_DISCONNECTED));
+    }
+
+    /* The socket was left open, attaching again uses it */
+    CHECK(rpc_attach(&test.client) == SOCK_OK);
+
+    _reset();
+    CHECK(_call(0, TEST_TIMEOUT_MS) == SOCK_OK);
+    CHECK(_wait(1) && (test.results[0].status == RPC_STATUS_OK));
+}
+
+/* Payloads over RPC_MAX_PAYLOAD are refused by the client, by the server, and as a response */
+static void _test_payload_bound( void ) {
+    static char payload[RPC_MAX_PAYLOAD + 1];
+    rpc_hdr_t hdr = { 0 };
+    struct sockaddr_un addr = { 0 };
+    rpc_stats_t before;
+    rpc_stats_t stats;
+    msec_t deadline;
+    char byte;
+    int fd;
+
+    _reset();
+    CHECK(get_rpc_stats(test.client, &before) == SOCK_OK);
+
+    CHECK(rpc_call(test.client, payload, RPC_MAX_PAYLOAD + 1, TEST_TIMEOUT_MS, _callback, &test.results[0], NULL) == SOCK_NOT_OK);
+    CHECK(rpc_call(test.client, payload, RPC_MAX_PAYLOAD, TEST_TIMEOUT_MS, _callback, &test.results[0], NULL) == SOCK_OK);
+    CHECK(rpc_call(test.client, "huge", 4, TEST_TIMEOUT_MS, _callback, &test.results[1], NULL) == SOCK_OK);
+    CHECK(rpc_call(test.client, "error", 5, TEST_TIMEOUT_MS, _callback, &test.results[2], NULL) == SOCK_OK);
+
+    CHECK(_wait(3));
+    CHECK((test.results[0].status == RPC_STATUS_OK) && (test.results[0].len == RPC_MAX_PAYLOAD));
+    CHECK((test.results[1].status == RPC_STATUS_ERROR) && (test.results[1].len == 0));
+    CHECK((test.results[2].status == RPC_STATUS_ERROR) && (test.results[2].len == 0));
+
+    CHECK(get_rpc_stats(test.client, &stats) == SOCK_OK);
+    CHECK((stats.completed == (before.completed + 1)) && (stats.errors == (before.errors + 2)));
+
+    /* A frame that claims a larger payload closes the connection */
+    hdr.id = htonl(1);
+    hdr.len = htonl(RPC_MAX_PAYLOAD + 1);
+
+    addr.sun_family = AF_LOCAL;
+    strncpy(addr.sun_path, test.path, sizeof(addr.sun_path) - 1);
+
+    CHECK((fd = socket(AF_LOCAL, SOCK_STREAM, 0)) >= 0);
+    CHECK(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(send(fd, &hdr, sizeof(hdr), MSG_NOSIGNAL) == (ssize_t)sizeof(hdr));
+
+    deadline = get_monotonic_ms() + TEST_WAIT_MS;
+    while ((recv(fd, &byte, 1, MSG_DONTWAIT) < 0) && (get_monotonic_ms() < deadline)) { (void)event_loop_run_once(10); }
+
+    CHECK(recv(fd, &byte, 1, MSG_DONTWAIT) == 0);
+    (void)close(fd);
+}
+
+/* Both ends check every frame, and compress once the server's first response accepts it */
+static void _test_checksum_compression( void ) {
+    static char payload[RPC_MAX_PAYLOAD];
+    rpc_stats_t before;
+    rpc_stats_t stats;
+    int count = 4;
+
+    for (size_t i=0; i<sizeof(payload); i++) { payload[i] = (char)('a' + ((i / 64) % 4)); }
+
+    CHECK(rpc_set_checksum(test.client, true) == SOCK_OK);
+    CHECK(rpc_set_compression(test.client, true) == SOCK_OK);
+    CHECK(get_rpc_stats(test.client, &before) == SOCK_OK);
+
+    for (int i=0; i<count; i++) {
+        _reset();
+        CHECK(rpc_call(test.client, payload, sizeof(payload), TEST_TIMEOUT_MS, _callback, &test.results[0], NULL) == SOCK_OK);
+        CHECK(_wait(1) && (test.results[0].status == RPC_STATUS_OK) && (test.results[0].len == sizeof(payload)));
+    }
+
+    CHECK(get_rpc_stats(test.client, &stats) == SOCK_OK);
+    CHECK(stats.compressed == (before.compressed + (uint32_t)(count - 1)));
+    CHECK((stats.bytes_saved > before.bytes_saved) && (stats.corrupt == 0));
+
+    CHECK(rpc_set_checksum(test.client, false) == SOCK_OK);
+    CHECK(rpc_set_compression(test.client, false) == SOCK_OK);
+}
+
+/* A lost connection completes every request in flight, attaching again reconnects */
+static void _test_disconnect( void ) {
+    int count = 5;
+
+    _reset();
+
+    for (int i=0; i<count; i++) { CHECK(_call((uint32_t)i, TEST_TIMEOUT_MS) == SOCK_OK); }
+
+    /* The server closes the connection before it reads them */
+    CHECK(event_loop_num_conns() == 1);
+    event_loop_close_all_conns();
+
+    CHECK(_wait(count));
+    for (int i=0; i<count; i++) { CHECK(test.results[i].status == RPC_STATUS_DISCONNECTED); }
+
+    CHECK(!rpc_connected(test.client));
+    CHECK(_call(0, TEST_TIMEOUT_MS) == SOCK_NOT_OK);
+
+    CHECK(rpc_attach(&test.client) == SOCK_OK);
+
+    _reset();
+    CHECK(_call(0, TEST_TIMEOUT_MS) == SOCK_OK);
+    CHECK(_wait(1) && (test.results[0].status == RPC_STATUS_OK) && (test.results[0].value == 0));
+}
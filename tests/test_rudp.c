@@ -0,0 +1,217 @@
+#include <unistd.h>
+#include <time.h>
+
+#include "rudp.h"
+#include "test.h"
+
+#define TEST_ADDR "127.0.0.1"
+#define TEST_PORT 19611
+#define TEST_MESSAGES 10
+#define TEST_WAIT_MS 1000
+
+/* A data message as rudp.c lays it out, in network byte order */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t len;
+    uint32_t epoch;
+    uint32_t seq;
+    uint32_t sack;
+    uint32_t ts;
+    int32_t value;
+} test_datagram_t;
+
+/* Static Functions */
+static sock_id_t _open( bool is_server );
+static int _exchange( sock_id_t from, const sockaddr_storage_t *peer, socklen_t peer_len, sock_id_t to, int count, int first );
+static void _test_restarted_receiver( void );
+static void _test_restarted_sender( void );
+static void _test_stale_epoch( void );
+static void _test_truncated( void );
+static void _test_evicted( void );
+
+int main( void ) {
+    _test_restarted_receiver();
+    _test_restarted_sender();
+    _test_stale_epoch();
+    _test_truncated();
+    _test_evicted();
+
+    return TEST_RESULT();
+}
+
+static sock_id_t _open( bool is_server ) {
+    return initialize_sock(E_RUDP_SOCK, TEST_ADDR, TEST_PORT, is_server);
+}
+
+/* Sends count numbered messages, from first, to peer or the address from was initialized with if
+ * it's NULL, and returns how many arrived in order
+ */
+static int _exchange( sock_id_t from, const sockaddr_storage_t *peer, socklen_t peer_len, sock_id_t to, int count, int first ) {
+    msec_t deadline = get_monotonic_ms() + TEST_WAIT_MS;
+    int received = 0;
+    int sent = 0;
+    int value;
+
+    while ((received < count) && (get_monotonic_ms() < deadline)) {
+        /* As fast as the window opens */
+        for (value = first + sent; sent < count; value++, sent++) {
+            if (rudp_send(from, (const sockaddr_t *)peer, peer_len, &value, sizeof(value)) != SOCK_OK) { break; }
+        }
+
+        (void)rudp_process(to);
+        (void)rudp_process(from);
+
+        while (rudp_receive(to, &value, sizeof(value), NULL, NULL) == (int)sizeof(value)) {
+            if (value != (first + received)) { return received; }
+            received++;
+        }
+
+        rudp_tick(from);
+        delay_ms(1);
+    }
+
+    return received;
+}
+
+/* The server loses its state, messages of the client's session are still delivered */
+static void _test_restarted_receiver( void ) {
+    sock_id_t server = _open(SERVER_SIDE);
+    sock_id_t client = _open(CLIENT_SIDE);
+    rudp_stats_t stats;
+
+    CHECK(_exchange(client, NULL, 0, server, TEST_MESSAGES, 0) == TEST_MESSAGES);
+
+    (void)close_sock(server);
+    server = _open(SERVER_SIDE);
+
+    CHECK(_exchange(client, NULL, 0, server, TEST_MESSAGES, TEST_MESSAGES) == TEST_MESSAGES);
+    CHECK(get_rudp_stats(client, &stats) == SOCK_OK);
+    CHECK(stats.peers_failed == 0);
+
+    (void)close_sock(client);
+    (void)close_sock(server);
+}
+
+/* The server loses its state and its replies start a new session, from the same address */
+static void _test_restarted_sender( void ) {
+    sock_id_t server = _open(SERVER_SIDE);
+    sock_id_t client = _open(CLIENT_SIDE);
+    sockaddr_storage_t peer;
+    socklen_t peer_len = sizeof(peer);
+    rudp_stats_t stats;
+    int value = 0;
+
+    for (int round=0; round<2; round++) {
+        CHECK(rudp_send(client, NULL, 0, &value, sizeof(value)) == SOCK_OK);
+
+        for (int i=0; (i<TEST_WAIT_MS) && (rudp_receive(server, &value, sizeof(value), &peer, &peer_len) < 0); i++) {
+            (void)rudp_process(server);
+            delay_ms(1);
+        }
+
+        CHECK(_exchange(server, &peer, peer_len, client, TEST_MESSAGES, round * 100) == TEST_MESSAGES);
+
+        (void)close_sock(server);
+        server = _open(SERVER_SIDE);
+    }
+
+    CHECK(get_rudp_stats(client, &stats) == SOCK_OK);
+    CHECK(stats.resyncs == 1);
+
+    (void)close_sock(client);
+    (void)close_sock(server);
+}
+
+/* A late message of a session older than the client's current one doesn't replace it */
+static void _test_stale_epoch( void ) {
+    sock_id_t server = _open(SERVER_SIDE);
+    sock_id_t client = _open(CLIENT_SIDE);
+    struct sockaddr_in addr;
+    struct timespec ts;
+    test_datagram_t datagram;
+    rudp_stats_t stats;
+    int value;
+
+    CHECK(_exchange(client, NULL, 0, server, TEST_MESSAGES, 0) == TEST_MESSAGES);
+
+    /* Sessions are named by the wall clock ms they started, a minute ago is older than any of ours */
+    (void)clock_gettime(CLOCK_REALTIME, &ts);
+
+    memset(&datagram, 0, sizeof(datagram));
+    datagram.type = 1;
+    datagram.len = htons(sizeof(datagram.value));
+    datagram.epoch = htonl((uint32_t)((((uint64_t)ts.tv_sec - 60) * 1000) + ((uint64_t)ts.tv_nsec / 1000000)));
+    datagram.seq = htonl(1000);
+    datagram.sack = htonl(1000);
+    datagram.value = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    addr.sin_addr.s_addr = inet_addr(TEST_ADDR);
+
+    CHECK(sendto(get_sock_fd(client), &datagram, sizeof(datagram), 0, (sockaddr_t *)&addr, sizeof(addr)) ==
+          (ssize_t)sizeof(datagram));
+
+    for (int i=0; i<10; i++) {
+        (void)rudp_process(server);
+        delay_ms(1);
+    }
+
+    CHECK(rudp_receive(server, &value, sizeof(value), NULL, NULL) == SOCK_NOT_OK);
+    CHECK(_exchange(client, NULL, 0, server, TEST_MESSAGES, TEST_MESSAGES) == TEST_MESSAGES);
+
+    CHECK(get_rudp_stats(server, &stats) == SOCK_OK);
+    CHECK((stats.resyncs == 0) && (stats.dropped >= 1));
+
+    (void)close_sock(client);
+    (void)close_sock(server);
+}
+
+static void _test_truncated( void ) {
+    sock_id_t server = _open(SERVER_SIDE);
+    sock_id_t client = _open(CLIENT_SIDE);
+    char message[100] = "truncated";
+    char buffer[10] = { 0 };
+    int num_bytes = SOCK_NOT_OK;
+
+    CHECK(rudp_send(client, NULL, 0, message, sizeof(message)) == SOCK_OK);
+
+    for (int i=0; (i<TEST_WAIT_MS) && (num_bytes < 0); i++) {
+        (void)rudp_process(server);
+        num_bytes = rudp_receive(server, buffer, sizeof(buffer), NULL, NULL);
+        delay_ms(1);
+    }
+
+    CHECK(num_bytes == (int)sizeof(message));
+    CHECK(memcmp(buffer, message, sizeof(buffer)) == 0);
+
+    (void)close_sock(client);
+    (void)close_sock(server);
+}
+
+/* One more client than the server has peers, the least recently active one is replaced and reported */
+static void _test_evicted( void ) {
+    sock_id_t server = _open(SERVER_SIDE);
+    sock_id_t clients[RUDP_MAX_PEERS + 1];
+    rudp_stats_t stats;
+    rudp_drop_t drop;
+
+    for (int i=0; i<=RUDP_MAX_PEERS; i++) {
+        clients[i] = _open(CLIENT_SIDE);
+        CHECK(_exchange(clients[i], NULL, 0, server, 1, i) == 1);
+    }
+
+    CHECK(get_rudp_stats(server, &stats) == SOCK_OK);
+    CHECK(stats.peers_evicted == 1);
+    CHECK(rudp_dropped(server, &drop) == SOCK_OK);
+    CHECK((drop.unacked == 0) && (drop.undelivered == 0));
+    CHECK(rudp_dropped(server, &drop) == SOCK_NOT_OK);
+
+    for (int i=0; i<=RUDP_MAX_PEERS; i++) {
+        (void)close_sock(clients[i]);
+    }
+
+    (void)close_sock(server);
+}
@@ -0,0 +1,148 @@
+#include "scheduler.h"
+#include "test.h"
+
+#define TEST_MAX_RUNS 16
+/* Spinning tasks give up after this, in case scheduler_should_yield() never says so */
+#define TEST_SPIN_LIMIT_US 1000000
+
+typedef struct {
+    int tag;
+    int yields_left;
+    usec_t busy_us;
+} test_task_t;
+
+static int order[TEST_MAX_RUNS];
+static int num_runs;
+
+/* Static Functions */
+static E_SCHEDULER_TASK _task( void *arg );
+static void _busy( usec_t us );
+static void _test_edf( void );
+static void _test_deadline_miss( void );
+static void _test_yield( void );
+
+int main( void ) {
+    _test_edf();
+    _test_deadline_miss();
+    _test_yield();
+
+    return TEST_RESULT();
+}
+
+/* Records its tag, then works for busy_us, or until it's asked to yield while it has yields left */
+static E_SCHEDULER_TASK _task( void *arg ) {
+    test_task_t *task = arg;
+    usec_t start = get_monotonic_us();
+
+    if (num_runs < TEST_MAX_RUNS) { order[num_runs++] = task->tag; }
+
+    if (task->yields_left > 0) {
+        while (!scheduler_should_yield() && ((get_monotonic_us() - start) < TEST_SPIN_LIMIT_US)) {}
+        task->yields_left--;
+        return SCHEDULER_TASK_YIELD;
+    }
+
+    _busy(task->busy_us);
+
+    return SCHEDULER_TASK_DONE;
+}
+
+static void _busy( usec_t us ) {
+    usec_t start = get_monotonic_us();
+
+    while ((get_monotonic_us() - start) < us) {}
+}
+
+/* Released together, the higher class runs first, and within a class the earliest deadline */
+static void _test_edf( void ) {
+    test_task_t tasks[] = { { 1, 0, 0 }, { 2, 0, 0 }, { 3, 0, 0 }, { 4, 0, 0 } };
+    int ids[4];
+
+    num_runs = 0;
+
+    CHECK((ids[0] = scheduler_add_task("late", SCHEDULER_CLASS_NORMAL, 1000, 50, _task, &tasks[0])) >= 0);
+    CHECK((ids[1] = scheduler_add_task("early", SCHEDULER_CLASS_NORMAL, 1000, 10, _task, &tasks[1])) >= 0);
+    CHECK((ids[2] = scheduler_add_task("middle", SCHEDULER_CLASS_NORMAL, 1000, 30, _task, &tasks[2])) >= 0);
+    CHECK((ids[3] = scheduler_add_task("background", SCHEDULER_CLASS_BACKGROUND, 1000, 1, _task, &tasks[3])) >= 0);
+
+    CHECK(!scheduler_should_yield());
+
+    for (int i=0; i<4; i++) { CHECK(scheduler_run_once() == 0); }
+
+    CHECK(num_runs == 4);
+    CHECK((order[0] == 2) && (order[1] == 3) && (order[2] == 1) && (order[3] == 4));
+
+    /* Nothing is due until the next period */
+    CHECK(scheduler_run_once() > 900);
+    CHECK(num_runs == 4);
+
+    for (int i=0; i<4; i++) { CHECK(scheduler_remove_task(ids[i]) == SCHEDULER_OK); }
+    CHECK(scheduler_run_once() == -1);
+}
+
+/* A run that ends past its deadline is a miss, and so is every period it overran */
+static void _test_deadline_miss( void ) {
+    test_task_t on_time = { 1, 0, 0 };
+    test_task_t late = { 2, 0, 10000 };
+    test_task_t overrun = { 3, 0, 12000 };
+    scheduler_stats_t stats;
+    int id;
+
+    CHECK((id = scheduler_add_task("on time", SCHEDULER_CLASS_NORMAL, 20, 5, _task, &on_time)) >= 0);
+    CHECK(scheduler_run_once() == 0);
+    CHECK(get_scheduler_stats(id, &stats) == SCHEDULER_OK);
+    CHECK((stats.runs == 1) && (stats.missed == 0));
+    CHECK(scheduler_remove_task(id) == SCHEDULER_OK);
+
+    CHECK((id = scheduler_add_task("late", SCHEDULER_CLASS_NORMAL, 20, 5, _task, &late)) >= 0);
+    CHECK(scheduler_run_once() == 0);
+    CHECK(get_scheduler_stats(id, &stats) == SCHEDULER_OK);
+    CHECK((stats.runs == 1) && (stats.missed == 1));
+    CHECK(stats.cpu_us >= 10000);
+    CHECK(scheduler_remove_task(id) == SCHEDULER_OK);
+
+    /* 12 ms in a 5 ms period, the deadline and the period that ended during the run */
+    CHECK((id = scheduler_add_task("overrun", SCHEDULER_CLASS_NORMAL, 5, 0, _task, &overrun)) >= 0);
+    CHECK(scheduler_run_once() == 0);
+    CHECK(get_scheduler_stats(id, &stats) == SCHEDULER_OK);
+    CHECK((stats.runs == 1) && (stats.missed >= 2));
+    CHECK(scheduler_remove_task(id) == SCHEDULER_OK);
+
+    CHECK(get_scheduler_stats(id, &stats) == SCHEDULER_NOT_OK);
+}
+
+/* A yielding task is asked to stop after its slice, and a more urgent task runs before it resumes */
+static void _test_yield( void ) {
+    test_task_t slow = { 1, 1, 0 };
+    test_task_t urgent = { 2, 0, 0 };
+    scheduler_stats_t stats;
+    usec_t start;
+    int slow_id;
+    int urgent_id;
+
+    num_runs = 0;
+
+    CHECK((slow_id = scheduler_add_task("slow", SCHEDULER_CLASS_NORMAL, 1000, 0, _task, &slow)) >= 0);
+
+    start = get_monotonic_us();
+    CHECK(scheduler_run_once() == 0);
+    CHECK((get_monotonic_us() - start) >= SCHEDULER_SLICE_US);
+    CHECK((get_monotonic_us() - start) < TEST_SPIN_LIMIT_US);
+
+    CHECK(get_scheduler_stats(slow_id, &stats) == SCHEDULER_OK);
+    CHECK((stats.yields == 1) && (stats.runs == 0));
+
+    CHECK((urgent_id = scheduler_add_task("urgent", SCHEDULER_CLASS_CRITICAL, 1000, 0, _task, &urgent)) >= 0);
+
+    CHECK(scheduler_run_once() == 0);
+    CHECK(scheduler_run_once() == 0);
+
+    CHECK(num_runs == 3);
+    CHECK((order[0] == 1) && (order[1] == 2) && (order[2] == 1));
+
+    CHECK(get_scheduler_stats(slow_id, &stats) == SCHEDULER_OK);
+    CHECK((stats.yields == 1) && (stats.runs == 1) && (stats.missed == 0));
+
+    CHECK(scheduler_remove_task(slow_id) == SCHEDULER_OK);
+    CHECK(scheduler_remove_task(urgent_id) == SCHEDULER_OK);
+}
@@ -0,0 +1,277 @@
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "threads_config.h"
+#include "test.h"
+
+#define TEST_PATH_SIZE 64
+#define TEST_DUMP_SIZE (1024 * 1024)
+
+/* Static Functions */
+static int _encode( uint64_t id, uint8_t *buffer, size_t len );
+static trace_record_t _record( uint64_t id, const uint64_t *latencies );
+static char *_read_dump( const char *path );
+static int _count( const char *haystack, const char *needle );
+static void _test_round_trip( void );
+static void _test_no_context( void );
+static void _test_histograms( void );
+static void _test_sampling( void );
+static void _test_dump( void );
+
+int main( void ) {
+    CHECK(trace_init(true, 0) == TRACE_NOT_OK);
+
+    _test_round_trip();
+    _test_no_context();
+    _test_histograms();
+    _test_sampling();
+    _test_dump();
+
+    return TEST_RESULT();
+}
+
+/* A trace context in front of a HELLO, as a client sends it */
+static int _encode( uint64_t id, uint8_t *buffer, size_t len ) {
+    codec_trace_t trace;
+    codec_hello_t hello = { 0 };
+    int trace_len;
+    int hello_len;
+
+    trace.id = id;
+    trace.queued_us = (uint64_t)get_monotonic_us();
+    trace.sent_us = trace.queued_us + 1;
+    hello.seq = 7;
+
+    if ((trace_len = codec_encode_trace(&trace, buffer, len)) < 0) { return -1; }
+    if ((hello_len = codec_encode_hello(&hello, buffer + trace_len, len - (size_t)trace_len)) < 0) { return -1; }
+
+    return trace_len + hello_len;
+}
+
+/* An active, unsampled record whose stage n takes latencies[n] us */
+static trace_record_t _record( uint64_t id, const uint64_t *latencies ) {
+    trace_record_t record = { 0 };
+
+    record.id = id;
+    record.flags = TRACE_FLAG_ACTIVE;
+    record.stamps[0] = 1000000;
+
+    for (int s=0; s<E_TRACE_NUM_STAGES; s++) {
+        record.stamps[s + 1] = record.stamps[s] + latencies[s];
+    }
+
+    return record;
+}
+
+static char *_read_dump( const char *path ) {
+    char *buffer = calloc(1, TEST_DUMP_SIZE);
+    FILE *fp;
+    size_t len;
+
+    if ((buffer == NULL) || ((fp = fopen(path, "r")) == NULL)) {
+        free(buffer);
+        return NULL;
+    }
+
+    len = fread(buffer, 1, TEST_DUMP_SIZE - 1, fp);
+    buffer[len] = '\0';
+    (void)fclose(fp);
+
+    return buffer;
+}
+
+static int _count( const char *haystack, const char *needle ) {
+    int count = 0;
+
+    while ((haystack = strstr(haystack, needle)) != NULL) {
+        count++;
+        haystack += strlen(needle);
+    }
+
+    return count;
+}
+
+/* Received with a context, stamped by the handler, passed through a worker's pipe and added there,
+ * every stage is counted once
+ */
+static void _test_round_trip( void ) {
+    uint8_t buffer[CODEC_TRACE_MAX_SIZE + CODEC_HELLO_MAX_SIZE];
+    trace_histogram_t before[E_TRACE_NUM_STAGES];
+    trace_histogram_t after;
+    trace_record_t record;
+    trace_record_t read;
+    codec_msg_t msg;
+    pipe_id_t pipe;
+    int consumed;
+    int len;
+
+    for (int s=0; s<E_TRACE_NUM_STAGES; s++) { CHECK(get_trace_histogram((E_TRACE_STAGE)s, &before[s]) == TRACE_OK); }
+
+    CHECK(trace_init(true, 1) == TRACE_OK);
+    CHECK((len = _encode(42, buffer, sizeof(buffer))) > 0);
+
+    CHECK((consumed = trace_begin(buffer, (size_t)len, &record)) > 0);
+    CHECK((codec_decode(buffer + consumed, (size_t)(len - consumed), &msg) > 0) && (msg.type == CODEC_MSG_HELLO) && (msg.body.hello.seq == 7));
+
+    CHECK((record.id == 42) && (record.flags == (TRACE_FLAG_ACTIVE | TRACE_FLAG_SAMPLED)));
+    CHECK(record.stamps[E_TRACE_SENT] == (record.stamps[E_TRACE_QUEUED] + 1));
+    CHECK(record.stamps[E_TRACE_RECEIVED] >= record.stamps[E_TRACE_QUEUED]);
+
+    trace_stamp(&record, E_TRACE_HANDLED);
+    CHECK(record.stamps[E_TRACE_HANDLED] >= record.stamps[E_TRACE_RECEIVED]);
+
+    CHECK((pipe = create_pipe()) >= 0);
+    CHECK(set_pipe_checksum(pipe, true) == THREAD_OK);
+    CHECK(write_pipe_record(pipe, &record, sizeof(record)) == (int)sizeof(record));
+    CHECK(read_pipe_record(pipe, &read, sizeof(read)) == (int)sizeof(read));
+    CHECK(memcmp(&read, &record, sizeof(record)) == 0);
+    CHECK(free_pipe(pipe) == THREAD_OK);
+
+    trace_stamp(&read, E_TRACE_IPC_READ);
+    CHECK(trace_add(&read) == TRACE_OK);
+
+    for (int s=0; s<E_TRACE_NUM_STAGES; s++) {
+        CHECK(get_trace_histogram((E_TRACE_STAGE)s, &after) == TRACE_OK);
+        CHECK(after.count == (before[s].count + 1));
+    }
+
+    CHECK(get_trace_histogram(E_TRACE_NUM_STAGES, &after) == TRACE_NOT_OK);
+}
+
+/* A message without a context has nothing to skip, one with a broken context is refused, and a
+ * context is skipped but not traced while tracing is disabled
+ */
+static void _test_no_context( void ) {
+    uint8_t buffer[CODEC_TRACE_MAX_SIZE + CODEC_HELLO_MAX_SIZE];
+    codec_hello_t hello = { 0 };
+    trace_record_t record;
+    int trace_len;
+    int len;
+
+    CHECK(trace_init(true, 1) == TRACE_OK);
+
+    CHECK((len = codec_encode_hello(&hello, buffer, sizeof(buffer))) > 0);
+    CHECK(trace_begin(buffer, (size_t)len, &record) == 0);
+    CHECK(record.flags == 0);
+    CHECK(trace_add(&record) == TRACE_NOT_OK);
+
+    CHECK((len = _encode(1, buffer, sizeof(buffer))) > 0);
+    CHECK((trace_len = trace_begin(buffer, (size_t)len, &record)) > 0);
+    CHECK(trace_begin(buffer, 2, &record) == TRACE_NOT_OK);
+
+    CHECK(trace_init(false, 1) == TRACE_OK);
+    CHECK(trace_begin(buffer, (size_t)len, &record) == trace_len);
+    CHECK(record.flags == 0);
+
+    memset(record.stamps, 0, sizeof(record.stamps));
+    trace_stamp(&record, E_TRACE_HANDLED);
+    CHECK(record.stamps[E_TRACE_HANDLED] == 0);
+}
+
+/* Latencies land in the bin of their power of 2, stages with missing or reversed stamps are skipped */
+static void _test_histograms( void ) {
+    uint64_t latencies[E_TRACE_NUM_STAGES] = { 0, 1, 1000, 1ULL << 40 };
+    int bins[E_TRACE_NUM_STAGES] = { 0, 1, 10, TRACE_HISTOGRAM_BINS - 1 };
+    trace_histogram_t before[E_TRACE_NUM_STAGES];
+    trace_histogram_t after;
+    trace_record_t record;
+
+    for (int s=0; s<E_TRACE_NUM_STAGES; s++) { CHECK(get_trace_histogram((E_TRACE_STAGE)s, &before[s]) == TRACE_OK); }
+
+    record = _record(2, latencies);
+    CHECK(trace_add(&record) == TRACE_OK);
+
+    for (int s=0; s<E_TRACE_NUM_STAGES; s++) {
+        CHECK(get_trace_histogram((E_TRACE_STAGE)s, &after) == TRACE_OK);
+        CHECK((after.count == (before[s].count + 1)) && (after.bins[bins[s]] == (before[s].bins[bins[s]] + 1)));
+        CHECK(after.max_us >= latencies[s]);
+        before[s] = after;
+    }
+
+    /* A client clock that's ahead, and a pipe stage that was never stamped */
+    record.stamps[E_TRACE_QUEUED] = record.stamps[E_TRACE_SENT] + 1;
+    record.stamps[E_TRACE_IPC_READ] = 0;
+    CHECK(trace_add(&record) == TRACE_OK);
+
+    for (int s=0; s<E_TRACE_NUM_STAGES; s++) {
+        CHECK(get_trace_histogram((E_TRACE_STAGE)s, &after) == TRACE_OK);
+
+        if ((s == E_TRACE_STAGE_CLIENT) || (s == E_TRACE_STAGE_PIPE)) {
+            CHECK(after.count == before[s].count);
+        } else {
+            CHECK(after.count == (before[s].count + 1));
+        }
+    }
+}
+
+/* One of every sample traces is sampled */
+static void _test_sampling( void ) {
+    uint8_t buffer[CODEC_TRACE_MAX_SIZE + CODEC_HELLO_MAX_SIZE];
+    trace_record_t record;
+    int sampled = 0;
+    int len;
+
+    CHECK(trace_init(true, 4) == TRACE_OK);
+    CHECK((len = _encode(3, buffer, sizeof(buffer))) > 0);
+
+    for (int i=0; i<40; i++) {
+        CHECK(trace_begin(buffer, (size_t)len, &record) > 0);
+        CHECK(record.flags & TRACE_FLAG_ACTIVE);
+        if (record.flags & TRACE_FLAG_SAMPLED) { sampled++; }
+    }
+
+    CHECK(sampled == 10);
+}
+
+/* Sampled traces are dumped as Chrome trace JSON, a slice per stage. Only the latest
+ * TRACE_MAX_SAMPLES are kept, and the file is only written again once there are new ones.
+ */
+static void _test_dump( void ) {
+    uint64_t latencies[E_TRACE_NUM_STAGES] = { 10, 20, 30, 40 };
+    char path[TEST_PATH_SIZE];
+    char needle[64];
+    trace_record_t record;
+    struct stat st;
+    char *dump;
+    uint64_t first_id = 1000;
+    uint64_t count = TRACE_MAX_SAMPLES + 10;
+
+    snprintf(path, sizeof(path), "/tmp/test_trace_%d.json", (int)getpid());
+
+    for (uint64_t id=first_id; id<(first_id + count); id++) {
+        record = _record(id, latencies);
+        record.flags |= TRACE_FLAG_SAMPLED;
+        CHECK(trace_add(&record) == TRACE_OK);
+    }
+
+    CHECK(trace_dump(path) == TRACE_OK);
+    CHECK((dump = _read_dump(path)) != NULL);
+
+    if (dump != NULL) {
+        CHECK(strncmp(dump, "{\"traceEvents\":[", 16) == 0);
+        CHECK(_count(dump, "\"ph\":\"X\"") == (TRACE_MAX_SAMPLES * E_TRACE_NUM_STAGES));
+        CHECK(_count(dump, "\"name\":\"pipe\"") == TRACE_MAX_SAMPLES);
+
+        snprintf(needle, sizeof(needle), "\"tid\":%lu,", (unsigned long)(first_id + count - 1));
+        CHECK(_count(dump, needle) == E_TRACE_NUM_STAGES);
+        snprintf(needle, sizeof(needle), "\"tid\":%lu,", (unsigned long)first_id);
+        CHECK(_count(dump, needle) == 0);
+
+        CHECK(strstr(dump, "\"ts\":1000010,\"dur\":20}") != NULL);
+        free(dump);
+    }
+
+    /* Nothing new, nothing written */
+    CHECK(unlink(path) == 0);
+    CHECK(trace_dump(path) == TRACE_OK);
+    CHECK(stat(path, &st) < 0);
+
+    record = _record(first_id + count, latencies);
+    record.flags |= TRACE_FLAG_SAMPLED;
+    CHECK(trace_add(&record) == TRACE_OK);
+    CHECK(trace_dump(path) == TRACE_OK);
+    CHECK(stat(path, &st) == 0);
+
+    (void)unlink(path);
+}